@@ -0,0 +1,769 @@
+/**
+ * @file   AIOAcquisitionGroup.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Synchronized acquisition across several analog input boards
+ *
+ * Ganging boards with one AIOContinuousBuf each starts them milliseconds
+ * apart, one full start sequence after another, and costs a worker thread
+ * per board. A group instead arms every board first ( scan configured,
+ * acquisition enabled, counter 1 loaded, bulk reads queued ) so that the
+ * only thing left is the counter 2 load that starts each board's scan
+ * clock. Those loads are then sent to all the boards at once.
+ *
+ * One event thread services every board: on real devices it runs the
+ * completions of the async bulk reads, devices without a libusb handle
+ * ( testing devices, mocks ) are read round robin with usb_bulk_transfer.
+ * Each board's counts go into its own ring in whole scans, and
+ * AIOAcquisitionGroupRead merges one scan of every board into each row
+ * it hands back. Scans a board loses to a full ring are remembered as
+ * gaps so each board's scans keep their sequence numbers, and rows are
+ * only made of scans with the same sequence number on every board.
+ */
+
+#include "AIOAcquisitionGroup.h"
+#include "AIOUSB_Core.h"
+#include "AIOUSB_ADC.h"
+#include "AIOUSB_CTR.h"
+#include "ADCConfigBlock.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOUSB_Log.h"
+#include <string.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+/* completions can run on any thread pumping libusb's default context */
+#define AIOACQUISITIONGROUP_LOAD(p)     __atomic_load_n( (p), __ATOMIC_ACQUIRE )
+#define AIOACQUISITIONGROUP_ADD(p,v)    __atomic_add_fetch( (p), (v), __ATOMIC_ACQ_REL )
+
+/*----------------------------------------------------------------------------*/
+static void aioacquisitiongroup_fail( AIOAcquisitionGroup *group, AIORESULT result )
+{
+    pthread_mutex_lock( &group->lock );
+    if ( group->result == AIOUSB_SUCCESS ) {
+        AIOUSB_ERROR("Acquisition group stopped: %d\n", (int)result );
+        group->result = result;
+    }
+    pthread_mutex_unlock( &group->lock );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Puts whole scans in the member's ring. What does not fit is
+ *        dropped and recorded as a gap at the current write position.
+ *        Once there is no slot left for a gap the scans after it can't
+ *        be numbered, so the member takes nothing more and the group
+ *        fails with AIOUSB_ERROR_INVALID_DATA.
+ */
+static void aioacquisitiongroup_put( AIOAcquisitionMember *member, const unsigned char *data, unsigned scans )
+{
+    AIOFifoRegion region;
+    AIORET_TYPE room = ( member->lost ? 0 : AIOFifoWriteAcquire( member->ring, &region, scans * member->scan_bytes ) );
+    unsigned kept = 0;
+
+    if ( room > 0 ) {
+        memcpy( region.data[0], data, region.size[0] );
+        if ( region.size[1] )
+            memcpy( region.data[1], data + region.size[0], region.size[1] );
+        AIOFifoWriteCommit( member->ring, (unsigned)room );
+        kept = (unsigned)room / member->scan_bytes;
+        member->written += kept;
+    }
+
+    if ( kept < scans ) {
+        AIOAcquisitionGroup *group = member->group;
+        AIOUSB_BOOL lost = AIOUSB_FALSE;
+        pthread_mutex_lock( &group->lock );
+        AIOAcquisitionGap *last = ( member->num_gaps ?
+                                    &member->gaps[( member->gap_head + member->num_gaps - 1 ) % AIOACQUISITIONGROUP_MAX_GAPS] :
+                                    NULL );
+        if ( last && last->position == member->written ) {
+            last->scans += scans - kept;
+        } else if ( member->num_gaps == AIOACQUISITIONGROUP_MAX_GAPS ) {
+            lost = ( member->lost ? AIOUSB_FALSE : AIOUSB_TRUE );
+            member->lost = AIOUSB_TRUE;
+        } else if ( !member->lost ) {
+            AIOAcquisitionGap *gap = &member->gaps[( member->gap_head + member->num_gaps ) % AIOACQUISITIONGROUP_MAX_GAPS];
+            gap->position = member->written;
+            gap->scans    = scans - kept;
+            member->num_gaps ++;
+        }
+        member->dropped += scans - kept;
+        pthread_mutex_unlock( &group->lock );
+        AIOStatsRecordOverruns( member->usb->stats, 1 );
+        if ( lost ) {
+            AIOUSB_ERROR("Device %lu dropped scans in more than %d places the reader has not reached, the rest can't be lined up\n", member->DeviceIndex, AIOACQUISITIONGROUP_MAX_GAPS );
+            aioacquisitiongroup_fail( group, AIOUSB_ERROR_INVALID_DATA );
+        }
+    }
+    AIOStatsRecordFifo( member->usb->stats, member->ring->rdelta( member->ring ), member->ring->size );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes bytes of counts off a board, carrying a trailing partial
+ *        scan over to the next call
+ */
+static void aioacquisitiongroup_accept( AIOAcquisitionMember *member, const unsigned char *data, unsigned bytes )
+{
+    bytes -= bytes % sizeof(unsigned short);
+    if ( member->carry_bytes ) {
+        unsigned take = MIN( bytes, member->scan_bytes - member->carry_bytes );
+        memcpy( member->carry + member->carry_bytes, data, take );
+        member->carry_bytes += take;
+        data  += take;
+        bytes -= take;
+        if ( member->carry_bytes < member->scan_bytes )
+            return;
+        aioacquisitiongroup_put( member, member->carry, 1 );
+        member->carry_bytes = 0;
+    }
+    if ( bytes >= member->scan_bytes )
+        aioacquisitiongroup_put( member, data, bytes / member->scan_bytes );
+    member->carry_bytes = bytes % member->scan_bytes;
+    memcpy( member->carry, data + bytes - member->carry_bytes, member->carry_bytes );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sequence number of the next scan in the member's ring. Call with
+ *        the group lock held.
+ */
+static unsigned long long aioacquisitiongroup_next_sequence( AIOAcquisitionMember *member )
+{
+    while ( member->num_gaps && member->gaps[member->gap_head].position <= member->read ) {
+        member->skipped += member->gaps[member->gap_head].scans;
+        member->gap_head = ( member->gap_head + 1 ) % AIOACQUISITIONGROUP_MAX_GAPS;
+        member->num_gaps --;
+    }
+    return member->read + member->skipped;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes the next scan out of the member's ring, copying it to counts
+ *        unless counts is NULL
+ */
+static void aioacquisitiongroup_take( AIOAcquisitionMember *member, unsigned short *counts )
+{
+    AIOFifoRegion region;
+    AIORET_TYPE size = AIOFifoReadAcquire( member->ring, &region, member->scan_bytes );
+    if ( counts ) {
+        memcpy( counts, region.data[0], region.size[0] );
+        if ( region.size[1] )
+            memcpy( (unsigned char *)counts + region.size[0], region.data[1], region.size[1] );
+    }
+    AIOFifoReadCommit( member->ring, (unsigned)size );
+    member->read ++;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes a finished bulk read's counts, a timed out one's included,
+ *        and resubmits it. Runs with the member's queue locked.
+ */
+static void aioacquisitiongroup_read_complete( AIOTransferQueue *queue, struct libusb_transfer *xfer, void *object )
+{
+    AIOAcquisitionMember *member = (AIOAcquisitionMember *)object;
+
+    if ( xfer->status == LIBUSB_TRANSFER_COMPLETED || xfer->status == LIBUSB_TRANSFER_TIMED_OUT ) {
+        int usbresult;
+        if ( xfer->actual_length > 0 )
+            aioacquisitiongroup_accept( member, xfer->buffer, (unsigned)xfer->actual_length );
+        if ( ( usbresult = AIOTransferQueueSubmit( queue, xfer, AIOACQUISITIONGROUP_TRANSFER_BYTES ) ) != LIBUSB_SUCCESS )
+            aioacquisitiongroup_fail( member->group, LIBUSB_RESULT_TO_AIOUSB_RESULT( usbresult ) );
+    } else if ( xfer->status != LIBUSB_TRANSFER_CANCELLED ) {
+        aioacquisitiongroup_fail( member->group, LIBUSB_RESULT_TO_AIOUSB_RESULT( AIOTransferQueueGetError( xfer ) ) );
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+static void LIBUSB_CALL aioacquisitiongroup_release_complete( struct libusb_transfer *xfer )
+{
+    AIOAcquisitionMember *member = (AIOAcquisitionMember *)xfer->user_data;
+    member->release_status = xfer->status;
+    AIOACQUISITIONGROUP_ADD( &member->group->releasing, -1 );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Cancels every queued bulk read and waits for the cancellations
+ */
+static void aioacquisitiongroup_cancel_transfers( AIOAcquisitionGroup *group )
+{
+    unsigned i;
+    for ( i = 0; i < group->num_members; i ++ ) {
+        if ( group->members[i].transfers )
+            AIOTransferQueueCancel( group->members[i].transfers );
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+static void aioacquisitiongroup_free_transfers( AIOAcquisitionGroup *group )
+{
+    unsigned i;
+    for ( i = 0; i < group->num_members; i ++ ) {
+        AIOAcquisitionMember *member = &group->members[i];
+        DeleteAIOTransferQueue( member->transfers );
+        if ( member->release ) {
+            free( member->release->buffer );
+            libusb_free_transfer( member->release );
+        }
+        member->transfers = NULL;
+        member->release   = NULL;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Allocates and queues every board's bulk reads, and prepares the
+ *        counter 2 load that releases each board
+ */
+static AIORESULT aioacquisitiongroup_start_transfers( AIOAcquisitionGroup *group )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    unsigned i;
+
+    for ( i = 0; i < group->num_members && result == AIOUSB_SUCCESS; i ++ ) {
+        AIOAcquisitionMember *member = &group->members[i];
+        struct libusb_transfer *xfer;
+        unsigned char *setup;
+
+        member->transfers = NewAIOTransferQueue( member->usb,
+                                                 0x86,
+                                                 AIOACQUISITIONGROUP_NUM_TRANSFERS,
+                                                 AIOACQUISITIONGROUP_TRANSFER_BYTES,
+                                                 aioacquisitiongroup_read_complete,
+                                                 member
+                                                 );
+        member->release = libusb_alloc_transfer(0);
+        setup = (unsigned char *)malloc( LIBUSB_CONTROL_SETUP_SIZE );
+        if ( !member->transfers || !member->release || !setup ) {
+            free( setup );
+            return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        }
+        /* same encoding as CTR_8254ModeLoad( DeviceIndex, 0, 2, 3, lowDivisor ) */
+        libusb_fill_control_setup( setup,
+                                   USB_WRITE_TO_DEVICE,
+                                   AUR_CTR_MODELOAD,
+                                   ( 2u << ( 6 + 8 ) ) | ( 0x3u << ( 4 + 8 ) ) | ( 3u << ( 1 + 8 ) ),
+                                   member->lowDivisor,
+                                   0
+                                   );
+        libusb_fill_control_transfer( member->release,
+                                      member->usb->deviceHandle,
+                                      setup,
+                                      aioacquisitiongroup_release_complete,
+                                      member,
+                                      group->timeout
+                                      );
+
+        /* the first completions can run on another thread before the last submit */
+        AIOTransferQueueLock( member->transfers );
+        while ( result == AIOUSB_SUCCESS && ( xfer = AIOTransferQueueUnpark( member->transfers ) ) ) {
+            int usbresult = AIOTransferQueueSubmit( member->transfers, xfer, AIOACQUISITIONGROUP_TRANSFER_BYTES );
+            if ( usbresult != LIBUSB_SUCCESS ) {
+                AIOUSB_ERROR("Unable to submit a bulk read for device %lu: %d\n", member->DeviceIndex, usbresult );
+                result = LIBUSB_RESULT_TO_AIOUSB_RESULT( usbresult );
+            }
+        }
+        AIOTransferQueueUnlock( member->transfers );
+    }
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Event thread for the whole group
+ */
+static void *aioacquisitiongroup_events( void *object )
+{
+    AIOAcquisitionGroup *group = (AIOAcquisitionGroup *)object;
+    unsigned i;
+
+    while ( !group->exiting ) {
+        if ( group->async ) {
+            struct timeval tv = { 0, AIOACQUISITIONGROUP_POLL_MS * 1000 };
+            libusb_handle_events_timeout_completed( NULL, &tv, NULL );
+            continue;
+        }
+        for ( i = 0; i < group->num_members && !group->exiting; i ++ ) {
+            AIOAcquisitionMember *member = &group->members[i];
+            int bytes = 0;
+            int usbresult = member->usb->usb_bulk_transfer( member->usb,
+                                                            0x86,
+                                                            group->scratch,
+                                                            AIOACQUISITIONGROUP_TRANSFER_BYTES,
+                                                            &bytes,
+                                                            AIOACQUISITIONGROUP_POLL_MS
+                                                            );
+            if ( bytes > 0 )
+                aioacquisitiongroup_accept( member, group->scratch, (unsigned)bytes );
+            if ( usbresult != LIBUSB_SUCCESS && usbresult != LIBUSB_ERROR_TIMEOUT ) {
+                aioacquisitiongroup_fail( group, LIBUSB_RESULT_TO_AIOUSB_RESULT( usbresult ) );
+                group->exiting = AIOUSB_TRUE;
+            }
+        }
+    }
+
+    if ( group->async )
+        aioacquisitiongroup_cancel_transfers( group );
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static AIORESULT aioacquisitiongroup_acquiring( AIOAcquisitionMember *member, AIOUSB_BOOL enable )
+{
+    unsigned char data[4] = { 0x07, 0x00, 0x00, 0x01 };
+    int bytesTransferred;
+    if ( !enable ) {
+        data[0] = 0x02;
+        data[2] = 0x02;
+        data[3] = 0x00;
+    }
+    bytesTransferred = member->usb->usb_control_transfer( member->usb,
+                                                          USB_WRITE_TO_DEVICE,
+                                                          AUR_START_ACQUIRING_BLOCK,
+                                                          0,
+                                                          0,
+                                                          data,
+                                                          sizeof(data),
+                                                          member->group->timeout
+                                                          );
+    return ( bytesTransferred < 0 ? LIBUSB_RESULT_TO_AIOUSB_RESULT( bytesTransferred ) : AIOUSB_SUCCESS );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Gets a board ready to go on the counter 2 load: clock stopped,
+ *        scan configured for counter triggering, acquisition enabled and
+ *        counter 1 running
+ */
+static AIORESULT aioacquisitiongroup_arm( AIOAcquisitionMember *member, double hz )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( member->DeviceIndex, &result );
+    ADCConfigBlock config;
+    unsigned channel;
+
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+
+    AIOUSBDeviceLock( deviceDesc );
+    if ( ( result = CTR_8254Mode( member->DeviceIndex, 0, 1, 2 ) ) != AIOUSB_SUCCESS ||
+         ( result = CTR_8254Mode( member->DeviceIndex, 0, 2, 3 ) ) != AIOUSB_SUCCESS ||
+         ( result = ReadConfigBlock( member->DeviceIndex, AIOUSB_FALSE ) ) != AIOUSB_SUCCESS )
+        goto out_aioacquisitiongroup_arm;
+
+    /* put back by aioacquisitiongroup_disarm */
+    member->savedConfigBlock = deviceDesc->cachedConfigBlock;
+    member->configured       = AIOUSB_TRUE;
+
+    ADCConfigBlockInitForCounterScan( &config, deviceDesc );
+    AIOUSB_SetScanRange( &config, member->startChannel, member->endChannel );
+    for ( channel = member->startChannel; channel <= member->endChannel; channel ++ )
+        AIOUSB_SetGainCode( &config, channel, member->gainCode );
+    AIOUSB_SetOversample( &config, 0 );
+    deviceDesc->cachedConfigBlock = config;
+    if ( ( result = WriteConfigBlock( member->DeviceIndex ) ) != AIOUSB_SUCCESS )
+        goto out_aioacquisitiongroup_arm;
+
+    CTR_CalculateOutputFreqDivisors( deviceDesc->RootClock, &hz, &member->highDivisor, &member->lowDivisor );
+    if ( ( result = aioacquisitiongroup_acquiring( member, AIOUSB_TRUE ) ) != AIOUSB_SUCCESS )
+        goto out_aioacquisitiongroup_arm;
+    result = CTR_8254ModeLoad( member->DeviceIndex, 0, 1, 2, member->highDivisor );
+
+ out_aioacquisitiongroup_arm:
+    AIOUSBDeviceUnlock( deviceDesc );
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops the board's clock and acquisition and gives it back the
+ *        config it had before it was armed
+ */
+static void aioacquisitiongroup_disarm( AIOAcquisitionMember *member )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( member->DeviceIndex, &result );
+
+    CTR_8254Mode( member->DeviceIndex, 0, 1, 2 );
+    CTR_8254Mode( member->DeviceIndex, 0, 2, 3 );
+    aioacquisitiongroup_acquiring( member, AIOUSB_FALSE );
+
+    if ( result != AIOUSB_SUCCESS || !member->configured )
+        return;
+    AIOUSBDeviceLock( deviceDesc );
+    deviceDesc->cachedConfigBlock = member->savedConfigBlock;
+    if ( ( result = WriteConfigBlock( member->DeviceIndex ) ) != AIOUSB_SUCCESS )
+        AIOUSB_ERROR("Unable to restore the config of device %lu: %d\n", member->DeviceIndex, (int)result );
+    AIOUSBDeviceUnlock( deviceDesc );
+    member->configured = AIOUSB_FALSE;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Starts every board's clock. On real devices all the counter loads
+ *        are submitted before any of them is waited on, otherwise they
+ *        are sent back to back.
+ */
+static AIORESULT aioacquisitiongroup_release( AIOAcquisitionGroup *group )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    unsigned long long start = AIOStatsNow();
+    unsigned i;
+
+    if ( !group->async ) {
+        for ( i = 0; i < group->num_members && result == AIOUSB_SUCCESS; i ++ )
+            result = CTR_8254ModeLoad( group->members[i].DeviceIndex, 0, 2, 3, group->members[i].lowDivisor );
+        group->release_ns = AIOStatsNow() - start;
+        return result;
+    }
+
+    for ( i = 0; i < group->num_members; i ++ ) {
+        AIOAcquisitionMember *member = &group->members[i];
+        int usbresult;
+        member->release_status = LIBUSB_TRANSFER_COMPLETED;
+        AIOACQUISITIONGROUP_ADD( &group->releasing, 1 );
+        usbresult = libusb_submit_transfer( member->release );
+        if ( usbresult != LIBUSB_SUCCESS ) {
+            AIOACQUISITIONGROUP_ADD( &group->releasing, -1 );
+            result = LIBUSB_RESULT_TO_AIOUSB_RESULT( usbresult );
+            break;
+        }
+    }
+    while ( AIOACQUISITIONGROUP_LOAD( &group->releasing ) > 0 ) {
+        struct timeval tv = { 0, AIOACQUISITIONGROUP_POLL_MS * 1000 };
+        libusb_handle_events_timeout_completed( NULL, &tv, NULL );
+    }
+    group->release_ns = AIOStatsNow() - start;
+
+    for ( i = 0; i < group->num_members && result == AIOUSB_SUCCESS; i ++ ) {
+        if ( group->members[i].release_status != LIBUSB_TRANSFER_COMPLETED )
+            result = LIBUSB_RESULT_TO_AIOUSB_RESULT( AIOTransferQueueGetError( group->members[i].release ) );
+    }
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief New, empty group
+ * @param ring_scans scans buffered per board, 0 for
+ *        AIOACQUISITIONGROUP_DEFAULT_RING_SCANS
+ */
+AIOAcquisitionGroup *NewAIOAcquisitionGroup( unsigned ring_scans )
+{
+    AIOAcquisitionGroup *group = (AIOAcquisitionGroup *)calloc( 1, sizeof(AIOAcquisitionGroup) );
+    if ( !group )
+        return NULL;
+    group->ring_scans = ( ring_scans ? ring_scans : AIOACQUISITIONGROUP_DEFAULT_RING_SCANS );
+    group->timeout    = 1000;
+    pthread_mutex_init( &group->lock, NULL );
+    return group;
+}
+
+/*----------------------------------------------------------------------------*/
+void DeleteAIOAcquisitionGroup( AIOAcquisitionGroup *group )
+{
+    unsigned i;
+    if ( !group )
+        return;
+    AIOAcquisitionGroupStop( group );
+    for ( i = 0; i < group->num_members; i ++ ) {
+        if ( group->members[i].ring )
+            DeleteAIOFifo( group->members[i].ring );
+        free( group->members[i].carry );
+    }
+    free( group->scratch );
+    pthread_mutex_destroy( &group->lock );
+    free( group );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Adds a board to the group. Its channels follow those of the
+ *        boards added before it in every merged scan.
+ * @param group
+ * @param DeviceIndex
+ * @param startChannel
+ * @param endChannel
+ * @param gainCode used for every channel of the board
+ */
+AIORESULT AIOAcquisitionGroupAddDevice( AIOAcquisitionGroup *group,
+                                        unsigned long DeviceIndex,
+                                        unsigned startChannel,
+                                        unsigned endChannel,
+                                        ADGainCode gainCode
+                                        )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOAcquisitionMember *member;
+    AIOUSBDevice *deviceDesc;
+    USBDevice *usb;
+    unsigned i;
+
+    if ( !group || !VALID_ENUM( ADGainCode, gainCode ) || startChannel > endChannel )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( group->started || group->num_members == AIOACQUISITIONGROUP_MAX_DEVICES )
+        return AIOUSB_ERROR_INVALID_DEVICE_SETTING;
+
+    deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+    if ( !deviceDesc->bADCStream || deviceDesc->Counters == 0 )
+        return AIOUSB_ERROR_NOT_SUPPORTED;
+    if ( endChannel >= deviceDesc->ADCMUXChannels )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+    usb = AIOUSBDeviceGetUSBHandle( deviceDesc );
+    if ( !usb )
+        return AIOUSB_ERROR_USBDEVICE_NOT_FOUND;
+    for ( i = 0; i < group->num_members; i ++ ) {
+        if ( group->members[i].DeviceIndex == DeviceIndex )
+            return AIOUSB_ERROR_DUP_NAME;
+    }
+
+    member = &group->members[group->num_members];
+    memset( member, 0, sizeof(*member) );
+    member->group        = group;
+    member->DeviceIndex  = DeviceIndex;
+    member->usb          = usb;
+    member->startChannel = startChannel;
+    member->endChannel   = endChannel;
+    member->gainCode     = gainCode;
+    member->scan_bytes   = ( endChannel - startChannel + 1 ) * sizeof(unsigned short);
+    member->ring         = NewAIOFifoLockFree( ( group->ring_scans + 1 ) * member->scan_bytes, member->scan_bytes );
+    member->carry        = (unsigned char *)malloc( member->scan_bytes );
+    if ( !member->ring || !member->carry ) {
+        if ( member->ring )
+            DeleteAIOFifo( member->ring );
+        free( member->carry );
+        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    group->num_members ++;
+    group->num_channels += endChannel - startChannel + 1;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Arms every board, queues their reads and then starts all of their
+ *        clocks together
+ * @param group
+ * @param ScanHz scan rate for every board, set to the actual rate
+ * @return
+ */
+AIORESULT AIOAcquisitionGroupStart( AIOAcquisitionGroup *group, double *ScanHz )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    unsigned i, armed = 0;
+    double hz;
+
+    if ( !group || !ScanHz || *ScanHz <= 0 || !group->num_members )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( group->started )
+        return AIOUSB_ERROR_OPEN_FAILED;
+
+    group->async = AIOUSB_TRUE;
+    for ( i = 0; i < group->num_members; i ++ ) {
+        AIOAcquisitionMember *member = &group->members[i];
+        AIOFifoReset( member->ring );
+        member->carry_bytes = 0;
+        member->written = member->read = member->skipped = 0;
+        member->dropped = member->discarded = 0;
+        member->gap_head = member->num_gaps = 0;
+        member->lost = AIOUSB_FALSE;
+        member->configured = AIOUSB_FALSE;
+        if ( !member->usb->deviceHandle )
+            group->async = AIOUSB_FALSE;
+    }
+    if ( !group->async && !group->scratch ) {
+        group->scratch = (unsigned char *)malloc( AIOACQUISITIONGROUP_TRANSFER_BYTES );
+        if ( !group->scratch )
+            return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+    group->result   = AIOUSB_SUCCESS;
+    group->exiting  = AIOUSB_FALSE;
+
+    for ( armed = 0; armed < group->num_members; armed ++ ) {
+        hz = *ScanHz;
+        if ( ( result = aioacquisitiongroup_arm( &group->members[armed], hz ) ) != AIOUSB_SUCCESS )
+            goto out_AIOAcquisitionGroupStart;
+    }
+
+    if ( group->async && ( result = aioacquisitiongroup_start_transfers( group ) ) != AIOUSB_SUCCESS )
+        goto out_AIOAcquisitionGroupStart;
+
+    if ( ( result = aioacquisitiongroup_release( group ) ) != AIOUSB_SUCCESS )
+        goto out_AIOAcquisitionGroupStart;
+
+    if ( pthread_create( &group->events, NULL, aioacquisitiongroup_events, (void *)group ) != 0 ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out_AIOAcquisitionGroupStart;
+    }
+
+    /* every board shares the divisors, so any of them gives the actual rate */
+    hz = *ScanHz;
+    {
+        AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( group->members[0].DeviceIndex, &result );
+        unsigned short high, low;
+        if ( deviceDesc )
+            CTR_CalculateOutputFreqDivisors( deviceDesc->RootClock, &hz, &high, &low );
+    }
+    group->hz      = hz;
+    *ScanHz        = hz;
+    group->started = AIOUSB_TRUE;
+    return AIOUSB_SUCCESS;
+
+ out_AIOAcquisitionGroupStart:
+    /* including a board whose arming failed part way */
+    for ( i = 0; i <= armed && i < group->num_members; i ++ )
+        aioacquisitiongroup_disarm( &group->members[i] );
+    if ( group->async ) {
+        aioacquisitiongroup_cancel_transfers( group );
+        aioacquisitiongroup_free_transfers( group );
+    }
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops every board's clock and the event thread. Scans already
+ *        captured stay readable.
+ * @return the first transfer error seen by the group, if any
+ */
+AIORESULT AIOAcquisitionGroupStop( AIOAcquisitionGroup *group )
+{
+    unsigned i;
+    if ( !group )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( !group->started )
+        return group->result;
+
+    for ( i = 0; i < group->num_members; i ++ )
+        aioacquisitiongroup_disarm( &group->members[i] );
+
+    group->exiting = AIOUSB_TRUE;
+    pthread_join( group->events, NULL );
+    if ( group->async )
+        aioacquisitiongroup_free_transfers( group );
+    group->started = AIOUSB_FALSE;
+
+    return group->result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes up to max_scans merged scans without blocking. Each holds
+ *        the channels of every board in the order they were added, and
+ *        every board's part has the same sequence number; scans of a
+ *        board that has no partner on another board ( because that one
+ *        lost them to a full ring ) are discarded.
+ * @param group
+ * @param counts max_scans * AIOAcquisitionGroupNumberChannels() counts
+ * @param max_scans
+ * @param sequences if not NULL, max_scans * number of boards sequence
+ *        numbers, the scan number of each board's part of each scan
+ * @return scans copied, or -error once nothing is left and the group has
+ *         failed
+ */
+AIORET_TYPE AIOAcquisitionGroupRead( AIOAcquisitionGroup *group,
+                                     unsigned short *counts,
+                                     unsigned max_scans,
+                                     unsigned long long *sequences
+                                     )
+{
+    unsigned long long avail[AIOACQUISITIONGROUP_MAX_DEVICES];
+    unsigned i, scans = 0;
+
+    if ( !group || !counts || !group->num_members )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    /* before the gaps are looked at, so every gap before these scans is there */
+    for ( i = 0; i < group->num_members; i ++ )
+        avail[i] = group->members[i].ring->rdelta( group->members[i].ring ) / group->members[i].scan_bytes;
+
+    pthread_mutex_lock( &group->lock );
+    while ( scans < max_scans ) {
+        unsigned long long target = 0;
+        AIOUSB_BOOL aligned = AIOUSB_TRUE;
+        unsigned short *row = counts + scans * group->num_channels;
+
+        for ( i = 0; i < group->num_members; i ++ ) {
+            if ( !avail[i] )
+                break;
+            target = MAX( target, aioacquisitiongroup_next_sequence( &group->members[i] ) );
+        }
+        if ( i < group->num_members )
+            break;
+
+        for ( i = 0; i < group->num_members; i ++ ) {
+            AIOAcquisitionMember *member = &group->members[i];
+            while ( avail[i] && aioacquisitiongroup_next_sequence( member ) < target ) {
+                aioacquisitiongroup_take( member, NULL );
+                member->discarded ++;
+                avail[i] --;
+            }
+            if ( !avail[i] || aioacquisitiongroup_next_sequence( member ) != target )
+                aligned = AIOUSB_FALSE;
+        }
+        if ( !aligned )
+            continue;
+
+        for ( i = 0; i < group->num_members; i ++ ) {
+            AIOAcquisitionMember *member = &group->members[i];
+            if ( sequences )
+                sequences[scans * group->num_members + i] = target;
+            aioacquisitiongroup_take( member, row );
+            row += member->endChannel - member->startChannel + 1;
+            avail[i] --;
+        }
+        scans ++;
+    }
+    pthread_mutex_unlock( &group->lock );
+
+    if ( !scans && group->result != AIOUSB_SUCCESS )
+        return -(AIORET_TYPE)group->result;
+    return scans;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOAcquisitionGroupNumberChannels( AIOAcquisitionGroup *group )
+{
+    if ( !group )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return group->num_channels;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Scans the member'th board lost because its ring was full
+ */
+AIORET_TYPE AIOAcquisitionGroupGetDropped( AIOAcquisitionGroup *group, unsigned member )
+{
+    if ( !group || member >= group->num_members )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return (AIORET_TYPE)group->members[member].dropped;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Scans of the member'th board thrown away because another board
+ *        had lost the matching ones
+ */
+AIORET_TYPE AIOAcquisitionGroupGetDiscarded( AIOAcquisitionGroup *group, unsigned member )
+{
+    if ( !group || member >= group->num_members )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return (AIORET_TYPE)group->members[member].discarded;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,105 @@
+/**
+ * @file   AIOAcquisitionGroup.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Several analog input boards armed together, started together
+ *         and read back as one time aligned stream of scans
+ *
+ */
+
+#ifndef _AIO_ACQUISITION_GROUP_H
+#define _AIO_ACQUISITION_GROUP_H
+
+#include "AIOTypes.h"
+#include "AIOFifo.h"
+#include "AIOTransferQueue.h"
+#include "ADCConfigBlock.h"
+#include "USBDevice.h"
+#include <pthread.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIOACQUISITIONGROUP_MAX_DEVICES        MAX_USB_DEVICES
+#define AIOACQUISITIONGROUP_DEFAULT_RING_SCANS ( 64*1024 )
+#define AIOACQUISITIONGROUP_NUM_TRANSFERS      8          /**< Async bulk reads kept queued per board */
+#define AIOACQUISITIONGROUP_TRANSFER_BYTES     ( 32*512 ) /**< Size of each of them */
+#define AIOACQUISITIONGROUP_MAX_GAPS           32
+#define AIOACQUISITIONGROUP_POLL_MS            10         /**< Longest the event thread waits on one board */
+
+struct aio_acquisition_group;
+
+/**
+ * @brief Scans a board lost to a full ring, starting at the position'th
+ * scan written to the ring
+ */
+typedef struct aio_acquisition_gap {
+    unsigned long long position;
+    unsigned long long scans;
+} AIOAcquisitionGap;
+
+typedef struct aio_acquisition_member {
+    struct aio_acquisition_group *group;
+    unsigned long DeviceIndex;
+    USBDevice *usb;
+    unsigned startChannel;
+    unsigned endChannel;
+    ADGainCode gainCode;
+    unsigned scan_bytes;
+    unsigned short highDivisor;
+    unsigned short lowDivisor;
+    AIOFifo *ring;                      /**< Whole scans only */
+    unsigned char *carry;               /**< Start of a scan split across transfers */
+    unsigned carry_bytes;
+    unsigned long long written;         /**< Scans put in the ring */
+    unsigned long long read;            /**< Scans taken out of the ring */
+    unsigned long long skipped;         /**< Sequence numbers passed over by gaps already read past */
+    unsigned long long dropped;         /**< Scans lost to a full ring */
+    unsigned long long discarded;       /**< Scans thrown away to line up with the other boards */
+    AIOAcquisitionGap gaps[AIOACQUISITIONGROUP_MAX_GAPS];
+    unsigned gap_head;
+    unsigned num_gaps;
+    AIOUSB_BOOL lost;                   /**< Ran out of gaps, takes no more scans */
+    ADCConfigBlock savedConfigBlock;    /**< The board's cached config before the group armed it */
+    AIOUSB_BOOL configured;             /**< savedConfigBlock is to be put back when the board is disarmed */
+    AIOTransferQueue *transfers;        /**< Bulk reads kept queued on a real device */
+    struct libusb_transfer *release;    /**< Counter load that starts the board's clock */
+    int release_status;
+} AIOAcquisitionMember;
+
+typedef struct aio_acquisition_group {
+    AIOAcquisitionMember members[AIOACQUISITIONGROUP_MAX_DEVICES];
+    unsigned num_members;
+    unsigned num_channels;              /**< Counts in one merged scan */
+    unsigned ring_scans;
+    unsigned timeout;                   /**< Control transfer timeout ( ms. ) */
+    double hz;                          /**< Scan rate every board was started at */
+    unsigned long long release_ns;      /**< Time taken to release all the boards, an upper bound on their start skew */
+    unsigned char *scratch;             /**< Landing area for synchronous reads */
+    pthread_t events;                   /**< Services every board of the group */
+    AIOUSB_BOOL async;                  /**< Every board has a libusb handle */
+    AIOUSB_BOOL started;
+    AIOUSB_BOOL exiting;
+    int releasing;
+    AIORESULT result;                   /**< First transfer error, reported by later calls */
+    pthread_mutex_t lock;               /**< Guards the gap lists */
+} AIOAcquisitionGroup;
+
+PUBLIC_EXTERN AIOAcquisitionGroup *NewAIOAcquisitionGroup( unsigned ring_scans );
+PUBLIC_EXTERN void DeleteAIOAcquisitionGroup( AIOAcquisitionGroup *group );
+PUBLIC_EXTERN AIORESULT AIOAcquisitionGroupAddDevice( AIOAcquisitionGroup *group, unsigned long DeviceIndex, unsigned startChannel, unsigned endChannel, ADGainCode gainCode );
+PUBLIC_EXTERN AIORESULT AIOAcquisitionGroupStart( AIOAcquisitionGroup *group, double *ScanHz );
+PUBLIC_EXTERN AIORESULT AIOAcquisitionGroupStop( AIOAcquisitionGroup *group );
+PUBLIC_EXTERN AIORET_TYPE AIOAcquisitionGroupRead( AIOAcquisitionGroup *group, unsigned short *counts, unsigned max_scans, unsigned long long *sequences );
+PUBLIC_EXTERN AIORET_TYPE AIOAcquisitionGroupNumberChannels( AIOAcquisitionGroup *group );
+PUBLIC_EXTERN AIORET_TYPE AIOAcquisitionGroupGetDropped( AIOAcquisitionGroup *group, unsigned member );
+PUBLIC_EXTERN AIORET_TYPE AIOAcquisitionGroupGetDiscarded( AIOAcquisitionGroup *group, unsigned member );
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
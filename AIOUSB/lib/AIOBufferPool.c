@@ -0,0 +1,239 @@
+/**
+ * @file   AIOBufferPool.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Per device pool of transfer and conversion buffers
+ *
+ */
+
+#include "AIOBufferPool.h"
+#include "AIOUSB_Log.h"
+#include <string.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+/*----------------------------------------------------------------------------*/
+static AIORET_TYPE aiobufferpool_class_init( AIOBufferPoolClass *cls, unsigned block_size, unsigned num_blocks )
+{
+    cls->block_size  = block_size;
+    cls->num_blocks  = num_blocks;
+    cls->arena       = (char *)malloc( (size_t)block_size * num_blocks );
+    cls->free_blocks = (void **)malloc( num_blocks * sizeof(void *) );
+    if ( !cls->arena || !cls->free_blocks )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    for ( cls->num_free = 0; cls->num_free < num_blocks; cls->num_free ++ )
+        cls->free_blocks[cls->num_free] = &cls->arena[(size_t)( num_blocks - 1 - cls->num_free ) * block_size];
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+static AIOUSB_BOOL aiobufferpool_class_owns( AIOBufferPoolClass *cls, void *ptr )
+{
+    return ( (char *)ptr >= cls->arena && (char *)ptr < cls->arena + (size_t)cls->block_size * cls->num_blocks ?
+             AIOUSB_TRUE : AIOUSB_FALSE );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Allocates every buffer the pool will ever hand out
+ */
+AIOBufferPool *NewAIOBufferPool( void )
+{
+    AIOBufferPool *pool = (AIOBufferPool *)calloc( 1, sizeof(AIOBufferPool) );
+    if ( !pool )
+        return NULL;
+
+    if ( aiobufferpool_class_init( &pool->classes[0], AIO_BUFFER_POOL_SMALL_SIZE, AIO_BUFFER_POOL_SMALL_COUNT ) < 0 ||
+         aiobufferpool_class_init( &pool->classes[1], AIO_BUFFER_POOL_LARGE_SIZE, AIO_BUFFER_POOL_LARGE_COUNT ) < 0 ||
+         aiobufferpool_class_init( &pool->classes[2], AIO_BUFFER_POOL_BULK_SIZE, AIO_BUFFER_POOL_BULK_COUNT ) < 0 )
+        goto out_NewAIOBufferPool;
+
+    pthread_mutex_init( &pool->lock, NULL );
+    return pool;
+
+ out_NewAIOBufferPool:
+    for ( int i = 0; i < AIO_BUFFER_POOL_NUM_CLASSES; i ++ ) {
+        free( pool->classes[i].arena );
+        free( pool->classes[i].free_blocks );
+    }
+    free( pool );
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+void DeleteAIOBufferPool( AIOBufferPool *pool )
+{
+    if ( !pool )
+        return;
+    for ( int i = 0; i < AIO_BUFFER_POOL_NUM_CLASSES; i ++ ) {
+        if ( pool->classes[i].num_free != pool->classes[i].num_blocks )
+            AIOUSB_ERROR("Deleting buffer pool with %u buffers still in use\n",
+                         pool->classes[i].num_blocks - pool->classes[i].num_free );
+        free( pool->classes[i].arena );
+        free( pool->classes[i].free_blocks );
+    }
+    pthread_mutex_destroy( &pool->lock );
+    free( pool );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Hands out the smallest free block that holds size bytes. Falls
+ * back to malloc when the request is bigger than any block, the matching
+ * blocks are all in use, or pool is NULL, so callers never need a second
+ * code path.
+ * @return buffer to give back with AIOBufferPoolPut, or NULL
+ */
+void *AIOBufferPoolGet( AIOBufferPool *pool, size_t size )
+{
+    void *ptr = NULL;
+    if ( !pool )
+        return malloc( size );
+
+    pthread_mutex_lock( &pool->lock );
+    for ( int i = 0; i < AIO_BUFFER_POOL_NUM_CLASSES && !ptr; i ++ ) {
+        AIOBufferPoolClass *cls = &pool->classes[i];
+        if ( size <= cls->block_size && cls->num_free )
+            ptr = cls->free_blocks[--cls->num_free];
+    }
+    if ( !ptr )
+        pool->heap_allocations ++;
+    pthread_mutex_unlock( &pool->lock );
+
+    return ( ptr ? ptr : malloc( size ) );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Returns a buffer obtained from AIOBufferPoolGet
+ */
+void AIOBufferPoolPut( AIOBufferPool *pool, void *ptr )
+{
+    if ( !ptr )
+        return;
+    if ( pool ) {
+        pthread_mutex_lock( &pool->lock );
+        for ( int i = 0; i < AIO_BUFFER_POOL_NUM_CLASSES; i ++ ) {
+            AIOBufferPoolClass *cls = &pool->classes[i];
+            if ( aiobufferpool_class_owns( cls, ptr ) ) {
+                cls->free_blocks[cls->num_free++] = ptr;
+                pthread_mutex_unlock( &pool->lock );
+                return;
+            }
+        }
+        pthread_mutex_unlock( &pool->lock );
+    }
+    free( ptr );
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOBufferPoolGetHeapAllocations( AIOBufferPool *pool )
+{
+    if ( !pool )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return (AIORET_TYPE)pool->heap_allocations;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief How many of the pool's own blocks are handed out and not yet put
+ * back, so owners can tell whether deleting it is safe
+ */
+AIORET_TYPE AIOBufferPoolGetInUse( AIOBufferPool *pool )
+{
+    AIORET_TYPE in_use = 0;
+    if ( !pool )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    pthread_mutex_lock( &pool->lock );
+    for ( int i = 0; i < AIO_BUFFER_POOL_NUM_CLASSES; i ++ )
+        in_use += pool->classes[i].num_blocks - pool->classes[i].num_free;
+    pthread_mutex_unlock( &pool->lock );
+    return in_use;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef SELF_TEST
+
+#include "gtest/gtest.h"
+#include "tap.h"
+#include <iostream>
+using namespace AIOUSB;
+
+TEST(AIOBufferPool,HandsOutSmallestClass )
+{
+    AIOBufferPool *pool = NewAIOBufferPool();
+    void *small = AIOBufferPoolGet( pool, 100 );
+    void *large = AIOBufferPoolGet( pool, AIO_BUFFER_POOL_SMALL_SIZE + 1 );
+
+    EXPECT_TRUE( aiobufferpool_class_owns( &pool->classes[0], small ) );
+    EXPECT_TRUE( aiobufferpool_class_owns( &pool->classes[1], large ) );
+    EXPECT_EQ( AIO_BUFFER_POOL_SMALL_COUNT - 1, pool->classes[0].num_free );
+    EXPECT_EQ( AIO_BUFFER_POOL_LARGE_COUNT - 1, pool->classes[1].num_free );
+    EXPECT_EQ( 0, AIOBufferPoolGetHeapAllocations( pool ) );
+
+    AIOBufferPoolPut( pool, small );
+    AIOBufferPoolPut( pool, large );
+    EXPECT_EQ( AIO_BUFFER_POOL_SMALL_COUNT, pool->classes[0].num_free );
+    EXPECT_EQ( AIO_BUFFER_POOL_LARGE_COUNT, pool->classes[1].num_free );
+    EXPECT_EQ( small, AIOBufferPoolGet( pool, 1 ) ) << "Most recently returned block is reused first";
+    AIOBufferPoolPut( pool, small );
+
+    DeleteAIOBufferPool( pool );
+}
+
+TEST(AIOBufferPool,FallsBackToHeap )
+{
+    AIOBufferPool *pool = NewAIOBufferPool();
+    void *blocks[AIO_BUFFER_POOL_SMALL_COUNT + AIO_BUFFER_POOL_LARGE_COUNT + AIO_BUFFER_POOL_BULK_COUNT + 1];
+    int num_blocks = sizeof(blocks)/sizeof(blocks[0]);
+
+    for ( int i = 0; i < num_blocks; i ++ ) {
+        blocks[i] = AIOBufferPoolGet( pool, 16 );
+        memset( blocks[i], i, 16 );
+    }
+    EXPECT_EQ( 1, AIOBufferPoolGetHeapAllocations( pool ) ) << "Small requests spill into the larger classes first";
+    EXPECT_EQ( num_blocks - 1, AIOBufferPoolGetInUse( pool ) ) << "The heap block is not the pool's";
+    for ( int i = 0; i < num_blocks; i ++ )
+        AIOBufferPoolPut( pool, blocks[i] );
+
+    void *bulk = AIOBufferPoolGet( pool, AIO_BUFFER_POOL_LARGE_SIZE + 1 );
+    EXPECT_TRUE( aiobufferpool_class_owns( &pool->classes[2], bulk ) );
+    void *huge = AIOBufferPoolGet( pool, AIO_BUFFER_POOL_BULK_SIZE + 1 );
+    EXPECT_TRUE( huge );
+    EXPECT_EQ( 2, AIOBufferPoolGetHeapAllocations( pool ) );
+    AIOBufferPoolPut( pool, bulk );
+    AIOBufferPoolPut( pool, huge );
+
+    EXPECT_EQ( AIO_BUFFER_POOL_SMALL_COUNT, pool->classes[0].num_free );
+    EXPECT_EQ( AIO_BUFFER_POOL_LARGE_COUNT, pool->classes[1].num_free );
+    EXPECT_EQ( AIO_BUFFER_POOL_BULK_COUNT, pool->classes[2].num_free );
+    EXPECT_EQ( 0, AIOBufferPoolGetInUse( pool ) );
+
+    void *nopool = AIOBufferPoolGet( NULL, 32 );
+    EXPECT_TRUE( nopool );
+    AIOBufferPoolPut( NULL, nopool );
+
+    DeleteAIOBufferPool( pool );
+}
+
+int main(int argc, char *argv[] )
+{
+  testing::InitGoogleTest(&argc, argv);
+  testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+  delete listeners.Release(listeners.default_result_printer());
+#endif
+
+  listeners.Append( new tap::TapListener() );
+  return RUN_ALL_TESTS();
+}
+
+#endif
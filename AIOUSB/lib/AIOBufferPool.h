@@ -0,0 +1,57 @@
+/**
+ * @file   AIOBufferPool.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Fixed size buffers handed out to the transfer and conversion paths
+ *         without touching the heap once the pool exists
+ *
+ */
+
+#ifndef _AIO_BUFFER_POOL_H
+#define _AIO_BUFFER_POOL_H
+
+#include "AIOTypes.h"
+#include "AIOBulkSizer.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIO_BUFFER_POOL_SMALL_SIZE     4096           /**< Control transfers, immediate scans */
+#define AIO_BUFFER_POOL_SMALL_COUNT    8
+#define AIO_BUFFER_POOL_LARGE_SIZE     ( 64*1024 )    /**< Bulk transfers, conversion scratch */
+#define AIO_BUFFER_POOL_LARGE_COUNT    4
+#define AIO_BUFFER_POOL_BULK_SIZE      AIOBULKSIZER_MAX_SIZE  /**< The streaming workers' reads */
+#define AIO_BUFFER_POOL_BULK_COUNT     2
+#define AIO_BUFFER_POOL_NUM_CLASSES    3
+
+typedef struct aio_buffer_pool_class {
+    unsigned block_size;
+    unsigned num_blocks;
+    char *arena;                        /**< num_blocks * block_size bytes, allocated once */
+    void **free_blocks;                 /**< Stack of blocks not handed out */
+    unsigned num_free;
+} AIOBufferPoolClass;
+
+typedef struct aio_buffer_pool {
+    AIOBufferPoolClass classes[AIO_BUFFER_POOL_NUM_CLASSES];
+    pthread_mutex_t lock;
+    unsigned long heap_allocations;     /**< Requests that were too big or found the pool empty */
+} AIOBufferPool;
+
+PUBLIC_EXTERN AIOBufferPool *NewAIOBufferPool( void );
+PUBLIC_EXTERN void DeleteAIOBufferPool( AIOBufferPool *pool );
+PUBLIC_EXTERN void *AIOBufferPoolGet( AIOBufferPool *pool, size_t size );
+PUBLIC_EXTERN void AIOBufferPoolPut( AIOBufferPool *pool, void *ptr );
+PUBLIC_EXTERN AIORET_TYPE AIOBufferPoolGetHeapAllocations( AIOBufferPool *pool );
+PUBLIC_EXTERN AIORET_TYPE AIOBufferPoolGetInUse( AIOBufferPool *pool );
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,185 @@
+/**
+ * @file   AIOBulkSizer.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Sizes streaming bulk transfers from the rate samples arrive at
+ *
+ * The rate is measured between completions rather than from each
+ * transfer's submit, since a queued transfer waits behind the others and
+ * a synchronous read finds data the board buffered while the worker was
+ * busy; over a completion interval the bytes that arrive are what the
+ * board produced. Sizes only move once the rate calls for a size a
+ * quarter away from the current one, so noise does not resize every
+ * transfer.
+ */
+
+#include "AIOBulkSizer.h"
+#include <math.h>
+#include <string.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define AIOBULKSIZER_FIXED_SIZE  ( 64*1024 )    /* FIXED with no size given */
+#define AIOBULKSIZER_SMOOTHING   8              /* completions the rate is averaged over */
+
+/**
+ * @brief Budget, queue depth and size limits for each preference
+ */
+static const struct {
+    unsigned budget_ms;
+    unsigned queue_ms;
+    unsigned min_size;
+    unsigned max_size;
+} aiobulksizer_profiles[] = {
+    { 0,  0,   0,         0          },   /* AIO_TRANSFERS_FIXED */
+    { 2,  20,  512,       16*1024    },   /* AIO_TRANSFERS_LOW_LATENCY */
+    { 10, 50,  512,       64*1024    },   /* AIO_TRANSFERS_BALANCED */
+    { 50, 200, 16*1024,   AIOBULKSIZER_MAX_SIZE }    /* AIO_TRANSFERS_HIGH_THROUGHPUT */
+};
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Bytes per second a scan clock of hz produces
+ */
+double AIOBulkSizerRate( double hz, unsigned num_channels, unsigned num_oversamples )
+{
+    return hz * num_channels * ( num_oversamples + 1 ) * sizeof(unsigned short);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief The whole packets the device fills in the budget at rate, within
+ * the preference's limits
+ */
+static unsigned aiobulksizer_size_for( AIOBulkSizer *sizer, double rate )
+{
+    double bytes = rate * sizer->budget_ns / 1e9;
+    if ( bytes >= sizer->max_size )
+        return sizer->max_size;
+    bytes = floor( bytes / AIOBULKSIZER_PACKET ) * AIOBULKSIZER_PACKET;
+    return (unsigned)MAX( bytes, (double)sizer->min_size );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @param latency_ms budget for one transfer to fill, 0 for the preference's
+ * @param bytes_per_sec what the clock says the device will produce, see
+ *        AIOBulkSizerRate
+ * @param fixed_size bytes per transfer for AIO_TRANSFERS_FIXED, rounded up
+ *        to whole packets, 0 for 64 KB
+ */
+AIORET_TYPE AIOBulkSizerInit( AIOBulkSizer *sizer, AIOTransferPreference preference, unsigned latency_ms, double bytes_per_sec, unsigned fixed_size )
+{
+    if ( !sizer || !VALID_ENUM( AIOTransferPreference, preference ) || bytes_per_sec < 0 )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    memset( sizer, 0, sizeof(AIOBulkSizer) );
+    sizer->preference = preference;
+    sizer->rate       = bytes_per_sec;
+
+    if ( preference == AIO_TRANSFERS_FIXED ) {
+        fixed_size = ( fixed_size ? fixed_size : AIOBULKSIZER_FIXED_SIZE );
+        sizer->size = sizer->min_size = sizer->max_size =
+            ( fixed_size + AIOBULKSIZER_PACKET - 1 ) / AIOBULKSIZER_PACKET * AIOBULKSIZER_PACKET;
+        return AIOUSB_SUCCESS;
+    }
+
+    latency_ms        = ( latency_ms ? latency_ms : aiobulksizer_profiles[preference].budget_ms );
+    sizer->budget_ns  = latency_ms * 1000000ULL;
+    sizer->queue_ns   = MAX( aiobulksizer_profiles[preference].queue_ms, 4 * latency_ms ) * 1000000ULL;
+    sizer->min_size   = aiobulksizer_profiles[preference].min_size;
+    sizer->max_size   = aiobulksizer_profiles[preference].max_size;
+    sizer->size       = ( bytes_per_sec > 0 ? aiobulksizer_size_for( sizer, bytes_per_sec ) : sizer->max_size );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Never asks for less than bytes, rounded up to whole packets, such
+ * as a whole scan
+ */
+AIORET_TYPE AIOBulkSizerSetMinSize( AIOBulkSizer *sizer, unsigned bytes )
+{
+    if ( !sizer )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    bytes = ( bytes + AIOBULKSIZER_PACKET - 1 ) / AIOBULKSIZER_PACKET * AIOBULKSIZER_PACKET;
+    sizer->min_size = MAX( sizer->min_size, bytes );
+    sizer->max_size = MAX( sizer->max_size, sizer->min_size );
+    sizer->size     = MAX( sizer->size, sizer->min_size );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief A transfer completed at now_ns with bytes in it. Completions with
+ * no data still count towards the next interval.
+ * @return size for the next transfer
+ */
+AIORET_TYPE AIOBulkSizerObserve( AIOBulkSizer *sizer, unsigned bytes, unsigned long long now_ns )
+{
+    unsigned target;
+    if ( !sizer )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( sizer->preference == AIO_TRANSFERS_FIXED || !bytes )
+        return sizer->size;
+
+    if ( sizer->last_ns && now_ns > sizer->last_ns ) {
+        double sample = bytes * 1e9 / ( now_ns - sizer->last_ns );
+        sizer->rate += ( sample - sizer->rate ) / ( sizer->observed ? AIOBULKSIZER_SMOOTHING : 1 );
+        sizer->observed ++;
+
+        target = aiobulksizer_size_for( sizer, sizer->rate );
+        if ( target != sizer->size && ( target >= sizer->size + sizer->size / 4 || target <= sizer->size - sizer->size / 5 ||
+                                        target == sizer->min_size || target == sizer->max_size ) ) {
+            sizer->size = target;
+            sizer->resized ++;
+        }
+    }
+    sizer->last_ns = now_ns;
+    return sizer->size;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOBulkSizerGetSize( AIOBulkSizer *sizer )
+{
+    if ( !sizer )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return sizer->size;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief The largest size the sizer will ask for, what transfer buffers
+ * need room for
+ */
+AIORET_TYPE AIOBulkSizerGetMaxSize( AIOBulkSizer *sizer )
+{
+    if ( !sizer )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return sizer->max_size;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief How many transfers of the current size to keep in flight so the
+ * queue holds the preference's worth of data, at least two and at most
+ * max_transfers
+ */
+AIORET_TYPE AIOBulkSizerGetTransfers( AIOBulkSizer *sizer, unsigned max_transfers )
+{
+    double fill_ns;
+    if ( !sizer )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( sizer->preference == AIO_TRANSFERS_FIXED || !( sizer->rate > 0 ) || max_transfers <= 2 )
+        return max_transfers;
+
+    fill_ns = sizer->size * 1e9 / sizer->rate;
+    return (AIORET_TYPE)MIN( (double)max_transfers, MAX( 2.0, ceil( sizer->queue_ns / fill_ns ) ) );
+}
+
+#ifdef __cplusplus
+}
+#endif
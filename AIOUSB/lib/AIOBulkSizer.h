@@ -0,0 +1,54 @@
+/**
+ * @file   AIOBulkSizer.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Sizes streaming bulk transfers from the rate samples arrive at
+ *
+ * A bulk read only completes once it is full, so a transfer sized for
+ * 500 kHz leaves a 1 kHz stream waiting seconds for its first scan, while
+ * one sized for 1 kHz spends a 500 kHz stream's time on per transfer
+ * overhead. The sizer asks for as many bytes as the device produces in a
+ * latency budget, starting from the rate the clock was set to and then
+ * following the rate completions actually arrive at.
+ */
+
+#ifndef _AIO_BULK_SIZER_H
+#define _AIO_BULK_SIZER_H
+
+#include "AIOTypes.h"
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIOBULKSIZER_PACKET     512     /**< Sizes are whole bulk packets */
+#define AIOBULKSIZER_MAX_SIZE   ( 256*1024 )    /**< Largest size any preference asks for */
+
+typedef struct aio_bulk_sizer {
+    AIOTransferPreference preference;
+    unsigned long long budget_ns;       /**< How long one transfer should take to fill */
+    unsigned long long queue_ns;        /**< Data the transfers in flight should have room for */
+    unsigned min_size;
+    unsigned max_size;
+    unsigned size;                      /**< Bytes to ask for next */
+    double rate;                        /**< Bytes per second, smoothed from completions */
+    unsigned long long last_ns;         /**< Last completion with data, 0 before the first */
+    unsigned long long observed;        /**< Completions timed */
+    unsigned long long resized;         /**< Times size changed */
+} AIOBulkSizer;
+
+PUBLIC_EXTERN AIORET_TYPE AIOBulkSizerInit( AIOBulkSizer *sizer, AIOTransferPreference preference, unsigned latency_ms, double bytes_per_sec, unsigned fixed_size );
+PUBLIC_EXTERN AIORET_TYPE AIOBulkSizerSetMinSize( AIOBulkSizer *sizer, unsigned bytes );
+PUBLIC_EXTERN AIORET_TYPE AIOBulkSizerObserve( AIOBulkSizer *sizer, unsigned bytes, unsigned long long now_ns );
+PUBLIC_EXTERN AIORET_TYPE AIOBulkSizerGetSize( AIOBulkSizer *sizer );
+PUBLIC_EXTERN AIORET_TYPE AIOBulkSizerGetMaxSize( AIOBulkSizer *sizer );
+PUBLIC_EXTERN AIORET_TYPE AIOBulkSizerGetTransfers( AIOBulkSizer *sizer, unsigned max_transfers );
+PUBLIC_EXTERN double AIOBulkSizerRate( double hz, unsigned num_channels, unsigned num_oversamples );
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
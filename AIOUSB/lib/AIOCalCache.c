@@ -0,0 +1,416 @@
+/**
+ * @file   AIOCalCache.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Calibration tables kept on disk between runs, so a device whose
+ *         table hasn't changed is neither recalibrated nor rewritten
+ *
+ */
+
+#include "AIOCalCache.h"
+#include "AIOTypes.h"
+#include "AIOUSB_Log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define AIOCALCACHE_ENTRY_SIZE  ( sizeof(AIOCalCacheHeader) + CAL_TABLE_WORDS * sizeof(unsigned short) )
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *cache_dir = NULL;
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets where entries are kept. NULL goes back to the default,
+ * $AIOUSB_CAL_CACHE, else $XDG_CACHE_HOME/aiousb, else ~/.cache/aiousb
+ */
+AIORET_TYPE AIOCalCacheSetDirectory( const char *dir )
+{
+    char *tmp = NULL;
+    if ( dir && !( tmp = strdup( dir ) ) )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    pthread_mutex_lock( &cache_lock );
+    free( cache_dir );
+    cache_dir = tmp;
+    pthread_mutex_unlock( &cache_lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief The directory entries are kept in
+ * @return a copy the caller frees, or NULL if no directory can be worked out
+ */
+char *AIOCalCacheGetDirectory( void )
+{
+    char *tmp = NULL;
+    const char *env;
+
+    pthread_mutex_lock( &cache_lock );
+    if ( cache_dir ) {
+        tmp = strdup( cache_dir );
+    } else if ( ( env = getenv( AIOCALCACHE_ENV ) ) && *env ) {
+        tmp = strdup( env );
+    } else if ( ( env = getenv( "XDG_CACHE_HOME" ) ) && *env ) {
+        if ( ( tmp = (char *)malloc( strlen(env) + sizeof("/aiousb") ) ) )
+            sprintf( tmp, "%s/aiousb", env );
+    } else if ( ( env = getenv( "HOME" ) ) && *env ) {
+        if ( ( tmp = (char *)malloc( strlen(env) + sizeof("/.cache/aiousb") ) ) )
+            sprintf( tmp, "%s/.cache/aiousb", env );
+    }
+    pthread_mutex_unlock( &cache_lock );
+    return tmp;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief 64 bit FNV-1a of the CAL_TABLE_WORDS words of table
+ */
+uint64_t AIOCalCacheHash( const unsigned short *table )
+{
+    const unsigned char *bytes = (const unsigned char *)table;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for ( size_t i = 0; i < CAL_TABLE_WORDS * sizeof(unsigned short); i ++ ) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/*----------------------------------------------------------------------------*/
+static char *entry_path( uint64_t serial, unsigned productID, ADGainCode range )
+{
+    char *dir = AIOCalCacheGetDirectory(), *path;
+    if ( !dir )
+        return NULL;
+
+    path = (char *)malloc( strlen(dir) + 64 );
+    if ( path )
+        sprintf( path, "%s/%04x-%016llx-%u.cal", dir, productID, (unsigned long long)serial, (unsigned)range );
+    free( dir );
+    return path;
+}
+
+/*----------------------------------------------------------------------------*/
+static AIORET_TYPE make_directory( void )
+{
+    char *dir = AIOCalCacheGetDirectory();
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+    if ( !dir )
+        return -AIOUSB_ERROR_FILE_NOT_FOUND;
+
+    for ( char *p = dir + 1; ; p ++ ) {
+        if ( *p != '/' && *p != '\0' )
+            continue;
+        char c = *p;
+        *p = '\0';
+        if ( mkdir( dir, 0755 ) != 0 && errno != EEXIST ) {
+            AIOUSB_ERROR("Can't create calibration cache directory %s: %s\n", dir, strerror(errno) );
+            retval = -AIOUSB_ERROR_FILE_NOT_FOUND;
+            break;
+        }
+        *p = c;
+        if ( !c )
+            break;
+    }
+    free( dir );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+static AIORET_TYPE check_header( const AIOCalCacheHeader *header, uint64_t serial, unsigned productID, ADGainCode range )
+{
+    if ( memcmp( header->magic, AIOCALCACHE_MAGIC, sizeof(header->magic) ) != 0 ||
+         header->version != AIOCALCACHE_VERSION ||
+         header->num_words != CAL_TABLE_WORDS ||
+         header->product_id != productID ||
+         header->serial_number != serial ||
+         header->range != (uint32_t)range )
+        return -AIOUSB_ERROR_INVALID_DATA;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Reads the entry for serial / productID / range into table
+ * @param table CAL_TABLE_WORDS words
+ * @param hash if not NULL, gets the table's hash
+ * @return AIOUSB_SUCCESS, -AIOUSB_ERROR_FILE_NOT_FOUND when there is no
+ *         entry or -AIOUSB_ERROR_INVALID_DATA when it is damaged
+ */
+AIORET_TYPE AIOCalCacheLoad( uint64_t serial, unsigned productID, ADGainCode range, unsigned short *table, uint64_t *hash )
+{
+    AIOCalCacheHeader header;
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+    char *path;
+    FILE *fp;
+
+    if ( !table )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( !( path = entry_path( serial, productID, range ) ) )
+        return -AIOUSB_ERROR_FILE_NOT_FOUND;
+    fp = fopen( path, "rb" );
+    free( path );
+    if ( !fp )
+        return -AIOUSB_ERROR_FILE_NOT_FOUND;
+
+    if ( fread( &header, sizeof(header), 1, fp ) != 1 ||
+         check_header( &header, serial, productID, range ) != AIOUSB_SUCCESS ||
+         fread( table, sizeof(unsigned short), CAL_TABLE_WORDS, fp ) != CAL_TABLE_WORDS ||
+         AIOCalCacheHash( table ) != header.hash )
+        retval = -AIOUSB_ERROR_INVALID_DATA;
+    fclose( fp );
+
+    if ( retval == AIOUSB_SUCCESS && hash )
+        *hash = header.hash;
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief AIOCalCacheLoad without the copy: *table points into a read only
+ * mapping of the entry until AIOCalCacheUnmap
+ */
+AIORET_TYPE AIOCalCacheMap( uint64_t serial, unsigned productID, ADGainCode range, const unsigned short **table, uint64_t *hash )
+{
+    const AIOCalCacheHeader *header;
+    struct stat info;
+    void *map;
+    char *path;
+    int fd;
+
+    if ( !table )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( !( path = entry_path( serial, productID, range ) ) )
+        return -AIOUSB_ERROR_FILE_NOT_FOUND;
+    fd = open( path, O_RDONLY );
+    free( path );
+    if ( fd < 0 )
+        return -AIOUSB_ERROR_FILE_NOT_FOUND;
+
+    if ( fstat( fd, &info ) != 0 || info.st_size != (off_t)AIOCALCACHE_ENTRY_SIZE ) {
+        close( fd );
+        return -AIOUSB_ERROR_INVALID_DATA;
+    }
+    map = mmap( NULL, AIOCALCACHE_ENTRY_SIZE, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( map == MAP_FAILED )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    header = (const AIOCalCacheHeader *)map;
+    *table = (const unsigned short *)( header + 1 );
+    if ( check_header( header, serial, productID, range ) != AIOUSB_SUCCESS || AIOCalCacheHash( *table ) != header->hash ) {
+        munmap( map, AIOCALCACHE_ENTRY_SIZE );
+        *table = NULL;
+        return -AIOUSB_ERROR_INVALID_DATA;
+    }
+
+    if ( hash )
+        *hash = header->hash;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+void AIOCalCacheUnmap( const unsigned short *table )
+{
+    if ( table )
+        munmap( (void *)( (const AIOCalCacheHeader *)table - 1 ), AIOCALCACHE_ENTRY_SIZE );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Saves table as the entry for serial / productID / range. An entry
+ * already holding the same table is left as it is; otherwise the new one
+ * is written beside it and renamed over it, so readers never see half a
+ * table.
+ */
+AIORET_TYPE AIOCalCacheStore( uint64_t serial, unsigned productID, ADGainCode range, const unsigned short *table )
+{
+    AIOCalCacheHeader header;
+    const unsigned short *old;
+    uint64_t hash;
+    AIORET_TYPE retval;
+    char *path, *tmpname;
+    FILE *fp;
+    int fd;
+
+    if ( !table )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( ( retval = make_directory() ) != AIOUSB_SUCCESS )
+        return retval;
+    if ( !( path = entry_path( serial, productID, range ) ) )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, AIOCALCACHE_MAGIC, sizeof(header.magic) );
+    header.version       = AIOCALCACHE_VERSION;
+    header.product_id    = productID;
+    header.serial_number = serial;
+    header.range         = range;
+    header.num_words     = CAL_TABLE_WORDS;
+    header.hash          = AIOCalCacheHash( table );
+
+    if ( AIOCalCacheMap( serial, productID, range, &old, &hash ) == AIOUSB_SUCCESS ) {
+        AIOCalCacheUnmap( old );
+        if ( hash == header.hash ) {
+            free( path );
+            return AIOUSB_SUCCESS;
+        }
+    }
+
+    tmpname = (char *)malloc( strlen(path) + sizeof(".XXXXXX") );
+    if ( !tmpname ) {
+        free( path );
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+    sprintf( tmpname, "%s.XXXXXX", path );
+
+    retval = -AIOUSB_ERROR_FILE_NOT_FOUND;
+    if ( ( fd = mkstemp( tmpname ) ) >= 0 ) {
+        if ( ( fp = fdopen( fd, "wb" ) ) ) {
+            int ok = ( fwrite( &header, sizeof(header), 1, fp ) == 1 &&
+                       fwrite( table, sizeof(unsigned short), CAL_TABLE_WORDS, fp ) == CAL_TABLE_WORDS );
+            fchmod( fd, 0644 );
+            if ( fclose( fp ) == 0 && ok && rename( tmpname, path ) == 0 )
+                retval = AIOUSB_SUCCESS;
+        } else {
+            close( fd );
+        }
+        if ( retval != AIOUSB_SUCCESS ) {
+            AIOUSB_ERROR("Can't write calibration cache entry %s: %s\n", path, strerror(errno) );
+            remove( tmpname );
+        }
+    }
+
+    free( tmpname );
+    free( path );
+    return retval;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#ifdef SELF_TEST
+
+#include "gtest/gtest.h"
+#include "tap.h"
+#include <iostream>
+using namespace AIOUSB;
+
+class CalCacheSetup : public ::testing::Test
+{
+ protected:
+    virtual void SetUp() {
+        strcpy( dir, "/tmp/aiocalcacheXXXXXX" );
+        ASSERT_TRUE( mkdtemp( dir ) );
+        strcat( dir, "/nested/dir" );
+        AIOCalCacheSetDirectory( dir );
+        table = (unsigned short *)malloc( CAL_TABLE_WORDS * sizeof(unsigned short) );
+        back  = (unsigned short *)malloc( CAL_TABLE_WORDS * sizeof(unsigned short) );
+        for ( int i = 0; i < CAL_TABLE_WORDS; i ++ )
+            table[i] = (unsigned short)( i * 3 + 7 );
+    }
+    virtual void TearDown() {
+        char cmd[64];
+        dir[strlen("/tmp/aiocalcacheXXXXXX")] = '\0';
+        sprintf( cmd, "rm -rf %s", dir );
+        ASSERT_EQ( 0, system( cmd ) );
+        AIOCalCacheSetDirectory( NULL );
+        free( table );
+        free( back );
+    }
+    char *path( ADGainCode range ) {
+        sprintf( name, "%s/%04x-%016llx-%u.cal", dir, 0x8040, 0x1234abcdULL, (unsigned)range );
+        return name;
+    }
+
+    char dir[64], name[128];
+    unsigned short *table, *back;
+};
+
+TEST_F(CalCacheSetup,RoundTripsAndMaps )
+{
+    uint64_t hash = 0;
+    const unsigned short *mapped;
+
+    EXPECT_EQ( -AIOUSB_ERROR_FILE_NOT_FOUND, AIOCalCacheLoad( 0x1234abcd, 0x8040, AD_GAIN_CODE_10V, back, &hash ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCalCacheStore( 0x1234abcd, 0x8040, AD_GAIN_CODE_10V, table ) );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCalCacheLoad( 0x1234abcd, 0x8040, AD_GAIN_CODE_10V, back, &hash ) );
+    EXPECT_EQ( 0, memcmp( table, back, CAL_TABLE_WORDS * sizeof(unsigned short) ) );
+    EXPECT_EQ( AIOCalCacheHash( table ), hash );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCalCacheMap( 0x1234abcd, 0x8040, AD_GAIN_CODE_10V, &mapped, &hash ) );
+    EXPECT_EQ( 0, memcmp( table, mapped, CAL_TABLE_WORDS * sizeof(unsigned short) ) );
+    AIOCalCacheUnmap( mapped );
+
+    EXPECT_EQ( -AIOUSB_ERROR_FILE_NOT_FOUND, AIOCalCacheLoad( 0x1234abcd, 0x8040, AD_GAIN_CODE_5V, back, &hash ) ) << "each range has its own entry";
+    EXPECT_EQ( -AIOUSB_ERROR_FILE_NOT_FOUND, AIOCalCacheLoad( 0x1234abce, 0x8040, AD_GAIN_CODE_10V, back, &hash ) );
+}
+
+TEST_F(CalCacheSetup,UnchangedTableIsNotRewritten )
+{
+    struct stat before, after;
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCalCacheStore( 0x1234abcd, 0x8040, AD_GAIN_CODE_10V, table ) );
+    ASSERT_EQ( 0, stat( path( AD_GAIN_CODE_10V ), &before ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCalCacheStore( 0x1234abcd, 0x8040, AD_GAIN_CODE_10V, table ) );
+    ASSERT_EQ( 0, stat( path( AD_GAIN_CODE_10V ), &after ) );
+    EXPECT_EQ( before.st_ino, after.st_ino );
+
+    table[100] ^= 1;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCalCacheStore( 0x1234abcd, 0x8040, AD_GAIN_CODE_10V, table ) );
+    ASSERT_EQ( 0, stat( path( AD_GAIN_CODE_10V ), &after ) );
+    EXPECT_NE( before.st_ino, after.st_ino );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCalCacheLoad( 0x1234abcd, 0x8040, AD_GAIN_CODE_10V, back, NULL ) );
+    EXPECT_EQ( table[100], back[100] );
+}
+
+TEST_F(CalCacheSetup,RejectsDamagedEntries )
+{
+    const unsigned short *mapped = table;
+    unsigned short word = 0xdead;
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCalCacheStore( 0x1234abcd, 0x8040, AD_GAIN_CODE_10V, table ) );
+    FILE *fp = fopen( path( AD_GAIN_CODE_10V ), "r+b" );
+    ASSERT_TRUE( fp );
+    fseek( fp, sizeof(AIOCalCacheHeader) + 5000 * sizeof(unsigned short), SEEK_SET );
+    fwrite( &word, sizeof(word), 1, fp );
+    fclose( fp );
+
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_DATA, AIOCalCacheLoad( 0x1234abcd, 0x8040, AD_GAIN_CODE_10V, back, NULL ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_DATA, AIOCalCacheMap( 0x1234abcd, 0x8040, AD_GAIN_CODE_10V, &mapped, NULL ) );
+    EXPECT_EQ( NULL, mapped );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCalCacheStore( 0x1234abcd, 0x8040, AD_GAIN_CODE_10V, table ) ) << "a damaged entry is replaced";
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOCalCacheLoad( 0x1234abcd, 0x8040, AD_GAIN_CODE_10V, back, NULL ) );
+}
+
+int main(int argc, char *argv[] )
+{
+  testing::InitGoogleTest(&argc, argv);
+  testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+  delete listeners.Release(listeners.default_result_printer());
+#endif
+
+  listeners.Append( new tap::TapListener() );
+  return RUN_ALL_TESTS();
+}
+
+#endif
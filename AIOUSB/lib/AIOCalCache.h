@@ -0,0 +1,56 @@
+/**
+ * @file   AIOCalCache.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  On-disk cache of ADC calibration tables, one file per device
+ *         serial number, product ID and range
+ *
+ * File layout, all integers in host ( little endian ) byte order:
+ *
+ *   offset 0            AIOCalCacheHeader
+ *   sizeof(header)      num_words calibration words
+ *
+ * The header carries a hash of the words, so a damaged or stale entry is
+ * never used and storing an unchanged table leaves the file alone.
+ */
+
+#ifndef _AIO_CAL_CACHE_H
+#define _AIO_CAL_CACHE_H
+
+#include "AIOTypes.h"
+#include <stdint.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIOCALCACHE_MAGIC       "AIOUSBC1"
+#define AIOCALCACHE_VERSION     1
+#define AIOCALCACHE_ENV         "AIOUSB_CAL_CACHE"   /**< Overrides the default directory */
+
+typedef struct aio_cal_cache_header {
+    char     magic[8];          /**< AIOCALCACHE_MAGIC, not NUL terminated */
+    uint32_t version;           /**< AIOCALCACHE_VERSION */
+    uint32_t product_id;
+    uint64_t serial_number;
+    uint32_t range;             /**< ADGainCode the table was made for */
+    uint32_t num_words;         /**< CAL_TABLE_WORDS */
+    uint64_t hash;              /**< AIOCalCacheHash of the words */
+} AIOCalCacheHeader;
+
+PUBLIC_EXTERN AIORET_TYPE AIOCalCacheSetDirectory( const char *dir );
+PUBLIC_EXTERN char *AIOCalCacheGetDirectory( void );
+PUBLIC_EXTERN uint64_t AIOCalCacheHash( const unsigned short *table );
+
+PUBLIC_EXTERN AIORET_TYPE AIOCalCacheStore( uint64_t serial, unsigned productID, ADGainCode range, const unsigned short *table );
+PUBLIC_EXTERN AIORET_TYPE AIOCalCacheLoad( uint64_t serial, unsigned productID, ADGainCode range, unsigned short *table, uint64_t *hash );
+PUBLIC_EXTERN AIORET_TYPE AIOCalCacheMap( uint64_t serial, unsigned productID, ADGainCode range, const unsigned short **table, uint64_t *hash );
+PUBLIC_EXTERN void AIOCalCacheUnmap( const unsigned short *table );
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
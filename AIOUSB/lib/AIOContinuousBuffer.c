@@ -23,6 +23,15 @@
 #include "AIODeviceTable.h"
 #include "AIOFifo.h"
 #include "AIOCountsConverter.h"
+#include "AIOScanClock.h"
+#include "AIOTransferQueue.h"
+#include "AIOUSB_CTR.h"
+#include <fcntl.h>
+#include <errno.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #ifdef __cplusplus
 namespace AIOUSB {
@@ -30,6 +39,38 @@ namespace AIOUSB {
 
 void *ConvertCountsToVoltsFunction( void *object );
 void *RawCountsWorkFunction( void *object );
+static void aiocontbuf_notify( AIOContinuousBuf *buf );
+static unsigned aiocontbuf_scan_counts( AIOContinuousBuf *buf );
+
+#define AIOCONTBUF_LOAD(p)          __atomic_load_n( (p), __ATOMIC_ACQUIRE )
+#define AIOCONTBUF_STORE(p,v)       __atomic_store_n( (p), (v), __ATOMIC_RELEASE )
+#define AIOCONTBUF_ADD(p,v)         __atomic_add_fetch( (p), (v), __ATOMIC_ACQ_REL )
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Publishes the size the sizer settled on. Completions resize on
+ * whatever thread pumps libusb, so AIOContinuousBufGetTransferSize reads
+ * this rather than the sizer.
+ */
+static void aiocontbuf_publish_size( AIOContinuousBuf *buf )
+{
+    AIOCONTBUF_STORE( &buf->transfer_size, (unsigned)AIOBulkSizerGetSize( &buf->sizer ) );
+}
+
+/*----------------------------------------------------------------------------*/
+#ifdef HAS_PTHREAD
+/**
+ * @brief ready_cond times its waits against CLOCK_MONOTONIC
+ */
+static void aiocontbuf_init_ready_cond( AIOContinuousBuf *buf )
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &buf->ready_cond, &attr );
+    pthread_condattr_destroy( &attr );
+}
+#endif
 
 /*-----------------------------  Constructors  -----------------------------*/
 AIOContinuousBuf *NewAIOContinuousBufForCounts( unsigned long DeviceIndex, unsigned scancounts, unsigned num_channels )
@@ -54,6 +95,25 @@ AIOContinuousBuf *NewAIOContinuousBufForCounts( unsigned long DeviceIndex, unsig
     return tmp;
 }
 
+/**
+ * @brief Volts without converting on the acquisition thread. The ring keeps
+ * the 16 bit counts, oversamples included, and AIOContinuousBufReadScanVolts
+ * converts them with the gain ranges captured when the acquisition starts.
+ * The device's oversample setting must match num_oversamples.
+ */
+AIOContinuousBuf *NewAIOContinuousBufForLazyVolts( unsigned long DeviceIndex, unsigned scancounts, unsigned num_channels, unsigned num_oversamples )
+{
+    assert( num_channels > 0 );
+
+    AIOContinuousBuf *tmp = NewAIOContinuousBufRawSmart( DeviceIndex, num_channels, scancounts, sizeof(unsigned short), num_oversamples );
+    DeleteAIOFifoCounts( tmp->fifo );
+    tmp->fifo       = NewAIOFifoCounts( num_channels * (num_oversamples+1) * scancounts );
+    tmp->lazy_volts = AIOUSB_TRUE;
+    tmp->PushN = AIOContinuousBufPushN;
+    tmp->PopN  = AIOContinuousBufPopN;
+    return tmp;
+}
+
 AIOContinuousBuf *NewAIOContinuousBufRawSmart( unsigned long DeviceIndex, 
                                                unsigned num_channels,
                                                unsigned num_scans,
@@ -101,8 +161,37 @@ AIOContinuousBuf *NewAIOContinuousBufRawSmart( unsigned long DeviceIndex,
     tmp->extra        = 0;
     tmp->tmpbuf       = NULL;
     tmp->tmpbufsize   = 0;
+    tmp->num_transfers = 0;
+    tmp->transfers    = NULL;
+    tmp->notify_fd[0] = tmp->notify_fd[1] = -1;
+    tmp->notify_watermark = 1;
+    tmp->notify_signaled = AIOUSB_FALSE;
+    tmp->endless      = AIOUSB_FALSE;
+    tmp->overrun_policy = AIOCONTINUOUS_BUF_DROP_NEWEST;
+    tmp->overruns     = 0;
+    tmp->dropped_scans = 0;
+    tmp->acquired_scans = 0;
+    tmp->carry        = NULL;
+    tmp->carry_counts = 0;
+    tmp->lazy_volts   = AIOUSB_FALSE;
+    tmp->converter    = NULL;
+    tmp->volts_counts = NULL;
+    tmp->straddle     = NULL;
+    tmp->straddle_size = 0;
+    tmp->scan_clock   = NULL;
+    tmp->divisora     = 0;
+    tmp->divisorb     = 0;
+    tmp->latch_counters = AIOUSB_FALSE;
+    tmp->read_counts  = 0;
+    tmp->reading      = AIOUSB_FALSE;
+    tmp->transfer_preference = AIO_TRANSFERS_BALANCED;
+    tmp->latency_ms   = 0;
+    AIOBulkSizerInit( &tmp->sizer, AIO_TRANSFERS_FIXED, 0, 0, tmp->usbbuf_size );
+    aiocontbuf_publish_size( tmp );
 #ifdef HAS_PTHREAD
     tmp->lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;   /* Threading mutex Setup */
+    tmp->notify_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+    aiocontbuf_init_ready_cond( tmp );
 #endif
     AIOContinuousBufSetCallback( tmp , RawCountsWorkFunction );
    
@@ -160,8 +249,37 @@ AIOContinuousBuf *NewAIOContinuousBufWithoutConfig( unsigned long DeviceIndex,
     tmp->extra        = 0;
     tmp->tmpbuf       = NULL;
     tmp->tmpbufsize   = 0;
+    tmp->num_transfers = 0;
+    tmp->transfers    = NULL;
+    tmp->notify_fd[0] = tmp->notify_fd[1] = -1;
+    tmp->notify_watermark = 1;
+    tmp->notify_signaled = AIOUSB_FALSE;
+    tmp->endless      = AIOUSB_FALSE;
+    tmp->overrun_policy = AIOCONTINUOUS_BUF_DROP_NEWEST;
+    tmp->overruns     = 0;
+    tmp->dropped_scans = 0;
+    tmp->acquired_scans = 0;
+    tmp->carry        = NULL;
+    tmp->carry_counts = 0;
+    tmp->lazy_volts   = AIOUSB_FALSE;
+    tmp->converter    = NULL;
+    tmp->volts_counts = NULL;
+    tmp->straddle     = NULL;
+    tmp->straddle_size = 0;
+    tmp->scan_clock   = NULL;
+    tmp->divisora     = 0;
+    tmp->divisorb     = 0;
+    tmp->latch_counters = AIOUSB_FALSE;
+    tmp->read_counts  = 0;
+    tmp->reading      = AIOUSB_FALSE;
+    tmp->transfer_preference = AIO_TRANSFERS_BALANCED;
+    tmp->latency_ms   = 0;
+    AIOBulkSizerInit( &tmp->sizer, AIO_TRANSFERS_FIXED, 0, 0, tmp->usbbuf_size );
+    aiocontbuf_publish_size( tmp );
 #ifdef HAS_PTHREAD
     tmp->lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;   /* Threading mutex Setup */
+    tmp->notify_lock = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+    aiocontbuf_init_ready_cond( tmp );
 #endif
     AIOContinuousBufSetCallback( tmp , ConvertCountsToVoltsFunction );
 
@@ -177,13 +295,22 @@ AIORET_TYPE AIOContinuousBuf_InitConfiguration(  AIOContinuousBuf *buf )
 /*----------------------------------------------------------------------------*/
 AIORET_TYPE AIOContinuousBufPushN(AIOContinuousBuf *buf ,unsigned short *frombuf, unsigned int N )
 {
-    return buf->fifo->PushN( buf->fifo, frombuf, N );
+    AIORET_TYPE retval = buf->fifo->PushN( buf->fifo, frombuf, N );
+    aiocontbuf_notify( buf );
+    return retval;
 }
 
 /*----------------------------------------------------------------------------*/
 AIORET_TYPE AIOContinuousBufPopN(AIOContinuousBuf *buf , unsigned short *frombuf, unsigned int N )
 {
-    return buf->fifo->PopN( buf->fifo, frombuf, N );
+    AIORET_TYPE retval;
+    AIOContinuousBufLock( buf );
+    retval = buf->fifo->PopN( buf->fifo, frombuf, N );
+    if ( retval > 0 )
+        buf->read_counts += retval / buf->fifo->refsize;
+    AIOContinuousBufUnlock( buf );
+    aiocontbuf_notify( buf );
+    return retval;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -243,10 +370,8 @@ AIORET_TYPE AIOContinuousBufInitConfiguration(  AIOContinuousBuf *buf )
 
     AIORESULT result = AIOUSB_SUCCESS;
     AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex(buf), &result );
-    if ( result != AIOUSB_SUCCESS ) {
-        AIOUSB_UnLock();
+    if ( result != AIOUSB_SUCCESS )
         return -result;
-    }
 
     ADCConfigBlockInitForCounterScan( &config, deviceDesc );
     /* ADCConfigBlockInit( &config, deviceDesc, deviceDesc->ConfigBytes  ); */
@@ -343,10 +468,27 @@ void AIOContinuousBuf_DeleteTmpBuf( AIOContinuousBuf *buf )
  */
 void DeleteAIOContinuousBuf( AIOContinuousBuf *buf )
 {
+    AIOContinuousBufStopTransfers( buf );
     DeleteAIOChannelMask( buf->mask );
     AIOContinuousBuf_DeleteTmpBuf( buf );
     free( buf->buffer );
     DeleteAIOFifoCounts( buf->fifo );
+    free( buf->carry );
+    if ( buf->converter ) {
+        DeleteAIOGainRange( buf->converter->gain_ranges );
+        DeleteAIOCountsConverter( buf->converter );
+    }
+    if ( buf->volts_counts )
+        DeleteAIOFifoCounts( buf->volts_counts );
+    free( buf->straddle );
+    DeleteAIOScanClock( buf->scan_clock );
+    if ( buf->notify_fd[0] >= 0 ) {
+        close( buf->notify_fd[0] );
+        close( buf->notify_fd[1] );
+    }
+#ifdef HAS_PTHREAD
+    pthread_cond_destroy( &buf->ready_cond );
+#endif
     free( buf );
 }
 
@@ -450,8 +592,11 @@ AIORET_TYPE AIOContinuousBufReset( AIOContinuousBuf *buf )
     AIOContinuousBufLock( buf );
 
     buf->fifo->Reset( (AIOFifo*)buf->fifo );
+    if ( buf->scan_clock )
+        buf->read_counts = (unsigned long long)AIOScanClockGetKept( buf->scan_clock ) * aiocontbuf_scan_counts(buf);
 
     AIOContinuousBufUnlock( buf );
+    aiocontbuf_notify( buf );
     return AIOUSB_SUCCESS;
 }
 
@@ -536,10 +681,591 @@ AIORET_TYPE AIOContinuousBufCountScansAvailable(AIOContinuousBuf *buf)
 {
     AIORET_TYPE retval = AIOUSB_SUCCESS;
 
-    retval = (AIORET_TYPE)buf->fifo->rdelta( (AIOFifo*)buf->fifo ) / ( buf->fifo->refsize * AIOContinuousBufNumberChannels(buf) );
+    retval = (AIORET_TYPE)buf->fifo->rdelta( (AIOFifo*)buf->fifo ) / ( buf->fifo->refsize * aiocontbuf_scan_counts(buf) );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Fifo entries making up one scan: a value per channel, or for lazy
+ * volts a count per channel and oversample
+ */
+static unsigned aiocontbuf_scan_counts( AIOContinuousBuf *buf )
+{
+    return AIOContinuousBufNumberChannels(buf) * ( buf->lazy_volts ? buf->num_oversamples + 1 : 1 );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Bytes one scan takes up in the buffer, the unit
+ *        AIOContinuousBufAcquireScans hands out
+ */
+AIORET_TYPE AIOContinuousBufGetScanSize( AIOContinuousBuf *buf )
+{
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return (AIORET_TYPE)( buf->fifo->refsize * aiocontbuf_scan_counts(buf) );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Makes notify_fd readable when at least notify_watermark scans are
+ * waiting or the acquisition has ended, and drains it otherwise. Run after
+ * anything that adds or removes scans or changes the status.
+ */
+static void aiocontbuf_notify( AIOContinuousBuf *buf )
+{
+    AIOUSB_BOOL ready;
+    char byte = 0;
+
+    if ( buf->notify_fd[0] < 0 )
+        return;
+#ifdef HAS_PTHREAD
+    pthread_mutex_lock( &buf->notify_lock );
+#endif
+    ready = ( buf->status == TERMINATED || buf->status == JOINED ||
+              AIOContinuousBufCountScansAvailable( buf ) >= (AIORET_TYPE)buf->notify_watermark );
+    if ( ready && !buf->notify_signaled ) {
+        if ( write( buf->notify_fd[1], &byte, 1 ) == 1 )
+            buf->notify_signaled = AIOUSB_TRUE;
+    } else if ( !ready && buf->notify_signaled ) {
+        if ( read( buf->notify_fd[0], &byte, 1 ) == 1 )
+            buf->notify_signaled = AIOUSB_FALSE;
+    }
+#ifdef HAS_PTHREAD
+    pthread_mutex_unlock( &buf->notify_lock );
+#endif
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief File descriptor for select / poll / epoll that is readable while
+ * at least the notify watermark ( AIOContinuousBufSetNotifyWatermark, one
+ * scan by default ) of scans is waiting in the buffer, or once the
+ * acquisition has ended. Never read from it; taking scans out of the
+ * buffer takes care of that. It stays valid until the buffer is deleted.
+ * @return the descriptor, or negative error code
+ */
+AIORET_TYPE AIOContinuousBufGetPollFd( AIOContinuousBuf *buf )
+{
+    AIORET_TYPE retval;
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+#ifdef HAS_PTHREAD
+    pthread_mutex_lock( &buf->notify_lock );
+#endif
+    if ( buf->notify_fd[0] < 0 ) {
+        int fds[2];
+        if ( pipe( fds ) != 0 ) {
+            AIOUSB_ERROR("Unable to create notification pipe\n");
+            retval = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+            goto out_AIOContinuousBufGetPollFd;
+        }
+        for ( int i = 0; i < 2; i ++ ) {
+            fcntl( fds[i], F_SETFL, fcntl( fds[i], F_GETFL ) | O_NONBLOCK );
+            fcntl( fds[i], F_SETFD, FD_CLOEXEC );
+        }
+        buf->notify_signaled = AIOUSB_FALSE;
+        buf->notify_fd[1] = fds[1];
+        buf->notify_fd[0] = fds[0];
+    }
+    retval = buf->notify_fd[0];
+
+ out_AIOContinuousBufGetPollFd:
+#ifdef HAS_PTHREAD
+    pthread_mutex_unlock( &buf->notify_lock );
+#endif
+    if ( retval >= 0 )
+        aiocontbuf_notify( buf ); /* scans may already be waiting */
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets how many scans must be waiting before the poll descriptor
+ * becomes readable
+ */
+AIORET_TYPE AIOContinuousBufSetNotifyWatermark( AIOContinuousBuf *buf, unsigned num_scans )
+{
+    if ( !buf || num_scans == 0 )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    buf->notify_watermark = num_scans;
+    aiocontbuf_notify( buf );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOContinuousBufGetNotifyWatermark( AIOContinuousBuf *buf )
+{
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return buf->notify_watermark;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief In endless mode the raw counts worker keeps streaming, wrapping the
+ * ring, until AIOContinuousBufEnd, instead of stopping once it has filled
+ * the buffer. What happens when the reader falls behind is set with
+ * AIOContinuousBufSetOverrunPolicy.
+ */
+AIORET_TYPE AIOContinuousBufSetEndless( AIOContinuousBuf *buf, AIOUSB_BOOL endless )
+{
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( buf->status == RUNNING )
+        return -AIOUSB_ERROR_INVALID_DEVICE_SETTING;
+    buf->endless = ( endless ? AIOUSB_TRUE : AIOUSB_FALSE );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOContinuousBufGetEndless( AIOContinuousBuf *buf )
+{
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return buf->endless;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Chooses what the worker does with scans that do not fit because
+ * the reader has fallen behind: drop them ( the default ), drop the oldest
+ * unread scans to make room, or stop reading the device until there is
+ * room. Scans held by AIOContinuousBufAcquireScans are never overwritten;
+ * until they are committed new scans are dropped instead. Can be changed
+ * while running.
+ */
+AIORET_TYPE AIOContinuousBufSetOverrunPolicy( AIOContinuousBuf *buf, AIOContinuousBufOverrunPolicy policy )
+{
+    if ( !buf || !VALID_ENUM( AIOContinuousBufOverrunPolicy, policy ) )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    buf->overrun_policy = policy;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOContinuousBufGetOverrunPolicy( AIOContinuousBuf *buf )
+{
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return buf->overrun_policy;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Number of transfers since the start that found the ring full
+ */
+AIORET_TYPE AIOContinuousBufGetOverruns( AIOContinuousBuf *buf )
+{
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return (AIORET_TYPE)buf->overruns;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Number of scans since the start lost to overruns, new or old
+ * depending on the policy. Always 0 with AIOCONTINUOUS_BUF_BLOCK unless
+ * the acquisition is ended while the worker waits for room.
+ */
+AIORET_TYPE AIOContinuousBufGetDroppedScans( AIOContinuousBuf *buf )
+{
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return (AIORET_TYPE)buf->dropped_scans;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Zero copy read. Points region at up to max_scans whole scans sitting
+ * in the buffer ( two pieces when the ring wraps, and a scan may straddle the
+ * two ) without removing them. Call AIOContinuousBufCommitScans when done.
+ * @return number of scans described by region
+ */
+AIORET_TYPE AIOContinuousBufAcquireScans( AIOContinuousBuf *buf, AIOFifoRegion *region, unsigned max_scans )
+{
+    AIORET_TYPE retval;
+    if ( !buf || !region )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    unsigned scansize = buf->fifo->refsize * aiocontbuf_scan_counts(buf);
+
+    /* locked so an overwriting worker sees which scans are held */
+    AIOContinuousBufLock( buf );
+    unsigned num_scans = MIN( max_scans, (unsigned)AIOContinuousBufCountScansAvailable( buf ) );
+    retval = AIOFifoReadAcquire( (AIOFifo*)buf->fifo, region, num_scans * scansize );
+    if ( retval >= 0 )
+        buf->acquired_scans = retval / scansize;
+    AIOContinuousBufUnlock( buf );
+    if ( retval < 0 )
+        return retval;
+
+    return retval / scansize;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Hands num_scans scans obtained with AIOContinuousBufAcquireScans back
+ * to the acquisition thread
+ */
+AIORET_TYPE AIOContinuousBufCommitScans( AIOContinuousBuf *buf, unsigned num_scans )
+{
+    AIORET_TYPE retval;
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    AIOContinuousBufLock( buf );
+    retval = AIOFifoReadCommit( (AIOFifo*)buf->fifo, num_scans * buf->fifo->refsize * aiocontbuf_scan_counts(buf) );
+    if ( retval > 0 )
+        buf->read_counts += retval / buf->fifo->refsize;
+    buf->acquired_scans -= MIN( buf->acquired_scans, num_scans );
+    AIOContinuousBufUnlock( buf );
+    aiocontbuf_notify( buf );
+
+    return ( retval < 0 ? retval : (AIORET_TYPE)num_scans );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Hands num_scans interleaved scans starting at scans to a reader,
+ * which puts them in out as scans first .. first+num_scans-1
+ */
+typedef void (*aiocontbuf_scans_fn)( AIOContinuousBuf *buf, const void *scans, unsigned num_scans, unsigned first, void *out );
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes up to max_scans scans straight out of the ring through fn,
+ * in at most three pieces: the scans before the end of the ring, one scan
+ * straddling it ( copied to buf->straddle ) and the scans after it. When
+ * ns is given it gets each scan's time.
+ * @return number of scans read
+ */
+static AIORET_TYPE aiocontbuf_read_scans( AIOContinuousBuf *buf, unsigned max_scans, aiocontbuf_scans_fn fn, void *out, uint64_t *ns )
+{
+    AIOFifoRegion region;
+    AIORET_TYPE retval;
+    unsigned scan_bytes = buf->fifo->refsize * aiocontbuf_scan_counts(buf);
+    unsigned num_scans, head, split, done;
+    unsigned char *tail;
+
+    if ( buf->straddle_size < scan_bytes ) {
+        unsigned short *tmp = (unsigned short *)realloc( buf->straddle, scan_bytes );
+        if ( !tmp )
+            return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        buf->straddle      = tmp;
+        buf->straddle_size = scan_bytes;
+    }
+
+    retval = AIOContinuousBufAcquireScans( buf, &region, max_scans );
+    if ( retval <= 0 )
+        return retval;
+
+    num_scans = (unsigned)retval;
+    if ( ns )
+        AIOScanClockTimes( buf->scan_clock, buf->read_counts / aiocontbuf_scan_counts(buf), num_scans, ns );
+    head      = MIN( num_scans, region.size[0] / scan_bytes );
+    if ( head )
+        fn( buf, region.data[0], head, 0, out );
+    done = head;
+
+    if ( done < num_scans ) {
+        tail  = (unsigned char *)region.data[1];
+        split = region.size[0] - head * scan_bytes;
+        if ( split ) {
+            memcpy( buf->straddle, (unsigned char *)region.data[0] + head * scan_bytes, split );
+            memcpy( (unsigned char *)buf->straddle + split, tail, scan_bytes - split );
+            fn( buf, buf->straddle, 1, done, out );
+            tail += scan_bytes - split;
+            done ++;
+        }
+        if ( done < num_scans )
+            fn( buf, tail, num_scans - done, done, out );
+    }
+
+    return AIOContinuousBufCommitScans( buf, num_scans );
+}
+
+/*----------------------------------------------------------------------------*/
+static void aiocontbuf_scans_to_volts( AIOContinuousBuf *buf, const void *scans, unsigned num_scans, unsigned first, void *out )
+{
+    AIOCountsConverterConvertScans( buf->converter, (const uint16_t *)scans, num_scans, (double *)out + first * buf->converter->num_channels );
+}
+
+static void aiocontbuf_scans_to_fvolts( AIOContinuousBuf *buf, const void *scans, unsigned num_scans, unsigned first, void *out )
+{
+    AIOCountsConverterConvertScansFloat( buf->converter, (const uint16_t *)scans, num_scans, (float *)out + first * buf->converter->num_channels );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Reads up to max_scans scans from a buffer made with
+ * NewAIOContinuousBufForLazyVolts, converting them to volts on the
+ * caller's thread. volts needs room for max_scans * channels values.
+ * @return number of scans read
+ */
+AIORET_TYPE AIOContinuousBufReadScanVolts( AIOContinuousBuf *buf, double *volts, unsigned max_scans )
+{
+    if ( !buf || !volts )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( !buf->lazy_volts || !buf->converter )
+        return -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER;
+    return aiocontbuf_read_scans( buf, max_scans, aiocontbuf_scans_to_volts, volts, NULL );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief AIOContinuousBufReadScanVolts into single precision volts
+ */
+AIORET_TYPE AIOContinuousBufReadScanVoltsFloat( AIOContinuousBuf *buf, float *volts, unsigned max_scans )
+{
+    if ( !buf || !volts )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( !buf->lazy_volts || !buf->converter )
+        return -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER;
+    return aiocontbuf_read_scans( buf, max_scans, aiocontbuf_scans_to_fvolts, volts, NULL );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Deinterleaving kernels, scans of num_channels values in, one array
+ * per channel out. The plain ones walk AIOCONTBUF_TRANSPOSE_SCANS scans
+ * at a time so the block being read stays in cache while every channel
+ * is written; the SSE2 ones transpose 8 scans at a time in registers and
+ * return how many scans they did, leaving the rest to the plain ones.
+ */
+#define AIOCONTBUF_TRANSPOSE_SCANS 256
+
+static void deinterleave_counts_scalar( const uint16_t *scans, unsigned num_channels, unsigned num_scans, uint16_t **channels, unsigned first )
+{
+    for ( unsigned block = 0; block < num_scans; block += AIOCONTBUF_TRANSPOSE_SCANS ) {
+        unsigned n = MIN( AIOCONTBUF_TRANSPOSE_SCANS, num_scans - block );
+        for ( unsigned ch = 0; ch < num_channels; ch ++ ) {
+            const uint16_t *in = scans + block * num_channels + ch;
+            uint16_t *out      = channels[ch] + first + block;
+            for ( unsigned i = 0; i < n; i ++ )
+                out[i] = in[i*num_channels];
+        }
+    }
+}
+
+static void deinterleave_volts_scalar( const double *scans, unsigned num_channels, unsigned num_scans, double **channels, unsigned first )
+{
+    for ( unsigned block = 0; block < num_scans; block += AIOCONTBUF_TRANSPOSE_SCANS ) {
+        unsigned n = MIN( AIOCONTBUF_TRANSPOSE_SCANS, num_scans - block );
+        for ( unsigned ch = 0; ch < num_channels; ch ++ ) {
+            const double *in = scans + block * num_channels + ch;
+            double *out      = channels[ch] + first + block;
+            for ( unsigned i = 0; i < n; i ++ )
+                out[i] = in[i*num_channels];
+        }
+    }
+}
+
+#ifdef __SSE2__
+/* 4 channels: 8 scans are 4 registers of 2 scans each */
+static unsigned deinterleave_counts4_sse2( const uint16_t *scans, unsigned num_scans, uint16_t **channels, unsigned first )
+{
+    unsigned scan = 0;
+    for ( ; scan + 8 <= num_scans; scan += 8, scans += 32 ) {
+        __m128i r0 = _mm_loadu_si128( (const __m128i *)&scans[0] );
+        __m128i r1 = _mm_loadu_si128( (const __m128i *)&scans[8] );
+        __m128i r2 = _mm_loadu_si128( (const __m128i *)&scans[16] );
+        __m128i r3 = _mm_loadu_si128( (const __m128i *)&scans[24] );
+        __m128i t0 = _mm_unpacklo_epi16( r0, r1 ), t1 = _mm_unpackhi_epi16( r0, r1 );
+        __m128i t2 = _mm_unpacklo_epi16( r2, r3 ), t3 = _mm_unpackhi_epi16( r2, r3 );
+        __m128i u0 = _mm_unpacklo_epi16( t0, t1 ), u1 = _mm_unpackhi_epi16( t0, t1 );
+        __m128i u2 = _mm_unpacklo_epi16( t2, t3 ), u3 = _mm_unpackhi_epi16( t2, t3 );
+        _mm_storeu_si128( (__m128i *)&channels[0][first+scan], _mm_unpacklo_epi64( u0, u2 ) );
+        _mm_storeu_si128( (__m128i *)&channels[1][first+scan], _mm_unpackhi_epi64( u0, u2 ) );
+        _mm_storeu_si128( (__m128i *)&channels[2][first+scan], _mm_unpacklo_epi64( u1, u3 ) );
+        _mm_storeu_si128( (__m128i *)&channels[3][first+scan], _mm_unpackhi_epi64( u1, u3 ) );
+    }
+    return scan;
+}
+
+/* multiples of 8 channels: an 8x8 transpose for each group of 8 channels */
+static unsigned deinterleave_counts8n_sse2( const uint16_t *scans, unsigned num_channels, unsigned num_scans, uint16_t **channels, unsigned first )
+{
+    unsigned scan = 0;
+    for ( ; scan + 8 <= num_scans; scan += 8 ) {
+        for ( unsigned group = 0; group < num_channels; group += 8 ) {
+            const uint16_t *in = scans + scan * num_channels + group;
+            __m128i a[8], b[8];
+            for ( int i = 0; i < 8; i ++ )
+                a[i] = _mm_loadu_si128( (const __m128i *)&in[i*num_channels] );
+            for ( int i = 0; i < 8; i += 2 ) {
+                b[i]   = _mm_unpacklo_epi16( a[i], a[i+1] );
+                b[i+1] = _mm_unpackhi_epi16( a[i], a[i+1] );
+            }
+            a[0] = _mm_unpacklo_epi32( b[0], b[2] ); a[1] = _mm_unpackhi_epi32( b[0], b[2] );
+            a[2] = _mm_unpacklo_epi32( b[1], b[3] ); a[3] = _mm_unpackhi_epi32( b[1], b[3] );
+            a[4] = _mm_unpacklo_epi32( b[4], b[6] ); a[5] = _mm_unpackhi_epi32( b[4], b[6] );
+            a[6] = _mm_unpacklo_epi32( b[5], b[7] ); a[7] = _mm_unpackhi_epi32( b[5], b[7] );
+            for ( int i = 0; i < 4; i ++ ) {
+                _mm_storeu_si128( (__m128i *)&channels[group+2*i][first+scan],   _mm_unpacklo_epi64( a[i], a[i+4] ) );
+                _mm_storeu_si128( (__m128i *)&channels[group+2*i+1][first+scan], _mm_unpackhi_epi64( a[i], a[i+4] ) );
+            }
+        }
+    }
+    return scan;
+}
+#endif
+
+/*----------------------------------------------------------------------------*/
+static void aiocontbuf_scans_to_count_channels( AIOContinuousBuf *buf, const void *scans, unsigned num_scans, unsigned first, void *out )
+{
+    unsigned num_channels = AIOContinuousBufNumberChannels(buf);
+    unsigned done = 0;
+#ifdef __SSE2__
+    if ( num_channels == 4 )
+        done = deinterleave_counts4_sse2( (const uint16_t *)scans, num_scans, (uint16_t **)out, first );
+    else if ( num_channels % 8 == 0 )
+        done = deinterleave_counts8n_sse2( (const uint16_t *)scans, num_channels, num_scans, (uint16_t **)out, first );
+#endif
+    deinterleave_counts_scalar( (const uint16_t *)scans + done * num_channels, num_channels, num_scans - done, (uint16_t **)out, first + done );
+}
+
+static void aiocontbuf_scans_to_volt_channels( AIOContinuousBuf *buf, const void *scans, unsigned num_scans, unsigned first, void *out )
+{
+    if ( buf->lazy_volts )
+        AIOCountsConverterConvertScansToChannels( buf->converter, (const uint16_t *)scans, num_scans, (double **)out, first );
+    else
+        deinterleave_volts_scalar( (const double *)scans, AIOContinuousBufNumberChannels(buf), num_scans, (double **)out, first );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Reads up to max_scans scans of a counts buffer with each channel's
+ * counts going to its own array, channels[ch][0 .. scans-1], instead of
+ * interleaved
+ * @param channels One array of at least max_scans counts per channel
+ * @return number of scans read
+ */
+AIORET_TYPE AIOContinuousBufReadChannelCounts( AIOContinuousBuf *buf, unsigned short **channels, unsigned max_scans )
+{
+    if ( !buf || !channels )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( buf->lazy_volts || buf->fifo->refsize != sizeof(unsigned short) )
+        return -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER;
+    return aiocontbuf_read_scans( buf, max_scans, aiocontbuf_scans_to_count_channels, channels, NULL );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief AIOContinuousBufReadChannelCounts for volts buffers, lazy or not.
+ * Lazy scans are converted straight into the channel arrays.
+ */
+AIORET_TYPE AIOContinuousBufReadChannelVolts( AIOContinuousBuf *buf, double **channels, unsigned max_scans )
+{
+    if ( !buf || !channels )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( buf->lazy_volts ? !buf->converter : buf->fifo->refsize != sizeof(double) )
+        return -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER;
+    return aiocontbuf_read_scans( buf, max_scans, aiocontbuf_scans_to_volt_channels, channels, NULL );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Keeps the time of every scan for AIOContinuousBufGetScanTimestamps
+ * and the timestamped reads. Each transfer is stamped with
+ * CLOCK_MONOTONIC_RAW as it completes and scans are placed between the
+ * stamps by the clock the counters were loaded with. With latch_counters,
+ * boards with 8254 counters also have them latched a few times a second,
+ * which pins the times to within a counter tick rather than the USB
+ * latency. Not while running.
+ */
+AIORET_TYPE AIOContinuousBufSetTimestamps( AIOContinuousBuf *buf, AIOUSB_BOOL timestamps, AIOUSB_BOOL latch_counters )
+{
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( buf->status == RUNNING )
+        return -AIOUSB_ERROR_INVALID_DEVICE_SETTING;
+
+    if ( timestamps && !buf->scan_clock ) {
+        buf->scan_clock = NewAIOScanClock();
+        if ( !buf->scan_clock )
+            return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    } else if ( !timestamps && buf->scan_clock ) {
+        DeleteAIOScanClock( buf->scan_clock );
+        buf->scan_clock = NULL;
+    }
+    buf->latch_counters = ( timestamps && latch_counters ? AIOUSB_TRUE : AIOUSB_FALSE );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOContinuousBufGetTimestamps( AIOContinuousBuf *buf )
+{
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return ( buf->scan_clock ? AIOUSB_TRUE : AIOUSB_FALSE );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Fills ns with the CLOCK_MONOTONIC_RAW times, in ns, of up to
+ * num_scans of the scans waiting to be read, oldest first: the scans the
+ * next read or AIOContinuousBufAcquireScans hands out. Times assume reads
+ * take whole scans.
+ * @return number of times filled
+ */
+AIORET_TYPE AIOContinuousBufGetScanTimestamps( AIOContinuousBuf *buf, uint64_t *ns, unsigned num_scans )
+{
+    AIORET_TYPE retval;
+    if ( !buf || !ns )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( !buf->scan_clock )
+        return -AIOUSB_ERROR_INVALID_DEVICE_SETTING;
+
+    AIOContinuousBufLock( buf );
+    num_scans = MIN( num_scans, (unsigned)AIOContinuousBufCountScansAvailable( buf ) );
+    retval = AIOScanClockTimes( buf->scan_clock, buf->read_counts / aiocontbuf_scan_counts(buf), num_scans, ns );
+    AIOContinuousBufUnlock( buf );
     return retval;
 }
 
+/*----------------------------------------------------------------------------*/
+static void aiocontbuf_scans_to_counts( AIOContinuousBuf *buf, const void *scans, unsigned num_scans, unsigned first, void *out )
+{
+    unsigned scan_counts = aiocontbuf_scan_counts(buf);
+    memcpy( (unsigned short *)out + first * scan_counts, scans, num_scans * scan_counts * sizeof(unsigned short) );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Reads up to max_scans interleaved scans of a counts buffer into
+ * counts, and the time of each into ns
+ * @return number of scans read
+ */
+AIORET_TYPE AIOContinuousBufReadTimestampedScanCounts( AIOContinuousBuf *buf, unsigned short *counts, uint64_t *ns, unsigned max_scans )
+{
+    if ( !buf || !counts || !ns )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( buf->lazy_volts || buf->fifo->refsize != sizeof(unsigned short) )
+        return -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER;
+    if ( !buf->scan_clock )
+        return -AIOUSB_ERROR_INVALID_DEVICE_SETTING;
+    return aiocontbuf_read_scans( buf, max_scans, aiocontbuf_scans_to_counts, counts, ns );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief AIOContinuousBufReadScanVolts with the time of each scan going
+ * into ns
+ */
+AIORET_TYPE AIOContinuousBufReadTimestampedScanVolts( AIOContinuousBuf *buf, double *volts, uint64_t *ns, unsigned max_scans )
+{
+    if ( !buf || !volts || !ns )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( !buf->lazy_volts || !buf->converter )
+        return -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER;
+    if ( !buf->scan_clock )
+        return -AIOUSB_ERROR_INVALID_DEVICE_SETTING;
+    return aiocontbuf_read_scans( buf, max_scans, aiocontbuf_scans_to_volts, volts, ns );
+}
+
 /*----------------------------------------------------------------------------*/
 /**
  * @brief will read in an integer number of scan counts if there is room.
@@ -563,10 +1289,15 @@ AIORET_TYPE AIOContinuousBufReadIntegerScanCounts( AIOContinuousBuf *buf,
         return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
     }
 
+    AIOContinuousBufLock( buf );
     int num_scans = AIOContinuousBufCountScansAvailable( buf );
 
-    retval += buf->fifo->PopN( buf->fifo, read_buf, num_scans*AIOContinuousBufNumberChannels(buf) );
-    retval /= AIOContinuousBufNumberChannels(buf);
+    retval += buf->fifo->PopN( buf->fifo, read_buf, num_scans*aiocontbuf_scan_counts(buf) );
+    if ( retval > 0 )
+        buf->read_counts += retval / buf->fifo->refsize;
+    AIOContinuousBufUnlock( buf );
+    aiocontbuf_notify( buf );
+    retval /= aiocontbuf_scan_counts(buf);
     retval /= buf->fifo->refsize;
 
     return retval;
@@ -646,6 +1377,128 @@ AIORET_TYPE AIOContinuousBufSetClock( AIOContinuousBuf *buf, unsigned int hz )
     return AIOUSB_SUCCESS;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Hands cc the device's host calibration tables for the range each
+ * channel is set to, so a table changed later only applies from the next
+ * start
+ */
+static AIORET_TYPE aiocontbuf_capture_cal( AIOUSBDevice *dev, AIOCountsConverter *cc )
+{
+    const uint16_t *tables[AD_MAX_CHANNELS] = { NULL };
+    ADCConfigBlock *config = AIOUSBDeviceGetADCConfigBlock( dev );
+    AIORET_TYPE retval;
+    AIOUSB_BOOL any = AIOUSB_FALSE;
+
+    if ( cc->num_channels > AD_MAX_CHANNELS )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    AIOUSBDeviceLock( dev );
+    for ( unsigned ch = 0; ch < cc->num_channels; ch ++ ) {
+        AIORET_TYPE code = ADCConfigBlockGetGainCode( config, ch );
+        if ( code >= 0 && code < AD_NUM_GAIN_CODES && dev->hostCalTables[code] ) {
+            tables[ch] = dev->hostCalTables[code];
+            any = AIOUSB_TRUE;
+        }
+    }
+    retval = AIOCountsConverterSetCalTables( cc, any ? tables : NULL );
+    AIOUSBDeviceUnlock( dev );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Snapshots the device's gain ranges into buf->converter, so later
+ * configuration changes don't reinterpret scans already acquired. The
+ * converter and its ranges from the last start are refilled in place
+ * while the channels and oversamples still match.
+ * @param num_scans scans the converter stops after, 0 for no limit
+ */
+static AIORET_TYPE aiocontbuf_capture_ranges( AIOContinuousBuf *buf, unsigned num_oversamples, unsigned num_scans )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex(buf), &result );
+    unsigned num_channels = AIOContinuousBufNumberChannels(buf);
+    AIOCountsConverter *cc = buf->converter;
+    ADCConfigBlock *config;
+
+    if ( result != AIOUSB_SUCCESS )
+        return -(AIORET_TYPE)result;
+    config = AIOUSBDeviceGetADCConfigBlock( dev );
+
+    if ( cc && ( cc->num_channels != num_channels || cc->num_oversamples != num_oversamples ) ) {
+        DeleteAIOGainRange( cc->gain_ranges );
+        DeleteAIOCountsConverter( cc );
+        cc = buf->converter = NULL;
+    }
+    if ( cc ) {
+        AIOGainRangeLoadFromADCConfigBlock( cc->gain_ranges, config );
+    } else {
+        AIOGainRange *ranges = NewAIOGainRangeFromADCConfigBlock( config );
+        cc = ( ranges ? NewAIOCountsConverter( num_channels, ranges, num_oversamples, sizeof(unsigned short) ) : NULL );
+        if ( !cc ) {
+            DeleteAIOGainRange( ranges );
+            return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        }
+        buf->converter = cc;
+    }
+    AIOCountsConverterReset( cc );
+    AIOCountsConverterSetScanLimit( cc, num_scans );
+    return aiocontbuf_capture_cal( dev, cc );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Bytes the work functions borrow for each bulk read, enough for the
+ * largest transfer the sizer will ask for
+ */
+static unsigned aiocontbuf_transfer_buffer_size( AIOContinuousBuf *buf )
+{
+    return MAX( 64*1024, (unsigned)AIOBulkSizerGetMaxSize( &buf->sizer ) );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Readies the converter and the counts fifo ConvertCountsToVoltsFunction
+ * converts each read through, keeping last start's when they still fit so
+ * starting again doesn't go back to the heap
+ */
+static AIORET_TYPE aiocontbuf_prepare_volts( AIOContinuousBuf *buf )
+{
+    AIORET_TYPE retval = AIOContinuousBufGetOverSample( buf );
+    unsigned counts = aiocontbuf_transfer_buffer_size( buf ) / sizeof(uint16_t);
+
+    if ( retval < 0 )
+        return retval;
+    if ( ( retval = aiocontbuf_capture_ranges( buf, (unsigned)retval, buf->num_scans ) ) != AIOUSB_SUCCESS )
+        return retval;
+
+    if ( buf->volts_counts && buf->volts_counts->size < ( counts + 1 ) * sizeof(uint16_t) ) {
+        DeleteAIOFifoCounts( buf->volts_counts );
+        buf->volts_counts = NULL;
+    }
+    if ( !buf->volts_counts && !( buf->volts_counts = NewAIOFifoCounts( counts ) ) )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    AIOFifoReset( (AIOFifo *)buf->volts_counts );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Gives the scan clock the period the counters are about to be
+ * loaded with, or buf->hz's when CalculateClocks has not run
+ */
+static AIORET_TYPE aiocontbuf_reset_clock( AIOContinuousBuf *buf )
+{
+    if ( buf->divisora && buf->divisorb ) {
+        double tick_ns = buf->divisora * 1e9 / ROOTCLOCK;
+        return AIOScanClockReset( buf->scan_clock, tick_ns * buf->divisorb, ( buf->latch_counters ? tick_ns : 0 ), buf->divisorb );
+    }
+    if ( !buf->hz )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return AIOScanClockReset( buf->scan_clock, 1e9 / buf->hz, 0, 0 );
+}
+
 /*----------------------------------------------------------------------------*/
 /**
  * @brief Starts the work function
@@ -657,7 +1510,32 @@ AIORET_TYPE AIOContinuousBufStart( AIOContinuousBuf *buf )
 {
     AIORET_TYPE retval = AIOUSB_SUCCESS;
 #ifdef HAS_PTHREAD
+    buf->overruns       = 0;
+    buf->dropped_scans  = 0;
+    buf->acquired_scans = 0;
+    buf->carry_counts   = 0;
+    buf->read_counts    = 0;
+    AIOCONTBUF_STORE( &buf->reading, AIOUSB_FALSE );
+    if ( buf->scan_clock && ( retval = aiocontbuf_reset_clock( buf ) ) != AIOUSB_SUCCESS )
+        return retval;
+    retval = AIOBulkSizerInit( &buf->sizer,
+                               buf->transfer_preference,
+                               buf->latency_ms,
+                               AIOBulkSizerRate( buf->hz, AIOContinuousBufNumberChannels(buf), buf->num_oversamples ),
+                               buf->usbbuf_size
+                               );
+    if ( retval != AIOUSB_SUCCESS )
+        return retval;
+    AIOBulkSizerSetMinSize( &buf->sizer, AIOContinuousBufNumberChannels(buf) * ( buf->num_oversamples + 1 ) * sizeof(unsigned short) );
+    aiocontbuf_publish_size( buf );
+    free( buf->carry );
+    buf->carry = (unsigned short *)malloc( aiocontbuf_scan_counts(buf) * sizeof(unsigned short) );
+    if ( buf->lazy_volts && ( retval = aiocontbuf_capture_ranges( buf, buf->num_oversamples, 0 ) ) != AIOUSB_SUCCESS )
+        return retval;
+    if ( buf->callback == ConvertCountsToVoltsFunction && ( retval = aiocontbuf_prepare_volts( buf ) ) != AIOUSB_SUCCESS )
+        return retval;
     buf->status = RUNNING;
+    aiocontbuf_notify( buf );
 #ifdef HIGH_PRIORITY            /* Must run as root if you use this */
     int fifo_max_prio;
     struct sched_param fifo_param;
@@ -674,6 +1552,7 @@ AIORET_TYPE AIOContinuousBufStart( AIOContinuousBuf *buf )
 #endif
     if (  retval != 0 ) {
         buf->status = TERMINATED;
+        aiocontbuf_notify( buf );
         AIOUSB_ERROR("Unable to create thread for Continuous acquisition");
         return -1;
     }
@@ -813,10 +1692,8 @@ AIORET_TYPE AIOContinuousBuf_SmartCountsToVolts( AIOContinuousBuf *buf,
     AIORET_TYPE retval = 0;
     AIORESULT result = AIOUSB_SUCCESS;
     AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex(buf), &result );
-    if ( result != AIOUSB_SUCCESS ) {
-        AIOUSB_UnLock();
+    if ( result != AIOUSB_SUCCESS )
         return -result;
-    }
 
     int number_channels = AIOContinuousBufNumberChannels(buf);
     assert(channel);
@@ -862,6 +1739,7 @@ AIORET_TYPE AIOContinuousBufWrite( AIOContinuousBuf *buf,
     retval = ( retval == 0 ? -AIOUSB_ERROR_NOT_ENOUGH_MEMORY : retval );
 
     AIOContinuousBufUnlock( buf );
+    aiocontbuf_notify( buf );
     return retval;
 }
 
@@ -871,11 +1749,300 @@ AIORET_TYPE AIOContinuousBufWriteCounts( AIOContinuousBuf *buf, unsigned short *
     AIORET_TYPE retval = AIOUSB_SUCCESS;
     /* retval += AIOContinuousBufWrite( buf, (AIOBufferType *)data, datasize, size , flag  ); */
     retval += buf->fifo->PushN( buf->fifo, data, size / sizeof(unsigned short));
+    aiocontbuf_notify( buf );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief State for the asynchronous streaming engine. Every transfer of
+ * queue is resubmitted from its completion, so the device always has as
+ * many requests waiting on endpoint 0x86 as the sizer wants. Completions
+ * run one at a time with the queue locked, which makes staging single
+ * producer / single consumer and lock free; the counters the worker polls
+ * are atomic.
+ */
+struct aio_continuous_buf_transfers {
+    AIOContinuousBuf *buf;
+    AIOTransferQueue *queue;
+    int error;                          /**< Last libusb error seen by a completion */
+    unsigned overruns;                  /**< Completions that did not fit in staging */
+    AIOFifo *staging;                   /**< Completed bytes not yet handed to the worker */
+    AIOStats *stats;                    /**< The device's, may be NULL */
+    unsigned long long completed_ns;    /**< AIOScanClockTime() at the last completion with data */
+};
+
+#define AIOCONTBUF_MAX_TRANSFERS   64
+#define AIOCONTBUF_BULK_PACKET     AIOBULKSIZER_PACKET
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Reads through num_transfers queued transfers, or synchronously
+ * when 0. A nonzero transfer_size pins every transfer to that many bytes,
+ * as AIOContinuousBufSetTransferPreference( buf, AIO_TRANSFERS_FIXED, 0 ).
+ */
+AIORET_TYPE AIOContinuousBufSetStreamingTransfers( AIOContinuousBuf *buf, unsigned num_transfers, unsigned transfer_size )
+{
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER;
+    if ( num_transfers > AIOCONTBUF_MAX_TRANSFERS || transfer_size % AIOCONTBUF_BULK_PACKET != 0 )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( buf->status == RUNNING )
+        return -AIOUSB_ERROR_INVALID_DEVICE_SETTING;
+
+    AIOContinuousBufLock( buf );
+    buf->num_transfers = num_transfers;
+    if ( transfer_size ) {
+        buf->usbbuf_size = transfer_size;
+        buf->transfer_preference = AIO_TRANSFERS_FIXED;
+        AIOBulkSizerInit( &buf->sizer, AIO_TRANSFERS_FIXED, 0, 0, transfer_size );
+        aiocontbuf_publish_size( buf );
+    }
+    AIOContinuousBufUnlock( buf );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOContinuousBufGetNumberTransfers( AIOContinuousBuf *buf )
+{
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER;
+    return buf->num_transfers;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Bytes the next bulk read asks for, which moves with the rate
+ * samples arrive at unless the preference is AIO_TRANSFERS_FIXED
+ */
+AIORET_TYPE AIOContinuousBufGetTransferSize( AIOContinuousBuf *buf )
+{
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER;
+    return AIOCONTBUF_LOAD( &buf->transfer_size );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Trades how soon scans reach the buffer against how many
+ * transfers a second it takes to bring them in. Transfers are sized from
+ * the clock, channels and oversamples when the acquisition starts and
+ * then follow the rate they complete at.
+ * @param latency_ms how long one transfer should take to fill, 0 for the
+ *        preference's own budget
+ */
+AIORET_TYPE AIOContinuousBufSetTransferPreference( AIOContinuousBuf *buf, AIOTransferPreference preference, unsigned latency_ms )
+{
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER;
+    if ( !VALID_ENUM( AIOTransferPreference, preference ) )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( buf->status == RUNNING )
+        return -AIOUSB_ERROR_INVALID_DEVICE_SETTING;
+
+    AIOContinuousBufLock( buf );
+    buf->transfer_preference = preference;
+    buf->latency_ms          = latency_ms;
+    AIOContinuousBufUnlock( buf );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOContinuousBufGetTransferPreference( AIOContinuousBuf *buf )
+{
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER;
+    return buf->transfer_preference;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Submits parked transfers until as many are in flight as the
+ * sizer wants, not counting the one whose completion is running, if any.
+ * Called with the queue locked.
+ */
+static int aiocontbuf_fill_queue( struct aio_continuous_buf_transfers *tr, int completing )
+{
+    AIOTransferQueue *queue = tr->queue;
+    AIOBulkSizer *sizer = &tr->buf->sizer;
+    int wanted = (int)AIOBulkSizerGetTransfers( sizer, AIOTransferQueueGetNumTransfers( queue ) );
+    int usbresult = LIBUSB_SUCCESS;
+    struct libusb_transfer *xfer;
+
+    while ( usbresult == LIBUSB_SUCCESS && AIOTransferQueuePending( queue ) - completing < wanted &&
+            ( xfer = AIOTransferQueueUnpark( queue ) ) ) {
+        usbresult = AIOTransferQueueSubmit( queue, xfer, AIOBulkSizerGetSize( sizer ) );
+        if ( usbresult != LIBUSB_SUCCESS )
+            AIOTransferQueuePark( queue, xfer );
+    }
+    return usbresult;
+}
+
+/*----------------------------------------------------------------------------*/
+static void aiocontbuf_transfer_complete( AIOTransferQueue *queue, struct libusb_transfer *xfer, void *object )
+{
+    struct aio_continuous_buf_transfers *tr = (struct aio_continuous_buf_transfers *)object;
+    AIOContinuousBuf *buf = tr->buf;
+
+    if ( xfer->status == LIBUSB_TRANSFER_COMPLETED || xfer->status == LIBUSB_TRANSFER_TIMED_OUT ) {
+        int usbresult;
+        if ( xfer->actual_length > 0 ) {
+            int written;
+            if ( buf->scan_clock )
+                AIOCONTBUF_STORE( &tr->completed_ns, AIOScanClockTime( buf->scan_clock ) );
+            written = tr->staging->Write( tr->staging, xfer->buffer, xfer->actual_length );
+            if ( written < xfer->actual_length ) {
+                tr->overruns ++;
+                AIOStatsRecordOverruns( tr->stats, 1 );
+                AIOUSB_DEVEL("Dropped %d bytes, staging full\n", xfer->actual_length - written );
+            }
+            AIOStatsRecordFifo( tr->stats, tr->staging->rdelta( tr->staging ), tr->staging->size );
+            AIOBulkSizerObserve( &buf->sizer, xfer->actual_length, AIOStatsNow() );
+            aiocontbuf_publish_size( buf );
+        }
+        /* parked first so it is the next one out, unless fewer are wanted now */
+        AIOTransferQueuePark( queue, xfer );
+        usbresult = aiocontbuf_fill_queue( tr, 1 );
+        if ( usbresult != LIBUSB_SUCCESS )
+            AIOCONTBUF_STORE( &tr->error, usbresult );
+    } else if ( xfer->status != LIBUSB_TRANSFER_CANCELLED ) {
+        AIOUSB_ERROR("Bulk transfer failed with status %d\n", (int)xfer->status );
+        AIOCONTBUF_STORE( &tr->error, ( xfer->status == LIBUSB_TRANSFER_NO_DEVICE ? LIBUSB_ERROR_NO_DEVICE : LIBUSB_ERROR_IO ) );
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Allocates buf->num_transfers bulk reads with room for the largest
+ * size the sizer may ask for, and queues as many of them as it wants in
+ * flight. Does nothing when async transfers are disabled or when there
+ * is no real libusb handle behind the device ( testing devices ), in which case
+ * aiocontbuf_get_data falls back to synchronous reads.
+ */
+AIORET_TYPE AIOContinuousBufStartTransfers( AIOContinuousBuf *buf, USBDevice *usb )
+{
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+    struct aio_continuous_buf_transfers *tr;
+    unsigned transfer_size;
+    int usbresult;
+
+    if ( !buf || !usb )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( buf->num_transfers == 0 || !usb->deviceHandle || buf->transfers )
+        return AIOUSB_SUCCESS;
+
+    tr = (struct aio_continuous_buf_transfers *)calloc(1, sizeof(struct aio_continuous_buf_transfers));
+    if ( !tr )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    buf->transfers = tr;
+
+    transfer_size = AIOBulkSizerGetMaxSize( &buf->sizer );
+    tr->buf       = buf;
+    tr->stats     = usb->stats;
+    tr->queue     = NewAIOTransferQueue( usb, 0x86, buf->num_transfers, transfer_size, aiocontbuf_transfer_complete, tr );
+    tr->staging   = NewAIOFifoLockFree( 2 * buf->num_transfers * transfer_size + sizeof(uint16_t), sizeof(uint16_t) );
+    if ( !tr->queue || !tr->staging ) {
+        retval = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out_AIOContinuousBufStartTransfers;
+    }
+
+    /* the first completions can run on another thread before the last submit */
+    AIOTransferQueueLock( tr->queue );
+    usbresult = aiocontbuf_fill_queue( tr, 0 );
+    AIOTransferQueueUnlock( tr->queue );
+    if ( usbresult != LIBUSB_SUCCESS ) {
+        AIOUSB_ERROR("Unable to submit bulk transfer: %d\n", usbresult );
+        retval = -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT(usbresult);
+    }
+
+ out_AIOContinuousBufStartTransfers:
+    if ( retval != AIOUSB_SUCCESS )
+        AIOContinuousBufStopTransfers( buf );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Cancels every queued transfer, waits until libusb has handed all
+ * of them back and releases the engine
+ * @return the libusb error that ended the transfers, as an AIOUSB error,
+ *         if one did
+ */
+AIORET_TYPE AIOContinuousBufStopTransfers( AIOContinuousBuf *buf )
+{
+    struct aio_continuous_buf_transfers *tr;
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+    int error;
+
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER;
+    tr = buf->transfers;
+    if ( !tr )
+        return AIOUSB_SUCCESS;
+    buf->transfers = NULL;
+
+    DeleteAIOTransferQueue( tr->queue );
+    if ( tr->overruns )
+        AIOUSB_ERROR("Staging overran %u times\n", tr->overruns );
+    if ( ( error = AIOCONTBUF_LOAD( &tr->error ) ) != LIBUSB_SUCCESS )
+        retval = -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT( error );
+
+    if ( tr->staging )
+        DeleteAIOFifo( tr->staging );
+    free( tr );
 
     return retval;
 }
 
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief Hands the worker whatever the queued transfers have completed,
+ * pumping libusb events for at most timeout ms if nothing is staged yet
+ */
+static AIORET_TYPE aiocontbuf_get_transfer_data( AIOContinuousBuf *buf,
+                                                 unsigned char *data,
+                                                 int datasize,
+                                                 int *bytes,
+                                                 unsigned timeout
+                                                 )
+{
+    struct aio_continuous_buf_transfers *tr = buf->transfers;
+    *bytes = 0;
+
+    if ( tr->staging->rdelta( tr->staging ) == 0 && AIOTransferQueuePending( tr->queue ) > 0 && !AIOCONTBUF_LOAD( &tr->error ) ) {
+        struct timeval tv = { (time_t)(timeout / 1000), (suseconds_t)((timeout % 1000) * 1000) };
+        int usbresult = libusb_handle_events_timeout_completed( NULL, &tv, NULL );
+        if ( usbresult < 0 )
+            return usbresult;
+    }
+
+    *bytes = tr->staging->Read( tr->staging, data, datasize );
+    if ( *bytes > 0 )
+        return *bytes;
+    if ( AIOCONTBUF_LOAD( &tr->error ) )
+        return AIOCONTBUF_LOAD( &tr->error );
+    if ( AIOTransferQueuePending( tr->queue ) == 0 )
+        return LIBUSB_ERROR_NO_DEVICE;
+
+    return LIBUSB_ERROR_TIMEOUT;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Notes how full the user facing FIFO is after a worker push
+ */
+static void aiocontbuf_record_fifo( AIOContinuousBuf *buf, AIOStats *stats )
+{
+    AIOStatsRecordFifo( stats, buf->fifo->rdelta( (AIOFifo *)buf->fifo ), buf->fifo->size );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Fetches the next chunk of streamed counts. Kept as the single entry
+ * point for the worker threads so that LD_PRELOAD mocks can replace it.
+ */
 AIORET_TYPE aiocontbuf_get_data( AIOContinuousBuf *buf, 
                                  USBDevice *usb, 
                                  unsigned char endpoint, 
@@ -887,6 +2054,9 @@ AIORET_TYPE aiocontbuf_get_data( AIOContinuousBuf *buf,
 {
     AIORET_TYPE usbresult;
 
+    if ( buf->transfers )
+        return aiocontbuf_get_transfer_data( buf, data, datasize, bytes, timeout );
+
     usbresult = usb->usb_bulk_transfer( usb,
                                         0x86,
                                         data,
@@ -899,6 +2069,201 @@ AIORET_TYPE aiocontbuf_get_data( AIOContinuousBuf *buf,
 }
 
 
+#define AIOCONTBUF_BLOCK_US 200  /* how often a BLOCKed worker looks for room */
+#define AIOCONTBUF_LATCH_NS  100000000ULL /* at most ten counter latches a second */
+#define AIOCONTBUF_MAX_COUNTER_BLOCKS 8
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief What the worker asks aiocontbuf_get_data for: the sizer's next
+ * transfer when reading synchronously, or as much as its buffer holds when
+ * draining what queued transfers staged
+ */
+static int aiocontbuf_read_size( AIOContinuousBuf *buf, unsigned datasize )
+{
+    if ( buf->transfers )
+        return datasize;
+    return MIN( datasize, (unsigned)AIOBulkSizerGetSize( &buf->sizer ) );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Times a synchronous read for the sizer; queued transfers are timed
+ * as they complete
+ */
+static void aiocontbuf_observe( AIOContinuousBuf *buf, int bytes )
+{
+    if ( !buf->transfers && bytes > 0 ) {
+        AIOBulkSizerObserve( &buf->sizer, bytes, AIOStatsNow() );
+        aiocontbuf_publish_size( buf );
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief When the data aiocontbuf_get_data just returned had all arrived:
+ * the last async completion, or now for a synchronous read
+ */
+static unsigned long long aiocontbuf_completed_ns( AIOContinuousBuf *buf )
+{
+    unsigned long long completed_ns = ( buf->transfers ? AIOCONTBUF_LOAD( &buf->transfers->completed_ns ) : 0 );
+    return ( completed_ns ? completed_ns : AIOScanClockTime( buf->scan_clock ) );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stamps a transfer holding num_scans whole scans that completed
+ * at done_ns, before its scans are pushed so no reader sees them
+ * unstamped. Every AIOCONTBUF_LATCH_NS the counters are latched as well.
+ */
+static void aiocontbuf_stamp( AIOContinuousBuf *buf, AIOUSBDevice *dev, unsigned num_scans, unsigned long long done_ns, unsigned long long *latched_ns )
+{
+    unsigned short counters[AIOCONTBUF_MAX_COUNTER_BLOCKS * COUNTERS_PER_BLOCK + 1];
+    unsigned long long before;
+
+    AIOScanClockStamp( buf->scan_clock, num_scans, done_ns );
+    if ( !buf->latch_counters || !dev || dev->Counters == 0 || dev->Counters > AIOCONTBUF_MAX_COUNTER_BLOCKS ||
+         done_ns < *latched_ns + AIOCONTBUF_LATCH_NS )
+        return;
+
+    before = AIOScanClockTime( buf->scan_clock );
+    if ( CTR_8254ReadLatched( AIOContinuousBufGetDeviceIndex(buf), counters ) == AIOUSB_SUCCESS )
+        AIOScanClockLatch( buf->scan_clock, counters[2], before, AIOScanClockTime( buf->scan_clock ) );
+    *latched_ns = before;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Puts num_scans whole scans in the fifo, applying the overrun policy
+ *        to what does not fit
+ * @return scans kept
+ */
+static unsigned aiocontbuf_put_scans( AIOContinuousBuf *buf, unsigned short *counts, unsigned num_scans, AIOUSB_BOOL *overrun )
+{
+    unsigned scan_counts = aiocontbuf_scan_counts(buf);
+    unsigned scan_bytes  = scan_counts * sizeof(unsigned short);
+    unsigned kept = 0, room, held, oldest;
+
+    for ( ;; ) {
+        room = MIN( num_scans, (unsigned)( buf->fifo->delta( (AIOFifo*)buf->fifo ) / scan_bytes ) );
+        if ( room ) {
+            buf->fifo->PushN( buf->fifo, counts, room * scan_counts );
+            if ( buf->scan_clock )
+                AIOScanClockKeep( buf->scan_clock, room );
+            counts    += room * scan_counts;
+            num_scans -= room;
+            kept      += room;
+        }
+        if ( !num_scans )
+            return kept;
+
+        *overrun = AIOUSB_TRUE;
+        if ( buf->overrun_policy == AIOCONTINUOUS_BUF_BLOCK && buf->status == RUNNING ) {
+            aiocontbuf_notify( buf );
+            usleep( AIOCONTBUF_BLOCK_US );
+        } else {
+            break;
+        }
+    }
+
+    if ( buf->overrun_policy == AIOCONTINUOUS_BUF_OVERWRITE_OLDEST ) {
+        /**
+         * readers pop under the lock, so read_pos can be moved from here,
+         * except while a reader holds the scans at read_pos
+         */
+        AIOContinuousBufLock( buf );
+        held   = (unsigned)( buf->fifo->rdelta( (AIOFifo*)buf->fifo ) / scan_bytes );
+        oldest = ( buf->acquired_scans ? 0 : MIN( num_scans, held ) );
+        buf->fifo->read_pos = ( buf->fifo->read_pos + oldest * scan_bytes ) % buf->fifo->size;
+        buf->read_counts   += oldest * scan_counts;
+        buf->dropped_scans += oldest;
+
+        room = MIN( num_scans, (unsigned)( buf->fifo->delta( (AIOFifo*)buf->fifo ) / scan_bytes ) );
+        if ( room < num_scans ) {
+            /* more new scans than the ring holds, only the latest are kept */
+            buf->dropped_scans += num_scans - room;
+            if ( buf->scan_clock )
+                AIOScanClockDrop( buf->scan_clock, num_scans - room );
+            counts   += ( num_scans - room ) * scan_counts;
+            num_scans = room;
+        }
+        if ( room ) {
+            buf->fifo->PushN( buf->fifo, counts, room * scan_counts );
+            if ( buf->scan_clock )
+                AIOScanClockKeep( buf->scan_clock, room );
+        }
+        AIOContinuousBufUnlock( buf );
+        return kept + room;
+    }
+
+    buf->dropped_scans += num_scans;
+    if ( buf->scan_clock )
+        AIOScanClockDrop( buf->scan_clock, num_scans );
+    return kept;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes num_counts counts from the device into the fifo a whole scan
+ *        at a time, so overruns never leave the stream out of step with
+ *        the channels. A scan split across transfers waits in buf->carry.
+ * @return bytes of counts kept
+ */
+static AIORET_TYPE aiocontbuf_push_scans( AIOContinuousBuf *buf, unsigned short *counts, unsigned num_counts, AIOStats *stats )
+{
+    unsigned scan_counts = aiocontbuf_scan_counts(buf);
+    unsigned kept = 0, take;
+    AIOUSB_BOOL overrun = AIOUSB_FALSE;
+
+    if ( !buf->carry )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    if ( buf->carry_counts ) {
+        take = MIN( num_counts, scan_counts - buf->carry_counts );
+        memcpy( buf->carry + buf->carry_counts, counts, take * sizeof(unsigned short) );
+        buf->carry_counts += take;
+        counts     += take;
+        num_counts -= take;
+        if ( buf->carry_counts < scan_counts )
+            return 0;
+        kept += aiocontbuf_put_scans( buf, buf->carry, 1, &overrun );
+        buf->carry_counts = 0;
+    }
+    kept += aiocontbuf_put_scans( buf, counts, num_counts / scan_counts, &overrun );
+    buf->carry_counts = num_counts % scan_counts;
+    memcpy( buf->carry, counts + num_counts - buf->carry_counts, buf->carry_counts * sizeof(unsigned short) );
+
+    if ( overrun ) {
+        buf->overruns ++;
+        AIOStatsRecordOverruns( stats, 1 );
+    }
+    return kept * scan_counts * sizeof(unsigned short);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Wakes aiocontbuf_wait_reading once the worker is reading or has
+ * stopped
+ */
+static void aiocontbuf_signal_ready( AIOContinuousBuf *buf )
+{
+    pthread_mutex_lock( &buf->notify_lock );
+    pthread_cond_broadcast( &buf->ready_cond );
+    pthread_mutex_unlock( &buf->notify_lock );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops the queued transfers on the way out of a worker. An error
+ * that ended them becomes the exit code, unless the worker already had one.
+ */
+static void aiocontbuf_stop_transfers( AIOContinuousBuf *buf, AIORET_TYPE *retval )
+{
+    AIORET_TYPE stopped = AIOContinuousBufStopTransfers( buf );
+    if ( stopped != AIOUSB_SUCCESS && buf->exitcode == AIOUSB_SUCCESS )
+        buf->exitcode = *retval = stopped;
+}
+
 /*----------------------------------------------------------------------------*/
 void *RawCountsWorkFunction( void *object )
 {
@@ -908,13 +2273,14 @@ void *RawCountsWorkFunction( void *object )
     AIOContinuousBuf *buf = (AIOContinuousBuf*)object;
     int bytes;
     srand(3);
-    /* unsigned datasize = AIOContinuousBufNumberChannels(buf)*16*512; */
-    unsigned datasize = 64*1024;
+    unsigned datasize = aiocontbuf_transfer_buffer_size( buf );
 
     int usbfail = 0;
     int usbfail_count = 5;
-    unsigned char *data  = (unsigned char *)malloc( datasize );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex( buf ), &result );
+    unsigned char *data  = (unsigned char *)AIOUSBDeviceGetBuffer( dev, datasize );
     unsigned count = 0;
+    unsigned long long done_ns = 0, latched_ns = 0;
     USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( AIOContinuousBufGetDeviceIndex( buf ), &result );
 
     if ( result != AIOUSB_SUCCESS ) {
@@ -922,6 +2288,17 @@ void *RawCountsWorkFunction( void *object )
         retval = -result;
         goto out_RawCountsWorkFunction;
     }
+    if ( !data ) {
+        AIOUSB_ERROR("No %u byte buffer left for device %lu\n", datasize, AIOContinuousBufGetDeviceIndex( buf ) );
+        buf->exitcode = retval = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out_RawCountsWorkFunction;
+    }
+    if ( ( retval = AIOContinuousBufStartTransfers( buf, usb )) != AIOUSB_SUCCESS ) {
+        buf->exitcode = retval;
+        goto out_RawCountsWorkFunction;
+    }
+    AIOCONTBUF_STORE( &buf->reading, AIOUSB_TRUE );
+    aiocontbuf_signal_ready( buf );
 
     while ( buf->status == RUNNING  ) {
 
@@ -944,21 +2321,30 @@ void *RawCountsWorkFunction( void *object )
         printf("");
 #else
 
-        usbresult = aiocontbuf_get_data( buf, usb, 0x86, data, datasize, &bytes, 3000 );
+        usbresult = aiocontbuf_get_data( buf, usb, 0x86, data, aiocontbuf_read_size( buf, datasize ), &bytes, 3000 );
+        aiocontbuf_observe( buf, bytes );
 
 #endif
+        if ( buf->scan_clock && bytes )
+            done_ns = aiocontbuf_completed_ns( buf );
 
         AIOUSB_DEVEL("libusb_bulk_transfer returned  %d as usbresult, bytes=%d\n", usbresult , (int)bytes);
 
         if (  bytes ) {
+            usbfail = 0;
             /* only write bytes that exist */
-            bytes = ( AIOContinuousBuf_BufSizeForCounts(buf) - buf->fifo->refsize - count < datasize ? AIOContinuousBuf_BufSizeForCounts(buf) - buf->fifo->refsize - count : bytes );
+            if ( !buf->endless )
+                bytes = ( AIOContinuousBuf_BufSizeForCounts(buf) - buf->fifo->refsize - count < datasize ? AIOContinuousBuf_BufSizeForCounts(buf) - buf->fifo->refsize - count : bytes );
+            if ( buf->scan_clock )
+                aiocontbuf_stamp( buf, dev, bytes / sizeof(unsigned short) / aiocontbuf_scan_counts(buf), done_ns, &latched_ns );
 
-            int tmp = buf->fifo->PushN( buf->fifo, (uint16_t*)data, bytes / sizeof(unsigned short));
+            int tmp = aiocontbuf_push_scans( buf, (unsigned short *)data, bytes / sizeof(unsigned short), usb->stats );
 
             AIOUSB_DEVEL("Pushed %d, size: %d\n", bytes / 2 , buf->fifo->size );
+            aiocontbuf_record_fifo( buf, usb->stats );
+            aiocontbuf_notify( buf );
 
-            if (  tmp >= 0 ) {
+            if (  tmp >= 0 && !buf->endless ) {
                 count += tmp;
             }
 
@@ -970,7 +2356,7 @@ void *RawCountsWorkFunction( void *object )
              * 1. count >= number we are supposed to read
              * 2. we don't have enough space
              */
-            if (  count >= AIOContinuousBuf_BufSizeForCounts(buf) - AIOContinuousBufNumberChannels(buf) ) {
+            if ( !buf->endless && count >= AIOContinuousBuf_BufSizeForCounts(buf) - AIOContinuousBufNumberChannels(buf) ) {
             /* if ( count >= AIOContinuousBufGetNumberScansToRead(buf) - AIOContinuousBufNumberChannels(buf) ) {  */
             /* if ( count > buf->num_scans*buf->num_channels ) {  */
                 AIOContinuousBufLock(buf);
@@ -995,9 +2381,13 @@ void *RawCountsWorkFunction( void *object )
     fclose(tmpf);
 #endif
  out_RawCountsWorkFunction:
+    aiocontbuf_stop_transfers( buf, &retval );
     AIOContinuousBufLock(buf);
     buf->status = TERMINATED;
     AIOContinuousBufUnlock(buf);
+    aiocontbuf_signal_ready( buf );
+    aiocontbuf_notify( buf );
+    AIOUSBDeviceReleaseBuffer( dev, data );
     AIOUSB_DEVEL("Stopping\n");
     AIOContinuousBufCleanup( buf );
     pthread_exit((void*)&retval);
@@ -1014,40 +2404,40 @@ void *RawCountsWorkFunction( void *object )
  */
 void *ConvertCountsToVoltsFunction( void *object )
 {
-    AIORET_TYPE retval;
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
     int usbresult;
     AIOContinuousBuf *buf = (AIOContinuousBuf*)object;
     unsigned long result;
     int bytes;
-    unsigned datasize = 64*1024;
-    /* unsigned datasize = AIOContinuousBufNumberChannels(buf)*16*512; */
+    unsigned datasize = aiocontbuf_transfer_buffer_size( buf );
 
     int usbfail = 0, usbfail_count = 5;
     unsigned count = 0;
-    int num_channels = AIOContinuousBufNumberChannels(buf);
-    int num_oversamples = AIOContinuousBufGetOverSample(buf);
-    int num_scans = AIOContinuousBufGetNumberScansToRead(buf);
-    AIOFifoCounts *infifo = NewAIOFifoCounts( (unsigned)num_channels*(num_oversamples+1)*num_scans );
+    unsigned long long done_ns = 0, latched_ns = 0;
+    AIOCountsConverter *cc = buf->converter;      /* both readied by AIOContinuousBufStart */
+    AIOFifoCounts *infifo = buf->volts_counts;
+    int num_channels = cc->num_channels;
+    int num_oversamples = cc->num_oversamples;
     AIOFifoVolts *outfifo = (AIOFifoVolts*)buf->fifo;
 
-
-    AIOGainRange *ranges;
     USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( AIOContinuousBufGetDeviceIndex(buf), &result );
-    unsigned char *data   = (unsigned char *)malloc( datasize );
-
-    AIOCountsConverter *cc;
     AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex(buf), &result );
+    unsigned char *data   = (unsigned char *)AIOUSBDeviceGetBuffer( dev, datasize );
+
     if ( result != AIOUSB_SUCCESS )
         goto out_ConvertCountsToVoltsFunction;
-    AIOUSBDeviceGetADCConfigBlock( dev );
-
-    ranges = NewAIOGainRangeFromADCConfigBlock( AIOUSBDeviceGetADCConfigBlock( dev ) );
-    if ( !ranges )
+    if ( !data ) {
+        AIOUSB_ERROR("No %u byte buffer left for device %lu\n", datasize, AIOContinuousBufGetDeviceIndex( buf ) );
+        buf->exitcode = retval = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
         goto out_ConvertCountsToVoltsFunction;
+    }
 
-    cc = NewAIOCountsConverterWithScanLimiter( (unsigned short*)data, num_scans, num_channels, ranges, num_oversamples , sizeof(unsigned short)  );
-    if ( !cc ) 
+    if ( ( retval = AIOContinuousBufStartTransfers( buf, usb )) != AIOUSB_SUCCESS ) {
+        buf->exitcode = retval;
         goto out_ConvertCountsToVoltsFunction;
+    }
+    AIOCONTBUF_STORE( &buf->reading, AIOUSB_TRUE );
+    aiocontbuf_signal_ready( buf );
 
     /**
      * @brief Load the fifo with values
@@ -1055,7 +2445,10 @@ void *ConvertCountsToVoltsFunction( void *object )
    
     while ( buf->status == RUNNING  ) {
         
-        usbresult = aiocontbuf_get_data( buf, usb, 0x86, data, datasize, &bytes, 3000 );
+        usbresult = aiocontbuf_get_data( buf, usb, 0x86, data, aiocontbuf_read_size( buf, datasize ), &bytes, 3000 );
+        aiocontbuf_observe( buf, bytes );
+        if ( buf->scan_clock && bytes )
+            done_ns = aiocontbuf_completed_ns( buf );
 
         AIOUSB_DEVEL("Using counts=%d\n",bytes / 2 );
 
@@ -1067,12 +2460,18 @@ void *ConvertCountsToVoltsFunction( void *object )
         AIOUSB_DEVEL("libusb_bulk_transfer returned  %d as usbresult, bytes=%d\n", usbresult , (int)bytes);
         if ( bytes ) {
             /* only write bytes that exist */
+            if ( buf->scan_clock )
+                aiocontbuf_stamp( buf, dev, bytes / sizeof(uint16_t) / ( num_channels * ( num_oversamples + 1 ) ), done_ns, &latched_ns );
 
             retval = cc->ConvertFifo( cc, outfifo, infifo , bytes / sizeof(uint16_t) );
 
             if (  retval >= 0 ) {
+                if ( buf->scan_clock )
+                    AIOScanClockKeep( buf->scan_clock, ( count + retval ) / num_channels - count / num_channels );
                 count += retval;
             }
+            aiocontbuf_record_fifo( buf, usb->stats );
+            aiocontbuf_notify( buf );
 
 
             AIOUSB_DEVEL("Pushed %d, size: %d\n", bytes / 2 , buf->fifo->size );
@@ -1104,12 +2503,13 @@ void *ConvertCountsToVoltsFunction( void *object )
         }
     }
  out_ConvertCountsToVoltsFunction:
-    DeleteAIOFifoCounts(infifo);
-    DeleteAIOCountsConverter( cc );
-    free(data);
+    aiocontbuf_stop_transfers( buf, &retval );
+    AIOUSBDeviceReleaseBuffer( dev, data );
     AIOContinuousBufLock(buf);
     buf->status = TERMINATED;
     AIOContinuousBufUnlock(buf);
+    aiocontbuf_signal_ready( buf );
+    aiocontbuf_notify( buf );
     AIOUSB_DEVEL("Stopping\n");
     AIOContinuousBufCleanup( buf );
 
@@ -1161,6 +2561,7 @@ AIORET_TYPE SetConfig( AIOContinuousBuf *buf )
 
     ADCConfigBlock *config = AIOUSBDeviceGetADCConfigBlock( deviceDesc );
 
+    deviceDesc->writtenConfigBlock.size = 0;
     usb->usb_put_config( usb, config );
 
     return retval;
@@ -1214,7 +2615,6 @@ AIORET_TYPE ResetCounters( AIOContinuousBuf *buf )
     if ( usbval  != 0 )
         retval = -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT(usbval);
  out_ResetCounters:
-    AIOUSB_UnLock();
     return retval;
 
 }
@@ -1501,6 +2901,51 @@ int continuous_setup( USBDevice *usb , unsigned char *data, unsigned length )
     return usbval;
 }
 
+#define AIOCONTBUF_READY_MS 1000 /* longest wait for a worker's first read */
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief With timestamps on, waits for the built in workers to get their
+ * transfers queued before the counters start, so the first scans are not
+ * left on the board for however long the thread took to start and then
+ * stamped as one late burst. Without timestamps nothing depends on it.
+ * @return AIOUSB_SUCCESS once the worker is reading, the worker's exit
+ * code if it stopped first, or -AIOUSB_ERROR_TIMEOUT
+ */
+static AIORET_TYPE aiocontbuf_wait_reading( AIOContinuousBuf *buf )
+{
+    struct timespec deadline;
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+
+    if ( !buf->scan_clock )
+        return AIOUSB_SUCCESS;
+    if ( buf->callback != RawCountsWorkFunction && buf->callback != ConvertCountsToVoltsFunction )
+        return AIOUSB_SUCCESS;
+
+    clock_gettime( CLOCK_MONOTONIC, &deadline );
+    deadline.tv_sec  += AIOCONTBUF_READY_MS / 1000;
+    deadline.tv_nsec += ( AIOCONTBUF_READY_MS % 1000 ) * 1000000L;
+    if ( deadline.tv_nsec >= 1000000000L ) {
+        deadline.tv_sec ++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    pthread_mutex_lock( &buf->notify_lock );
+    while ( !AIOCONTBUF_LOAD( &buf->reading ) && buf->status == RUNNING ) {
+        if ( pthread_cond_timedwait( &buf->ready_cond, &buf->notify_lock, &deadline ) == ETIMEDOUT &&
+             !AIOCONTBUF_LOAD( &buf->reading ) && buf->status == RUNNING ) {
+            retval = -AIOUSB_ERROR_TIMEOUT;
+            break;
+        }
+    }
+    if ( retval == AIOUSB_SUCCESS && !AIOCONTBUF_LOAD( &buf->reading ) )
+        retval = ( buf->exitcode < 0 ? buf->exitcode : -AIOUSB_ERROR_INVALID_THREAD );
+    pthread_mutex_unlock( &buf->notify_lock );
+
+    if ( retval == -AIOUSB_ERROR_TIMEOUT )
+        AIOUSB_ERROR("Worker for device %lu not reading after %d ms\n", AIOContinuousBufGetDeviceIndex( buf ), AIOCONTBUF_READY_MS );
+    return retval;
+}
+
 /*----------------------------------------------------------------------------*/
 /**
  * @brief Setups the Automated runs for continuous mode runs
@@ -1532,7 +2977,12 @@ AIORET_TYPE AIOContinuousBufCallbackStart( AIOContinuousBuf *buf )
     /**
      * @note BufStart ( or bulk read ) must occur before loading the counters
      */ 
-    retval = AIOContinuousBufStart( buf ); /* Startup the thread that handles the data acquisition */
+    if ( ( retval = AIOContinuousBufStart( buf ) ) != AIOUSB_SUCCESS ) /* Startup the thread that handles the data acquisition */
+        goto cleanup_AIOContinuousBufCallbackStart;
+    if ( ( retval = aiocontbuf_wait_reading( buf ) ) != AIOUSB_SUCCESS ) {
+        AIOContinuousBufEnd( buf );
+        goto cleanup_AIOContinuousBufCallbackStart;
+    }
 
     if ( ( retval = AIOContinuousBufLoadCounters( buf, buf->divisora, buf->divisorb )) != AIOUSB_SUCCESS)
         goto out_AIOContinuousBufCallbackStart;
@@ -1594,10 +3044,13 @@ AIORET_TYPE AIOContinuousBufRead( AIOContinuousBuf *buf, AIOBufferType *readbuf
     int N = MIN(size ,readbufsize ) / buf->fifo->refsize;
 
     retval = buf->fifo->PopN( buf->fifo, readbuf, N );
+    if ( retval > 0 )
+        buf->read_counts += retval / buf->fifo->refsize;
 
     retval = ( retval == 0 ? -AIOUSB_ERROR_NOT_ENOUGH_MEMORY : retval );
 
     AIOContinuousBufUnlock( buf );
+    aiocontbuf_notify( buf );
     return retval;
 }
 
@@ -1641,10 +3094,8 @@ AIORET_TYPE AIOContinuousBufSimpleSetupConfig( AIOContinuousBuf *buf, ADGainCode
     ADCConfigBlock configBlock = {0};
     AIORESULT result = AIOUSB_SUCCESS;
     AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex(buf) , &result );
-    if ( result != AIOUSB_SUCCESS ){
-        AIOUSB_UnLock();
+    if ( result != AIOUSB_SUCCESS )
         return result;
-    }
 
     ADCConfigBlockInit( &configBlock, deviceDesc, AIOUSB_FALSE );
 
@@ -1672,6 +3123,7 @@ AIORET_TYPE AIOContinuousBufEnd( AIOContinuousBuf *buf )
     AIOUSB_DEVEL("\tWaiting for thread to terminate\n");
     AIOUSB_DEVEL("Set flag to FINISH\n");
     AIOContinuousBufUnlock( buf );
+    aiocontbuf_notify( buf );
 
 
 #ifdef HAS_PTHREAD
@@ -1782,10 +3234,8 @@ AIORET_TYPE AIOContinuousBufSetStartAndEndChannel( AIOContinuousBuf *buf, unsign
 {
     AIORESULT result = AIOUSB_SUCCESS;
     AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex(buf), &result );
-    if ( result != AIOUSB_SUCCESS ){
-        AIOUSB_UnLock();
+    if ( result != AIOUSB_SUCCESS )
         return -result;
-    }
     if ( AIOContinuousBufNumberChannels( buf ) > 16 ) {
         deviceDesc->cachedConfigBlock.size = AD_MUX_CONFIG_REGISTERS;
     }
@@ -1810,10 +3260,8 @@ AIORET_TYPE AIOContinuousBufSetChannelRange( AIOContinuousBuf *buf,
 {
     AIORESULT result = AIOUSB_SUCCESS;
     AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex(buf) , &result );
-    if ( result != AIOUSB_SUCCESS ){
-        AIOUSB_UnLock();
+    if ( result != AIOUSB_SUCCESS )
         return result;
-    }
 
     for ( unsigned i = startChannel; i <= endChannel ; i ++ ) {
 #ifdef __cplusplus
@@ -2333,6 +3781,55 @@ TEST(AIOContinuousBuf,CleanupMemory)
     DeleteAIOContinuousBuf(buf);
 }
 
+TEST(AIOContinuousBuf,StreamingTransfers)
+{
+    int num_channels = 16, num_scans = 1000;
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, num_scans, num_channels );
+
+    EXPECT_EQ( 0, AIOContinuousBufGetNumberTransfers( buf ) ) << "Synchronous reads by default";
+    EXPECT_EQ( 128*512, AIOContinuousBufGetTransferSize( buf ) );
+
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOContinuousBufSetStreamingTransfers( buf, 8, 1000 ) ) << "Must be whole bulk packets";
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOContinuousBufSetStreamingTransfers( buf, 1000, 512 ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetStreamingTransfers( buf, 8, 16*1024 ) );
+    EXPECT_EQ( 8, AIOContinuousBufGetNumberTransfers( buf ) );
+    EXPECT_EQ( 16*1024, AIOContinuousBufGetTransferSize( buf ) );
+
+    /* Testing devices have no libusb handle, so reads stay on the mockable synchronous path */
+    USBDevice *usb = (USBDevice *)calloc(1, sizeof(USBDevice));
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOContinuousBufStartTransfers( buf, usb ) );
+    EXPECT_TRUE( buf->transfers == NULL );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOContinuousBufStopTransfers( buf ) );
+
+    DeleteUSBDevice( usb );
+    DeleteAIOContinuousBuf( buf );
+}
+
+TEST(AIOContinuousBuf,ZeroCopyScans)
+{
+    int num_channels = 16, num_scans = 100;
+    AIOFifoRegion region;
+    unsigned short *tobuf = (unsigned short *)malloc( num_scans*num_channels*sizeof(unsigned short) );
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, num_scans, num_channels );
+
+    for ( int i = 0; i < num_channels*num_scans; i ++ ) tobuf[i] = i;
+    buf->PushN( buf, tobuf, 10*num_channels );
+
+    EXPECT_EQ( 4, AIOContinuousBufAcquireScans( buf, &region, 4 ) );
+    EXPECT_EQ( 4*num_channels*sizeof(unsigned short), region.size[0] + region.size[1] );
+    EXPECT_EQ( 0, ((unsigned short *)region.data[0])[0] );
+    EXPECT_EQ( 10, AIOContinuousBufCountScansAvailable( buf ) ) << "Acquiring does not consume";
+
+    EXPECT_EQ( 4, AIOContinuousBufCommitScans( buf, 4 ) );
+    EXPECT_EQ( 6, AIOContinuousBufCountScansAvailable( buf ) );
+    EXPECT_EQ( 6, AIOContinuousBufAcquireScans( buf, &region, 100 ) );
+    EXPECT_EQ( 4*num_channels, ((unsigned short *)region.data[0])[0] );
+    EXPECT_LT( AIOContinuousBufCommitScans( buf, 7 ), 0 ) << "Can't commit more than was available";
+
+    DeleteAIOContinuousBuf( buf );
+    free( tobuf );
+}
+
 class AIOBufParams {
 public:
     int num_scans;
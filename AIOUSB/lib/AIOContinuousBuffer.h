@@ -16,6 +16,7 @@
 #include "AIOTypes.h"
 #include "AIOFifo.h"
 #include "AIOUSB_Core.h"
+#include "AIOBulkSizer.h"
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -33,12 +34,18 @@ namespace AIOUSB
 
 typedef void *(*AIOUSB_WorkFn)( void *obj );
 
+struct aio_continuous_buf_transfers;
+struct aio_counts_converter;
+struct aio_scan_clock;
+
 typedef struct aio_continuous_buf {
     void *(*callback)(void *object);
 #ifdef HAS_PTHREAD
     pthread_t worker;
     pthread_mutex_t lock;
     pthread_attr_t tattr;
+    pthread_mutex_t notify_lock;
+    pthread_cond_t ready_cond;          /**< Broadcast under notify_lock once the worker is reading or has stopped */
 #endif
     AIOUSB_WorkFn work;
     int DeviceIndex;
@@ -65,6 +72,31 @@ typedef struct aio_continuous_buf {
     AIOBufferType *tmpbuf;
     unsigned tmpbufsize;
     volatile THREAD_STATUS status; /* Are we running, paused ..etc; */
+    unsigned num_transfers;             /**< Bulk transfers kept queued on 0x86, 0 == synchronous reads */
+    struct aio_continuous_buf_transfers *transfers; /**< In flight async transfers while RUNNING */
+    int notify_fd[2];                   /**< Pipe behind AIOContinuousBufGetPollFd, -1 until asked for */
+    unsigned notify_watermark;          /**< Scans waiting that make notify_fd readable */
+    AIOUSB_BOOL notify_signaled;        /**< A byte is sitting in the pipe */
+    AIOUSB_BOOL endless;                /**< Wrap the ring until AIOContinuousBufEnd instead of stopping when full */
+    volatile AIOContinuousBufOverrunPolicy overrun_policy;
+    volatile unsigned long long overruns;      /**< Transfers that found the ring full */
+    volatile unsigned long long dropped_scans; /**< Scans lost to overruns, whatever the policy */
+    unsigned acquired_scans;            /**< Handed out by AIOContinuousBufAcquireScans, not yet committed */
+    unsigned short *carry;              /**< Start of a scan split across transfers */
+    unsigned carry_counts;
+    AIOUSB_BOOL lazy_volts;             /**< Ring holds counts with their oversamples, converted when read */
+    struct aio_counts_converter *converter; /**< Gain ranges captured at start for lazy reads and the volts worker */
+    AIOFifoCounts *volts_counts;        /**< Each read's counts on their way through converter, kept across starts */
+    unsigned short *straddle;           /**< A scan split by the ring wrapping, copied whole for reading */
+    unsigned straddle_size;
+    struct aio_scan_clock *scan_clock;  /**< Scan times, NULL unless AIOContinuousBufSetTimestamps */
+    AIOUSB_BOOL latch_counters;         /**< Latch the 8254 now and then to pin the scan clock down */
+    unsigned long long read_counts;     /**< Counts taken out of the ring since the start */
+    AIOUSB_BOOL reading;                /**< The worker has queued its transfers, or is about to issue its first synchronous read */
+    AIOTransferPreference transfer_preference;
+    unsigned latency_ms;                /**< Budget for one transfer to fill, 0 for the preference's */
+    AIOBulkSizer sizer;                 /**< Sizes the bulk reads while RUNNING */
+    unsigned transfer_size;             /**< The sizer's size, published for readers off the transfer path */
     AIORET_TYPE (*PushN)( struct aio_continuous_buf *buf, unsigned short *frombuf, unsigned int N );
     AIORET_TYPE (*PopN)( struct aio_continuous_buf *buf, unsigned short *frombuf, unsigned int N );
 } AIOContinuousBuf;
@@ -77,6 +109,7 @@ PUBLIC_EXTERN AIOContinuousBuf *NewAIOContinuousBufWithoutConfig( unsigned long
 PUBLIC_EXTERN AIOContinuousBuf *NewAIOContinuousBufForCounts( unsigned long DeviceIndex, unsigned scancounts, unsigned num_channels );
 PUBLIC_EXTERN AIOContinuousBuf *NewAIOContinuousBufTesting( unsigned long DeviceIndex , unsigned scancounts , unsigned num_channels , AIOUSB_BOOL counts  );
 PUBLIC_EXTERN AIOContinuousBuf *NewAIOContinuousBufForVolts( unsigned long DeviceIndex, unsigned scancounts, unsigned num_channels, unsigned num_oversamples );
+PUBLIC_EXTERN AIOContinuousBuf *NewAIOContinuousBufForLazyVolts( unsigned long DeviceIndex, unsigned scancounts, unsigned num_channels, unsigned num_oversamples );
 
 
 PUBLIC_EXTERN AIOContinuousBuf *NewAIOContinuousBufRawSmart( unsigned long DeviceIndex, unsigned num_channels, unsigned num_scans,
@@ -134,6 +167,23 @@ PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetRemainingWriteSize( AIOContinuousBu
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetUnitSize( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufReset( AIOContinuousBuf *buf );
 
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetStreamingTransfers( AIOContinuousBuf *buf, unsigned num_transfers, unsigned transfer_size );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetNumberTransfers( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetTransferSize( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetTransferPreference( AIOContinuousBuf *buf, AIOTransferPreference preference, unsigned latency_ms );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetTransferPreference( AIOContinuousBuf *buf );
+
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetEndless( AIOContinuousBuf *buf, AIOUSB_BOOL endless );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetEndless( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetOverrunPolicy( AIOContinuousBuf *buf, AIOContinuousBufOverrunPolicy policy );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetOverrunPolicy( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetOverruns( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetDroppedScans( AIOContinuousBuf *buf );
+
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetPollFd( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetNotifyWatermark( AIOContinuousBuf *buf, unsigned num_scans );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetNotifyWatermark( AIOContinuousBuf *buf );
+
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufPushN(AIOContinuousBuf *buf ,unsigned short *frombuf, unsigned int N );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufPopN(AIOContinuousBuf *buf , unsigned short *frombuf, unsigned int N );
 
@@ -173,8 +223,21 @@ PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetExitCode( AIOContinuousBuf *buf );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufReadIntegerScanCounts( AIOContinuousBuf *buf, unsigned short *tmp , unsigned tmpsize, unsigned size );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufReadCompleteScanCounts( AIOContinuousBuf *buf, unsigned short *read_buf, unsigned read_buf_size );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufReadIntegerNumberOfScans( AIOContinuousBuf *buf, unsigned short *read_buf, unsigned tmpbuffer_size, size_t num_scans );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufReadScanVolts( AIOContinuousBuf *buf, double *volts, unsigned max_scans );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufReadScanVoltsFloat( AIOContinuousBuf *buf, float *volts, unsigned max_scans );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufReadChannelCounts( AIOContinuousBuf *buf, unsigned short **channels, unsigned max_scans );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufReadChannelVolts( AIOContinuousBuf *buf, double **channels, unsigned max_scans );
+
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetTimestamps( AIOContinuousBuf *buf, AIOUSB_BOOL timestamps, AIOUSB_BOOL latch_counters );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetTimestamps( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetScanTimestamps( AIOContinuousBuf *buf, uint64_t *ns, unsigned num_scans );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufReadTimestampedScanCounts( AIOContinuousBuf *buf, unsigned short *counts, uint64_t *ns, unsigned max_scans );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufReadTimestampedScanVolts( AIOContinuousBuf *buf, double *volts, uint64_t *ns, unsigned max_scans );
 
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufCountScansAvailable(AIOContinuousBuf *buf);
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufGetScanSize( AIOContinuousBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufAcquireScans( AIOContinuousBuf *buf, AIOFifoRegion *region, unsigned max_scans );
+PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufCommitScans( AIOContinuousBuf *buf, unsigned num_scans );
 
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufSetClock( AIOContinuousBuf *buf, unsigned int hz );
 PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufEnd( AIOContinuousBuf *buf );
@@ -187,6 +250,8 @@ PUBLIC_EXTERN AIORET_TYPE AIOContinuousBufWriteCounts( AIOContinuousBuf *buf, un
 PUBLIC_EXTERN AIORET_TYPE Launch( AIOUSB_WorkFn callback, AIOContinuousBuf *buf );
 
 AIORET_TYPE AIOContinuousBufCleanup( AIOContinuousBuf *buf );
+AIORET_TYPE AIOContinuousBufStartTransfers( AIOContinuousBuf *buf, USBDevice *usb );
+AIORET_TYPE AIOContinuousBufStopTransfers( AIOContinuousBuf *buf );
 
 
 
@@ -13,10 +13,226 @@
 #include "AIOUSB_Log.h"
 #include <pthread.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AIOCC_X86_SIMD 1
+#endif
+
+#define AIOCC_SCALE_RUN 64      /* fewest values scale and offset are laid out for */
+
 #ifdef __cplusplus
 namespace AIOUSB {
 #endif 
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Oversample summing kernels. Each one adds up num_counts 16 bit
+ * counts into a 32 bit total; at most 256 oversamples of 0xffff fit
+ * comfortably. The widest one the cpu supports is picked at runtime.
+ */
+static unsigned sum_counts_scalar( const uint16_t *counts, unsigned num_counts )
+{
+    unsigned sum = 0;
+    for ( unsigned i = 0; i < num_counts; i ++ )
+        sum += counts[i];
+    return sum;
+}
+
+#ifdef AIOCC_X86_SIMD
+__attribute__((target("sse2")))
+static unsigned sum_counts_sse2( const uint16_t *counts, unsigned num_counts )
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc  = _mm_setzero_si128();
+    unsigned i = 0, sum;
+
+    for ( ; i + 8 <= num_counts; i += 8 ) {
+        __m128i v = _mm_loadu_si128( (const __m128i *)&counts[i] );
+        acc = _mm_add_epi32( acc, _mm_unpacklo_epi16( v, zero ) );
+        acc = _mm_add_epi32( acc, _mm_unpackhi_epi16( v, zero ) );
+    }
+    acc = _mm_add_epi32( acc, _mm_srli_si128( acc, 8 ) );
+    acc = _mm_add_epi32( acc, _mm_srli_si128( acc, 4 ) );
+    sum = (unsigned)_mm_cvtsi128_si32( acc );
+
+    for ( ; i < num_counts; i ++ )
+        sum += counts[i];
+    return sum;
+}
+
+__attribute__((target("avx2")))
+static unsigned sum_counts_avx2( const uint16_t *counts, unsigned num_counts )
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc  = _mm256_setzero_si256();
+    __m128i half;
+    unsigned i = 0, sum;
+
+    for ( ; i + 16 <= num_counts; i += 16 ) {
+        __m256i v = _mm256_loadu_si256( (const __m256i *)&counts[i] );
+        acc = _mm256_add_epi32( acc, _mm256_unpacklo_epi16( v, zero ) );
+        acc = _mm256_add_epi32( acc, _mm256_unpackhi_epi16( v, zero ) );
+    }
+    half = _mm_add_epi32( _mm256_castsi256_si128( acc ), _mm256_extracti128_si256( acc, 1 ) );
+    half = _mm_add_epi32( half, _mm_srli_si128( half, 8 ) );
+    half = _mm_add_epi32( half, _mm_srli_si128( half, 4 ) );
+    sum = (unsigned)_mm_cvtsi128_si32( half );
+
+    for ( ; i < num_counts; i ++ )
+        sum += counts[i];
+    return sum;
+}
+#endif
+
+static unsigned (*best_sum_counts(void))( const uint16_t *, unsigned )
+{
+#ifdef AIOCC_X86_SIMD
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx2") )
+        return sum_counts_avx2;
+    if ( __builtin_cpu_supports("sse2") )
+        return sum_counts_sse2;
+#endif
+    return sum_counts_scalar;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief The same sums with every count first looked up in a host
+ * calibration table. The AVX2 kernel gathers 32 bits at a time, so the
+ * tables carry one word of padding past CAL_TABLE_WORDS.
+ */
+static unsigned cal_sum_counts_scalar( const uint16_t *table, const uint16_t *counts, unsigned num_counts )
+{
+    unsigned sum = 0;
+    for ( unsigned i = 0; i < num_counts; i ++ )
+        sum += table[counts[i]];
+    return sum;
+}
+
+#ifdef AIOCC_X86_SIMD
+__attribute__((target("avx2")))
+static unsigned cal_sum_counts_avx2( const uint16_t *table, const uint16_t *counts, unsigned num_counts )
+{
+    __m256i mask = _mm256_set1_epi32( 0xffff );
+    __m256i acc  = _mm256_setzero_si256();
+    __m128i half;
+    unsigned i = 0, sum;
+
+    for ( ; i + 8 <= num_counts; i += 8 ) {
+        __m256i index = _mm256_cvtepu16_epi32( _mm_loadu_si128( (const __m128i *)&counts[i] ) );
+        __m256i v     = _mm256_i32gather_epi32( (const int *)table, index, 2 );
+        acc = _mm256_add_epi32( acc, _mm256_and_si256( v, mask ) );
+    }
+    half = _mm_add_epi32( _mm256_castsi256_si128( acc ), _mm256_extracti128_si256( acc, 1 ) );
+    half = _mm_add_epi32( half, _mm_srli_si128( half, 8 ) );
+    half = _mm_add_epi32( half, _mm_srli_si128( half, 4 ) );
+    sum = (unsigned)_mm_cvtsi128_si32( half );
+
+    for ( ; i < num_counts; i ++ )
+        sum += table[counts[i]];
+    return sum;
+}
+#endif
+
+static unsigned (*best_cal_sum_counts(void))( const uint16_t *, const uint16_t *, unsigned )
+{
+#ifdef AIOCC_X86_SIMD
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx2") )
+        return cal_sum_counts_avx2;
+#endif
+    return cal_sum_counts_scalar;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Scale and offset kernels, turning a run of averaged counts left
+ * in volts by the summing pass into volts in place. scale and offset line
+ * up with volts. They multiply and then add, never fused, so each one
+ * gives the scalar result to the bit.
+ */
+static void scale_volts_scalar( const double *scale, const double *offset, double *volts, unsigned n )
+{
+    for ( unsigned i = 0; i < n; i ++ )
+        volts[i] = scale[i] * volts[i] + offset[i];
+}
+
+static void scale_volts_float_scalar( const double *scale, const double *offset, float *volts, unsigned n )
+{
+    for ( unsigned i = 0; i < n; i ++ )
+        volts[i] = (float)( scale[i] * volts[i] + offset[i] );
+}
+
+#ifdef AIOCC_X86_SIMD
+__attribute__((target("sse2")))
+static void scale_volts_sse2( const double *scale, const double *offset, double *volts, unsigned n )
+{
+    unsigned i = 0;
+    for ( ; i + 2 <= n; i += 2 ) {
+        __m128d v = _mm_mul_pd( _mm_loadu_pd( &scale[i] ), _mm_loadu_pd( &volts[i] ) );
+        _mm_storeu_pd( &volts[i], _mm_add_pd( v, _mm_loadu_pd( &offset[i] ) ) );
+    }
+    scale_volts_scalar( &scale[i], &offset[i], &volts[i], n - i );
+}
+
+__attribute__((target("avx")))
+static void scale_volts_avx( const double *scale, const double *offset, double *volts, unsigned n )
+{
+    unsigned i = 0;
+    for ( ; i + 4 <= n; i += 4 ) {
+        __m256d v = _mm256_mul_pd( _mm256_loadu_pd( &scale[i] ), _mm256_loadu_pd( &volts[i] ) );
+        _mm256_storeu_pd( &volts[i], _mm256_add_pd( v, _mm256_loadu_pd( &offset[i] ) ) );
+    }
+    scale_volts_scalar( &scale[i], &offset[i], &volts[i], n - i );
+}
+
+__attribute__((target("avx")))
+static void scale_volts_float_avx( const double *scale, const double *offset, float *volts, unsigned n )
+{
+    unsigned i = 0;
+    for ( ; i + 4 <= n; i += 4 ) {
+        __m256d v = _mm256_mul_pd( _mm256_loadu_pd( &scale[i] ), _mm256_cvtps_pd( _mm_loadu_ps( &volts[i] ) ) );
+        _mm_storeu_ps( &volts[i], _mm256_cvtpd_ps( _mm256_add_pd( v, _mm256_loadu_pd( &offset[i] ) ) ) );
+    }
+    scale_volts_float_scalar( &scale[i], &offset[i], &volts[i], n - i );
+}
+#endif
+
+static void (*best_scale_volts(void))( const double *, const double *, double *, unsigned )
+{
+#ifdef AIOCC_X86_SIMD
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx") )
+        return scale_volts_avx;
+    if ( __builtin_cpu_supports("sse2") )
+        return scale_volts_sse2;
+#endif
+    return scale_volts_scalar;
+}
+
+static void (*best_scale_volts_float(void))( const double *, const double *, float *, unsigned )
+{
+#ifdef AIOCC_X86_SIMD
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx") )
+        return scale_volts_float_avx;
+#endif
+    return scale_volts_float_scalar;
+}
+
+/**
+ * @brief Sum of one channel's oversample group, through the channel's
+ * calibration table when it has one
+ */
+static inline unsigned sum_group( AIOCountsConverter *cc, unsigned ch, const uint16_t *counts, unsigned samplesize )
+{
+    const uint16_t *table = ( cc->cal_tables ? cc->cal_tables[ch] : NULL );
+    if ( table )
+        return ( samplesize == 1 ? table[counts[0]] : cc->CalSumCounts( table, counts, samplesize ) );
+    return ( samplesize == 1 ? counts[0] : cc->SumCounts( counts, samplesize ) );
+}
+
 int default_out( AIOCountsConverter *cc, unsigned rounded_num_counts )
 {
     return cc->converted_count < rounded_num_counts;
@@ -76,21 +292,135 @@ AIOCountsConverter *NewAIOCountsConverter( unsigned num_channels, AIOGainRange *
     tmp->Convert          = AIOCountsConverterConvert;
     tmp->ConvertFifo      = AIOCountsConverterConvertFifo;
     tmp->continue_conversion = default_out;
+    tmp->SumCounts        = best_sum_counts();
+    tmp->CalSumCounts     = best_cal_sum_counts();
+    tmp->ScaleVolts       = best_scale_volts();
+    tmp->ScaleVoltsFloat  = best_scale_volts_float();
+    tmp->scale_size       = num_channels * ( ( AIOCC_SCALE_RUN + num_channels - 1 ) / num_channels );
+    tmp->scale            = (double *)malloc( 2*tmp->scale_size*sizeof(double) );
+    if ( !tmp->scale ) {
+        free(tmp);
+        return NULL;
+    }
+    tmp->offset           = &tmp->scale[tmp->scale_size];
     return tmp;
 }
 
+/*----------------------------------------------------------------------------*/
+static void free_cal_tables( AIOCountsConverter *cc )
+{
+    if ( !cc->cal_tables )
+        return;
+    for ( unsigned ch = 0; ch < cc->num_channels; ch ++ ) {
+        unsigned prev = 0;
+        while ( prev < ch && cc->cal_tables[prev] != cc->cal_tables[ch] )
+            prev ++;
+        if ( prev == ch )
+            free( cc->cal_tables[ch] );
+    }
+    free( cc->cal_tables );
+    cc->cal_tables = NULL;
+}
+
 /*----------------------------------------------------------------------------*/
 void DeleteAIOCountsConverter( AIOCountsConverter *ccv )
 {
+    if ( !ccv )
+        return;
+    free_cal_tables( ccv );
+    free(ccv->countsbuf);
+    free(ccv->voltsbuf);
+    free(ccv->scale);
     free(ccv);
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Chooses between the SIMD oversample and scale kernels ( when the
+ * cpu has them ) and the plain C loops
+ */
+AIORET_TYPE AIOCountsConverterSetVectorized( AIOCountsConverter *cc, AIOUSB_BOOL vectorized )
+{
+    if ( !cc )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    cc->SumCounts    = ( vectorized ? best_sum_counts() : sum_counts_scalar );
+    cc->CalSumCounts = ( vectorized ? best_cal_sum_counts() : cal_sum_counts_scalar );
+    cc->ScaleVolts   = ( vectorized ? best_scale_volts() : scale_volts_scalar );
+    cc->ScaleVoltsFloat = ( vectorized ? best_scale_volts_float() : scale_volts_float_scalar );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Corrects each channel's counts through a CAL_TABLE_WORDS word
+ * calibration table before they are averaged, the host side equivalent of
+ * a table loaded into the device's SRAM
+ * @param cc
+ * @param tables one table per channel, NULL entries ( or tables itself
+ *        NULL ) leaving those channels uncorrected. The converter keeps its
+ *        own copies, one per distinct table.
+ */
+AIORET_TYPE AIOCountsConverterSetCalTables( AIOCountsConverter *cc, const uint16_t *const *tables )
+{
+    uint16_t **copies;
+    if ( !cc )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( !tables ) {
+        free_cal_tables( cc );
+        return AIOUSB_SUCCESS;
+    }
+
+    copies = (uint16_t **)calloc( cc->num_channels, sizeof(uint16_t *) );
+    if ( !copies )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    for ( unsigned ch = 0; ch < cc->num_channels; ch ++ ) {
+        unsigned prev = 0;
+        if ( !tables[ch] )
+            continue;
+        while ( prev < ch && tables[prev] != tables[ch] )
+            prev ++;
+        if ( prev < ch ) {
+            copies[ch] = copies[prev];
+            continue;
+        }
+        copies[ch] = (uint16_t *)malloc( ( CAL_TABLE_WORDS + 1 ) * sizeof(uint16_t) );
+        if ( !copies[ch] ) {
+            AIOCountsConverter tmp = *cc;
+            tmp.cal_tables = copies;
+            free_cal_tables( &tmp );
+            return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        }
+        memcpy( copies[ch], tables[ch], CAL_TABLE_WORDS * sizeof(uint16_t) );
+        copies[ch][CAL_TABLE_WORDS] = 0;
+    }
+
+    free_cal_tables( cc );
+    cc->cal_tables = copies;
+    return AIOUSB_SUCCESS;
+}
+
 void AIOCountsConverterReset( AIOCountsConverter *cc )
 {
     assert(cc);
     cc->scan_count = cc->os_count = cc->channel_count = 0;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops ConvertFifo after num_scans scans from the next reset, as
+ * NewAIOCountsConverterWithScanLimiter does, or never when num_scans is 0,
+ * so one converter can be reused across acquisitions
+ */
+AIORET_TYPE AIOCountsConverterSetScanLimit( AIOCountsConverter *cc, unsigned num_scans )
+{
+    if ( !cc )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    cc->num_scans           = num_scans;
+    cc->continue_conversion = ( num_scans ? enhanced_out : default_out );
+    return AIOUSB_SUCCESS;
+}
+
 /*----------------------------------------------------------------------------*/
 AIORET_TYPE AIOCountsConverterConvertNScans( AIOCountsConverter *ccv, int num_scans )
 {
@@ -113,6 +443,66 @@ double Convert( AIOGainRange range, unsigned short sum )
 
 
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Fills scale and offset, repeating the channels out to scale_size
+ * so the kernels get runs of several scans at a time
+ */
+static void load_scale( AIOCountsConverter *cc )
+{
+    for ( unsigned i = 0, ch = 0; i < cc->scale_size; i ++, ch = ( ch + 1 == cc->num_channels ? 0 : ch + 1 ) ) {
+        cc->scale[i]  = (cc->gain_ranges[ch].max - cc->gain_ranges[ch].min) / ((( unsigned short )-1)+1);
+        cc->offset[i] = cc->gain_ranges[ch].min;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Scales n averaged counts, the first of them from channel ch
+ */
+static void scale_channels( AIOCountsConverter *cc, double *volts, unsigned ch, unsigned n )
+{
+    while ( n ) {
+        unsigned run = MIN( n, cc->scale_size - ch );
+        cc->ScaleVolts( &cc->scale[ch], &cc->offset[ch], volts, run );
+        volts += run;
+        n     -= run;
+        ch     = 0;
+    }
+}
+
+static void scale_channels_float( AIOCountsConverter *cc, float *volts, unsigned n )
+{
+    while ( n ) {
+        unsigned run = MIN( n, cc->scale_size );
+        cc->ScaleVoltsFloat( cc->scale, cc->offset, volts, run );
+        volts += run;
+        n     -= run;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+static AIORET_TYPE reserve_scratch( AIOCountsConverter *cc, unsigned num_counts )
+{
+    unsigned num_volts = num_counts / (cc->num_oversamples + 1) + 2;
+
+    if ( cc->countsbuf_size < num_counts ) {
+        uint16_t *tmp = (uint16_t *)realloc( cc->countsbuf, num_counts*sizeof(uint16_t) );
+        if ( !tmp )
+            return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        cc->countsbuf      = tmp;
+        cc->countsbuf_size = num_counts;
+    }
+    if ( cc->voltsbuf_size < num_volts ) {
+        double *tmp = (double *)realloc( cc->voltsbuf, num_volts*sizeof(double) );
+        if ( !tmp )
+            return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        cc->voltsbuf      = tmp;
+        cc->voltsbuf_size = num_volts;
+    }
+    return AIOUSB_SUCCESS;
+}
+
 /*----------------------------------------------------------------------------*/
 /**
  * @param cc Counts converter object
@@ -121,60 +511,128 @@ double Convert( AIOGainRange range, unsigned short sum )
  * @param num_counts  number of counts to convert
  * 
  * @return Number of tobufptr objects that have been created
+ * @note Complete oversample groups are summed with the SIMD kernel, partial
+ *       groups at either end of the batch are carried across calls in 
+ *       cc->sum / cc->os_count, the batch's averages are scaled in one
+ *       pass and the whole batch of volts goes into the fifo with one PushN
  */
 AIORET_TYPE AIOCountsConverterConvertFifo( AIOCountsConverter *cc, void *tobufptr, void *frombufptr , unsigned num_counts )
 {
     AIOFifoVolts *tofifo     = (AIOFifoVolts*)tobufptr;
     AIOFifoCounts *fromfifo  = (AIOFifoCounts*)frombufptr;
+    unsigned samplesize      = cc->num_oversamples + 1;
+    unsigned pos = 0, take, first_channel = cc->channel_count;
+    int num_converted = 0;
 
     cc->converted_count = 0;
-    double tmpvolt;
-    int pos;
-    unsigned rounded_num_counts = num_counts;
-    unsigned short *tmpbuf = (unsigned short *)malloc( num_counts*sizeof(uint16_t) );
+    if ( reserve_scratch( cc, num_counts ) != AIOUSB_SUCCESS )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
 
-    int tmpval = fromfifo->PopN( fromfifo, tmpbuf, rounded_num_counts );
-    if ( tmpval != (int)rounded_num_counts*(int)sizeof(uint16_t ) ) {
+    int tmpval = fromfifo->PopN( fromfifo, cc->countsbuf, num_counts );
+    if ( tmpval != (int)num_counts*(int)sizeof(uint16_t ) ) {
         return -3;
     }
-    int num_converted = 0;
-    int initial = (cc->scan_count *(cc->num_channels)*(cc->num_oversamples + 1)) + 
-        cc->channel_count * ( cc->num_oversamples + 1) + cc->os_count;
-
-    for ( int tobuf_pos = 0; cc->continue_conversion( cc, rounded_num_counts) ; cc->scan_count ++ ) {
-        for ( ; cc->channel_count < cc->num_channels && cc->converted_count < rounded_num_counts; cc->channel_count ++ , tobuf_pos ++  ) {
-            for ( ; cc->os_count < (cc->num_oversamples + 1) && cc->converted_count < rounded_num_counts; cc->os_count ++ ) {
 
-                pos = (cc->scan_count *(cc->num_channels)*(cc->num_oversamples + 1)) + 
-                    cc->channel_count * ( cc->num_oversamples + 1) + cc->os_count - initial;
+    load_scale( cc );
 
-                cc->sum += tmpbuf[pos];
+    while ( cc->continue_conversion( cc, num_counts ) ) {
+        if ( cc->os_count == 0 && pos + samplesize <= num_counts ) {
+            cc->sum = sum_group( cc, cc->channel_count, &cc->countsbuf[pos], samplesize );
+            take    = samplesize;
+        } else {
+            const uint16_t *table = ( cc->cal_tables ? cc->cal_tables[cc->channel_count] : NULL );
+            take     = MIN( samplesize - cc->os_count, num_counts - pos );
+            cc->sum += ( table ? cal_sum_counts_scalar( table, &cc->countsbuf[pos], take ) : sum_counts_scalar( &cc->countsbuf[pos], take ) );
+        }
+        pos                 += take;
+        cc->os_count        += take;
+        cc->converted_count  = pos;
 
-                cc->converted_count ++;
-            }
-            if ( cc->os_count >= (cc->num_oversamples + 1) ) { 
-                cc->os_count = 0;
-                cc->sum /= (cc->num_oversamples + 1);
-                tmpvolt = (double)Convert( cc->gain_ranges[cc->channel_count], cc->sum );
-                tofifo->Push( tofifo, tmpvolt );
-                num_converted ++;
-                cc->sum = 0;
-            } else {
-                AIOUSB_DEVEL("Leaving !\n");
-                goto done_procssing;
-            }
+        if ( cc->os_count < samplesize ) {
+            AIOUSB_DEVEL("Leaving !\n");
+            break;
         }
-        if ( cc->channel_count >= cc->num_channels ) {
+        cc->os_count = 0;
+        cc->voltsbuf[num_converted++] = (unsigned short)(cc->sum / samplesize);
+        cc->sum = 0;
+
+        if ( ++cc->channel_count >= cc->num_channels ) {
             cc->channel_count = 0;
-        } else {
-            AIOUSB_DEVEL("other leaving\n");
-            goto done_procssing;
+            cc->scan_count ++;
         }
     }
- done_procssing:
-    free(tmpbuf);
+
+    if ( num_converted ) {
+        scale_channels( cc, cc->voltsbuf, first_channel, num_converted );
+        tofifo->PushN( tofifo, cc->voltsbuf, num_converted );
+    }
+
     return num_converted;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Converts num_scans whole scans of counts, each channel followed by
+ * its oversamples, into one volts value per channel. Unlike ConvertFifo
+ * nothing is carried between calls.
+ * @return number of scans converted
+ */
+AIORET_TYPE AIOCountsConverterConvertScans( AIOCountsConverter *cc, const uint16_t *counts, unsigned num_scans, double *volts )
+{
+    unsigned samplesize;
+    if ( !cc || !counts || !volts )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    samplesize = cc->num_oversamples + 1;
+
+    load_scale( cc );
+    for ( unsigned scan = 0, i = 0; scan < num_scans; scan ++ ) {
+        for ( unsigned ch = 0; ch < cc->num_channels; ch ++, counts += samplesize )
+            volts[i++] = (unsigned short)( sum_group( cc, ch, counts, samplesize ) / samplesize );
+    }
+    scale_channels( cc, volts, 0, num_scans * cc->num_channels );
+    return num_scans;
+}
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief AIOCountsConverterConvertScans for single precision callers
+ */
+AIORET_TYPE AIOCountsConverterConvertScansFloat( AIOCountsConverter *cc, const uint16_t *counts, unsigned num_scans, float *volts )
+{
+    unsigned samplesize;
+    if ( !cc || !counts || !volts )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    samplesize = cc->num_oversamples + 1;
+
+    load_scale( cc );
+    for ( unsigned scan = 0, i = 0; scan < num_scans; scan ++ ) {
+        for ( unsigned ch = 0; ch < cc->num_channels; ch ++, counts += samplesize )
+            volts[i++] = (unsigned short)( sum_group( cc, ch, counts, samplesize ) / samplesize );
+    }
+    scale_channels_float( cc, volts, num_scans * cc->num_channels );
+    return num_scans;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief AIOCountsConverterConvertScans writing each channel's volts to its
+ * own array, scan i going to channels[ch][first+i]
+ */
+AIORET_TYPE AIOCountsConverterConvertScansToChannels( AIOCountsConverter *cc, const uint16_t *counts, unsigned num_scans, double **channels, unsigned first )
+{
+    unsigned samplesize;
+    if ( !cc || !counts || !channels )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    samplesize = cc->num_oversamples + 1;
+
+    load_scale( cc );
+    for ( unsigned scan = 0; scan < num_scans; scan ++ ) {
+        for ( unsigned ch = 0; ch < cc->num_channels; ch ++, counts += samplesize ) {
+            unsigned sum = sum_group( cc, ch, counts, samplesize );
+            channels[ch][first+scan] = cc->scale[ch] * (unsigned short)(sum / samplesize) + cc->offset[ch];
+        }
+    }
+    return num_scans;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -206,12 +664,25 @@ PUBLIC_EXTERN AIOGainRange* NewAIOGainRangeFromADCConfigBlock( ADCConfigBlock *a
     if (!tmp )
         return tmp;
 
+    AIOGainRangeLoadFromADCConfigBlock( tmp, adc );
+    return tmp;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Refills ranges ( AD_NUM_GAIN_CODE_REGISTERS of them, as from
+ * NewAIOGainRangeFromADCConfigBlock ) from adc's gain codes in place
+ */
+PUBLIC_EXTERN AIORET_TYPE AIOGainRangeLoadFromADCConfigBlock( AIOGainRange *ranges, ADCConfigBlock *adc )
+{
+    if ( !ranges || !adc )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
     for ( int i = 0; i < AD_NUM_GAIN_CODE_REGISTERS ; i ++ ) {
-        tmp[i].min = adRanges[ adc->registers[i] ].minVolts;
-        tmp[i].max = adRanges[ adc->registers[i] ].minVolts + adRanges[ adc->registers[i] ].range;
+        ranges[i].min = adRanges[ adc->registers[i] ].minVolts;
+        ranges[i].max = adRanges[ adc->registers[i] ].minVolts + adRanges[ adc->registers[i] ].range;
     }
-
-    return tmp;
+    return AIOUSB_SUCCESS;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -461,6 +932,159 @@ TEST(Composite,FifoWriting )
     }
 }
 
+TEST(Composite,VectorizedMatchesScalar )
+{
+    int num_channels     = 16;
+    int num_oversamples  = 255;
+    int num_scans        = 50;
+    int total_size       = num_channels * (num_oversamples+1) * num_scans;
+    unsigned short *from_buf = (unsigned short *)malloc(total_size*sizeof(unsigned short));
+    double *scalar_volts = (double *)malloc(num_channels*num_scans*sizeof(double));
+    double *simd_volts   = (double *)malloc(num_channels*num_scans*sizeof(double));
+    AIOGainRange ranges[16];
+
+    for ( int i = 0; i < num_channels; i ++ ) {
+        ranges[i].min = -(double)(i % 4) * 2.5;
+        ranges[i].max = 10.0 - (i % 3);
+    }
+    for ( int i = 0; i < total_size; i ++ )
+        from_buf[i] = (unsigned short)(rand() & 0xffff);
+
+    AIOFifoCounts *infifo  = NewAIOFifoCounts( total_size );
+    AIOFifoVolts  *outfifo = NewAIOFifoVolts( num_channels*num_scans );
+    AIOCountsConverter *cc = NewAIOCountsConverter( num_channels, ranges, num_oversamples, sizeof(unsigned short) );
+
+    AIOCountsConverterSetVectorized( cc, AIOUSB_FALSE );
+    infifo->PushN( infifo, from_buf, total_size );
+    EXPECT_EQ( num_channels*num_scans, cc->ConvertFifo( cc, outfifo, infifo, total_size ) );
+    outfifo->PopN( outfifo, scalar_volts, num_channels*num_scans );
+
+    /* Feed the same data in uneven pieces so partial oversample groups are carried across calls */
+    AIOCountsConverterReset( cc );
+    AIOCountsConverterSetVectorized( cc, AIOUSB_TRUE );
+    int converted = 0;
+    for ( int pos = 0, chunk = 1000; pos < total_size; pos += chunk ) {
+        chunk = MIN( chunk, total_size - pos );
+        infifo->PushN( infifo, &from_buf[pos], chunk );
+        converted += cc->ConvertFifo( cc, outfifo, infifo, chunk );
+    }
+    EXPECT_EQ( num_channels*num_scans, converted );
+    outfifo->PopN( outfifo, simd_volts, num_channels*num_scans );
+
+    for ( int scan = 0, i = 0; scan < num_scans; scan ++ ) {
+        for ( int ch = 0; ch < num_channels; ch ++, i ++ ) {
+            unsigned sum = 0;
+            for ( int os = 0; os < num_oversamples + 1; os ++ )
+                sum += from_buf[ i*(num_oversamples+1) + os ];
+            ASSERT_EQ( Convert( ranges[ch], sum / (num_oversamples+1) ), scalar_volts[i] ) << "scan " << scan << " channel " << ch;
+            ASSERT_EQ( scalar_volts[i], simd_volts[i] ) << "scan " << scan << " channel " << ch;
+        }
+    }
+
+    DeleteAIOCountsConverter( cc );
+    DeleteAIOFifoCounts( infifo );
+    DeleteAIOFifoVolts( outfifo );
+    free(from_buf);
+    free(scalar_volts);
+    free(simd_volts);
+}
+
+TEST(Composite,VectorizedScaleMatchesScalar )
+{
+    int num_channels = 5, num_scans = 37;       /* runs that end part way through a vector */
+    unsigned short counts[5*37];
+    double scalar_volts[5*37], simd_volts[5*37];
+    float scalar_float[5*37], simd_float[5*37];
+    AIOGainRange ranges[5];
+
+    for ( int i = 0; i < num_channels; i ++ ) {
+        ranges[i].min = -(double)i * 1.25;
+        ranges[i].max = 10.0 - i;
+    }
+    for ( int i = 0; i < num_channels*num_scans; i ++ )
+        counts[i] = (unsigned short)(rand() & 0xffff);
+
+    AIOCountsConverter *cc = NewAIOCountsConverter( num_channels, ranges, 0, sizeof(unsigned short) );
+    AIOCountsConverterSetVectorized( cc, AIOUSB_FALSE );
+    EXPECT_EQ( num_scans, AIOCountsConverterConvertScans( cc, counts, num_scans, scalar_volts ) );
+    EXPECT_EQ( num_scans, AIOCountsConverterConvertScansFloat( cc, counts, num_scans, scalar_float ) );
+    AIOCountsConverterSetVectorized( cc, AIOUSB_TRUE );
+    EXPECT_EQ( num_scans, AIOCountsConverterConvertScans( cc, counts, num_scans, simd_volts ) );
+    EXPECT_EQ( num_scans, AIOCountsConverterConvertScansFloat( cc, counts, num_scans, simd_float ) );
+
+    for ( int i = 0; i < num_channels*num_scans; i ++ ) {
+        ASSERT_EQ( Convert( ranges[i % num_channels], counts[i] ), scalar_volts[i] ) << "value " << i;
+        ASSERT_EQ( scalar_volts[i], simd_volts[i] ) << "value " << i;
+        ASSERT_EQ( (float)scalar_volts[i], scalar_float[i] ) << "value " << i;
+        ASSERT_EQ( scalar_float[i], simd_float[i] ) << "value " << i;
+    }
+    DeleteAIOCountsConverter( cc );
+}
+
+TEST(Composite,CalTablesLookUpEachCount )
+{
+    int num_channels     = 3;
+    int num_oversamples  = 12;
+    int num_scans        = 40;
+    int total_size       = num_channels * (num_oversamples+1) * num_scans;
+    unsigned short *from_buf = (unsigned short *)malloc(total_size*sizeof(unsigned short));
+    unsigned short *table    = (unsigned short *)malloc(CAL_TABLE_WORDS*sizeof(unsigned short));
+    const uint16_t *tables[3] = { table, NULL, table };
+    double *fifo_volts = (double *)malloc(num_channels*num_scans*sizeof(double));
+    double *scan_volts = (double *)malloc(num_channels*num_scans*sizeof(double));
+    AIOGainRange ranges[3] = { { -10.0, 10.0 }, { 0.0, 5.0 }, { -2.0, 2.0 } };
+
+    for ( int i = 0; i < CAL_TABLE_WORDS; i ++ )
+        table[i] = (unsigned short)( CAL_TABLE_WORDS - 1 - i );
+    for ( int i = 0; i < total_size; i ++ )
+        from_buf[i] = (unsigned short)( i % 7 == 0 ? 0xffff : rand() & 0xffff );
+
+    AIOFifoCounts *infifo  = NewAIOFifoCounts( total_size );
+    AIOFifoVolts  *outfifo = NewAIOFifoVolts( num_channels*num_scans );
+    AIOCountsConverter *cc = NewAIOCountsConverter( num_channels, ranges, num_oversamples, sizeof(unsigned short) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCountsConverterSetCalTables( cc, tables ) );
+    EXPECT_EQ( cc->cal_tables[0], cc->cal_tables[2] ) << "channels sharing a table share the copy";
+    table[0] = 0;                       /* the converter works from its own copy */
+
+    int converted = 0;
+    for ( int pos = 0, chunk = 333; pos < total_size; pos += chunk ) {
+        chunk = MIN( chunk, total_size - pos );
+        infifo->PushN( infifo, &from_buf[pos], chunk );
+        converted += cc->ConvertFifo( cc, outfifo, infifo, chunk );
+    }
+    EXPECT_EQ( num_channels*num_scans, converted );
+    outfifo->PopN( outfifo, fifo_volts, num_channels*num_scans );
+    AIOCountsConverterSetVectorized( cc, AIOUSB_FALSE );
+    EXPECT_EQ( num_scans, AIOCountsConverterConvertScans( cc, from_buf, num_scans, scan_volts ) );
+
+    for ( int scan = 0, i = 0; scan < num_scans; scan ++ ) {
+        for ( int ch = 0; ch < num_channels; ch ++, i ++ ) {
+            unsigned sum = 0;
+            for ( int os = 0; os < num_oversamples + 1; os ++ ) {
+                unsigned short count = from_buf[ i*(num_oversamples+1) + os ];
+                sum += ( ch == 1 ? count : CAL_TABLE_WORDS - 1 - count );
+            }
+            ASSERT_EQ( Convert( ranges[ch], sum / (num_oversamples+1) ), fifo_volts[i] ) << "scan " << scan << " channel " << ch;
+            ASSERT_EQ( fifo_volts[i], scan_volts[i] ) << "scan " << scan << " channel " << ch;
+        }
+    }
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOCountsConverterSetCalTables( cc, NULL ) );
+    EXPECT_EQ( 1, AIOCountsConverterConvertScans( cc, from_buf, 1, scan_volts ) );
+    unsigned sum = 0;
+    for ( int os = 0; os < num_oversamples + 1; os ++ )
+        sum += from_buf[os];
+    EXPECT_EQ( Convert( ranges[0], sum / (num_oversamples+1) ), scan_volts[0] ) << "clearing the tables stops the correction";
+
+    DeleteAIOCountsConverter( cc );
+    DeleteAIOFifoCounts( infifo );
+    DeleteAIOFifoVolts( outfifo );
+    free(from_buf);
+    free(table);
+    free(fifo_volts);
+    free(scan_volts);
+}
+
 class AllGainCode : public ::testing::TestWithParam<ADGainCode> {};
 TEST_P( AllGainCode, FromADCConfigBlock )
 {
@@ -43,6 +43,18 @@ typedef struct aio_counts_converter {
     AIORET_TYPE (*Convert)( struct aio_counts_converter *cc, void *tobuf, void *frombuf, unsigned num_bytes );
     AIORET_TYPE (*ConvertFifo)( struct aio_counts_converter *cc, void *tobuf, void *frombuf , unsigned num_bytes );
     AIOUSB_BOOL discardFirstSample;
+    unsigned (*SumCounts)( const uint16_t *counts, unsigned num_counts );
+    uint16_t *countsbuf;                /**< Scratch for counts popped from the fifo, grown on demand */
+    unsigned countsbuf_size;
+    double *voltsbuf;                   /**< Scratch for one batch of volts pushed with a single PushN */
+    unsigned voltsbuf_size;
+    double *scale;                      /**< Per channel (max-min)/65536, the channels repeated out to scale_size */
+    double *offset;                     /**< Per channel min, laid out as scale */
+    unsigned scale_size;
+    uint16_t **cal_tables;              /**< Per channel host calibration, NULL when uncorrected, see AIOCountsConverterSetCalTables */
+    unsigned (*CalSumCounts)( const uint16_t *table, const uint16_t *counts, unsigned num_counts );
+    void (*ScaleVolts)( const double *scale, const double *offset, double *volts, unsigned n );
+    void (*ScaleVoltsFloat)( const double *scale, const double *offset, float *volts, unsigned n );
 } AIOCountsConverter;
 
 
@@ -54,13 +66,20 @@ PUBLIC_EXTERN AIOCountsConverter *NewAIOCountsConverterWithScanLimiter( void *bu
                                                                         unsigned num_oversamples,unsigned unit_size );
 
 PUBLIC_EXTERN void AIOCountsConverterReset( AIOCountsConverter *cc );
+PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterSetScanLimit( AIOCountsConverter *cc, unsigned num_scans );
+PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterSetVectorized( AIOCountsConverter *cc, AIOUSB_BOOL vectorized );
+PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterSetCalTables( AIOCountsConverter *cc, const uint16_t *const *tables );
 PUBLIC_EXTERN void DeleteAIOCountsConverter( AIOCountsConverter *ccv );
 PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertNScans( AIOCountsConverter *cc, int num_scans );
 PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertAllAvailableScans( AIOCountsConverter *cc );
 PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvert( AIOCountsConverter *cc, void *tobuf, void *frombuf, unsigned num_bytes );
 PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertFifo( AIOCountsConverter *cc, void *tobuf, void *frombuf , unsigned num_bytes );
+PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertScans( AIOCountsConverter *cc, const uint16_t *counts, unsigned num_scans, double *volts );
+PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertScansFloat( AIOCountsConverter *cc, const uint16_t *counts, unsigned num_scans, float *volts );
+PUBLIC_EXTERN AIORET_TYPE AIOCountsConverterConvertScansToChannels( AIOCountsConverter *cc, const uint16_t *counts, unsigned num_scans, double **channels, unsigned first );
 
 PUBLIC_EXTERN AIOGainRange* NewAIOGainRangeFromADCConfigBlock( ADCConfigBlock *adc );
+PUBLIC_EXTERN AIORET_TYPE AIOGainRangeLoadFromADCConfigBlock( AIOGainRange *ranges, ADCConfigBlock *adc );
 PUBLIC_EXTERN void  DeleteAIOGainRange( AIOGainRange* );
 
 #ifdef __aiousb_cplusplus
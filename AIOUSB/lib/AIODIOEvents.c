@@ -0,0 +1,348 @@
+/**
+ * @file   AIODIOEvents.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Change of state capture on streamed DIO input
+ *
+ * Polling DIO_ReadAll and diffing costs a USB round trip per look and
+ * misses anything shorter than the poll interval. Fed the blocks of an
+ * AIODIOStream, the scanner sees every sample the read clock took.
+ *
+ * Samples are compared four at a time: four 16 bit samples make one 64 bit
+ * word, which is XORed with itself shifted up one sample ( the previous
+ * block's last sample shifted in ) and masked with the watched bits. Quiet
+ * input costs one compare per four samples, which keeps the scan well
+ * ahead of AIODIOEVENTS_MAX_CLOCK_HZ; only words with a change are taken
+ * apart lane by lane.
+ */
+
+#include "AIODIOEvents.h"
+#include "AIOUSB_Log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define AIODIOEVENTS_LANES  ( sizeof(uint64_t) / sizeof(uint16_t) )
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Makes notify_fd readable while events are waiting or the stream
+ *        has ended, and drains it otherwise
+ */
+static void aiodioevents_notify( AIODIOEvents *events )
+{
+    AIOUSB_BOOL ready;
+    char byte = 0;
+
+    if ( events->notify_fd[0] < 0 )
+        return;
+    ready = ( events->ended || events->ring->rdelta( events->ring ) ? AIOUSB_TRUE : AIOUSB_FALSE );
+    if ( ready && !events->notify_signaled ) {
+        if ( write( events->notify_fd[1], &byte, 1 ) == 1 )
+            events->notify_signaled = AIOUSB_TRUE;
+    } else if ( !ready && events->notify_signaled ) {
+        if ( read( events->notify_fd[0], &byte, 1 ) == 1 )
+            events->notify_signaled = AIOUSB_FALSE;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Wakes readers after events were queued or the stream ended
+ */
+static void aiodioevents_signal( AIODIOEvents *events )
+{
+    pthread_mutex_lock( &events->lock );
+    aiodioevents_notify( events );
+    pthread_cond_broadcast( &events->cond );
+    pthread_mutex_unlock( &events->lock );
+}
+
+/*----------------------------------------------------------------------------*/
+static void aiodioevents_flush( AIODIOEvents *events, AIODIOEvent *batch, unsigned num )
+{
+    AIORET_TYPE size = events->ring->Write( events->ring, batch, num * sizeof(AIODIOEvent) );
+    unsigned kept = ( size > 0 ? (unsigned)size / sizeof(AIODIOEvent) : 0 );
+    events->events  += num;
+    events->dropped += num - kept;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @param ring_events events the ring holds, 0 for AIODIOEVENTS_DEFAULT_RING_EVENTS
+ * @param watch bits whose changes are reported, 0xffff for all of them
+ */
+AIODIOEvents *NewAIODIOEvents( unsigned ring_events, unsigned short watch )
+{
+    AIODIOEvents *events = (AIODIOEvents *)calloc( 1, sizeof(AIODIOEvents) );
+    pthread_condattr_t attr;
+    if ( !events )
+        return NULL;
+    if ( !ring_events )
+        ring_events = AIODIOEVENTS_DEFAULT_RING_EVENTS;
+
+    /* One slot of a lock free ring always stays empty */
+    events->ring = NewAIOFifoLockFree( ( ring_events + 1 ) * sizeof(AIODIOEvent), sizeof(AIODIOEvent) );
+    if ( !events->ring || !events->ring->data ) {
+        if ( events->ring )
+            DeleteAIOFifo( events->ring );
+        free( events );
+        return NULL;
+    }
+    events->watch = watch;
+    events->notify_fd[0] = events->notify_fd[1] = -1;
+    pthread_mutex_init( &events->lock, NULL );
+    pthread_condattr_init( &attr );
+    pthread_condattr_setclock( &attr, CLOCK_MONOTONIC );
+    pthread_cond_init( &events->cond, &attr );
+    pthread_condattr_destroy( &attr );
+
+    return events;
+}
+
+/*----------------------------------------------------------------------------*/
+void DeleteAIODIOEvents( AIODIOEvents *events )
+{
+    if ( !events )
+        return;
+    if ( events->notify_fd[0] >= 0 ) {
+        close( events->notify_fd[0] );
+        close( events->notify_fd[1] );
+    }
+    DeleteAIOFifo( events->ring );
+    pthread_cond_destroy( &events->cond );
+    pthread_mutex_destroy( &events->lock );
+    free( events );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Empties the ring and starts sample numbering again. Only call it
+ *        while nothing is scanning or reading, as AIODIOStreamStart does.
+ */
+AIORET_TYPE AIODIOEventsReset( AIODIOEvents *events )
+{
+    if ( !events )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    pthread_mutex_lock( &events->lock );
+    events->ring->Reset( events->ring );
+    events->primed  = AIOUSB_FALSE;
+    events->ended   = AIOUSB_FALSE;
+    events->sample  = 0;
+    events->events  = 0;
+    events->dropped = 0;
+    aiodioevents_notify( events );
+    pthread_mutex_unlock( &events->lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Queues an event for every sample where a watched bit differs from
+ *        the sample before. The very first sample only sets the starting
+ *        state. Events that do not fit in the ring are counted as dropped.
+ *        Only one thread may scan.
+ * @return events found
+ */
+AIORET_TYPE AIODIOEventsScan( AIODIOEvents *events, const unsigned short *data, unsigned num_samples )
+{
+    AIODIOEvent batch[AIODIOEVENTS_BATCH];
+    unsigned num = 0, i = 0;
+    unsigned long long found;
+    uint64_t watch;
+    uint16_t last;
+
+    if ( !events || !data )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( !num_samples )
+        return 0;
+    found = events->events;
+    watch = events->watch * 0x0001000100010001ULL;   /* the mask in every lane */
+    if ( !events->primed ) {
+        events->last   = data[0];
+        events->primed = AIOUSB_TRUE;
+        i = 1;
+    }
+    last = events->last;
+
+    for ( ; i + AIODIOEVENTS_LANES <= num_samples; i += AIODIOEVENTS_LANES ) {
+        uint64_t word = (uint64_t)data[i] | (uint64_t)data[i+1] << 16 | (uint64_t)data[i+2] << 32 | (uint64_t)data[i+3] << 48;
+        uint64_t diff = ( word ^ ( ( word << 16 ) | last ) ) & watch;
+        last = data[i+3];
+        while ( diff ) {
+            unsigned lane = __builtin_ctzll( diff ) / 16;
+            batch[num].sample = events->sample + i + lane;
+            batch[num].mask   = (uint16_t)( diff >> ( 16 * lane ) );
+            batch[num].value  = data[i+lane];
+            diff &= ~( 0xffffULL << ( 16 * lane ) );
+            if ( ++num == AIODIOEVENTS_BATCH ) {
+                aiodioevents_flush( events, batch, num );
+                num = 0;
+            }
+        }
+    }
+    for ( ; i < num_samples; i ++ ) {
+        uint16_t diff = ( data[i] ^ last ) & events->watch;
+        last = data[i];
+        if ( !diff )
+            continue;
+        batch[num].sample = events->sample + i;
+        batch[num].mask   = diff;
+        batch[num].value  = data[i];
+        if ( ++num == AIODIOEVENTS_BATCH ) {
+            aiodioevents_flush( events, batch, num );
+            num = 0;
+        }
+    }
+    if ( num )
+        aiodioevents_flush( events, batch, num );
+
+    events->last    = last;
+    events->sample += num_samples;
+    found = events->events - found;
+    if ( found )
+        aiodioevents_signal( events );
+
+    return (AIORET_TYPE)found;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Marks the end of the input, so blocked readers return once the
+ *        ring is empty
+ */
+AIORET_TYPE AIODIOEventsEnd( AIODIOEvents *events )
+{
+    if ( !events )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    pthread_mutex_lock( &events->lock );
+    events->ended = AIOUSB_TRUE;
+    aiodioevents_notify( events );
+    pthread_cond_broadcast( &events->cond );
+    pthread_mutex_unlock( &events->lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes up to max_events events, oldest first
+ * @param timeout_ms how long to wait for the first event: 0 returns at
+ *        once, a negative timeout waits until an event arrives or the
+ *        input ends
+ * @return events copied, 0 if none came in time or the input has ended
+ */
+AIORET_TYPE AIODIOEventsRead( AIODIOEvents *events, AIODIOEvent *out, unsigned max_events, int timeout_ms )
+{
+    AIORET_TYPE size;
+    if ( !events || !out )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    if ( timeout_ms != 0 ) {
+        struct timespec deadline;
+        clock_gettime( CLOCK_MONOTONIC, &deadline );
+        deadline.tv_sec  += timeout_ms / 1000;
+        deadline.tv_nsec += ( timeout_ms % 1000 ) * 1000000L;
+        if ( deadline.tv_nsec >= 1000000000L ) {
+            deadline.tv_sec ++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock( &events->lock );
+        while ( !events->ended && !events->ring->rdelta( events->ring ) ) {
+            if ( timeout_ms < 0 )
+                pthread_cond_wait( &events->cond, &events->lock );
+            else if ( pthread_cond_timedwait( &events->cond, &events->lock, &deadline ) == ETIMEDOUT )
+                break;
+        }
+        pthread_mutex_unlock( &events->lock );
+    }
+
+    size = events->ring->Read( events->ring, out, max_events * sizeof(AIODIOEvent) );
+    if ( size > 0 ) {
+        pthread_mutex_lock( &events->lock );
+        aiodioevents_notify( events );
+        pthread_mutex_unlock( &events->lock );
+    }
+    return ( size > 0 ? size / (AIORET_TYPE)sizeof(AIODIOEvent) : 0 );
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODIOEventsAvailable( AIODIOEvents *events )
+{
+    if ( !events )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return events->ring->rdelta( events->ring ) / sizeof(AIODIOEvent);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief File descriptor for select / poll / epoll that is readable while
+ *        events are waiting or once the input has ended. Never read from
+ *        it; AIODIOEventsRead takes care of that. It stays valid until the
+ *        events are deleted.
+ * @return the descriptor, or negative error code
+ */
+AIORET_TYPE AIODIOEventsGetPollFd( AIODIOEvents *events )
+{
+    AIORET_TYPE retval;
+    if ( !events )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock( &events->lock );
+    if ( events->notify_fd[0] < 0 ) {
+        int fds[2];
+        if ( pipe( fds ) != 0 ) {
+            AIOUSB_ERROR("Unable to create notification pipe\n");
+            retval = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+            goto out_AIODIOEventsGetPollFd;
+        }
+        for ( int i = 0; i < 2; i ++ ) {
+            fcntl( fds[i], F_SETFL, fcntl( fds[i], F_GETFL ) | O_NONBLOCK );
+            fcntl( fds[i], F_SETFD, FD_CLOEXEC );
+        }
+        events->notify_signaled = AIOUSB_FALSE;
+        events->notify_fd[1] = fds[1];
+        events->notify_fd[0] = fds[0];
+    }
+    aiodioevents_notify( events );      /* events may already be waiting */
+    retval = events->notify_fd[0];
+
+ out_AIODIOEventsGetPollFd:
+    pthread_mutex_unlock( &events->lock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Events lost because the ring was full
+ */
+AIORET_TYPE AIODIOEventsGetDropped( AIODIOEvents *events )
+{
+    if ( !events )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return (AIORET_TYPE)events->dropped;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief The last sample scanned, so the current input state, or
+ *        -AIOUSB_ERROR_INVALID_DATA before the first sample
+ */
+AIORET_TYPE AIODIOEventsGetLastValue( AIODIOEvents *events )
+{
+    if ( !events )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( !events->primed )
+        return -AIOUSB_ERROR_INVALID_DATA;
+    return events->last;
+}
+
+#ifdef __cplusplus
+}
+#endif
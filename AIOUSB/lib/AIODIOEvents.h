@@ -0,0 +1,69 @@
+/**
+ * @file   AIODIOEvents.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Change of state capture on streamed DIO input
+ *
+ * Scans each block of a DIO input stream for bit transitions and queues
+ * one compact event per changed sample in a lock free ring, for readers
+ * that want edges rather than every captured word.
+ */
+
+#ifndef _AIO_DIO_EVENTS_H
+#define _AIO_DIO_EVENTS_H
+
+#include "AIOTypes.h"
+#include "AIOFifo.h"
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIODIOEVENTS_DEFAULT_RING_EVENTS  ( 64*1024 )
+#define AIODIOEVENTS_MAX_CLOCK_HZ         40000000.0    /**< Fastest read clock DIO_StreamSetClocks will set */
+#define AIODIOEVENTS_BATCH                64            /**< Events gathered on the stack before going into the ring */
+
+/**
+ * @brief One sample at which at least one watched bit changed
+ */
+typedef struct aio_dio_event {
+    uint64_t sample;                    /**< Position of the sample in the stream, the first being 0 */
+    uint16_t mask;                      /**< Watched bits that differ from the sample before */
+    uint16_t value;                     /**< The whole input word at that sample */
+} AIODIOEvent;
+
+typedef struct aio_dio_events {
+    AIOFifo *ring;                      /**< Lock free ring of AIODIOEvent */
+    uint16_t watch;                     /**< Bits whose changes are reported */
+    uint16_t last;                      /**< Last sample scanned */
+    AIOUSB_BOOL primed;                 /**< last holds a sample */
+    uint64_t sample;                    /**< Samples scanned */
+    unsigned long long events;          /**< Events found, including dropped ones */
+    unsigned long long dropped;         /**< Events lost to a full ring */
+    AIOUSB_BOOL ended;                  /**< No more samples are coming */
+    int notify_fd[2];                   /**< Poll pipe, created on first use */
+    AIOUSB_BOOL notify_signaled;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} AIODIOEvents;
+
+PUBLIC_EXTERN AIODIOEvents *NewAIODIOEvents( unsigned ring_events, unsigned short watch );
+PUBLIC_EXTERN void DeleteAIODIOEvents( AIODIOEvents *events );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventsReset( AIODIOEvents *events );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventsScan( AIODIOEvents *events, const unsigned short *data, unsigned num_samples );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventsEnd( AIODIOEvents *events );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventsRead( AIODIOEvents *events, AIODIOEvent *out, unsigned max_events, int timeout_ms );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventsAvailable( AIODIOEvents *events );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventsGetPollFd( AIODIOEvents *events );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventsGetDropped( AIODIOEvents *events );
+PUBLIC_EXTERN AIORET_TYPE AIODIOEventsGetLastValue( AIODIOEvents *events );
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,809 @@
+/**
+ * @file   AIODIOStream.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Continuous DIO streaming
+ *
+ * DIO_StreamFrame moves one caller supplied frame and returns, so anything
+ * the board clocks in between calls is lost and generated patterns stall
+ * while the caller refills. A stream keeps bulk transfers queued in both
+ * directions against lock free rings, so the caller only ever touches the
+ * rings and the endpoints never wait on it.
+ *
+ * On a real device each direction keeps an AIOTransferQueue of
+ * AIODIOSTREAM_NUM_TRANSFERS transfers submitted and resubmits them from
+ * their completions; one event thread pumps libusb and refills the output
+ * transfers parked for lack of data. Devices without a libusb handle
+ * ( testing devices, mocks ) get a pump thread per direction instead that
+ * goes through usb_bulk_transfer back to back: input is read straight into
+ * the free part of the ring and output is sent straight out of the filled
+ * part.
+ *
+ * An AIODIOEvents attached with AIODIOStreamSetEvents sees every input block
+ * as it comes off the endpoint, before the ring, so edges are found even
+ * when the ring overruns. A stream kept only for its events skips the ring
+ * altogether.
+ */
+
+#include "AIODIOStream.h"
+#include "AIOUSB_Core.h"
+#include "AIOUSB_DIO.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOUSB_Log.h"
+#include <string.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copies as much of data as fits into the ring
+ * @return bytes copied
+ */
+static unsigned aiodiostream_put( AIOFifo *ring, const unsigned char *data, unsigned size )
+{
+    AIOFifoRegion region;
+    AIORET_TYPE room = AIOFifoWriteAcquire( ring, &region, size );
+    if ( room <= 0 )
+        return 0;
+    memcpy( region.data[0], data, region.size[0] );
+    if ( region.size[1] )
+        memcpy( region.data[1], data + region.size[0], region.size[1] );
+    AIOFifoWriteCommit( ring, (unsigned)room );
+    return (unsigned)room;
+}
+
+/*----------------------------------------------------------------------------*/
+static AIORESULT aiodiostream_send( AIODIOStream *stream, unsigned char *data, int size )
+{
+    while ( size > 0 ) {
+        int bytes = 0;
+        int usbresult = stream->usb->usb_bulk_transfer( stream->usb,
+                                                        stream->out.endpoint,
+                                                        data,
+                                                        size,
+                                                        &bytes,
+                                                        stream->timeout
+                                                        );
+        if ( usbresult != LIBUSB_SUCCESS )
+            return LIBUSB_RESULT_TO_AIOUSB_RESULT( usbresult );
+        if ( bytes <= 0 )
+            return AIOUSB_ERROR_TIMEOUT;
+        data += bytes;
+        size -= bytes;
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+static void aiodiostream_fail( AIODIOStream *stream, AIORESULT result )
+{
+    AIOUSB_ERROR("DIO stream on device %lu stopped: %d\n", stream->DeviceIndex, (int)result );
+    if ( stream->result == AIOUSB_SUCCESS )
+        stream->result = result;
+    pthread_cond_broadcast( &stream->cond );
+    if ( stream->edges )
+        AIODIOEventsEnd( stream->edges );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Counts bytes of capture that came off the board, of which kept
+ *        made it into the ring, and reports them to the device statistics
+ */
+static void aiodiostream_account_input( AIODIOStream *stream, unsigned bytes, unsigned kept )
+{
+    AIOFifo *ring = (AIOFifo *)stream->in.ring;
+
+    stream->in.words += bytes / sizeof(unsigned short);
+    if ( kept < bytes ) {
+        stream->in.gaps += ( bytes - kept ) / sizeof(unsigned short);
+        AIOStatsRecordOverruns( stream->usb->stats, 1 );
+    }
+    AIOStatsRecordFifo( stream->usb->stats, ring->rdelta( ring ), ring->size );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Reads the input endpoint back to back until the stream stops.
+ *        Reads land in place in the ring; when the ring is too full to
+ *        take a whole packet the data still has to be taken off the board,
+ *        and whatever does not fit is counted as an overrun.
+ */
+static void *aiodiostream_capture( void *object )
+{
+    AIODIOStreamPump *pump = (AIODIOStreamPump *)object;
+    AIODIOStream *stream = pump->stream;
+    AIOFifo *ring = (AIOFifo *)pump->ring;
+    AIOFifoRegion region;
+
+    while ( !stream->exiting ) {
+        unsigned char *target = stream->scratch;
+        int size = (int)stream->block_bytes;
+        int bytes = 0, usbresult;
+
+        AIOFifoWriteAcquire( ring, &region, stream->block_bytes );
+        if ( stream->keep_words && region.size[0] >= AIODIOSTREAM_PACKET_BYTES ) {
+            target = (unsigned char *)region.data[0];
+            size   = region.size[0] - region.size[0] % AIODIOSTREAM_PACKET_BYTES;
+        }
+
+        usbresult = stream->usb->usb_bulk_transfer( stream->usb, pump->endpoint, target, size, &bytes, stream->timeout );
+        /* on a slow read clock a read can time out part way; what it got is still taken */
+        if ( usbresult != LIBUSB_SUCCESS && usbresult != LIBUSB_ERROR_TIMEOUT ) {
+            pthread_mutex_lock( &stream->lock );
+            aiodiostream_fail( stream, LIBUSB_RESULT_TO_AIOUSB_RESULT( usbresult ) );
+            pthread_mutex_unlock( &stream->lock );
+            break;
+        }
+        bytes -= bytes % sizeof(unsigned short);
+        if ( bytes <= 0 )
+            continue;           /* nothing to take yet */
+        if ( stream->edges )
+            AIODIOEventsScan( stream->edges, (unsigned short *)target, bytes / sizeof(unsigned short) );
+
+        if ( !stream->keep_words ) {
+            stream->in.words += bytes / sizeof(unsigned short);
+        } else if ( target == stream->scratch ) {
+            aiodiostream_account_input( stream, bytes, aiodiostream_put( ring, target, bytes ) );
+        } else {
+            AIOFifoWriteCommit( ring, bytes );
+            aiodiostream_account_input( stream, bytes, bytes );
+        }
+    }
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sends whatever is in the output ring, sleeping while it is empty.
+ *        Running dry while the write clock is going is counted as an
+ *        underrun, except when the stream is being drained.
+ */
+static void *aiodiostream_generate( void *object )
+{
+    AIODIOStreamPump *pump = (AIODIOStreamPump *)object;
+    AIODIOStream *stream = pump->stream;
+    AIOFifo *ring = (AIOFifo *)pump->ring;
+    AIOFifoRegion region;
+    AIORESULT result;
+    AIORET_TYPE size;
+    AIOUSB_BOOL dry = AIOUSB_TRUE;
+
+    pthread_mutex_lock( &stream->lock );
+    for ( ;; ) {
+        while ( !stream->exiting && !ring->rdelta( ring ) ) {
+            if ( !dry && !stream->draining )
+                pump->gaps ++;
+            dry = AIOUSB_TRUE;
+            pump->busy = AIOUSB_FALSE;
+            stream->primed = AIOUSB_TRUE;
+            pthread_cond_broadcast( &stream->cond );
+            pthread_cond_wait( &stream->cond, &stream->lock );
+        }
+        if ( stream->exiting )
+            break;
+        pump->busy = AIOUSB_TRUE;
+        pthread_mutex_unlock( &stream->lock );
+
+        size = AIOFifoReadAcquire( ring, &region, stream->block_bytes );
+        result = aiodiostream_send( stream, (unsigned char *)region.data[0], region.size[0] );
+        if ( result == AIOUSB_SUCCESS )
+            result = aiodiostream_send( stream, (unsigned char *)region.data[1], region.size[1] );
+        AIOFifoReadCommit( ring, size );
+
+        pthread_mutex_lock( &stream->lock );
+        if ( result != AIOUSB_SUCCESS ) {
+            aiodiostream_fail( stream, result );
+            break;
+        }
+        pump->words += size / sizeof(unsigned short);
+        stream->primed = AIOUSB_TRUE;
+        dry = AIOUSB_FALSE;
+        pthread_cond_broadcast( &stream->cond );
+    }
+    pump->busy = AIOUSB_FALSE;
+    pthread_cond_broadcast( &stream->cond );
+    pthread_mutex_unlock( &stream->lock );
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static void aiodiostream_async_fail( AIODIOStream *stream, AIORESULT result )
+{
+    pthread_mutex_lock( &stream->lock );
+    aiodiostream_fail( stream, result );
+    pthread_mutex_unlock( &stream->lock );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes a finished input transfer's words, a timed out one's
+ *        included, and resubmits it. Runs with the input queue locked.
+ */
+static void aiodiostream_capture_complete( AIOTransferQueue *queue, struct libusb_transfer *xfer, void *object )
+{
+    AIODIOStream *stream = (AIODIOStream *)object;
+    int usbresult;
+
+    if ( xfer->status == LIBUSB_TRANSFER_COMPLETED || xfer->status == LIBUSB_TRANSFER_TIMED_OUT ) {
+        int bytes = xfer->actual_length - xfer->actual_length % sizeof(unsigned short);
+        if ( bytes > 0 && stream->edges )
+            AIODIOEventsScan( stream->edges, (unsigned short *)xfer->buffer, bytes / sizeof(unsigned short) );
+        if ( bytes > 0 && !stream->keep_words ) {
+            stream->in.words += bytes / sizeof(unsigned short);
+        } else if ( bytes > 0 ) {
+            unsigned kept = aiodiostream_put( (AIOFifo *)stream->in.ring, xfer->buffer, bytes );
+            aiodiostream_account_input( stream, bytes, kept );
+        }
+        if ( ( usbresult = AIOTransferQueueSubmit( queue, xfer, stream->block_bytes ) ) != LIBUSB_SUCCESS )
+            aiodiostream_async_fail( stream, LIBUSB_RESULT_TO_AIOUSB_RESULT( usbresult ) );
+    } else if ( xfer->status != LIBUSB_TRANSFER_CANCELLED ) {
+        aiodiostream_async_fail( stream, LIBUSB_RESULT_TO_AIOUSB_RESULT( AIOTransferQueueGetError( xfer ) ) );
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Loads the next block of the output ring into xfer and submits it.
+ *        Called with the output queue locked.
+ * @return AIOUSB_FALSE if the ring is empty or the submit failed
+ */
+static AIOUSB_BOOL aiodiostream_fill( AIODIOStream *stream, struct libusb_transfer *xfer )
+{
+    AIOFifo *ring = (AIOFifo *)stream->out.ring;
+    AIOFifoRegion region;
+    AIORET_TYPE size = AIOFifoReadAcquire( ring, &region, stream->block_bytes );
+    int usbresult;
+
+    if ( size <= 0 )
+        return AIOUSB_FALSE;
+    /* busy before the ring looks empty, so AIODIOStreamStop can't finish early */
+    pthread_mutex_lock( &stream->lock );
+    stream->out.busy = AIOUSB_TRUE;
+    pthread_mutex_unlock( &stream->lock );
+    memcpy( xfer->buffer, region.data[0], region.size[0] );
+    if ( region.size[1] )
+        memcpy( xfer->buffer + region.size[0], region.data[1], region.size[1] );
+    AIOFifoReadCommit( ring, (unsigned)size );
+
+    if ( ( usbresult = AIOTransferQueueSubmit( stream->out.transfers, xfer, (unsigned)size ) ) != LIBUSB_SUCCESS ) {
+        aiodiostream_async_fail( stream, LIBUSB_RESULT_TO_AIOUSB_RESULT( usbresult ) );
+        return AIOUSB_FALSE;
+    }
+    return AIOUSB_TRUE;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Counts a sent block and refills the transfer, parking it for the
+ *        event thread when the ring is empty. The last transfer to go idle
+ *        clears busy. Runs with the output queue locked.
+ */
+static void aiodiostream_generate_complete( AIOTransferQueue *queue, struct libusb_transfer *xfer, void *object )
+{
+    AIODIOStream *stream = (AIODIOStream *)object;
+    AIOUSB_BOOL refilled = AIOUSB_FALSE;
+
+    if ( xfer->status == LIBUSB_TRANSFER_COMPLETED ) {
+        stream->out.words += xfer->actual_length / sizeof(unsigned short);
+        if ( xfer->actual_length < xfer->length )
+            aiodiostream_async_fail( stream, AIOUSB_ERROR_TIMEOUT );
+    } else if ( xfer->status != LIBUSB_TRANSFER_CANCELLED ) {
+        aiodiostream_async_fail( stream, LIBUSB_RESULT_TO_AIOUSB_RESULT( AIOTransferQueueGetError( xfer ) ) );
+    }
+
+    if ( stream->result == AIOUSB_SUCCESS && xfer->status == LIBUSB_TRANSFER_COMPLETED ) {
+        if ( !stream->primed ) {
+            pthread_mutex_lock( &stream->lock );
+            stream->primed = AIOUSB_TRUE;
+            pthread_cond_broadcast( &stream->cond );
+            pthread_mutex_unlock( &stream->lock );
+        }
+        if ( !( refilled = aiodiostream_fill( stream, xfer ) ) )
+            AIOTransferQueuePark( queue, xfer );
+    }
+
+    /* xfer still counts as pending until this returns */
+    if ( !refilled && AIOTransferQueuePending( queue ) == 1 ) {
+        pthread_mutex_lock( &stream->lock );
+        if ( stream->result == AIOUSB_SUCCESS && !stream->draining )
+            stream->out.gaps ++;
+        stream->out.busy = AIOUSB_FALSE;
+        pthread_cond_broadcast( &stream->cond );
+        pthread_mutex_unlock( &stream->lock );
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Event thread for the async transfers: runs the completions, hands
+ *        parked output transfers new data as it is written and lets
+ *        AIODIOStreamStart / AIODIOStreamStop know how far output has got.
+ *        Cancels everything on the way out.
+ */
+static void *aiodiostream_events( void *object )
+{
+    AIODIOStream *stream = (AIODIOStream *)object;
+    AIOTransferQueue *out = stream->out.transfers;
+    AIOFifo *ring = (AIOFifo *)stream->out.ring;
+    struct libusb_transfer *xfer;
+
+    while ( !stream->exiting ) {
+        struct timeval tv = { 0, AIODIOSTREAM_POLL_US };
+
+        if ( out ) {
+            AIOTransferQueueLock( out );
+            while ( stream->result == AIOUSB_SUCCESS && ( xfer = AIOTransferQueueUnpark( out ) ) ) {
+                if ( !aiodiostream_fill( stream, xfer ) ) {
+                    AIOTransferQueuePark( out, xfer );
+                    break;
+                }
+            }
+            AIOTransferQueueUnlock( out );
+
+            if ( !stream->primed && AIOTransferQueuePending( out ) == 0 && !ring->rdelta( ring ) ) {
+                pthread_mutex_lock( &stream->lock );
+                stream->primed = AIOUSB_TRUE;       /* nothing to prime with */
+                pthread_cond_broadcast( &stream->cond );
+                pthread_mutex_unlock( &stream->lock );
+            }
+        }
+
+        libusb_handle_events_timeout_completed( NULL, &tv, NULL );
+    }
+
+    if ( stream->in.transfers )
+        AIOTransferQueueCancel( stream->in.transfers );
+    if ( out )
+        AIOTransferQueueCancel( out );
+
+    pthread_mutex_lock( &stream->lock );
+    stream->out.busy = AIOUSB_FALSE;
+    pthread_cond_broadcast( &stream->cond );
+    pthread_mutex_unlock( &stream->lock );
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Releases the async transfers, waiting for any still in flight
+ */
+static void aiodiostream_free_transfers( AIODIOStream *stream )
+{
+    DeleteAIOTransferQueue( stream->in.transfers );
+    DeleteAIOTransferQueue( stream->out.transfers );
+    stream->in.transfers = stream->out.transfers = NULL;
+    stream->async = AIOUSB_FALSE;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Allocates the async transfers, submits the input ones and leaves
+ *        the output ones parked for the event thread to fill
+ */
+static AIORESULT aiodiostream_start_transfers( AIODIOStream *stream )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    struct libusb_transfer *xfer;
+
+    if ( stream->in.ring && !( stream->in.transfers = NewAIOTransferQueue( stream->usb,
+                                                                          stream->in.endpoint,
+                                                                          AIODIOSTREAM_NUM_TRANSFERS,
+                                                                          stream->block_bytes,
+                                                                          aiodiostream_capture_complete,
+                                                                          stream ) ) )
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    if ( result == AIOUSB_SUCCESS && stream->out.ring &&
+         !( stream->out.transfers = NewAIOTransferQueue( stream->usb,
+                                                         stream->out.endpoint,
+                                                         AIODIOSTREAM_NUM_TRANSFERS,
+                                                         stream->block_bytes,
+                                                         aiodiostream_generate_complete,
+                                                         stream ) ) )
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    if ( result == AIOUSB_SUCCESS && stream->in.transfers ) {
+        /* the first completions can run on another thread before the last submit */
+        AIOTransferQueueLock( stream->in.transfers );
+        while ( result == AIOUSB_SUCCESS && ( xfer = AIOTransferQueueUnpark( stream->in.transfers ) ) ) {
+            int usbresult = AIOTransferQueueSubmit( stream->in.transfers, xfer, stream->block_bytes );
+            if ( usbresult != LIBUSB_SUCCESS ) {
+                AIOUSB_ERROR("Unable to submit DIO stream transfer: %d\n", usbresult );
+                result = LIBUSB_RESULT_TO_AIOUSB_RESULT( usbresult );
+            }
+        }
+        AIOTransferQueueUnlock( stream->in.transfers );
+    }
+
+    if ( result != AIOUSB_SUCCESS )
+        aiodiostream_free_transfers( stream );
+    else
+        stream->async = AIOUSB_TRUE;
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+static AIORESULT aiodiostream_open_endpoint( AIODIOStream *stream, unsigned char request )
+{
+    int bytesTransferred = stream->usb->usb_control_transfer( stream->usb,
+                                                              USB_WRITE_TO_DEVICE,
+                                                              request,
+                                                              0,
+                                                              0,
+                                                              0,
+                                                              0,
+                                                              stream->timeout
+                                                              );
+    return ( bytesTransferred != 0 ? LIBUSB_RESULT_TO_AIOUSB_RESULT( bytesTransferred ) : AIOUSB_SUCCESS );
+}
+
+/*----------------------------------------------------------------------------*/
+static void aiodiostream_join( AIODIOStream *stream )
+{
+    pthread_mutex_lock( &stream->lock );
+    stream->exiting = AIOUSB_TRUE;
+    pthread_cond_broadcast( &stream->cond );
+    pthread_mutex_unlock( &stream->lock );
+
+    if ( stream->async ) {
+        pthread_join( stream->events, NULL );
+        aiodiostream_free_transfers( stream );
+    }
+    if ( stream->in.running )
+        pthread_join( stream->in.worker, NULL );
+    if ( stream->out.running )
+        pthread_join( stream->out.worker, NULL );
+    stream->in.running = stream->out.running = AIOUSB_FALSE;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Opens the DIO stream endpoints for direction. Output can be
+ *        queued with AIODIOStreamWrite before AIODIOStreamStart so the
+ *        pattern is on the board before the write clock runs.
+ * @param DeviceIndex
+ * @param direction
+ * @param ring_words size of each ring, 0 for AIODIOSTREAM_DEFAULT_RING_WORDS
+ * @return new stream, or NULL if the device cannot stream or is already
+ *         streaming
+ */
+AIODIOStream *NewAIODIOStream( unsigned long DeviceIndex, AIODIOStreamDirection direction, unsigned ring_words )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIODIOStream *stream;
+
+    if ( direction < AIODIOSTREAM_INPUT || direction > AIODIOSTREAM_BOTH )
+        return NULL;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return NULL;
+    if ( !deviceDesc->bDIOStream || deviceDesc->bDIOOpen ) {
+        AIOUSB_ERROR("Device %lu can't start a DIO stream\n", DeviceIndex );
+        return NULL;
+    }
+    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return NULL;
+
+    stream = (AIODIOStream *)calloc( 1, sizeof(AIODIOStream) );
+    if ( !stream )
+        return NULL;
+
+    stream->DeviceIndex  = DeviceIndex;
+    stream->usb          = usb;
+    stream->timeout      = deviceDesc->commTimeout;
+    stream->direction    = direction;
+    stream->block_bytes  = deviceDesc->StreamingBlockSize * sizeof(unsigned short);
+    stream->block_bytes -= stream->block_bytes % AIODIOSTREAM_PACKET_BYTES;
+    if ( stream->block_bytes == 0 )
+        stream->block_bytes = AIODIOSTREAM_PACKET_BYTES;
+    stream->keep_words   = AIOUSB_TRUE;
+    stream->in.stream    = stream->out.stream = stream;
+    stream->in.endpoint  = LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT;
+    stream->out.endpoint = LIBUSB_ENDPOINT_OUT | USB_BULK_WRITE_ENDPOINT;
+    if ( !ring_words )
+        ring_words = AIODIOSTREAM_DEFAULT_RING_WORDS;
+
+    if ( direction & AIODIOSTREAM_INPUT ) {
+        stream->in.ring = NewAIOFifoCountsLockFree( ring_words );
+        stream->scratch = (unsigned char *)AIOUSBDeviceGetBuffer( deviceDesc, stream->block_bytes );
+        if ( !stream->in.ring || !stream->scratch )
+            goto out_free_NewAIODIOStream;
+    }
+    if ( direction & AIODIOSTREAM_OUTPUT ) {
+        stream->out.ring = NewAIOFifoCountsLockFree( ring_words );
+        if ( !stream->out.ring )
+            goto out_free_NewAIODIOStream;
+    }
+
+    if ( direction & AIODIOSTREAM_INPUT )
+        result = aiodiostream_open_endpoint( stream, AUR_DIO_STREAM_OPEN_INPUT );
+    if ( result == AIOUSB_SUCCESS && ( direction & AIODIOSTREAM_OUTPUT ) )
+        result = aiodiostream_open_endpoint( stream, AUR_DIO_STREAM_OPEN_OUTPUT );
+    if ( result != AIOUSB_SUCCESS ) {
+        AIOUSB_ERROR("Unable to open DIO stream on device %lu: %d\n", DeviceIndex, (int)result );
+        goto out_free_NewAIODIOStream;
+    }
+
+    pthread_mutex_init( &stream->lock, NULL );
+    pthread_cond_init( &stream->cond, NULL );
+    deviceDesc->bDIOOpen = AIOUSB_TRUE;
+    deviceDesc->bDIORead = ( direction == AIODIOSTREAM_INPUT ? AIOUSB_TRUE : AIOUSB_FALSE );
+
+    return stream;
+
+ out_free_NewAIODIOStream:
+    if ( stream->in.ring )
+        DeleteAIOFifoCounts( stream->in.ring );
+    if ( stream->out.ring )
+        DeleteAIOFifoCounts( stream->out.ring );
+    AIOUSBDeviceReleaseBuffer( deviceDesc, stream->scratch );
+    free( stream );
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops the stream without draining and frees it
+ */
+void DeleteAIODIOStream( AIODIOStream *stream )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    if ( !stream )
+        return;
+
+    AIODIOStreamStop( stream, AIOUSB_FALSE );
+
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( stream->DeviceIndex, &result );
+    if ( result == AIOUSB_SUCCESS ) {
+        deviceDesc->bDIOOpen = AIOUSB_FALSE;
+        deviceDesc->bDIORead = AIOUSB_FALSE;
+    }
+    AIOUSBDeviceReleaseBuffer( result == AIOUSB_SUCCESS ? deviceDesc : NULL, stream->scratch );
+
+    if ( stream->in.ring )
+        DeleteAIOFifoCounts( stream->in.ring );
+    if ( stream->out.ring )
+        DeleteAIOFifoCounts( stream->out.ring );
+    pthread_cond_destroy( &stream->cond );
+    pthread_mutex_destroy( &stream->lock );
+    free( stream );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Starts the pumps, waits for the first output block to reach the
+ *        board and then starts the clocks with DIO_StreamSetClocks
+ * @param stream
+ * @param ReadClockHz read clock for input streams, set to the actual rate
+ * @param WriteClockHz write clock for output streams, set to the actual rate
+ * @return
+ */
+AIORESULT AIODIOStreamStart( AIODIOStream *stream, double *ReadClockHz, double *WriteClockHz )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    double readHz = 0, writeHz = 0;
+
+    if ( !stream )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( stream->direction & AIODIOSTREAM_INPUT ) {
+        if ( !ReadClockHz || *ReadClockHz <= 0 )
+            return AIOUSB_ERROR_INVALID_PARAMETER;
+        readHz = *ReadClockHz;
+    }
+    if ( stream->direction & AIODIOSTREAM_OUTPUT ) {
+        if ( !WriteClockHz || *WriteClockHz <= 0 )
+            return AIOUSB_ERROR_INVALID_PARAMETER;
+        writeHz = *WriteClockHz;
+    }
+    if ( stream->started )
+        return AIOUSB_ERROR_OPEN_FAILED;
+    if ( stream->result != AIOUSB_SUCCESS )
+        return stream->result;
+
+    stream->exiting  = AIOUSB_FALSE;
+    stream->draining = AIOUSB_FALSE;
+    if ( stream->edges )
+        AIODIOEventsReset( stream->edges );
+    stream->primed   = ( stream->direction & AIODIOSTREAM_OUTPUT ? AIOUSB_FALSE : AIOUSB_TRUE );
+    stream->started  = AIOUSB_TRUE;
+
+    if ( stream->usb->deviceHandle ) {
+        if ( ( result = aiodiostream_start_transfers( stream ) ) != AIOUSB_SUCCESS ) {
+            stream->started = AIOUSB_FALSE;
+            return result;
+        }
+        if ( pthread_create( &stream->events, NULL, aiodiostream_events, (void *)stream ) != 0 ) {
+            result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+            aiodiostream_free_transfers( stream );
+            stream->started = AIOUSB_FALSE;
+            return result;
+        }
+    } else {
+        if ( ( stream->direction & AIODIOSTREAM_INPUT ) &&
+             pthread_create( &stream->in.worker, NULL, aiodiostream_capture, (void *)&stream->in ) == 0 )
+            stream->in.running = AIOUSB_TRUE;
+        if ( ( stream->direction & AIODIOSTREAM_OUTPUT ) &&
+             pthread_create( &stream->out.worker, NULL, aiodiostream_generate, (void *)&stream->out ) == 0 )
+            stream->out.running = AIOUSB_TRUE;
+        if ( ( ( stream->direction & AIODIOSTREAM_INPUT ) && !stream->in.running ) ||
+             ( ( stream->direction & AIODIOSTREAM_OUTPUT ) && !stream->out.running ) ) {
+            result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+            goto out_AIODIOStreamStart;
+        }
+    }
+
+    pthread_mutex_lock( &stream->lock );
+    while ( !stream->primed && stream->result == AIOUSB_SUCCESS )
+        pthread_cond_wait( &stream->cond, &stream->lock );
+    result = stream->result;
+    pthread_mutex_unlock( &stream->lock );
+    if ( result != AIOUSB_SUCCESS )
+        goto out_AIODIOStreamStart;
+
+    result = DIO_StreamSetClocks( stream->DeviceIndex, &readHz, &writeHz );
+    if ( result != AIOUSB_SUCCESS )
+        goto out_AIODIOStreamStart;
+
+    if ( stream->direction & AIODIOSTREAM_INPUT )
+        *ReadClockHz = readHz;
+    if ( stream->direction & AIODIOSTREAM_OUTPUT )
+        *WriteClockHz = writeHz;
+    return result;
+
+ out_AIODIOStreamStart:
+    aiodiostream_join( stream );
+    stream->started = AIOUSB_FALSE;
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops the clocks and the pumps. With bWait the output ring is sent
+ *        to the board first. Data already captured stays readable.
+ * @return the first transfer error seen by the stream, if any
+ */
+AIORESULT AIODIOStreamStop( AIODIOStream *stream, AIOUSB_BOOL bWait )
+{
+    double readHz = 0, writeHz = 0;
+    if ( !stream )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( !stream->started )
+        return stream->result;
+
+    if ( bWait && stream->out.ring ) {
+        AIOFifo *ring = (AIOFifo *)stream->out.ring;
+        pthread_mutex_lock( &stream->lock );
+        stream->draining = AIOUSB_TRUE;
+        while ( stream->result == AIOUSB_SUCCESS && ( ring->rdelta( ring ) || stream->out.busy ) )
+            pthread_cond_wait( &stream->cond, &stream->lock );
+        pthread_mutex_unlock( &stream->lock );
+    }
+
+    DIO_StreamSetClocks( stream->DeviceIndex, &readHz, &writeHz );
+    aiodiostream_join( stream );
+    stream->started = AIOUSB_FALSE;
+    if ( stream->edges )
+        AIODIOEventsEnd( stream->edges );
+
+    return stream->result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes up to maxwords captured words without blocking
+ * @return words copied, or -error once the ring is empty and the input
+ *         pump has failed
+ */
+AIORET_TYPE AIODIOStreamRead( AIODIOStream *stream, unsigned short *data, unsigned maxwords )
+{
+    AIOFifoRegion region;
+    AIORET_TYPE size;
+    if ( !stream || !data || !stream->in.ring )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    size = AIOFifoReadAcquire( (AIOFifo *)stream->in.ring, &region, maxwords * sizeof(unsigned short) );
+    if ( size <= 0 )
+        return ( stream->result != AIOUSB_SUCCESS ? -(AIORET_TYPE)stream->result : 0 );
+
+    memcpy( data, region.data[0], region.size[0] );
+    if ( region.size[1] )
+        memcpy( (unsigned char *)data + region.size[0], region.data[1], region.size[1] );
+    AIOFifoReadCommit( (AIOFifo *)stream->in.ring, (unsigned)size );
+
+    return size / sizeof(unsigned short);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Queues as much of data as fits in the output ring without
+ *        blocking
+ * @return words queued, or -error if the output pump has failed
+ */
+AIORET_TYPE AIODIOStreamWrite( AIODIOStream *stream, const unsigned short *data, unsigned words )
+{
+    unsigned size;
+    if ( !stream || !data || !stream->out.ring )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( stream->result != AIOUSB_SUCCESS )
+        return -(AIORET_TYPE)stream->result;
+
+    size = aiodiostream_put( (AIOFifo *)stream->out.ring, (const unsigned char *)data, words * sizeof(unsigned short) );
+    if ( size ) {
+        pthread_mutex_lock( &stream->lock );
+        pthread_cond_broadcast( &stream->cond );
+        pthread_mutex_unlock( &stream->lock );
+    }
+
+    return size / sizeof(unsigned short);
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODIOStreamReadAvailable( AIODIOStream *stream )
+{
+    if ( !stream || !stream->in.ring )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return stream->in.ring->rdelta( (AIOFifo *)stream->in.ring ) / sizeof(unsigned short);
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIODIOStreamWriteAvailable( AIODIOStream *stream )
+{
+    if ( !stream || !stream->out.ring )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return stream->out.ring->delta( (AIOFifo *)stream->out.ring ) / sizeof(unsigned short);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Captured words dropped because the input ring was full
+ */
+AIORET_TYPE AIODIOStreamGetOverruns( AIODIOStream *stream )
+{
+    if ( !stream )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return (AIORET_TYPE)stream->in.gaps;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Times the output ring ran dry while the write clock was running
+ */
+AIORET_TYPE AIODIOStreamGetUnderruns( AIODIOStream *stream )
+{
+    if ( !stream )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return (AIORET_TYPE)stream->out.gaps;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Feeds every input block to events, which starts over each time
+ *        the stream starts and is ended when it stops or fails. The stream
+ *        does not own events. Without keep_words the input ring is left
+ *        empty, for readers that only want the edges.
+ * @param stream input stream that is not running
+ * @param events change of state capture, or NULL to detach it
+ * @param keep_words whether captured words still go to the input ring
+ */
+AIORESULT AIODIOStreamSetEvents( AIODIOStream *stream, AIODIOEvents *events, AIOUSB_BOOL keep_words )
+{
+    if ( !stream || !stream->in.ring || ( !events && !keep_words ) )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( stream->started )
+        return AIOUSB_ERROR_OPEN_FAILED;
+    stream->edges      = events;
+    stream->keep_words = ( keep_words ? AIOUSB_TRUE : AIOUSB_FALSE );
+    return AIOUSB_SUCCESS;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,93 @@
+/**
+ * @file   AIODIOStream.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Continuous pattern capture / generation on the streaming DIO
+ *         boards ( USB-DIO-16A family, USB-DI16A ), backed by lock free rings
+ *
+ */
+
+#ifndef _AIO_DIO_STREAM_H
+#define _AIO_DIO_STREAM_H
+
+#include "AIOTypes.h"
+#include "AIOFifo.h"
+#include "AIODIOEvents.h"
+#include "AIOTransferQueue.h"
+#include "USBDevice.h"
+#include <pthread.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIODIOSTREAM_DEFAULT_RING_WORDS   ( 256*1024 )
+#define AIODIOSTREAM_PACKET_BYTES         512   /**< Bulk reads are kept to whole packets */
+#define AIODIOSTREAM_NUM_TRANSFERS        8     /**< Async transfers kept queued per direction */
+#define AIODIOSTREAM_POLL_US              2000  /**< Longest a parked output transfer waits for new data */
+
+typedef enum {
+    AIODIOSTREAM_INPUT  = 1,            /**< Pattern capture on the read clock */
+    AIODIOSTREAM_OUTPUT = 2,            /**< Pattern generation on the write clock */
+    AIODIOSTREAM_BOTH   = 3
+} AIODIOStreamDirection;
+
+struct aio_dio_stream;
+
+/**
+ * @brief One direction of the stream: a ring and the thread that keeps a
+ * bulk transfer going between it and the endpoint
+ */
+typedef struct aio_dio_stream_pump {
+    struct aio_dio_stream *stream;
+    AIOFifoCounts *ring;
+    unsigned char endpoint;
+    AIOTransferQueue *transfers;        /**< Queued async transfers, real devices only */
+    pthread_t worker;
+    AIOUSB_BOOL running;
+    AIOUSB_BOOL busy;                   /**< Output pump has a transfer in flight */
+    unsigned long long words;           /**< Words moved over USB */
+    unsigned long long gaps;            /**< Input: words dropped on a full ring. Output: times the ring ran dry */
+} AIODIOStreamPump;
+
+typedef struct aio_dio_stream {
+    unsigned long DeviceIndex;
+    USBDevice *usb;
+    unsigned timeout;                   /**< Per transfer timeout ( ms. ) */
+    AIODIOStreamDirection direction;
+    unsigned block_bytes;               /**< Largest single bulk transfer */
+    unsigned char *scratch;             /**< Landing area for input that does not fit in place */
+    AIODIOStreamPump in;
+    AIODIOStreamPump out;
+    AIODIOEvents *edges;                /**< Change of state capture fed every input block, or NULL */
+    AIOUSB_BOOL keep_words;             /**< Input words go to the ring as well as the event scan */
+    AIOUSB_BOOL async;                  /**< The pumps' transfers are queued and events runs them */
+    pthread_t events;                   /**< Runs the async completions for both directions */
+    AIOUSB_BOOL started;
+    AIOUSB_BOOL primed;                 /**< First output block is on the device */
+    AIOUSB_BOOL draining;               /**< AIODIOStreamStop is sending what is left */
+    AIOUSB_BOOL exiting;
+    AIORESULT result;                   /**< First transfer error, reported by later calls */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} AIODIOStream;
+
+PUBLIC_EXTERN AIODIOStream *NewAIODIOStream( unsigned long DeviceIndex, AIODIOStreamDirection direction, unsigned ring_words );
+PUBLIC_EXTERN void DeleteAIODIOStream( AIODIOStream *stream );
+PUBLIC_EXTERN AIORESULT AIODIOStreamStart( AIODIOStream *stream, double *ReadClockHz, double *WriteClockHz );
+PUBLIC_EXTERN AIORESULT AIODIOStreamStop( AIODIOStream *stream, AIOUSB_BOOL bWait );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamRead( AIODIOStream *stream, unsigned short *data, unsigned maxwords );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamWrite( AIODIOStream *stream, const unsigned short *data, unsigned words );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamReadAvailable( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamWriteAvailable( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamGetOverruns( AIODIOStream *stream );
+PUBLIC_EXTERN AIORET_TYPE AIODIOStreamGetUnderruns( AIODIOStream *stream );
+PUBLIC_EXTERN AIORESULT AIODIOStreamSetEvents( AIODIOStream *stream, AIODIOEvents *events, AIOUSB_BOOL keep_words );
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
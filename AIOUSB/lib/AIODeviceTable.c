@@ -1,4 +1,6 @@
 #include "AIODeviceTable.h" 
+#include "AIOUSB_Log.h"
+#include "AIOUSB_DIO.h"
 #include <string.h>
 
 #ifdef __cplusplus
@@ -7,6 +9,14 @@ namespace AIOUSB {
 
 AIOUSBDevice deviceTable[ MAX_USB_DEVICES ];
 
+/**
+ * @note Two levels of locking: deviceTableLock guards which entries exist
+ * and is only written while devices are added or the table is reset;
+ * each entry's own lock ( AIOUSBDeviceLock ) guards I/O with that board.
+ */
+static pthread_rwlock_t deviceTableLock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_once_t deviceLocksOnce = PTHREAD_ONCE_INIT;
+
 
 static ProductIDName productIDNameTable[] = {
     { USB_DA12_8A_REV_A , "USB-DA12-8A-A"  },
@@ -129,11 +139,45 @@ unsigned long AIOUSB_INIT_PATTERN = 0x9b6773adul;  /* random pattern */
 unsigned long aiousbInit = 0;                    /* == AIOUSB_INIT_PATTERN if AIOUSB module is initialized */
 
 
+/*----------------------------------------------------------------------------*/
+static void aiodevicetable_init_device_locks(void)
+{
+    for ( int index = 0; index < MAX_USB_DEVICES; index ++ )
+        AIOUSBDeviceInitLock( &deviceTable[index] );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Shared lock for looking entries up. Held only for the lookup;
+ * never call a locking AIODeviceTable function while holding it.
+ */
+void AIODeviceTableLockRead(void)
+{
+    pthread_once( &deviceLocksOnce, aiodevicetable_init_device_locks );
+    pthread_rwlock_rdlock( &deviceTableLock );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Exclusive lock for adding devices and resetting the table
+ */
+void AIODeviceTableLockWrite(void)
+{
+    pthread_once( &deviceLocksOnce, aiodevicetable_init_device_locks );
+    pthread_rwlock_wrlock( &deviceTableLock );
+}
+
+/*----------------------------------------------------------------------------*/
+void AIODeviceTableUnlock(void)
+{
+    pthread_rwlock_unlock( &deviceTableLock );
+}
+
 /*----------------------------------------------------------------------------*/
 AIOUSBDevice *_get_device( unsigned long index , AIORESULT *result )
 {
     AIOUSBDevice *dev;
-    if ( index > MAX_USB_DEVICES ) { 
+    if ( index >= MAX_USB_DEVICES ) { 
         *result = AIOUSB_ERROR_INVALID_INDEX;
         return NULL;
     }
@@ -169,11 +213,41 @@ AIOUSB_BOOL AIOUSB_SetInit()
     return AIOUSB_SUCCESS;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Frees what a device allocated for itself. A buffer pool with
+ * blocks still handed out stays attached, since those blocks live in its
+ * arenas; the next setup reuses it and a later pass frees it once they are
+ * back.
+ */
+static void aiodevicetable_free_device( AIOUSBDevice *device )
+{
+    AIORET_TYPE in_use;
+    if ( device->bufferPool ) {
+        if ( ( in_use = AIOBufferPoolGetInUse( device->bufferPool ) ) > 0 ) {
+            AIOUSB_ERROR("Keeping buffer pool with %d buffers still in use\n", (int)in_use );
+        } else {
+            DeleteAIOBufferPool( device->bufferPool );
+            device->bufferPool = NULL;
+        }
+    }
+    DeleteAIOStats( device->stats );
+    device->stats = NULL;
+    for ( int code = 0; code < AD_NUM_GAIN_CODES; code ++ ) {
+        free( device->hostCalTables[code] );
+        device->hostCalTables[code] = NULL;
+    }
+    /* whatever opens the board next can't know what its SRAM holds */
+    device->sramCalValid = AIOUSB_FALSE;
+    device->sramCalHash  = 0;
+}
+
 /*----------------------------------------------------------------------------*/
 void AIODeviceTableInit(void)
 {
     int index;
     AIORESULT result;
+    AIODeviceTableLockWrite();
     for(index = 0; index < MAX_USB_DEVICES; index++) {
         AIOUSBDevice *device = _get_device( index , &result );
         /* libusb handles */
@@ -190,6 +264,8 @@ void AIODeviceTableInit(void)
         device->discardFirstSample = AIOUSB_FALSE;
         device->commTimeout = 5000;
         device->miscClockHz = 1;
+        device->BulkTransferPreference = AIO_TRANSFERS_BALANCED;
+        device->BulkTransferLatency = 0;
 
         /* device-specific properties */
         device->ProductID = 0;
@@ -231,9 +307,16 @@ void AIODeviceTableInit(void)
         device->DACData = NULL;
         device->PendingDACData = NULL;
         device->LastDIOData = NULL;
+        device->PendingDIOData = NULL;
+        device->DIOBatchDepth = 0;
+        device->bDIOBatchDirty = AIOUSB_FALSE;
+        device->DIOFlushMs = 0;
+        device->bDIOFlushThread = AIOUSB_FALSE;
+        device->DIOFlushResult = AIOUSB_SUCCESS;
         device->cachedName = NULL;
         device->cachedSerialNumber = 0;
         device->cachedConfigBlock.size = 0;       // .size == 0 == uninitialized
+        device->writtenConfigBlock.size = 0;
 
         /* worker thread state */
         device->workerBusy = AIOUSB_FALSE;
@@ -241,7 +324,10 @@ void AIODeviceTableInit(void)
         device->workerResult = AIOUSB_SUCCESS;
         device->valid = AIOUSB_FALSE;
         device->testing = AIOUSB_FALSE;
+
+        aiodevicetable_free_device( device );
     }
+    AIODeviceTableUnlock();
     AIOUSB_SetInit();
 }
 
@@ -261,8 +347,19 @@ unsigned long AIOUSB_InitTest(void) {
 /*----------------------------------------------------------------------------*/
 AIOUSB_BOOL AIOUSB_Cleanup()
 {
+    AIOBufferPool *pools[MAX_USB_DEVICES];
+    int index;
     aiousbInit = ~ AIOUSB_INIT_PATTERN;
+    AIODeviceTableLockWrite();
+    for ( index = 0; index < MAX_USB_DEVICES; index ++ ) {
+        aiodevicetable_free_device( &deviceTable[index] );
+        pools[index] = deviceTable[index].bufferPool;
+    }
     memset( &deviceTable[0], 0, MAX_USB_DEVICES * AIOUSBDeviceSize() );
+    for ( index = 0; index < MAX_USB_DEVICES; index ++ )
+        deviceTable[index].bufferPool = pools[index];
+    aiodevicetable_init_device_locks();
+    AIODeviceTableUnlock();
     return AIOUSB_SUCCESS;
 }
 
@@ -474,10 +571,12 @@ AIORET_TYPE GetDevices(void)
        */
         /* AIODeviceTableClearDevices(); */
         int index;
+        AIODeviceTableLockRead();
         for(index = 0; index < MAX_USB_DEVICES; index++) {
             if ( deviceTable[index].usb_device != NULL && deviceTable[index].valid == AIOUSB_TRUE )
                 deviceMask =  (deviceMask << 1) | 1;
         }
+        AIODeviceTableUnlock();
     } else {
         return -AIOUSB_ERROR_NOT_INIT;
     }
@@ -673,6 +772,8 @@ AIORESULT _Initialize_Device_Desc(unsigned long DeviceIndex)
     device->RangeShift = 0;
     device->bDIOStream = AIOUSB_FALSE;
     device->StreamingBlockSize = 31 * 1024;
+    device->BulkTransferPreference = AIO_TRANSFERS_BALANCED;
+    device->BulkTransferLatency = 0;
     device->bDIODebounce = AIOUSB_FALSE;
     device->bDIOSPI = AIOUSB_FALSE;
     device->bClearFIFO = AIOUSB_FALSE;
@@ -1022,6 +1123,7 @@ AIOUSBDevice *AIODeviceTableGetDeviceAtIndex( unsigned long DeviceIndex , AIORES
         *result = AIOUSB_ERROR_NOT_INIT;
         return NULL;
     }
+    AIODeviceTableLockRead();
     if (DeviceIndex == diFirst) { /* find first device on bus */
         *result = AIOUSB_ERROR_FILE_NOT_FOUND;
         int index;
@@ -1063,6 +1165,7 @@ AIOUSBDevice *AIODeviceTableGetDeviceAtIndex( unsigned long DeviceIndex , AIORES
          */
         retval = _verified_device( _get_device( DeviceIndex , result ), result );
     }
+    AIODeviceTableUnlock();
 
     return retval;
 }
@@ -1072,6 +1175,8 @@ void _setup_device_parameters( AIOUSBDevice *device , unsigned long productID )
 {
     device->ProductID = productID;
     device->StreamingBlockSize = 31ul * 1024ul;
+    device->BulkTransferPreference = AIO_TRANSFERS_BALANCED;
+    device->BulkTransferLatency = 0;
     device->bGetName = AIOUSB_TRUE;             // most boards support this feature
     if(productID == USB_DIO_32) {
         device->DIOBytes = 4;
@@ -1265,6 +1370,14 @@ void _setup_device_parameters( AIOUSBDevice *device , unsigned long productID )
     device->cachedConfigBlock.mux_settings.ADCMUXChannels       = device->ADCMUXChannels;
     device->cachedConfigBlock.mux_settings.ADCChannelsPerGroup  = device->ADCChannelsPerGroup;
     device->cachedConfigBlock.mux_settings.defined              = AIOUSB_TRUE;
+    device->writtenConfigBlock.size                             = 0;
+    device->sramCalValid                                        = AIOUSB_FALSE;
+    device->sramCalHash                                         = 0;
+
+    if ( !device->bufferPool )
+        device->bufferPool = NewAIOBufferPool();
+    if ( !device->stats )
+        device->stats = NewAIOStats();
 
     device->valid = AIOUSB_TRUE;
 }
@@ -1282,13 +1395,21 @@ AIORESULT AIODeviceTableAddDeviceToDeviceTable( int *numAccesDevices, unsigned l
 AIORESULT AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( int *numAccesDevices, unsigned long productID , USBDevice *usb_dev ) 
 {
     AIORESULT result = AIOUSB_SUCCESS;
+    AIODeviceTableLockWrite();
     AIOUSBDevice *device  = _get_device( *numAccesDevices , &result );
+    if ( !device ) {
+        AIODeviceTableUnlock();
+        return result;
+    }
 
     device->usb_device    = usb_dev;
     device->ProductID     = productID;
     device->isInit        = AIOUSB_TRUE;
     _setup_device_parameters( device , productID );
     ADCConfigBlockSetDevice( AIOUSBDeviceGetADCConfigBlock( device ), device );
+    if ( usb_dev )
+        usb_dev->stats = device->stats;
+    AIODeviceTableUnlock();
 
     *numAccesDevices += 1;
     return result;
@@ -1358,6 +1479,7 @@ void CloseAllDevices(void)
         AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( index, &result );
         if ( result == AIOUSB_SUCCESS )  {
             USBDevice *usb = AIOUSBDeviceGetUSBHandle( device );
+            DIO_CloseBatch( device );
             if ( usb ) 
                 USBDeviceClose( usb );
         
@@ -1370,6 +1492,8 @@ void CloseAllDevices(void)
                 free(device->cachedName);
                 device->cachedName = NULL;
             }
+
+            aiodevicetable_free_device( device );
         }
     }
 }
@@ -1441,14 +1565,17 @@ AIORET_TYPE AIODeviceTablePopulateTable(void)
     if ( result < AIOUSB_SUCCESS ) 
         return result;
 
-    for ( int i = 0; i < size ; i ++ ) {
+    AIODeviceTableLockWrite();
+    for ( int i = 0; i < size && numAccesDevices < MAX_USB_DEVICES ; i ++ ) {
         AIOUSBDevice *device = (AIOUSBDevice *)&deviceTable[ numAccesDevices++ ];
 
         unsigned productID = USBDeviceGetIdProduct( &usbdevices[i] );
         _setup_device_parameters( device, productID );
         /* device->usb_device = usbdevices[i]; */
         device->usb_device = CopyUSBDevice( &usbdevices[i] );
+        device->usb_device->stats = device->stats;
     }
+    AIODeviceTableUnlock();
     
     AIOUSB_SetInit();
     return AIOUSB_SUCCESS;
@@ -1538,6 +1665,7 @@ unsigned long AIOUSB_Reset( unsigned long DeviceIndex )
     if(usb != NULL) {
 
         int libusbResult = usb->usb_reset_device(usb);
+        deviceDesc->sramCalValid = AIOUSB_FALSE;
         if (libusbResult != LIBUSB_SUCCESS )
             result = LIBUSB_RESULT_TO_AIOUSB_RESULT(libusbResult);
         usleep(250000);
@@ -1697,6 +1825,31 @@ TEST(AIODeviceTable, SetsUpDefaults )
     EXPECT_EQ( ((AIOUSBDevice *)&deviceTable[1])->DIOBytes, 4  );
 }
 
+TEST(AIODeviceTable, CleanupKeepsPoolWithBuffersOut )
+{
+    int numAccesDevices = 0;
+    AIORESULT result = AIOUSB_SUCCESS;
+
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numAccesDevices, USB_AIO16_16A, NULL );
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+    ASSERT_EQ( AIOUSB_SUCCESS, result );
+    AIOBufferPool *pool = dev->bufferPool;
+    void *block = AIOUSBDeviceGetBuffer( dev, 100 );
+    ASSERT_TRUE( pool && block );
+
+    AIOUSB_Cleanup();
+    EXPECT_EQ( pool, dev->bufferPool ) << "The block still lives in the pool";
+    EXPECT_FALSE( dev->stats );
+    AIODeviceTableInit();
+    EXPECT_EQ( pool, dev->bufferPool );
+
+    AIOUSBDeviceReleaseBuffer( dev, block );
+    EXPECT_EQ( 0, AIOBufferPoolGetInUse( pool ) );
+    AIODeviceTableInit();
+    EXPECT_FALSE( dev->bufferPool ) << "Freed once nothing is handed out";
+    AIOUSB_Cleanup();
+}
+
 
 int 
 main(int argc, char *argv[] )
@@ -24,6 +24,9 @@ PUBLIC_EXTERN AIORESULT AIODeviceTableClearDevices( void );
 PUBLIC_EXTERN AIOUSBDevice *AIODeviceTableGetDeviceAtIndex( unsigned long index , AIORESULT *result );
 PUBLIC_EXTERN USBDevice *AIODeviceTableGetUSBDeviceAtIndex( unsigned long DeviceIndex, AIORESULT *result );
 void _setup_device_parameters( AIOUSBDevice *device , unsigned long productID );
+PUBLIC_EXTERN void AIODeviceTableLockRead(void);
+PUBLIC_EXTERN void AIODeviceTableLockWrite(void);
+PUBLIC_EXTERN void AIODeviceTableUnlock(void);
 
 
 PUBLIC_EXTERN unsigned long QueryDeviceInfo( unsigned long DeviceIndex, unsigned long *pPID, unsigned long *pNameSize, 
@@ -0,0 +1,298 @@
+/**
+ * @file   AIOFastITSession.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Persistent FastIT scan session
+ *
+ * ADC_GetFastITScanV reprograms the counters, starts two threads and polls
+ * for completion on every call. A session does the configuration once,
+ * leaves the counter clock running and keeps one worker parked on a
+ * condition variable; each scan is then the start-acquire command and a
+ * single bulk read.
+ */
+
+#include "AIOFastITSession.h"
+#include "AIOUSB_Core.h"
+#include "AIOUSB_ADC.h"
+#include "AIOUSB_CTR.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOUSB_Log.h"
+#include <string.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+/*----------------------------------------------------------------------------*/
+static AIORESULT aiofastitsession_read_scan( AIOFastITSession *session )
+{
+    unsigned char startdata[] = {0x05,0x00,0x00,0x00 };
+    unsigned char *data = (unsigned char *)session->counts;
+    int bytesRemaining = (int)session->scan_bytes;
+    int bytesTransferred;
+    int usbresult;
+
+    usbresult = session->usb->usb_control_transfer( session->usb,
+                                                    USB_WRITE_TO_DEVICE,
+                                                    AUR_START_ACQUIRING_BLOCK,
+                                                    (session->scan_bytes >> 17) & 0xffff, /* high */
+                                                    (session->scan_bytes >> 1) & 0xffff,
+                                                    startdata,
+                                                    sizeof(startdata),
+                                                    session->timeout
+                                                    );
+    if ( usbresult != (int)sizeof(startdata) )
+        return LIBUSB_RESULT_TO_AIOUSB_RESULT( usbresult );
+
+    while ( bytesRemaining > 0 ) {
+        usbresult = session->usb->usb_bulk_transfer( session->usb,
+                                                     LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT,
+                                                     data,
+                                                     bytesRemaining,
+                                                     &bytesTransferred,
+                                                     session->timeout
+                                                     );
+        if ( usbresult != LIBUSB_SUCCESS )
+            return LIBUSB_RESULT_TO_AIOUSB_RESULT( usbresult );
+        if ( bytesTransferred <= 0 )
+            return AIOUSB_ERROR_INVALID_DATA;
+        data += bytesTransferred;
+        bytesRemaining -= bytesTransferred;
+    }
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sleeps until a scan is requested, services it and signals the
+ *        waiter, until the session is deleted
+ */
+static void *aiofastitsession_work( void *object )
+{
+    AIOFastITSession *session = (AIOFastITSession *)object;
+    AIORESULT result;
+
+    pthread_mutex_lock( &session->lock );
+    for ( ;; ) {
+        while ( session->state != AIOFASTIT_REQUESTED && session->state != AIOFASTIT_EXITING )
+            pthread_cond_wait( &session->cond, &session->lock );
+        if ( session->state == AIOFASTIT_EXITING )
+            break;
+        pthread_mutex_unlock( &session->lock );
+
+        result = aiofastitsession_read_scan( session );
+
+        pthread_mutex_lock( &session->lock );
+        session->result = result;
+        if ( result == AIOUSB_SUCCESS )
+            session->scans ++;
+        if ( session->state == AIOFASTIT_REQUESTED )
+            session->state = AIOFASTIT_DONE;
+        pthread_cond_broadcast( &session->cond );
+    }
+    pthread_mutex_unlock( &session->lock );
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Puts the device into FastIT mode, starts the scan clock and
+ *        parks the worker thread. The device stays in FastIT mode until
+ *        DeleteAIOFastITSession.
+ * @param DeviceIndex
+ * @return new session, or NULL if the device could not be set up
+ */
+AIOFastITSession *NewAIOFastITSession( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIORET_TYPE scan_bytes;
+    double clockHz = 0;
+    AIOFastITSession *session = NULL;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return NULL;
+    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return NULL;
+
+    if ( (result = ADC_InitFastITScanV( DeviceIndex )) != AIOUSB_SUCCESS ) {
+        AIOUSB_ERROR("Unable to put device %lu in FastIT mode: %d\n", DeviceIndex, (int)result );
+        return NULL;
+    }
+
+    scan_bytes = ADC_FastITScanBytes( DeviceIndex );
+    if ( scan_bytes <= 0 )
+        goto out_reset_NewAIOFastITSession;
+
+    session = (AIOFastITSession *)calloc( 1, sizeof(AIOFastITSession) );
+    if ( !session )
+        goto out_reset_NewAIOFastITSession;
+
+    session->DeviceIndex  = DeviceIndex;
+    session->usb          = usb;
+    session->timeout      = deviceDesc->commTimeout;
+    session->scan_bytes   = (unsigned)scan_bytes;
+    session->num_channels = session->scan_bytes / sizeof(unsigned short) /
+                            ( AIOUSB_GetRegister( deviceDesc->FastITConfig, 0x13 ) + 1 );
+    session->state        = AIOFASTIT_IDLE;
+    session->counts       = (unsigned short *)AIOUSBDeviceGetBuffer( deviceDesc, session->scan_bytes );
+    if ( !session->counts )
+        goto out_free_NewAIOFastITSession;
+
+    CTR_8254Mode( DeviceIndex, 0, 2, 0 );
+    CTR_8254Mode( DeviceIndex, 0, 2, 1 );
+    ADC_SetScanLimits( DeviceIndex, 0, session->num_channels - 1 );
+    AIOUSB_SetStreamingBlockSize( DeviceIndex, AIOFASTITSESSION_BLOCK_SIZE );
+    CTR_StartOutputFreq( DeviceIndex, 0, &clockHz );
+    ADC_ADMode( DeviceIndex, AD_TRIGGER_SCAN | AD_TRIGGER_TIMER, AD_CAL_MODE_NORMAL );
+    AIOUSB_SetMiscClock( DeviceIndex, AIOFASTITSESSION_CLOCK_HZ );
+
+    /* The clock keeps running; each start-acquire command takes the next scan */
+    clockHz = deviceDesc->miscClockHz;
+    if ( CTR_StartOutputFreq( DeviceIndex, 0, &clockHz ) < 0 )
+        goto out_free_NewAIOFastITSession;
+
+    pthread_mutex_init( &session->lock, NULL );
+    pthread_cond_init( &session->cond, NULL );
+    if ( pthread_create( &session->worker, NULL, aiofastitsession_work, (void *)session ) != 0 ) {
+        pthread_cond_destroy( &session->cond );
+        pthread_mutex_destroy( &session->lock );
+        goto out_stop_NewAIOFastITSession;
+    }
+
+    return session;
+
+ out_stop_NewAIOFastITSession:
+    clockHz = 0;
+    CTR_StartOutputFreq( DeviceIndex, 0, &clockHz );
+ out_free_NewAIOFastITSession:
+    AIOUSBDeviceReleaseBuffer( deviceDesc, session->counts );
+    free( session );
+ out_reset_NewAIOFastITSession:
+    ADC_ResetFastITScanV( DeviceIndex );
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Stops the worker and the scan clock and restores the config
+ *        block the device had before the session
+ */
+void DeleteAIOFastITSession( AIOFastITSession *session )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    double clockHz = 0;
+
+    if ( !session )
+        return;
+
+    pthread_mutex_lock( &session->lock );
+    session->state = AIOFASTIT_EXITING;
+    pthread_cond_broadcast( &session->cond );
+    pthread_mutex_unlock( &session->lock );
+    pthread_join( session->worker, NULL );
+
+    CTR_StartOutputFreq( session->DeviceIndex, 0, &clockHz );
+    ADC_ResetFastITScanV( session->DeviceIndex );
+
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( session->DeviceIndex, &result );
+    AIOUSBDeviceReleaseBuffer( result == AIOUSB_SUCCESS ? deviceDesc : NULL, session->counts );
+
+    pthread_cond_destroy( &session->cond );
+    pthread_mutex_destroy( &session->lock );
+    free( session );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Hands the next scan to the worker and returns immediately
+ * @return AIOUSB_ERROR_OPEN_FAILED if a scan is already outstanding
+ */
+AIORESULT AIOFastITSessionStartScan( AIOFastITSession *session )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    if ( !session )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock( &session->lock );
+    if ( session->state != AIOFASTIT_IDLE ) {
+        result = AIOUSB_ERROR_OPEN_FAILED;
+    } else {
+        session->state = AIOFASTIT_REQUESTED;
+        pthread_cond_broadcast( &session->cond );
+    }
+    pthread_mutex_unlock( &session->lock );
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Blocks until the scan started by AIOFastITSessionStartScan has
+ *        been read and converts it to volts
+ * @param session
+ * @param pData AIOFastITSessionGetNumChannels() voltages
+ * @return
+ */
+AIORESULT AIOFastITSessionWaitScan( AIOFastITSession *session, double *pData )
+{
+    AIORESULT result;
+    if ( !session || !pData )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock( &session->lock );
+    if ( session->state == AIOFASTIT_IDLE ) {
+        pthread_mutex_unlock( &session->lock );
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+    }
+    while ( session->state == AIOFASTIT_REQUESTED )
+        pthread_cond_wait( &session->cond, &session->lock );
+    result = session->result;
+    pthread_mutex_unlock( &session->lock );
+
+    if ( result == AIOUSB_SUCCESS )
+        result = ADC_FastITCountsToVolts( session->DeviceIndex, session->counts, pData );
+
+    pthread_mutex_lock( &session->lock );
+    session->state = AIOFASTIT_IDLE;
+    pthread_mutex_unlock( &session->lock );
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Drop in replacement for ADC_GetFastITScanV for callers that keep
+ *        the session open
+ */
+AIORESULT AIOFastITSessionGetScanV( AIOFastITSession *session, double *pData )
+{
+    AIORESULT result = AIOFastITSessionStartScan( session );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+    return AIOFastITSessionWaitScan( session, pData );
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOFastITSessionGetNumChannels( AIOFastITSession *session )
+{
+    if ( !session )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return (AIORET_TYPE)session->num_channels;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOFastITSessionGetScans( AIOFastITSession *session )
+{
+    if ( !session )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return (AIORET_TYPE)session->scans;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,60 @@
+/**
+ * @file   AIOFastITSession.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Keeps a device configured for FastIT scans so that each scan is
+ *         one start command and one bulk read serviced by a parked thread
+ *
+ */
+
+#ifndef _AIO_FASTIT_SESSION_H
+#define _AIO_FASTIT_SESSION_H
+
+#include "AIOTypes.h"
+#include "USBDevice.h"
+#include <pthread.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIOFASTITSESSION_CLOCK_HZ       100000
+#define AIOFASTITSESSION_BLOCK_SIZE     100000
+
+typedef enum {
+    AIOFASTIT_IDLE = 0,                 /**< Worker parked, no scan outstanding */
+    AIOFASTIT_REQUESTED,                /**< Scan handed to the worker */
+    AIOFASTIT_DONE,                     /**< Scan finished, result waiting to be collected */
+    AIOFASTIT_EXITING
+} AIOFastITSessionState;
+
+typedef struct aio_fastit_session {
+    unsigned long DeviceIndex;
+    USBDevice *usb;
+    unsigned timeout;                   /**< Per transfer timeout ( ms. ) */
+    unsigned short *counts;             /**< One scan of raw counts, from the device buffer pool */
+    unsigned scan_bytes;
+    unsigned num_channels;
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    AIOFastITSessionState state;
+    AIORESULT result;                   /**< Result of the last scan */
+    unsigned long scans;                /**< Scans completed so far */
+} AIOFastITSession;
+
+PUBLIC_EXTERN AIOFastITSession *NewAIOFastITSession( unsigned long DeviceIndex );
+PUBLIC_EXTERN void DeleteAIOFastITSession( AIOFastITSession *session );
+PUBLIC_EXTERN AIORESULT AIOFastITSessionStartScan( AIOFastITSession *session );
+PUBLIC_EXTERN AIORESULT AIOFastITSessionWaitScan( AIOFastITSession *session, double *pData );
+PUBLIC_EXTERN AIORESULT AIOFastITSessionGetScanV( AIOFastITSession *session, double *pData );
+PUBLIC_EXTERN AIORET_TYPE AIOFastITSessionGetNumChannels( AIOFastITSession *session );
+PUBLIC_EXTERN AIORET_TYPE AIOFastITSessionGetScans( AIOFastITSession *session );
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
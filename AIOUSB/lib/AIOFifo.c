@@ -39,7 +39,7 @@ size_t rdelta( AIOFifo *fifo  )
 AIORET_TYPE AIOFifoReadSize( void *tmpfifo )
 {
     AIOFifo *fifo = (AIOFifo*)tmpfifo;
-    return rdelta( (AIOFifo*)fifo  );
+    return fifo->rdelta( (AIOFifo*)fifo  );
 }
 
 
@@ -52,7 +52,7 @@ size_t _calculate_size_write( AIOFifo *fifo, unsigned maxsize)
 
 size_t _calculate_size_read( AIOFifo *fifo, unsigned maxsize)
 {
-    return MIN(MIN( maxsize, fifo->size), rdelta(fifo) );
+    return MIN(MIN( maxsize, fifo->size), fifo->rdelta(fifo) );
 }
 
 size_t _calculate_size_aon_write( AIOFifo *fifo, unsigned maxsize)
@@ -62,7 +62,7 @@ size_t _calculate_size_aon_write( AIOFifo *fifo, unsigned maxsize)
 
 size_t _calculate_size_aon_read( AIOFifo *fifo, unsigned maxsize )
 {
-    return ( rdelta(fifo) < maxsize ? 0 : maxsize );
+    return ( fifo->rdelta(fifo) < maxsize ? 0 : maxsize );
 }
 
 void AIOFifoInitialize( AIOFifo *nfifo, unsigned int size, unsigned refsize )
@@ -104,6 +104,73 @@ AIOFifo *NewAIOFifoAllOrNone( unsigned int size , unsigned refsize )
     return nfifo;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Lock free single producer / single consumer variant. The producer
+ * only ever stores write_pos and the consumer only ever stores read_pos, each
+ * with release ordering after the data has been copied, and each side loads
+ * the other's index with acquire ordering before touching the data. The
+ * buffer is rounded up to a power of two so wrapping is a mask of size - 1,
+ * not a modulo. The struct is the same as every other fifo's, so code that
+ * takes an AIOFifo works on either kind.
+ */
+#define AIOFIFO_LOAD_ACQUIRE(p)     __atomic_load_n( (p), __ATOMIC_ACQUIRE )
+#define AIOFIFO_LOAD_RELAXED(p)     __atomic_load_n( (p), __ATOMIC_RELAXED )
+#define AIOFIFO_STORE_RELEASE(p,v)  __atomic_store_n( (p), (v), __ATOMIC_RELEASE )
+
+static unsigned int next_power_of_two( unsigned int v )
+{
+    unsigned int p = 1;
+    while ( p < v )
+        p <<= 1;
+    return p;
+}
+
+size_t delta_lockfree( AIOFifo *fifo )
+{
+    unsigned int r = AIOFIFO_LOAD_ACQUIRE( &fifo->read_pos );
+    unsigned int w = AIOFIFO_LOAD_ACQUIRE( &fifo->write_pos );
+    size_t tmp = ( r - w - 1 ) & ( fifo->size - 1 );
+    return ( tmp / fifo->refsize ) * fifo->refsize;
+}
+
+size_t rdelta_lockfree( AIOFifo *fifo )
+{
+    unsigned int w = AIOFIFO_LOAD_ACQUIRE( &fifo->write_pos );
+    unsigned int r = AIOFIFO_LOAD_ACQUIRE( &fifo->read_pos );
+    return ( w - r ) & ( fifo->size - 1 );
+}
+
+void AIOFifoLockFreeInitialize( AIOFifo *nfifo, unsigned int size, unsigned refsize )
+{
+    AIOFifoInitialize( nfifo, next_power_of_two( size ), refsize );
+    nfifo->Read     = AIOFifoReadLockFree;
+    nfifo->Write    = AIOFifoWriteLockFree;
+    nfifo->delta    = delta_lockfree;
+    nfifo->rdelta   = rdelta_lockfree;
+}
+
+AIOFifo *NewAIOFifoLockFree( unsigned int size , unsigned refsize )
+{
+    AIOFifo *nfifo  = (AIOFifo *)calloc(1,sizeof(AIOFifo));
+    AIOFifoLockFreeInitialize( nfifo, size, refsize );
+    return nfifo;
+}
+
+/**
+ * @brief Switches an already initialized lock free fifo to all or none
+ * semantics, undoing what the Counts / Volts initializers install
+ */
+void AIOFifoLockFreeAllOrNoneInitialize( AIOFifo *nfifo )
+{
+    nfifo->Read     = AIOFifoReadLockFree;
+    nfifo->Write    = AIOFifoWriteLockFree;
+    nfifo->delta    = delta_lockfree;
+    nfifo->rdelta   = rdelta_lockfree;
+    nfifo->_calculate_size_write = _calculate_size_aon_write;
+    nfifo->_calculate_size_read  = _calculate_size_aon_read;
+}
+
 void AIOFifoReset( AIOFifo *fifo )
 {
     assert(fifo);
@@ -239,6 +306,117 @@ AIORET_TYPE AIOFifoReadAllOrNone( AIOFifo *fifo, void *tobuf , unsigned maxsize
 }
 
 
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOFifoWriteLockFree( AIOFifo *fifo, void *frombuf , unsigned maxsize )
+{
+    unsigned int w = AIOFIFO_LOAD_RELAXED( &fifo->write_pos );
+    int actsize = fifo->_calculate_size_write( fifo, maxsize );
+    if ( actsize ) {
+        int basic_copy = MIN( (unsigned)actsize, fifo->size - w ), wrap_copy = actsize - basic_copy;
+        memcpy( &((char *)fifo->data)[w], frombuf, basic_copy );
+        memcpy( &((char *)fifo->data)[0], (void*)((char *)frombuf+basic_copy), wrap_copy );
+        AIOFIFO_STORE_RELEASE( &fifo->write_pos, (w + actsize) & ( fifo->size - 1 ) );
+    }
+    return actsize;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOFifoReadLockFree( AIOFifo *fifo, void *tobuf , unsigned maxsize )
+{
+    unsigned int r = AIOFIFO_LOAD_RELAXED( &fifo->read_pos );
+    int actsize = fifo->_calculate_size_read( fifo, maxsize );
+    if ( actsize ) {
+        int basic_copy = MIN( (unsigned)actsize, fifo->size - r ), wrap_copy = actsize - basic_copy;
+        memcpy( tobuf                       , &((char *)fifo->data)[r], basic_copy );
+        memcpy( &((char*)tobuf)[basic_copy] , &((char *)fifo->data)[0], wrap_copy );
+        AIOFIFO_STORE_RELEASE( &fifo->read_pos, (r + actsize) & ( fifo->size - 1 ) );
+    }
+    return actsize;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Describes up to maxsize readable bytes ( whole refsize units ) 
+ * in place, without moving read_pos. Follow with AIOFifoReadCommit once
+ * the caller is done with the data.
+ * @return number of bytes described by region
+ */
+AIORET_TYPE AIOFifoReadAcquire( AIOFifo *fifo, AIOFifoRegion *region, unsigned maxsize )
+{
+    if ( !fifo || !region )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    unsigned int r = AIOFIFO_LOAD_RELAXED( &fifo->read_pos );
+    unsigned avail = (unsigned)fifo->rdelta( fifo );   /* once: MIN would call it twice while the writer moves on */
+    avail = MIN( avail, maxsize );
+    avail = ( avail / fifo->refsize ) * fifo->refsize;
+
+    region->size[0] = MIN( avail, fifo->size - r );
+    region->size[1] = avail - region->size[0];
+    region->data[0] = ( region->size[0] ? &((char *)fifo->data)[r] : NULL );
+    region->data[1] = ( region->size[1] ? fifo->data : NULL );
+
+    return avail;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Releases size bytes previously obtained from AIOFifoReadAcquire
+ * back to the writer
+ */
+AIORET_TYPE AIOFifoReadCommit( AIOFifo *fifo, unsigned size )
+{
+    if ( !fifo || size > fifo->rdelta( fifo ) )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    unsigned int r = AIOFIFO_LOAD_RELAXED( &fifo->read_pos );
+    AIOFIFO_STORE_RELEASE( &fifo->read_pos, (r + size) % fifo->size );
+
+    return size;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Describes up to maxsize writable bytes ( whole refsize units ) in
+ * place so a producer can fill the fifo directly, eg. as the target of a
+ * bulk read. Follow with AIOFifoWriteCommit for the bytes actually filled.
+ * @return number of bytes described by region
+ */
+AIORET_TYPE AIOFifoWriteAcquire( AIOFifo *fifo, AIOFifoRegion *region, unsigned maxsize )
+{
+    if ( !fifo || !region )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    unsigned int w = AIOFIFO_LOAD_RELAXED( &fifo->write_pos );
+    unsigned room = (unsigned)fifo->delta( fifo );     /* once: MIN would call it twice while the reader moves on */
+    room = MIN( room, maxsize );
+    room = ( room / fifo->refsize ) * fifo->refsize;
+
+    region->size[0] = MIN( room, fifo->size - w );
+    region->size[1] = room - region->size[0];
+    region->data[0] = ( region->size[0] ? &((char *)fifo->data)[w] : NULL );
+    region->data[1] = ( region->size[1] ? fifo->data : NULL );
+
+    return room;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Publishes size bytes filled in after AIOFifoWriteAcquire to the
+ * reader
+ */
+AIORET_TYPE AIOFifoWriteCommit( AIOFifo *fifo, unsigned size )
+{
+    if ( !fifo || size > fifo->delta( fifo ) )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    unsigned int w = AIOFIFO_LOAD_RELAXED( &fifo->write_pos );
+    AIOFIFO_STORE_RELEASE( &fifo->write_pos, (w + size) % fifo->size );
+
+    return size;
+}
+
+
 TEMPLATE_AIOFIFO_API( Counts, uint16_t );
 TEMPLATE_AIOFIFO_API( Volts, double );
 
@@ -451,6 +629,143 @@ TEST(Volts,Testing )
 }
 
 
+TEST(LockFree,PowerOfTwoSizing )
+{
+    AIOFifoCounts *cfifo = NewAIOFifoCountsLockFree( 1000 );
+    EXPECT_EQ( 2048, cfifo->size );
+    EXPECT_EQ( 2046, cfifo->delta( (AIOFifo*)cfifo ) ) << "One refsize slot always stays empty";
+    DeleteAIOFifoCounts( cfifo );
+
+    AIOFifo *fifo = NewAIOFifoLockFree( 4096, 1 );
+    EXPECT_EQ( 4096, fifo->size );
+    DeleteAIOFifo( fifo );
+}
+
+TEST(LockFree,CountsWrapAround )
+{
+    int size = 1000;
+    AIOFifoCounts *cfifo = NewAIOFifoCountsLockFree( size );
+    uint16_t tmp[size], out[size];
+    for( int i = 0; i < size ; i ++ ) tmp[i] = i;
+
+    for ( int round = 0; round < 10; round ++ ) {
+        EXPECT_EQ( size*sizeof(uint16_t), cfifo->PushN( cfifo, tmp, size ) );
+        EXPECT_EQ( size*sizeof(uint16_t), cfifo->rdelta( (AIOFifo*)cfifo ) );
+        EXPECT_EQ( 0, cfifo->PushN( cfifo, tmp, size ) ) << "All or none on a fifo without room";
+        EXPECT_EQ( size*sizeof(uint16_t), cfifo->PopN( cfifo, out, size ) );
+        for ( int i = 0; i < size ; i ++ )
+            ASSERT_EQ( tmp[i], out[i] ) << "round " << round << " index " << i;
+        EXPECT_LT( cfifo->write_pos, cfifo->size );
+    }
+    EXPECT_EQ( 0, cfifo->PopN( cfifo, out, 1 ) );
+    DeleteAIOFifoCounts( cfifo );
+}
+
+TEST(LockFree,Volts )
+{
+    AIOFifoVolts *cfifo = NewAIOFifoVoltsLockFree(1000);
+    double tmp[1000];
+    for( int i = 0; i < 1000 ; i ++ ) tmp[i] = 3.342*sqrt((double)i);
+
+    cfifo->PushN( cfifo, tmp, 1000 );
+
+    for( int i = 0; i < 1000 ; i ++ ) {
+        AIOEither tval = cfifo->Pop(cfifo);
+        EXPECT_EQ( tval.right.d, tmp[i] );
+    }
+    DeleteAIOFifoVolts( cfifo );
+}
+
+TEST(ZeroCopy,AcquireAndCommitAcrossWrap )
+{
+    int size = 100;
+    AIOFifoCounts *cfifo = NewAIOFifoCounts( size );
+    AIOFifoRegion region;
+    uint16_t tmp[size];
+    for( int i = 0; i < size ; i ++ ) tmp[i] = i;
+
+    EXPECT_EQ( 0, AIOFifoReadAcquire( (AIOFifo*)cfifo, &region, 1000 ) );
+
+    /* Move the positions near the end so the next push wraps */
+    cfifo->write_pos = cfifo->read_pos = cfifo->size - 20*sizeof(uint16_t);
+    cfifo->PushN( cfifo, tmp, 50 );
+
+    EXPECT_EQ( 50*sizeof(uint16_t), AIOFifoReadAcquire( (AIOFifo*)cfifo, &region, 1000 ) );
+    EXPECT_EQ( 20*sizeof(uint16_t), region.size[0] );
+    EXPECT_EQ( 30*sizeof(uint16_t), region.size[1] );
+    EXPECT_EQ( cfifo->data, region.data[1] );
+    for ( int i = 0; i < 20; i ++ )
+        EXPECT_EQ( i, ((uint16_t *)region.data[0])[i] );
+    for ( int i = 0; i < 30; i ++ )
+        EXPECT_EQ( 20 + i, ((uint16_t *)region.data[1])[i] );
+
+    EXPECT_EQ( 50*sizeof(uint16_t), cfifo->rdelta( (AIOFifo*)cfifo ) ) << "Acquire must not consume";
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOFifoReadCommit( (AIOFifo*)cfifo, 51*sizeof(uint16_t) ) );
+    EXPECT_EQ( 25*sizeof(uint16_t), AIOFifoReadCommit( (AIOFifo*)cfifo, 25*sizeof(uint16_t) ) );
+
+    EXPECT_EQ( 25*sizeof(uint16_t), AIOFifoReadAcquire( (AIOFifo*)cfifo, &region, 1000 ) );
+    EXPECT_EQ( 0, region.size[1] );
+    EXPECT_EQ( 25, ((uint16_t *)region.data[0])[0] );
+
+    DeleteAIOFifoCounts( cfifo );
+}
+
+static void *lockfree_producer( void *obj )
+{
+    AIOFifoCounts *cfifo = (AIOFifoCounts *)obj;
+    uint16_t block[100];
+    for ( unsigned i = 0; i < 100000; ) {
+        for ( int j = 0; j < 100; j ++ ) block[j] = (uint16_t)(i + j);
+        if ( cfifo->PushN( cfifo, block, 100 ) > 0 )
+            i += 100;
+    }
+    return NULL;
+}
+
+TEST(LockFree,WriteAcquireCommit )
+{
+    AIOFifoCounts *cfifo = NewAIOFifoCountsLockFree( 100 );
+    AIOFifoRegion region;
+    uint16_t tmp[50];
+
+    /* Move the positions near the end so the region wraps */
+    cfifo->write_pos = cfifo->read_pos = cfifo->size - 20*sizeof(uint16_t);
+    EXPECT_EQ( 50*sizeof(uint16_t), AIOFifoWriteAcquire( (AIOFifo*)cfifo, &region, 50*sizeof(uint16_t) ) );
+    EXPECT_EQ( 20*sizeof(uint16_t), region.size[0] );
+    EXPECT_EQ( 30*sizeof(uint16_t), region.size[1] );
+    for ( int i = 0; i < 20; i ++ )
+        ((uint16_t *)region.data[0])[i] = i;
+    for ( int i = 0; i < 30; i ++ )
+        ((uint16_t *)region.data[1])[i] = 20 + i;
+
+    EXPECT_EQ( 0, cfifo->rdelta( (AIOFifo*)cfifo ) ) << "Acquire must not publish";
+    EXPECT_EQ( 50*sizeof(uint16_t), AIOFifoWriteCommit( (AIOFifo*)cfifo, 50*sizeof(uint16_t) ) );
+    EXPECT_EQ( 50*sizeof(uint16_t), cfifo->PopN( cfifo, tmp, 50 ) );
+    for ( int i = 0; i < 50; i ++ )
+        EXPECT_EQ( i, tmp[i] );
+
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOFifoWriteCommit( (AIOFifo*)cfifo, cfifo->size ) );
+    DeleteAIOFifoCounts( cfifo );
+}
+
+TEST(LockFree,SingleProducerSingleConsumer )
+{
+    pthread_t producer;
+    AIOFifoCounts *cfifo = NewAIOFifoCountsLockFree( 1000 );
+    uint16_t block[100];
+
+    pthread_create( &producer, NULL, lockfree_producer, cfifo );
+    for ( unsigned i = 0; i < 100000; ) {
+        if ( cfifo->PopN( cfifo, block, 100 ) > 0 ) {
+            for ( int j = 0; j < 100; j ++ )
+                ASSERT_EQ( (uint16_t)(i + j), block[j] );
+            i += 100;
+        }
+    }
+    pthread_join( producer, NULL );
+    DeleteAIOFifoCounts( cfifo );
+}
+
 int main(int argc, char *argv[] )
 {
 
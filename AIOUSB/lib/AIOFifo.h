@@ -52,6 +52,15 @@ typedef struct aio_fifo {
     LOCKING_MECHANISM;
 } AIOFifo;
 
+/**
+ * @brief Readable part of a fifo handed out without copying. The ring may
+ * wrap, so the bytes are data[0] for size[0] followed by data[1] for size[1]
+ */
+typedef struct aio_fifo_region {
+    void *data[2];
+    unsigned size[2];
+} AIOFifoRegion;
+
 
 typedef uint32_t TYPE;
 
@@ -75,6 +84,7 @@ typedef struct new_aio_fifo {
         AIORET_TYPE (*PopN)( struct new_aio_fifo_##NAME *fifo , TYPE *a, unsigned N );              \
     } AIOFifo##NAME;                                                                                \
     AIOFifo##NAME *NewAIOFifo##NAME( unsigned int size );                                           \
+    AIOFifo##NAME *NewAIOFifo##NAME##LockFree( unsigned int size );                                 \
     void DeleteAIOFifo##NAME( AIOFifo##NAME *fifo );                                                \
     AIORET_TYPE AIOFifo##NAME ##Initialize( AIOFifo##NAME *nfifo );
 
@@ -144,6 +154,14 @@ AIOFifo##NAME *NewAIOFifo##NAME( unsigned int size )
     AIOFifo##NAME ##Initialize( nfifo );                                                            \
     return nfifo;                                                                                   \
 }                                                                                                   \
+AIOFifo##NAME *NewAIOFifo##NAME##LockFree( unsigned int size )                                      \
+{                                                                                                   \
+    AIOFifo##NAME *nfifo = (AIOFifo##NAME*)calloc(1,sizeof(AIOFifo##NAME));                         \
+    AIOFifoLockFreeInitialize( (AIOFifo*)nfifo , (size+1)*sizeof(TYPE), sizeof(TYPE));              \
+    AIOFifo##NAME ##Initialize( nfifo );                                                            \
+    AIOFifoLockFreeAllOrNoneInitialize( (AIOFifo*)nfifo );                                          \
+    return nfifo;                                                                                   \
+}                                                                                                   \
 void DeleteAIOFifo##NAME( AIOFifo##NAME *fifo )                                                     \
 {                                                                                                   \
     DeleteAIOFifo( (AIOFifo*)fifo);                                                                 \
@@ -157,8 +175,18 @@ TEMPLATE_AIOFIFO_INTERFACE(Volts,double);
 
 
 AIOFifo *NewAIOFifo( unsigned int size , unsigned int refsize );
+AIOFifo *NewAIOFifoLockFree( unsigned int size , unsigned int refsize );
 void DeleteAIOFifo( AIOFifo *fifo );
 
+void AIOFifoLockFreeInitialize( AIOFifo *nfifo, unsigned int size, unsigned refsize );
+void AIOFifoLockFreeAllOrNoneInitialize( AIOFifo *nfifo );
+AIORET_TYPE AIOFifoReadLockFree( AIOFifo *fifo, void *tobuf , unsigned maxsize );
+AIORET_TYPE AIOFifoReadAcquire( AIOFifo *fifo, AIOFifoRegion *region, unsigned maxsize );
+AIORET_TYPE AIOFifoReadCommit( AIOFifo *fifo, unsigned size );
+AIORET_TYPE AIOFifoWriteAcquire( AIOFifo *fifo, AIOFifoRegion *region, unsigned maxsize );
+AIORET_TYPE AIOFifoWriteCommit( AIOFifo *fifo, unsigned size );
+AIORET_TYPE AIOFifoWriteLockFree( AIOFifo *fifo, void *frombuf , unsigned maxsize );
+
 void AIOFifoReset( AIOFifo *fifo );
 AIORET_TYPE AIOFifoRead( AIOFifo *fifo, void *tobuf , unsigned maxsize );
 AIORET_TYPE AIOFifoWrite( AIOFifo *fifo, void *frombuf , unsigned maxsize );
@@ -0,0 +1,502 @@
+/**
+ * @file   AIORecorder.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Recorder stage that copies scans from an AIOContinuousBuf into a
+ *         pre-sized, memory mapped file on its own thread
+ *
+ */
+
+#include "AIORecorder.h"
+#include "AIOTypes.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "ADCConfigBlock.h"
+#include "AIOUSB_Log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <poll.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define AIORECORDER_CHUNK_SIZE  ( 1024*1024 )
+#define AIORECORDER_POLL_MS     10     /* longest wait for scans before checking for a stop */
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Creates a recorder that will write at most max_scans scans of buf
+ * to filename. Nothing touches the disk until AIORecorderStart.
+ */
+AIORecorder *NewAIORecorder( AIOContinuousBuf *buf, const char *filename, unsigned long max_scans )
+{
+    if ( !buf || !filename || !max_scans )
+        return NULL;
+
+    AIORecorder *rec = (AIORecorder *)calloc(1, sizeof(AIORecorder) );
+    if ( !rec )
+        return NULL;
+
+    rec->filename = strdup( filename );
+    if ( !rec->filename )
+        goto out_NewAIORecorder;
+
+    rec->buf       = buf;
+    rec->fd        = -1;
+    rec->scan_size = (unsigned)AIOContinuousBufGetScanSize( buf );
+    rec->capacity  = (uint64_t)max_scans * rec->scan_size;
+    rec->status    = NOT_STARTED;
+
+    return rec;
+
+ out_NewAIORecorder:
+    free( rec );
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static size_t aiorecorder_window_length( AIORecorder *rec )
+{
+    return (size_t)MIN( (uint64_t)AIORECORDER_WINDOW_SIZE, rec->capacity - rec->window_offset );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Starts write back of the current window and drops the mapping, so
+ * the recorder never holds more than one window of the file
+ */
+static void aiorecorder_unmap_window( AIORecorder *rec )
+{
+    if ( !rec->window )
+        return;
+    msync( rec->window, aiorecorder_window_length( rec ), MS_ASYNC );
+    munmap( rec->window, aiorecorder_window_length( rec ) );
+    rec->window = NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+static AIORET_TYPE aiorecorder_map_window( AIORecorder *rec )
+{
+    aiorecorder_unmap_window( rec );
+    rec->window_offset = ( rec->written / AIORECORDER_WINDOW_SIZE ) * AIORECORDER_WINDOW_SIZE;
+
+    void *addr = mmap( NULL, aiorecorder_window_length( rec ), PROT_READ | PROT_WRITE, MAP_SHARED,
+                       rec->fd, (off_t)( rec->header.data_offset + rec->window_offset ) );
+    if ( addr == MAP_FAILED ) {
+        AIOUSB_ERROR("Unable to map %s: %s\n", rec->filename, strerror(errno) );
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+    rec->window = (char *)addr;
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+static AIORET_TYPE aiorecorder_write( AIORecorder *rec, const char *data, unsigned size )
+{
+    AIORET_TYPE retval;
+    while ( size ) {
+        if ( !rec->window || rec->written >= rec->window_offset + AIORECORDER_WINDOW_SIZE ) {
+            if ( ( retval = aiorecorder_map_window( rec ) ) < 0 )
+                return retval;
+        }
+        unsigned n = (unsigned)MIN( (uint64_t)size, rec->window_offset + AIORECORDER_WINDOW_SIZE - rec->written );
+        memcpy( rec->window + ( rec->written - rec->window_offset ), data, n );
+        rec->written += n;
+        data += n;
+        size -= n;
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Waits for more scans on the buffer's poll descriptor. Once the
+ * acquisition has ended that stays readable, so fall back to sleeping
+ * until the recorder is told to stop.
+ */
+static void aiorecorder_wait( AIORecorder *rec )
+{
+    AIORET_TYPE fd = AIOContinuousBufGetPollFd( rec->buf );
+    if ( fd >= 0 && AIOContinuousBufGetStatus( rec->buf ) == RUNNING ) {
+        struct pollfd pfd = { (int)fd, POLLIN, 0 };
+        poll( &pfd, 1, AIORECORDER_POLL_MS );
+    } else {
+        usleep( 1000 );
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Recorder thread. Takes scans straight out of the buffer's fifo with
+ * AIOContinuousBufAcquireScans, so the only copy is into the mapped file and
+ * the acquisition thread is only held up for the commit. Stops when the file
+ * is full or, once asked to stop, when the buffer has been drained.
+ */
+static void *aiorecorder_work( void *obj )
+{
+    AIORecorder *rec = (AIORecorder *)obj;
+    AIOFifoRegion region;
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+    unsigned chunk_scans = MAX( 1, AIORECORDER_CHUNK_SIZE / rec->scan_size );
+
+    for ( ;; ) {
+        unsigned max_scans = (unsigned)MIN( (uint64_t)chunk_scans, ( rec->capacity - rec->written ) / rec->scan_size );
+        if ( max_scans == 0 ) {
+            AIOUSB_DEVEL("%s is full after %lu bytes\n", rec->filename, (unsigned long)rec->written );
+            break;
+        }
+
+        retval = AIOContinuousBufAcquireScans( rec->buf, &region, max_scans );
+        if ( retval < 0 )
+            break;
+        if ( retval == 0 ) {
+            if ( rec->status != RUNNING )
+                break;
+            aiorecorder_wait( rec );
+            continue;
+        }
+
+        unsigned num_scans = (unsigned)retval;
+        for ( int i = 0; i < 2; i ++ ) {
+            if ( region.size[i] && ( retval = aiorecorder_write( rec, (const char *)region.data[i], region.size[i] ) ) < 0 )
+                goto out_aiorecorder_work;
+        }
+        if ( ( retval = AIOContinuousBufCommitScans( rec->buf, num_scans ) ) < 0 )
+            break;
+        retval = AIOUSB_SUCCESS;
+    }
+
+ out_aiorecorder_work:
+    rec->exitcode = retval;
+    rec->status = TERMINATED;
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Creates the file, sizes it for max_scans scans, writes the header
+ * and starts the recorder thread
+ */
+AIORET_TYPE AIORecorderStart( AIORecorder *rec )
+{
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+    AIORESULT result = AIOUSB_SUCCESS;
+    char *json = NULL;
+
+    if ( !rec )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( rec->status == RUNNING )
+        return -AIOUSB_ERROR_INVALID_THREAD;
+
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( AIOContinuousBufGetDeviceIndex( rec->buf ), &result );
+    if ( result == AIOUSB_SUCCESS && dev )
+        json = ADCConfigBlockToJSON( AIOUSBDeviceGetADCConfigBlock( dev ) );
+    if ( !json )
+        json = strdup("{}");
+    if ( !json )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    /* lazy volts buffers hold every oversample, so their own count is what the data is laid out by */
+    AIORET_TYPE oversample = ( rec->buf->lazy_volts ? (AIORET_TYPE)rec->buf->num_oversamples : AIOContinuousBufGetOverSample( rec->buf ) );
+
+    memset( &rec->header, 0, sizeof(rec->header) );
+    memcpy( rec->header.magic, AIORECORDER_MAGIC, sizeof(rec->header.magic) );
+    rec->header.version         = AIORECORDER_VERSION;
+    rec->header.num_channels    = AIOContinuousBufNumberChannels( rec->buf );
+    rec->header.num_oversamples = ( oversample < 0 ? 0 : (uint32_t)oversample );
+    rec->header.sample_size     = rec->buf->fifo->refsize;
+    rec->header.clock_hz        = rec->buf->hz;
+    rec->header.config_length   = strlen( json ) + 1;
+    rec->header.data_offset     = ( ( sizeof(AIORecorderHeader) + rec->header.config_length + AIORECORDER_PAGE_SIZE - 1 ) /
+                                    AIORECORDER_PAGE_SIZE ) * AIORECORDER_PAGE_SIZE;
+
+    rec->fd = open( rec->filename, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( rec->fd < 0 ) {
+        AIOUSB_ERROR("Unable to open %s: %s\n", rec->filename, strerror(errno) );
+        retval = -AIOUSB_ERROR_OPEN_FAILED;
+        goto out_AIORecorderStart;
+    }
+
+    /* Reserve the blocks up front so a full disk fails here rather than as a SIGBUS in the thread */
+    result = posix_fallocate( rec->fd, 0, (off_t)( rec->header.data_offset + rec->capacity ) );
+    if ( result == EINVAL || result == EOPNOTSUPP )
+        result = ( ftruncate( rec->fd, (off_t)( rec->header.data_offset + rec->capacity ) ) == 0 ? 0 : errno );
+    if ( result != 0 ) {
+        AIOUSB_ERROR("Unable to size %s: %s\n", rec->filename, strerror((int)result) );
+        retval = -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out_AIORecorderStart;
+    }
+
+    if ( pwrite( rec->fd, &rec->header, sizeof(rec->header), 0 ) != (ssize_t)sizeof(rec->header) ||
+         pwrite( rec->fd, json, rec->header.config_length, sizeof(rec->header) ) != (ssize_t)rec->header.config_length ) {
+        retval = -AIOUSB_ERROR_FILE_NOT_FOUND;
+        goto out_AIORecorderStart;
+    }
+
+    rec->written       = 0;
+    rec->window        = NULL;
+    rec->window_offset = 0;
+    rec->exitcode      = AIOUSB_SUCCESS;
+    rec->status        = RUNNING;
+
+    if ( pthread_create( &rec->worker, NULL, aiorecorder_work, (void *)rec ) != 0 ) {
+        rec->status = NOT_STARTED;
+        retval = -AIOUSB_ERROR_INVALID_THREAD;
+    }
+
+ out_AIORecorderStart:
+    if ( retval < 0 && rec->fd >= 0 ) {
+        close( rec->fd );
+        rec->fd = -1;
+    }
+    free( json );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Drains what is left in the buffer, joins the recorder thread and
+ * trims the file to what was recorded. Stop the acquisition first.
+ * @return the exit code of the recorder thread
+ */
+AIORET_TYPE AIORecorderStop( AIORecorder *rec )
+{
+    AIORET_TYPE retval;
+    if ( !rec )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( rec->fd < 0 )
+        return AIOUSB_SUCCESS;
+
+    rec->status = TERMINATED;
+    pthread_join( rec->worker, NULL );
+    rec->status = JOINED;
+
+    aiorecorder_unmap_window( rec );
+
+    retval = rec->exitcode;
+    rec->header.num_samples = rec->written / rec->header.sample_size;
+    if ( pwrite( rec->fd, &rec->header, sizeof(rec->header), 0 ) != (ssize_t)sizeof(rec->header) ||
+         ftruncate( rec->fd, (off_t)( rec->header.data_offset + rec->written ) ) != 0 ) {
+        AIOUSB_ERROR("Unable to finish %s: %s\n", rec->filename, strerror(errno) );
+        if ( retval >= 0 )
+            retval = -AIOUSB_ERROR_FILE_NOT_FOUND;
+    }
+    close( rec->fd );
+    rec->fd = -1;
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIORecorderGetScansWritten( AIORecorder *rec )
+{
+    if ( !rec )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return (AIORET_TYPE)( rec->written / rec->scan_size );
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIORecorderGetStatus( AIORecorder *rec )
+{
+    if ( !rec )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return (AIORET_TYPE)rec->status;
+}
+
+/*----------------------------------------------------------------------------*/
+void DeleteAIORecorder( AIORecorder *rec )
+{
+    if ( !rec )
+        return;
+    AIORecorderStop( rec );
+    free( rec->filename );
+    free( rec );
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef SELF_TEST
+
+#include "AIOUSBDevice.h"
+#include "gtest/gtest.h"
+#include "tap.h"
+#include <iostream>
+#include <stdio.h>
+using namespace AIOUSB;
+
+static void read_recording( const char *fname, AIORecorderHeader *header, char **json, uint16_t **data )
+{
+    FILE *fp = fopen( fname, "rb" );
+    ASSERT_TRUE( fp );
+    ASSERT_EQ( 1, fread( header, sizeof(*header), 1, fp ) );
+    *json = (char *)malloc( header->config_length );
+    ASSERT_EQ( header->config_length, fread( *json, 1, header->config_length, fp ) );
+    *data = (uint16_t *)malloc( header->num_samples * header->sample_size + 1 );
+    fseek( fp, header->data_offset, SEEK_SET );
+    ASSERT_EQ( header->num_samples, fread( *data, header->sample_size, header->num_samples, fp ) );
+    fclose( fp );
+}
+
+TEST(AIORecorder,RecordsScansAndHeader )
+{
+    int num_channels = 16, num_scans = 1000;
+    char fname[] = "/tmp/aiorecorderXXXXXX";
+    int fd = mkstemp( fname );
+    AIORecorderHeader header;
+    char *json;
+    uint16_t *data;
+    uint16_t *tobuf = (uint16_t *)malloc( num_scans*num_channels*sizeof(uint16_t) );
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, num_scans, num_channels );
+    AIOContinuousBufSetClock( buf, 1000 );
+    close( fd );
+
+    for ( int i = 0; i < num_channels*num_scans; i ++ ) tobuf[i] = (uint16_t)i;
+
+    AIORecorder *rec = NewAIORecorder( buf, fname, 10*num_scans );
+    ASSERT_TRUE( rec );
+    EXPECT_EQ( NOT_STARTED, AIORecorderGetStatus( rec ) );
+
+    buf->PushN( buf, tobuf, 100*num_channels );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIORecorderStart( rec ) );
+    EXPECT_EQ( RUNNING, AIORecorderGetStatus( rec ) );
+
+    for ( int pushed = 100; pushed < num_scans; ) {
+        if ( buf->PushN( buf, &tobuf[pushed*num_channels], 100*num_channels ) > 0 )
+            pushed += 100;
+        else
+            usleep( 100 );
+    }
+    EXPECT_EQ( AIOUSB_SUCCESS, AIORecorderStop( rec ) );
+    EXPECT_EQ( num_scans, AIORecorderGetScansWritten( rec ) );
+    EXPECT_EQ( 0, AIOContinuousBufCountScansAvailable( buf ) );
+
+    read_recording( fname, &header, &json, &data );
+    EXPECT_EQ( 0, memcmp( header.magic, AIORECORDER_MAGIC, 8 ) );
+    EXPECT_EQ( AIORECORDER_VERSION, header.version );
+    EXPECT_EQ( num_channels, header.num_channels );
+    EXPECT_EQ( sizeof(uint16_t), header.sample_size );
+    EXPECT_EQ( 1000, header.clock_hz );
+    EXPECT_EQ( 0, header.data_offset % AIORECORDER_PAGE_SIZE );
+    EXPECT_EQ( num_channels*num_scans, header.num_samples );
+    EXPECT_EQ( strlen(json) + 1, header.config_length );
+    EXPECT_EQ( 0, memcmp( data, tobuf, num_channels*num_scans*sizeof(uint16_t) ) );
+
+    free( json );
+    free( data );
+    DeleteAIORecorder( rec );
+    DeleteAIOContinuousBuf( buf );
+    free( tobuf );
+    unlink( fname );
+}
+
+TEST(AIORecorder,StopsWhenFileIsFull )
+{
+    int num_channels = 4, num_scans = 100;
+    char fname[] = "/tmp/aiorecorderXXXXXX";
+    int fd = mkstemp( fname );
+    AIORecorderHeader header;
+    char *json;
+    uint16_t *data;
+    uint16_t *tobuf = (uint16_t *)malloc( num_scans*num_channels*sizeof(uint16_t) );
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, num_scans, num_channels );
+    close( fd );
+
+    for ( int i = 0; i < num_channels*num_scans; i ++ ) tobuf[i] = (uint16_t)i;
+    buf->PushN( buf, tobuf, num_scans*num_channels );
+
+    AIORecorder *rec = NewAIORecorder( buf, fname, 30 );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIORecorderStart( rec ) );
+    while ( AIORecorderGetStatus( rec ) == RUNNING )
+        usleep( 100 );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIORecorderStop( rec ) );
+    EXPECT_EQ( 30, AIORecorderGetScansWritten( rec ) );
+    EXPECT_EQ( num_scans - 30, AIOContinuousBufCountScansAvailable( buf ) ) << "Scans that did not fit stay in the buffer";
+
+    read_recording( fname, &header, &json, &data );
+    EXPECT_EQ( 30*num_channels, header.num_samples );
+    EXPECT_EQ( 0, memcmp( data, tobuf, 30*num_channels*sizeof(uint16_t) ) );
+
+    free( json );
+    free( data );
+    DeleteAIORecorder( rec );
+    DeleteAIOContinuousBuf( buf );
+    free( tobuf );
+    unlink( fname );
+}
+
+TEST(AIORecorder,RecordsLazyVoltsOversamples )
+{
+    int num_channels = 4, num_oversamples = 3, num_scans = 200;
+    int scan_counts = num_channels * ( num_oversamples + 1 );
+    char fname[] = "/tmp/aiorecorderXXXXXX";
+    int fd = mkstemp( fname );
+    AIORecorderHeader header;
+    char *json;
+    uint16_t *data;
+    uint16_t *tobuf = (uint16_t *)malloc( num_scans*scan_counts*sizeof(uint16_t) );
+    AIOContinuousBuf *buf = NewAIOContinuousBufForLazyVolts( 0, num_scans, num_channels, num_oversamples );
+    close( fd );
+
+    for ( int i = 0; i < scan_counts*num_scans; i ++ ) tobuf[i] = (uint16_t)i;
+    buf->PushN( buf, tobuf, num_scans*scan_counts );
+    ASSERT_EQ( num_scans, AIOContinuousBufCountScansAvailable( buf ) );
+    EXPECT_EQ( scan_counts*sizeof(uint16_t), AIOContinuousBufGetScanSize( buf ) );
+
+    AIORecorder *rec = NewAIORecorder( buf, fname, 150 );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIORecorderStart( rec ) );
+    while ( AIORecorderGetStatus( rec ) == RUNNING )
+        usleep( 100 );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIORecorderStop( rec ) );
+    EXPECT_EQ( 150, AIORecorderGetScansWritten( rec ) );
+    EXPECT_EQ( num_scans - 150, AIOContinuousBufCountScansAvailable( buf ) );
+
+    read_recording( fname, &header, &json, &data );
+    EXPECT_EQ( num_channels, header.num_channels );
+    EXPECT_EQ( num_oversamples, header.num_oversamples );
+    EXPECT_EQ( sizeof(uint16_t), header.sample_size );
+    EXPECT_EQ( 150*scan_counts, header.num_samples );
+    EXPECT_EQ( 0, memcmp( data, tobuf, 150*scan_counts*sizeof(uint16_t) ) );
+
+    free( json );
+    free( data );
+    DeleteAIORecorder( rec );
+    DeleteAIOContinuousBuf( buf );
+    free( tobuf );
+    unlink( fname );
+}
+
+TEST(AIORecorder,RejectsBadArguments )
+{
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, 10, 4 );
+    EXPECT_FALSE( NewAIORecorder( NULL, "/tmp/foo", 10 ) );
+    EXPECT_FALSE( NewAIORecorder( buf, NULL, 10 ) );
+    EXPECT_FALSE( NewAIORecorder( buf, "/tmp/foo", 0 ) );
+
+    AIORecorder *rec = NewAIORecorder( buf, "/nonexistent/dir/recording.bin", 10 );
+    EXPECT_EQ( -AIOUSB_ERROR_OPEN_FAILED, AIORecorderStart( rec ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIORecorderStop( rec ) );
+    DeleteAIORecorder( rec );
+    DeleteAIOContinuousBuf( buf );
+}
+
+int main(int argc, char *argv[] )
+{
+  testing::InitGoogleTest(&argc, argv);
+  testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+  delete listeners.Release(listeners.default_result_printer());
+#endif
+
+  listeners.Append( new tap::TapListener() );
+  return RUN_ALL_TESTS();
+}
+
+#endif
@@ -0,0 +1,79 @@
+/**
+ * @file   AIORecorder.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Streams the contents of an AIOContinuousBuf to disk
+ *
+ * File layout, all integers in host ( little endian ) byte order:
+ *
+ *   offset 0            AIORecorderHeader
+ *   sizeof(header)      config_length bytes of ADCConfigBlock JSON, NUL terminated
+ *   data_offset         num_samples samples of sample_size bytes each, exactly
+ *                       as they left the AIOContinuousBuf. A lazy volts buffer
+ *                       keeps raw counts, so each of its scans is num_channels
+ *                       groups of num_oversamples+1 counts; other buffers hold
+ *                       one sample per channel.
+ *
+ * data_offset is a multiple of AIORECORDER_PAGE_SIZE so the data can be
+ * mapped or read with O_DIRECT without copying the header.
+ */
+
+#ifndef _AIO_RECORDER_H
+#define _AIO_RECORDER_H
+
+#include "AIOTypes.h"
+#include "AIOContinuousBuffer.h"
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIORECORDER_MAGIC       "AIOUSBR1"
+#define AIORECORDER_VERSION     1
+#define AIORECORDER_PAGE_SIZE   4096
+#define AIORECORDER_WINDOW_SIZE ( 8*1024*1024 )
+
+typedef struct aio_recorder_header {
+    char     magic[8];          /**< AIORECORDER_MAGIC, not NUL terminated */
+    uint32_t version;           /**< AIORECORDER_VERSION */
+    uint32_t data_offset;       /**< File offset of the first sample */
+    uint32_t num_channels;
+    uint32_t num_oversamples;
+    uint32_t sample_size;       /**< 2 for raw counts, 8 for volts */
+    uint32_t clock_hz;
+    uint64_t num_samples;       /**< Filled in by AIORecorderStop */
+    uint32_t config_length;     /**< Bytes of JSON following the header */
+    uint32_t reserved;
+} AIORecorderHeader;
+
+typedef struct aio_recorder {
+    AIOContinuousBuf *buf;
+    char *filename;
+    int fd;
+    AIORecorderHeader header;
+    unsigned scan_size;         /**< Bytes per AIOContinuousBuf scan */
+    uint64_t capacity;          /**< Bytes of data the file was pre-sized for */
+    uint64_t written;           /**< Bytes of data written so far */
+    char *window;               /**< Currently mapped part of the data */
+    uint64_t window_offset;     /**< Data offset of window */
+    pthread_t worker;
+    volatile THREAD_STATUS status;
+    AIORET_TYPE exitcode;
+} AIORecorder;
+
+PUBLIC_EXTERN AIORecorder *NewAIORecorder( AIOContinuousBuf *buf, const char *filename, unsigned long max_scans );
+PUBLIC_EXTERN void DeleteAIORecorder( AIORecorder *rec );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderStart( AIORecorder *rec );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderStop( AIORecorder *rec );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderGetScansWritten( AIORecorder *rec );
+PUBLIC_EXTERN AIORET_TYPE AIORecorderGetStatus( AIORecorder *rec );
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,287 @@
+/**
+ * @file   AIOScanClock.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Host timestamps for the scans of a counter clocked acquisition
+ *
+ * A transfer completing at tc with scans 0 .. D-1 delivered says
+ * t0 <= tc - ( D - 1 ) * period. The bound is only as tight as the
+ * quickest transfer, so the lowest of the last AIOSCANCLOCK_WINDOW is
+ * used; a window rather than the whole run lets t0 follow the drift
+ * between the board's crystal and the host clock.
+ *
+ * Counter 2 runs in mode 3, counting down by two from its load each half
+ * of its output period, so a latched count gives the time since the last
+ * output edge but not which of the two edges it was. The edges sit half a
+ * period apart; t0 is taken as the latest edge not after the transfer
+ * bound, which picks the right one while the quickest transfer lands
+ * within half a scan period. Counter 2 only moves once per counter 1
+ * period and the latch lands somewhere in its control transfer, so the
+ * edge may be placed up to that much late, and the bound is allowed to
+ * fall that far before it.
+ */
+
+#include "AIOScanClock.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+/*----------------------------------------------------------------------------*/
+AIOScanClock *NewAIOScanClock( void )
+{
+    AIOScanClock *clock = (AIOScanClock *)calloc( 1, sizeof(AIOScanClock) );
+    if ( !clock )
+        return NULL;
+    pthread_mutex_init( &clock->lock, NULL );
+    return clock;
+}
+
+/*----------------------------------------------------------------------------*/
+void DeleteAIOScanClock( AIOScanClock *clock )
+{
+    if ( !clock )
+        return;
+    pthread_mutex_destroy( &clock->lock );
+    free( clock );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief CLOCK_MONOTONIC_RAW in ns, which NTP does not slew
+ */
+unsigned long long AIOScanClockNow( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC_RAW, &ts );
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Takes host times from source( object ) rather than
+ * AIOScanClockNow(), for a board whose time the caller keeps, such as a
+ * simulator on a manual clock. Set it before the acquisition starts.
+ * @param source NULL to go back to AIOScanClockNow()
+ */
+AIORET_TYPE AIOScanClockSetSource( AIOScanClock *clock, unsigned long long (*source)( void *object ), void *object )
+{
+    if ( !clock )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock( &clock->lock );
+    clock->source        = source;
+    clock->source_object = object;
+    pthread_mutex_unlock( &clock->lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief The host time to stamp with now, from the clock's source
+ */
+unsigned long long AIOScanClockTime( AIOScanClock *clock )
+{
+    return ( clock && clock->source ? clock->source( clock->source_object ) : AIOScanClockNow() );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Forgets the last run, before the counters start clocking scans
+ * @param period_ns time between scans
+ * @param tick_ns counter 2 input period, 0 to ignore latched counts
+ * @param divisor counter 2 load
+ */
+AIORET_TYPE AIOScanClockReset( AIOScanClock *clock, double period_ns, double tick_ns, unsigned divisor )
+{
+    if ( !clock || !( period_ns > 0 ) || tick_ns < 0 )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock( &clock->lock );
+    clock->period_ns  = period_ns;
+    clock->tick_ns    = ( divisor >= 2 ? tick_ns : 0 );
+    clock->divisor    = divisor;
+    clock->scans      = 0;
+    clock->kept       = 0;
+    clock->num_bounds = 0;
+    clock->next_bound = 0;
+    clock->edge_ns    = 0;
+    clock->edge_slack_ns = 0;
+    clock->latched    = AIOUSB_FALSE;
+    clock->num_gaps   = 0;
+    clock->stamps     = 0;
+    clock->latches    = 0;
+    pthread_mutex_unlock( &clock->lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief num_scans delivered scans went into the buffer
+ */
+AIORET_TYPE AIOScanClockKeep( AIOScanClock *clock, unsigned num_scans )
+{
+    if ( !clock )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    pthread_mutex_lock( &clock->lock );
+    clock->scans += num_scans;
+    clock->kept  += num_scans;
+    pthread_mutex_unlock( &clock->lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief num_scans delivered scans were dropped before reaching the buffer,
+ * so the next scan kept comes that much later. With AIOSCANCLOCK_GAPS
+ * unread gaps outstanding the newest absorbs this one, and the scans
+ * between the two are placed late.
+ */
+AIORET_TYPE AIOScanClockDrop( AIOScanClock *clock, unsigned num_scans )
+{
+    AIOScanClockGap *gap;
+    if ( !clock )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( !num_scans )
+        return AIOUSB_SUCCESS;
+
+    pthread_mutex_lock( &clock->lock );
+    clock->scans += num_scans;
+    gap = ( clock->num_gaps ? &clock->gaps[clock->num_gaps-1] : NULL );
+    if ( !gap || ( gap->ordinal != clock->kept && clock->num_gaps < AIOSCANCLOCK_GAPS ) ) {
+        gap = &clock->gaps[clock->num_gaps++];
+        gap->ordinal = clock->kept;
+    }
+    gap->offset = clock->scans - clock->kept;
+    pthread_mutex_unlock( &clock->lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief A transfer completed at ns bringing the scans counted so far up
+ * to date, plus more_scans whole scans not yet kept or dropped
+ */
+AIORET_TYPE AIOScanClockStamp( AIOScanClock *clock, unsigned more_scans, unsigned long long ns )
+{
+    uint64_t scans;
+    if ( !clock )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock( &clock->lock );
+    scans = clock->scans + more_scans;
+    if ( scans ) {
+        clock->bounds[clock->next_bound] = (int64_t)ns - llround( ( scans - 1 ) * clock->period_ns );
+        clock->next_bound = ( clock->next_bound + 1 ) % AIOSCANCLOCK_WINDOW;
+        clock->num_bounds = MIN( clock->num_bounds + 1, AIOSCANCLOCK_WINDOW );
+        clock->stamps ++;
+    }
+    pthread_mutex_unlock( &clock->lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Counter 2 was latched holding count somewhere between before_ns
+ * and after_ns, taken as the middle of the two
+ */
+AIORET_TYPE AIOScanClockLatch( AIOScanClock *clock, unsigned count, unsigned long long before_ns, unsigned long long after_ns )
+{
+    if ( !clock || after_ns < before_ns )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock( &clock->lock );
+    if ( clock->tick_ns > 0 && count <= clock->divisor ) {
+        double since_edge = ( clock->divisor - count ) / 2.0 * clock->tick_ns;
+        clock->edge_ns = (int64_t)( before_ns + ( after_ns - before_ns ) / 2 ) - llround( since_edge );
+        clock->edge_slack_ns = (int64_t)( ( after_ns - before_ns ) / 2 ) + llround( clock->tick_ns );
+        clock->latched = AIOUSB_TRUE;
+        clock->latches ++;
+    }
+    pthread_mutex_unlock( &clock->lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Fills ns with the times of num_scans kept scans, the first being
+ * the ordinal'th kept since the reset, or 0s before the first stamp.
+ * Gaps before ordinal are forgotten, so ordinal may not go backwards.
+ */
+AIORET_TYPE AIOScanClockTimes( AIOScanClock *clock, uint64_t ordinal, unsigned num_scans, uint64_t *ns )
+{
+    int64_t t0;
+    uint64_t offset = 0;
+    unsigned gap = 0, i;
+
+    if ( !clock || ( num_scans && !ns ) )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock( &clock->lock );
+    if ( !clock->num_bounds ) {
+        pthread_mutex_unlock( &clock->lock );
+        if ( num_scans )
+            memset( ns, 0, num_scans * sizeof(uint64_t) );
+        return num_scans;
+    }
+
+    t0 = clock->bounds[0];
+    for ( i = 1; i < clock->num_bounds; i ++ )
+        t0 = MIN( t0, clock->bounds[i] );
+    if ( clock->latched ) {
+        double half = clock->period_ns / 2;
+        t0 = clock->edge_ns + llround( floor( (double)( t0 - clock->edge_ns + clock->edge_slack_ns ) / half ) * half );
+    }
+
+    while ( gap + 1 < clock->num_gaps && clock->gaps[gap+1].ordinal <= ordinal )
+        gap ++;
+    if ( gap ) {
+        memmove( clock->gaps, clock->gaps + gap, ( clock->num_gaps - gap ) * sizeof(AIOScanClockGap) );
+        clock->num_gaps -= gap;
+        gap = 0;
+    }
+
+    for ( i = 0; i < num_scans; i ++ ) {
+        while ( gap < clock->num_gaps && clock->gaps[gap].ordinal <= ordinal + i )
+            offset = clock->gaps[gap++].offset;
+        ns[i] = (uint64_t)( t0 + llround( (double)( ordinal + i + offset ) * clock->period_ns ) );
+    }
+    pthread_mutex_unlock( &clock->lock );
+    return num_scans;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOScanClockGetKept( AIOScanClock *clock )
+{
+    AIORET_TYPE retval;
+    if ( !clock )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    pthread_mutex_lock( &clock->lock );
+    retval = (AIORET_TYPE)clock->kept;
+    pthread_mutex_unlock( &clock->lock );
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Latched counts used since the reset
+ */
+AIORET_TYPE AIOScanClockGetLatches( AIOScanClock *clock )
+{
+    AIORET_TYPE retval;
+    if ( !clock )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    pthread_mutex_lock( &clock->lock );
+    retval = (AIORET_TYPE)clock->latches;
+    pthread_mutex_unlock( &clock->lock );
+    return retval;
+}
+
+#ifdef __cplusplus
+}
+#endif
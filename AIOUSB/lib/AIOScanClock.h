@@ -0,0 +1,81 @@
+/**
+ * @file   AIOScanClock.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Host timestamps for the scans of a counter clocked acquisition
+ *
+ * Scans are clocked by the 8254, so scan n happens at t0 + n * period for
+ * the period the counters were loaded with. Every transfer completion
+ * bounds t0 from above ( the scans it brought in had happened by then ),
+ * and the lowest bound over the last few transfers is taken as t0. Where
+ * the board's counters can be latched, the count left in counter 2 places
+ * one of its output edges in host time, which pins t0 to within a counter
+ * 1 period instead of the USB latency. Times are CLOCK_MONOTONIC_RAW ns.
+ */
+
+#ifndef _AIO_SCAN_CLOCK_H
+#define _AIO_SCAN_CLOCK_H
+
+#include "AIOTypes.h"
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIOSCANCLOCK_WINDOW     32      /**< Transfer stamps t0 is the lowest bound of */
+#define AIOSCANCLOCK_GAPS       64      /**< Unread runs of dropped scans kept track of */
+
+/**
+ * @brief Where scans were dropped on the way into the buffer: from the
+ * kept scan numbered ordinal on, scan ordinal is the device's scan
+ * ordinal + offset
+ */
+typedef struct aio_scan_clock_gap {
+    uint64_t ordinal;
+    uint64_t offset;
+} AIOScanClockGap;
+
+typedef struct aio_scan_clock {
+    pthread_mutex_t lock;
+    double period_ns;                   /**< Between scans */
+    double tick_ns;                     /**< Counter 2 input period, 0 when the counters are not known */
+    unsigned divisor;                   /**< Counter 2 load */
+    uint64_t scans;                     /**< Scans the device has delivered */
+    uint64_t kept;                      /**< Scans that went into the buffer */
+    int64_t bounds[AIOSCANCLOCK_WINDOW];/**< Latest upper bounds on t0 */
+    unsigned num_bounds;
+    unsigned next_bound;
+    int64_t edge_ns;                    /**< A counter 2 output edge, from the last latch */
+    int64_t edge_slack_ns;              /**< How much later than the real edge edge_ns may be */
+    AIOUSB_BOOL latched;
+    AIOScanClockGap gaps[AIOSCANCLOCK_GAPS];
+    unsigned num_gaps;
+    unsigned long long stamps;
+    unsigned long long latches;
+    unsigned long long (*source)( void *object ); /**< Where host times come from, NULL for AIOScanClockNow() */
+    void *source_object;
+} AIOScanClock;
+
+PUBLIC_EXTERN AIOScanClock *NewAIOScanClock( void );
+PUBLIC_EXTERN void DeleteAIOScanClock( AIOScanClock *clock );
+PUBLIC_EXTERN unsigned long long AIOScanClockNow( void );
+PUBLIC_EXTERN AIORET_TYPE AIOScanClockSetSource( AIOScanClock *clock, unsigned long long (*source)( void *object ), void *object );
+PUBLIC_EXTERN unsigned long long AIOScanClockTime( AIOScanClock *clock );
+PUBLIC_EXTERN AIORET_TYPE AIOScanClockReset( AIOScanClock *clock, double period_ns, double tick_ns, unsigned divisor );
+PUBLIC_EXTERN AIORET_TYPE AIOScanClockKeep( AIOScanClock *clock, unsigned num_scans );
+PUBLIC_EXTERN AIORET_TYPE AIOScanClockDrop( AIOScanClock *clock, unsigned num_scans );
+PUBLIC_EXTERN AIORET_TYPE AIOScanClockStamp( AIOScanClock *clock, unsigned more_scans, unsigned long long ns );
+PUBLIC_EXTERN AIORET_TYPE AIOScanClockLatch( AIOScanClock *clock, unsigned count, unsigned long long before_ns, unsigned long long after_ns );
+PUBLIC_EXTERN AIORET_TYPE AIOScanClockTimes( AIOScanClock *clock, uint64_t ordinal, unsigned num_scans, uint64_t *ns );
+PUBLIC_EXTERN AIORET_TYPE AIOScanClockGetKept( AIOScanClock *clock );
+PUBLIC_EXTERN AIORET_TYPE AIOScanClockGetLatches( AIOScanClock *clock );
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,507 @@
+/**
+ * @file   AIOSimDevice.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Simulated analog input board, answering the library's vendor
+ *         requests and sample reads in place of libusb
+ *
+ */
+
+#include "AIOSimDevice.h"
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOStats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define AIOSIM_POLL_NS          1000000ULL      /* longest nap while waiting for scans to come due */
+#define AIOSIM_DEFAULT_SERIAL   0x00000000a10051aaULL
+
+/*----------------------------------------------------------------------------*/
+static uint64_t sim_mix( uint64_t x )
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = ( x ^ ( x >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+    x = ( x ^ ( x >> 27 ) ) * 0x94d049bb133111ebULL;
+    return x ^ ( x >> 31 );
+}
+
+/*----------------------------------------------------------------------------*/
+static unsigned sim_first_channel( AIOSimDevice *sim )
+{
+    unsigned ch = sim->registers[AD_CONFIG_START_END] & 0xf;
+    if ( sim->config_size > AD_CONFIG_MUX_START_END )
+        ch |= ( sim->registers[AD_CONFIG_MUX_START_END] & 0xf ) << 4;
+    return ch;
+}
+
+/*----------------------------------------------------------------------------*/
+static unsigned sim_last_channel( AIOSimDevice *sim )
+{
+    unsigned ch = sim->registers[AD_CONFIG_START_END] >> 4;
+    if ( sim->config_size > AD_CONFIG_MUX_START_END )
+        ch |= sim->registers[AD_CONFIG_MUX_START_END] & 0xf0;
+    return ch;
+}
+
+/*----------------------------------------------------------------------------*/
+static unsigned sim_scan_samples( AIOSimDevice *sim )
+{
+    unsigned first = sim_first_channel( sim ), last = sim_last_channel( sim );
+    unsigned channels = last >= first ? last - first + 1 : 1;
+    return channels * ( sim->registers[AD_CONFIG_OVERSAMPLE] + 1 );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief The simulator's time, AIOStatsNow() unless AIOSimDeviceSetTime
+ * has taken over. Called with the lock held
+ */
+static unsigned long long sim_now( AIOSimDevice *sim )
+{
+    return ( sim->manual_clock ? sim->manual_ns : AIOStatsNow() );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Called with the lock held whenever a counter changes. Restarts
+ * the real time clock from the scan the stream has reached
+ */
+static void sim_update_clock( AIOSimDevice *sim )
+{
+    double hz = 0;
+    if ( sim->divisors[1] && sim->divisors[2] )
+        hz = sim->root_clock / ( (double)sim->divisors[1] * sim->divisors[2] );
+    if ( hz != sim->scan_hz ) {
+        sim->scan_hz        = hz;
+        sim->clock_scan     = sim->sample / sim_scan_samples( sim );
+        sim->clock_start_ns = sim_now( sim );
+        if ( hz > 0 )
+            sim->signal_hz = hz;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Samples since the last start that the board has converted by now,
+ * UINT64_MAX when nothing holds them back
+ */
+static uint64_t sim_samples_due( AIOSimDevice *sim, unsigned long long now )
+{
+    if ( !( sim->registers[AD_CONFIG_TRIG_COUNT] & AD_TRIGGER_TIMER ) )
+        return UINT64_MAX;
+    if ( sim->scan_hz <= 0 )
+        return 0;
+    if ( !sim->realtime )
+        return UINT64_MAX;
+
+    double scans = (double)( now - sim->clock_start_ns ) * sim->scan_hz / 1e9;
+    return ( sim->clock_scan + (uint64_t)scans ) * sim_scan_samples( sim );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief What channel sees at the given scan, before it is converted. Scans
+ * are spaced at the last rate the counters clocked, so they can be looked
+ * up after the counters stop. The calibration modes replace the input with
+ * ground or the reference
+ */
+double AIOSimDeviceVolts( AIOSimDevice *sim, unsigned channel, uint64_t scan, uint64_t sample )
+{
+    switch ( sim->registers[AD_CONFIG_CAL_MODE] ) {
+    case AD_CAL_MODE_GROUND:
+    case AD_CAL_MODE_BIP_GROUND:
+        return 0;
+    case AD_CAL_MODE_REFERENCE:
+    case AD_CAL_MODE_REFERENCE | AD_CAL_MODE_BIP_GROUND:
+        return AIOSIM_REFERENCE_VOLTS;
+    default:
+        break;
+    }
+
+    const AIOSimSignal *sig = &sim->signals[channel % AIOSIM_MAX_CHANNELS];
+    double t     = sim->signal_hz > 0 ? (double)scan / sim->signal_hz : 0;
+    double phase = 2 * M_PI * sig->frequency * t + sig->phase;
+    double v     = sig->offset;
+
+    switch ( sig->shape ) {
+    case AIOSIM_SIGNAL_SINE:
+        v += sig->amplitude * sin( phase );
+        break;
+    case AIOSIM_SIGNAL_SQUARE:
+        v += sin( phase ) >= 0 ? sig->amplitude : -sig->amplitude;
+        break;
+    case AIOSIM_SIGNAL_RAMP: {
+        double frac = phase / ( 2 * M_PI );
+        frac -= floor( frac );
+        v += sig->amplitude * ( 2 * frac - 1 );
+        break;
+    }
+    default:
+        break;
+    }
+
+    if ( sig->noise != 0 ) {
+        double u = (double)( sim_mix( sim->seed ^ sim_mix( sample ) ) >> 11 ) / 9007199254740992.0;
+        v += sig->noise * ( 2 * u - 1 );
+    }
+    return v;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief The count the board returns for channel at the given scan, using
+ * the channel's gain code
+ */
+unsigned short AIOSimDeviceCounts( AIOSimDevice *sim, unsigned channel, uint64_t scan, uint64_t sample )
+{
+    if ( sim->signals[channel % AIOSIM_MAX_CHANNELS].shape == AIOSIM_SIGNAL_COUNTER &&
+         sim->registers[AD_CONFIG_CAL_MODE] == AD_CAL_MODE_NORMAL )
+        return (unsigned short)sample;
+
+    unsigned group = channel / ( sim->channels_per_group ? sim->channels_per_group : 1 );
+    unsigned gainCode = group < AD_NUM_GAIN_CODE_REGISTERS ? sim->registers[AD_CONFIG_GAIN_CODE + group] & AD_GAIN_CODE_MASK : 0;
+    double counts = ( AIOSimDeviceVolts( sim, channel, scan, sample ) - adRanges[gainCode].minVolts ) /
+                    adRanges[gainCode].range * AI_16_MAX_COUNTS + 0.5;
+
+    if ( counts < 0 )
+        return 0;
+    if ( counts > AI_16_MAX_COUNTS )
+        return AI_16_MAX_COUNTS;
+    return (unsigned short)counts;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief What the first block's counters hold now, loaded the way the
+ * library loads a scan clock: counter 1 in mode 2 counting down by one,
+ * counter 2 in mode 3 counting down by two each half of its period. A
+ * stopped counter reads its load
+ */
+static void sim_latch_counters( AIOSimDevice *sim, unsigned short *counts, unsigned num_counts )
+{
+    unsigned i;
+    for ( i = 0; i < num_counts && i < COUNTERS_PER_BLOCK; i ++ )
+        counts[i] = sim->divisors[i];
+    if ( sim->scan_hz <= 0 || num_counts < COUNTERS_PER_BLOCK )
+        return;
+
+    double ticks = (double)( sim_now( sim ) - sim->clock_start_ns ) * sim->root_clock / 1e9;
+    double ctr1  = floor( ticks / sim->divisors[1] );
+    counts[1] = (unsigned short)( sim->divisors[1] - fmod( floor( ticks ), sim->divisors[1] ) );
+    counts[2] = (unsigned short)lround( sim->divisors[2] - 2 * fmod( ctr1, sim->divisors[2] / 2.0 ) );
+}
+
+/*----------------------------------------------------------------------------*/
+static int sim_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    AIOSimDevice *sim = (AIOSimDevice *)usb;
+    unsigned counter = wValue >> 14;
+
+    pthread_mutex_lock( &sim->lock );
+    sim->control_transfers ++;
+    if ( request_type == USB_READ_FROM_DEVICE && data )
+        memset( data, 0, wLength );
+
+    switch ( bRequest ) {
+    case AUR_ADC_SET_CONFIG:
+        sim->config_size = MIN( wLength, AD_MAX_CONFIG_REGISTERS );
+        memcpy( sim->registers, data, sim->config_size );
+        break;
+    case AUR_ADC_GET_CONFIG:
+        memcpy( data, sim->registers, MIN( wLength, AD_MAX_CONFIG_REGISTERS ) );
+        break;
+    case AUR_CTR_MODE:
+        if ( counter < COUNTERS_PER_BLOCK )
+            sim->divisors[counter] = 0;
+        sim_update_clock( sim );
+        break;
+    case AUR_CTR_LOAD:
+    case AUR_CTR_MODELOAD:
+        if ( counter < COUNTERS_PER_BLOCK )
+            sim->divisors[counter] = wIndex;
+        sim_update_clock( sim );
+        break;
+    case AUR_CTR_READLATCHED:
+        if ( wLength )
+            sim_latch_counters( sim, (unsigned short *)data, ( wLength - 1 ) / sizeof(unsigned short) );
+        break;
+    case AUR_START_ACQUIRING_BLOCK:
+        sim->pending        = ( (uint64_t)wValue << 16 ) | wIndex;
+        sim->streaming      = sim->pending == 0 ? AIOUSB_TRUE : AIOUSB_FALSE;
+        sim->sample         = 0;
+        sim->clock_scan     = 0;
+        sim->clock_start_ns = sim_now( sim );
+        break;
+    case AUR_GEN_CLEAR_FIFO_NEXT:
+    case AUR_GEN_CLEAR_FIFO:
+    case AUR_GEN_CLEAR_FIFO_WAIT:
+    case AUR_GEN_ABORT_AND_CLEAR:
+        sim->streaming = AIOUSB_FALSE;
+        sim->pending   = 0;
+        break;
+    case AUR_EEPROM_READ:
+        memcpy( data, &sim->serial_number, MIN( wLength, sizeof(sim->serial_number) ) );
+        break;
+    case AUR_PROBE_CALFEATURE:
+        if ( wLength )
+            data[0] = 0xBB;     /* calibration SRAM present */
+        break;
+    default:
+        break;
+    }
+    pthread_mutex_unlock( &sim->lock );
+    return wLength;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Reads from the sample endpoint hand out whatever has come due, in
+ * whole scans while streaming, waiting up to timeout ms for the first
+ * scan. Writes ( calibration tables ) are taken whole
+ */
+static int sim_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    AIOSimDevice *sim = (AIOSimDevice *)usb;
+    unsigned long long now = AIOStatsNow();
+    unsigned long long deadline = timeout ? now + timeout * 1000000ULL : ULLONG_MAX;
+    unsigned short *counts = (unsigned short *)data;
+    uint64_t want, n = 0, i;
+
+    *actual_length = 0;
+    pthread_mutex_lock( &sim->lock );
+    sim->bulk_transfers ++;
+    if ( !( endpoint & LIBUSB_ENDPOINT_IN ) ) {
+        sim->bulk_bytes += length;
+        pthread_mutex_unlock( &sim->lock );
+        *actual_length = length;
+        return LIBUSB_SUCCESS;
+    }
+
+    for ( ;; ) {
+        unsigned scan_samples = sim_scan_samples( sim );
+        uint64_t due = sim_samples_due( sim, sim_now( sim ) );
+
+        want = length / sizeof(unsigned short);
+        if ( sim->streaming ) {
+            want -= want % scan_samples;
+        } else {
+            want = MIN( want, sim->pending );
+        }
+        if ( due != UINT64_MAX ) {
+            due = due > sim->sample ? due - sim->sample : 0;
+            n = MIN( want, due - due % scan_samples );
+        } else {
+            n = want;
+        }
+        if ( n || ( !sim->streaming && !sim->pending ) || now >= deadline )
+            break;
+
+        pthread_mutex_unlock( &sim->lock );
+        unsigned long long nap = MIN( AIOSIM_POLL_NS, deadline - now );
+        struct timespec ts = { 0, (long)nap };
+        nanosleep( &ts, NULL );
+        now = AIOStatsNow();
+        pthread_mutex_lock( &sim->lock );
+    }
+
+    if ( !n ) {
+        pthread_mutex_unlock( &sim->lock );
+        return LIBUSB_ERROR_TIMEOUT;
+    }
+
+    unsigned scan_samples = sim_scan_samples( sim );
+    unsigned first = sim_first_channel( sim );
+    unsigned per_channel = sim->registers[AD_CONFIG_OVERSAMPLE] + 1;
+    for ( i = 0; i < n; i ++ ) {
+        uint64_t sample = sim->sample + i;
+        counts[i] = AIOSimDeviceCounts( sim, first + ( sample % scan_samples ) / per_channel, sample / scan_samples, sample );
+    }
+    sim->sample += n;
+    if ( !sim->streaming )
+        sim->pending -= n;
+    sim->bulk_bytes += n * sizeof(unsigned short);
+    pthread_mutex_unlock( &sim->lock );
+
+    *actual_length = (int)( n * sizeof(unsigned short) );
+    return LIBUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+static int sim_reset_device( USBDevice *usb )
+{
+    return LIBUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIOSimDevice *NewAIOSimDevice( void )
+{
+    AIOSimDevice *sim = (AIOSimDevice *)calloc( 1, sizeof(AIOSimDevice) );
+    if ( !sim )
+        return NULL;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init( &attr );
+    pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+    pthread_mutex_init( &sim->lock, &attr );
+    pthread_mutexattr_destroy( &attr );
+
+    sim->usb.usb_control_transfer = sim_control_transfer;
+    sim->usb.usb_bulk_transfer    = sim_bulk_transfer;
+    sim->usb.usb_request          = sim_control_transfer;
+    sim->usb.usb_reset_device     = sim_reset_device;
+    sim->usb.usb_put_config       = USBDevicePutADCConfigBlock;
+    sim->usb.usb_get_config       = USBDeviceFetchADCConfigBlock;
+
+    sim->config_size        = AD_CONFIG_REGISTERS;
+    sim->channels_per_group = 1;
+    sim->root_clock         = ROOTCLOCK;
+    sim->realtime           = AIOUSB_TRUE;
+    sim->serial_number      = AIOSIM_DEFAULT_SERIAL;
+    return sim;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Frees the simulator, first taking it out of any device table
+ * slot it was added to
+ */
+void DeleteAIOSimDevice( AIOSimDevice *sim )
+{
+    int index;
+    if ( !sim )
+        return;
+
+    AIODeviceTableLockWrite();
+    for ( index = 0; index < MAX_USB_DEVICES; index ++ ) {
+        if ( deviceTable[index].usb_device == &sim->usb )
+            deviceTable[index].usb_device = NULL;
+    }
+    AIODeviceTableUnlock();
+
+    pthread_mutex_destroy( &sim->lock );
+    free( sim );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Puts the simulator in the next free device table slot as
+ * productID, taking the clock and channel grouping from that product
+ */
+AIORET_TYPE AIOSimDeviceAddToDeviceTable( AIOSimDevice *sim, int *numAccesDevices, unsigned long productID )
+{
+    AIORESULT result;
+    if ( !sim || !numAccesDevices )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    result = AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( numAccesDevices, productID, &sim->usb );
+    if ( result != AIOUSB_SUCCESS )
+        return -(AIORET_TYPE)result;
+
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( *numAccesDevices - 1, &result );
+    if ( !dev )
+        return -(AIORET_TYPE)result;
+
+    pthread_mutex_lock( &sim->lock );
+    if ( dev->RootClock )
+        sim->root_clock = dev->RootClock;
+    if ( dev->ADCChannelsPerGroup )
+        sim->channels_per_group = dev->ADCChannelsPerGroup;
+    sim->config_size = dev->ConfigBytes ? dev->ConfigBytes : AD_CONFIG_REGISTERS;
+    pthread_mutex_unlock( &sim->lock );
+
+    return *numAccesDevices - 1;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOSimDeviceSetSignal( AIOSimDevice *sim, unsigned channel, const AIOSimSignal *signal )
+{
+    if ( !sim || !signal || channel >= AIOSIM_MAX_CHANNELS )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock( &sim->lock );
+    sim->signals[channel] = *signal;
+    pthread_mutex_unlock( &sim->lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief AIOUSB_TRUE hands out timer clocked scans no faster than the
+ * counters would clock them, AIOUSB_FALSE as fast as they are read
+ */
+AIORET_TYPE AIOSimDeviceSetRealTime( AIOSimDevice *sim, AIOUSB_BOOL realtime )
+{
+    if ( !sim )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock( &sim->lock );
+    sim->realtime       = realtime;
+    sim->clock_scan     = sim->sample / sim_scan_samples( sim );
+    sim->clock_start_ns = sim_now( sim );
+    pthread_mutex_unlock( &sim->lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Runs the simulator's clock at ns from now on instead of
+ * AIOStatsNow(), so tests can say exactly how long the counters have been
+ * running. Each later call moves it on to ns; it never goes back
+ */
+AIORET_TYPE AIOSimDeviceSetTime( AIOSimDevice *sim, unsigned long long ns )
+{
+    if ( !sim )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock( &sim->lock );
+    if ( sim->manual_clock && ns < sim->manual_ns ) {
+        pthread_mutex_unlock( &sim->lock );
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    }
+    if ( !sim->manual_clock ) {
+        sim->clock_scan     = sim->sample / sim_scan_samples( sim );
+        sim->clock_start_ns = ns;
+        sim->manual_clock   = AIOUSB_TRUE;
+    }
+    sim->manual_ns = ns;
+    pthread_mutex_unlock( &sim->lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOSimDeviceSetSeed( AIOSimDevice *sim, uint64_t seed )
+{
+    if ( !sim )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    pthread_mutex_lock( &sim->lock );
+    sim->seed = seed;
+    pthread_mutex_unlock( &sim->lock );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+double AIOSimDeviceGetScanRate( AIOSimDevice *sim )
+{
+    double hz;
+    if ( !sim )
+        return 0;
+
+    pthread_mutex_lock( &sim->lock );
+    hz = sim->scan_hz;
+    pthread_mutex_unlock( &sim->lock );
+    return hz;
+}
+
+#ifdef __cplusplus
+}
+#endif
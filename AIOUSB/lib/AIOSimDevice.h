@@ -0,0 +1,99 @@
+/**
+ * @file   AIOSimDevice.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Simulated USB-AI16 family board behind the USBDevice function
+ *         table, for running the acquisition stack with no hardware
+ *
+ * The simulator answers the control requests the library sends an analog
+ * input board: the A/D config block, the 8254 counters that clock scans
+ * ( CTR_StartOutputFreq, AIOContinuousBufLoadCounters, and latched reads
+ * of them ), block and streaming acquisition starts, FIFO clears,
+ * calibration probes and the serial number. Bulk reads from the sample endpoint return counts from a
+ * per channel signal generator, scaled by each channel's gain code.
+ *
+ * Every count is a function of the sample's position in the acquisition,
+ * so a run gives the same data however the reads are split up. Real time
+ * mode hands out scans no faster than the counters would clock them;
+ * unthrottled mode fills every read at once. Time is AIOStatsNow() until
+ * AIOSimDeviceSetTime hands the clock to the caller.
+ */
+
+#ifndef _AIO_SIM_DEVICE_H
+#define _AIO_SIM_DEVICE_H
+
+#include "AIOTypes.h"
+#include "USBDevice.h"
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+#define AIOSIM_MAX_CHANNELS     128
+#define AIOSIM_REFERENCE_VOLTS  9.9339         /* what the calibration reference reads */
+
+typedef enum {
+    AIOSIM_SIGNAL_CONSTANT = 0,     /* offset */
+    AIOSIM_SIGNAL_SINE     = 1,
+    AIOSIM_SIGNAL_SQUARE   = 2,
+    AIOSIM_SIGNAL_RAMP     = 3,     /* rises from -amplitude to +amplitude each period */
+    AIOSIM_SIGNAL_COUNTER  = 4      /* counts 0, 1, 2 ... per sample, ignoring the range */
+} AIOSimSignalShape;
+
+typedef struct aio_sim_signal {
+    AIOSimSignalShape shape;
+    double amplitude;               /**< Volts, peak */
+    double offset;                  /**< Volts */
+    double frequency;               /**< Hz */
+    double phase;                   /**< Radians */
+    double noise;                   /**< Volts, peak, of repeatable pseudo random noise */
+} AIOSimSignal;
+
+typedef struct aio_sim_device {
+    USBDevice usb;                  /**< First, so the callbacks can get back to the simulator */
+    pthread_mutex_t lock;
+    unsigned char registers[AD_MAX_CONFIG_REGISTERS];
+    unsigned config_size;           /**< Bytes in the last config block written */
+    unsigned channels_per_group;    /**< Channels sharing a gain code register */
+    double root_clock;              /**< Hz into the 8254 */
+    unsigned short divisors[3];     /**< Counter loads, 0 while a counter is stopped */
+    double scan_hz;                 /**< Counter 2 output, 0 when not clocking */
+    double signal_hz;               /**< Last nonzero scan_hz, which places scans in time */
+    AIOUSB_BOOL realtime;
+    AIOSimSignal signals[AIOSIM_MAX_CHANNELS];
+    uint64_t seed;                  /**< Noise generator seed */
+    uint64_t serial_number;
+
+    AIOUSB_BOOL streaming;          /**< Started with a zero length START_ACQUIRING_BLOCK */
+    uint64_t pending;               /**< Samples left in a block acquisition */
+    uint64_t sample;                /**< Samples handed out since the last start */
+    uint64_t clock_scan;            /**< Scan due when the clock last started or changed rate */
+    unsigned long long clock_start_ns; /**< The simulator's time at that moment */
+    AIOUSB_BOOL manual_clock;       /**< Time is manual_ns rather than AIOStatsNow() */
+    unsigned long long manual_ns;
+
+    unsigned long long control_transfers;
+    unsigned long long bulk_transfers;
+    unsigned long long bulk_bytes;
+} AIOSimDevice;
+
+PUBLIC_EXTERN AIOSimDevice *NewAIOSimDevice( void );
+PUBLIC_EXTERN void DeleteAIOSimDevice( AIOSimDevice *sim );
+PUBLIC_EXTERN AIORET_TYPE AIOSimDeviceAddToDeviceTable( AIOSimDevice *sim, int *numAccesDevices, unsigned long productID );
+PUBLIC_EXTERN AIORET_TYPE AIOSimDeviceSetSignal( AIOSimDevice *sim, unsigned channel, const AIOSimSignal *signal );
+PUBLIC_EXTERN AIORET_TYPE AIOSimDeviceSetRealTime( AIOSimDevice *sim, AIOUSB_BOOL realtime );
+PUBLIC_EXTERN AIORET_TYPE AIOSimDeviceSetSeed( AIOSimDevice *sim, uint64_t seed );
+PUBLIC_EXTERN AIORET_TYPE AIOSimDeviceSetTime( AIOSimDevice *sim, unsigned long long ns );
+PUBLIC_EXTERN double AIOSimDeviceGetScanRate( AIOSimDevice *sim );
+PUBLIC_EXTERN double AIOSimDeviceVolts( AIOSimDevice *sim, unsigned channel, uint64_t scan, uint64_t sample );
+PUBLIC_EXTERN unsigned short AIOSimDeviceCounts( AIOSimDevice *sim, unsigned channel, uint64_t scan, uint64_t sample );
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,382 @@
+/**
+ * @file   AIOStats.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Per device transfer statistics. Recording is a handful of relaxed
+ *         atomic adds, so it stays compiled in on every transfer path.
+ *
+ */
+
+#include "AIOStats.h"
+#include "AIODeviceTable.h"
+#include <string.h>
+#include <time.h>
+#include <libusb.h>
+#include <limits.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define AIOSTATS_ADD(p,v)       __atomic_fetch_add( (p), (v), __ATOMIC_RELAXED )
+#define AIOSTATS_LOAD(p)        __atomic_load_n( (p), __ATOMIC_RELAXED )
+#define AIOSTATS_STORE(p,v)     __atomic_store_n( (p), (v), __ATOMIC_RELAXED )
+
+/*----------------------------------------------------------------------------*/
+static void aiostats_store_max( unsigned long long *p, unsigned long long value )
+{
+    unsigned long long cur = AIOSTATS_LOAD( p );
+    while ( value > cur && !__atomic_compare_exchange_n( p, &cur, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+        ;
+}
+
+/*----------------------------------------------------------------------------*/
+static void aiostats_store_min( unsigned long long *p, unsigned long long value )
+{
+    unsigned long long cur = AIOSTATS_LOAD( p );
+    while ( value < cur && !__atomic_compare_exchange_n( p, &cur, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED ) )
+        ;
+}
+
+/*----------------------------------------------------------------------------*/
+unsigned long long AIOStatsNow( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/*----------------------------------------------------------------------------*/
+AIOStats *NewAIOStats( void )
+{
+    AIOStats *stats = (AIOStats *)malloc( sizeof(AIOStats) );
+    if ( stats )
+        AIOStatsReset( stats );
+    return stats;
+}
+
+/*----------------------------------------------------------------------------*/
+void DeleteAIOStats( AIOStats *stats )
+{
+    free( stats );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Zeroes everything. Transfers recorded while the reset is running
+ * may be partly lost, which is fine for monitoring.
+ */
+void AIOStatsReset( AIOStats *stats )
+{
+    if ( !stats )
+        return;
+    memset( stats, 0, sizeof(AIOStats) );
+    for ( int i = 0; i < AIO_STATS_NUM_KINDS; i ++ )
+        AIOSTATS_STORE( &stats->transfers[i].min_ns, ULLONG_MAX );
+    AIOSTATS_STORE( &stats->since_ns, AIOStatsNow() );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Values below AIO_STATS_SUB_BUCKETS get a bucket each; above that
+ * each power of two is split into AIO_STATS_SUB_BUCKETS equal steps
+ */
+unsigned AIOStatsBucketIndex( unsigned long long ns )
+{
+    unsigned msb, shift;
+
+    if ( ns < AIO_STATS_SUB_BUCKETS )
+        return (unsigned)ns;
+    msb = 63 - __builtin_clzll( ns );
+    if ( msb >= AIO_STATS_MAX_BITS )
+        return AIO_STATS_NUM_BUCKETS - 1;
+    shift = msb - AIO_STATS_SUB_BITS;
+
+    return ( shift + 1 ) * AIO_STATS_SUB_BUCKETS + (unsigned)( ( ns >> shift ) - AIO_STATS_SUB_BUCKETS );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Largest value that falls into bucket index
+ */
+unsigned long long AIOStatsBucketUpperBound( unsigned index )
+{
+    unsigned shift;
+
+    if ( index < AIO_STATS_SUB_BUCKETS )
+        return index;
+    if ( index >= AIO_STATS_NUM_BUCKETS - 1 )
+        return ULLONG_MAX;
+    shift = index / AIO_STATS_SUB_BUCKETS - 1;
+
+    return ( ( (unsigned long long)( AIO_STATS_SUB_BUCKETS + index % AIO_STATS_SUB_BUCKETS ) << shift ) +
+             ( 1ULL << shift ) - 1 );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Records one finished transfer that began at start_ns ( from
+ * AIOStatsNow() ). bytes is what actually moved, libusbResult the
+ * LIBUSB_* code it finished with. A NULL stats is ignored so the transfer
+ * paths can call this unconditionally.
+ */
+void AIOStatsRecordTransfer( AIOStats *stats, AIOStatsKind kind, unsigned long long start_ns, int bytes, int libusbResult )
+{
+    AIOStatsHistogram *hist;
+    unsigned long long now, ns;
+
+    if ( !stats || (unsigned)kind >= AIO_STATS_NUM_KINDS )
+        return;
+    hist = &stats->transfers[kind];
+    now  = AIOStatsNow();
+    ns   = ( now > start_ns ? now - start_ns : 0 );
+
+    AIOSTATS_ADD( &hist->count, 1 );
+    if ( libusbResult < 0 ) {
+        AIOSTATS_ADD( &hist->errors, 1 );
+        if ( libusbResult == LIBUSB_ERROR_TIMEOUT )
+            AIOSTATS_ADD( &hist->timeouts, 1 );
+    }
+    if ( bytes > 0 )
+        AIOSTATS_ADD( &hist->bytes, (unsigned long long)bytes );
+    AIOSTATS_ADD( &hist->total_ns, ns );
+    AIOSTATS_ADD( &hist->buckets[AIOStatsBucketIndex( ns )], 1 );
+    aiostats_store_min( &hist->min_ns, ns );
+    aiostats_store_max( &hist->max_ns, ns );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Notes how full a FIFO is, keeping the high-water mark
+ */
+void AIOStatsRecordFifo( AIOStats *stats, unsigned long long used, unsigned long long capacity )
+{
+    if ( !stats )
+        return;
+    if ( AIOSTATS_LOAD( &stats->fifo_capacity ) != capacity )
+        AIOSTATS_STORE( &stats->fifo_capacity, capacity );
+    aiostats_store_max( &stats->fifo_high_water, used );
+}
+
+/*----------------------------------------------------------------------------*/
+void AIOStatsRecordOverruns( AIOStats *stats, unsigned long long count )
+{
+    if ( stats && count )
+        AIOSTATS_ADD( &stats->overruns, count );
+}
+
+/*----------------------------------------------------------------------------*/
+static unsigned long long aiostats_percentile( const unsigned long long *buckets,
+                                               unsigned long long count,
+                                               unsigned long long min_ns,
+                                               unsigned long long max_ns,
+                                               double fraction
+                                               )
+{
+    unsigned long long target = (unsigned long long)( count * fraction + 0.999999 );
+    unsigned long long seen = 0;
+    unsigned long long value = max_ns;
+
+    if ( count == 0 )
+        return 0;
+    for ( unsigned i = 0; i < AIO_STATS_NUM_BUCKETS; i ++ ) {
+        seen += buckets[i];
+        if ( seen >= target ) {
+            value = AIOStatsBucketUpperBound( i );
+            break;
+        }
+    }
+    if ( value > max_ns )
+        value = max_ns;
+    if ( value < min_ns )
+        value = min_ns;
+    return value;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copies out a consistent enough view of the counters. Nothing is
+ * locked, so a snapshot taken mid transfer may be off by that transfer.
+ */
+AIORET_TYPE AIOStatsGetSnapshot( AIOStats *stats, AIOStatsSnapshot *snapshot )
+{
+    unsigned long long buckets[AIO_STATS_NUM_BUCKETS];
+    double elapsed;
+
+    if ( !stats || !snapshot )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+
+    memset( snapshot, 0, sizeof(AIOStatsSnapshot) );
+    elapsed = ( AIOStatsNow() - AIOSTATS_LOAD( &stats->since_ns ) ) / 1e9;
+    snapshot->elapsed = elapsed;
+
+    for ( int k = 0; k < AIO_STATS_NUM_KINDS; k ++ ) {
+        AIOStatsHistogram *hist = &stats->transfers[k];
+        AIOStatsTransferSnapshot *out = &snapshot->transfers[k];
+        unsigned long long total = 0;
+
+        for ( unsigned i = 0; i < AIO_STATS_NUM_BUCKETS; i ++ ) {
+            buckets[i] = AIOSTATS_LOAD( &hist->buckets[i] );
+            total += buckets[i];
+        }
+        out->count    = AIOSTATS_LOAD( &hist->count );
+        out->errors   = AIOSTATS_LOAD( &hist->errors );
+        out->timeouts = AIOSTATS_LOAD( &hist->timeouts );
+        out->bytes    = AIOSTATS_LOAD( &hist->bytes );
+        if ( out->count == 0 )
+            continue;
+        out->min_ns   = AIOSTATS_LOAD( &hist->min_ns );
+        out->max_ns   = AIOSTATS_LOAD( &hist->max_ns );
+        out->mean_ns  = AIOSTATS_LOAD( &hist->total_ns ) / out->count;
+        out->p50_ns   = aiostats_percentile( buckets, total, out->min_ns, out->max_ns, 0.50 );
+        out->p99_ns   = aiostats_percentile( buckets, total, out->min_ns, out->max_ns, 0.99 );
+        out->p999_ns  = aiostats_percentile( buckets, total, out->min_ns, out->max_ns, 0.999 );
+        out->bytes_per_second = ( elapsed > 0 ? out->bytes / elapsed : 0 );
+    }
+    snapshot->fifo_high_water = AIOSTATS_LOAD( &stats->fifo_high_water );
+    snapshot->fifo_capacity   = AIOSTATS_LOAD( &stats->fifo_capacity );
+    snapshot->overruns        = AIOSTATS_LOAD( &stats->overruns );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Fills snapshot with the statistics DeviceIndex has gathered since
+ * it was found or since AIOUSB_ResetStatistics
+ */
+AIORESULT AIOUSB_GetStatistics( unsigned long DeviceIndex, AIOStatsSnapshot *snapshot )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+    if ( !snapshot )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( !device->stats )
+        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    AIOStatsGetSnapshot( device->stats, snapshot );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Copies up to num_buckets latency bucket counts for one kind of
+ * transfer. Bucket i holds transfers that took at most
+ * AIOStatsBucketUpperBound(i) ns.
+ */
+AIORESULT AIOUSB_GetLatencyHistogram( unsigned long DeviceIndex, AIOStatsKind kind, unsigned long long *counts, unsigned num_buckets )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+    if ( !counts || (unsigned)kind >= AIO_STATS_NUM_KINDS )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( !device->stats )
+        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    for ( unsigned i = 0; i < num_buckets; i ++ )
+        counts[i] = ( i < AIO_STATS_NUM_BUCKETS ? AIOSTATS_LOAD( &device->stats->transfers[kind].buckets[i] ) : 0 );
+
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+AIORESULT AIOUSB_ResetStatistics( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+
+    AIOStatsReset( device->stats );
+    return AIOUSB_SUCCESS;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef SELF_TEST
+
+#include "gtest/gtest.h"
+#include "tap.h"
+#include <iostream>
+using namespace AIOUSB;
+
+TEST(AIOStats,BucketsAreLogLinear )
+{
+    for ( unsigned long long v = 0; v < AIO_STATS_SUB_BUCKETS; v ++ )
+        EXPECT_EQ( v, AIOStatsBucketIndex( v ) );
+
+    unsigned last = 0;
+    for ( unsigned long long v = 1; v < ( 1ULL << AIO_STATS_MAX_BITS ); v += v / 7 + 1 ) {
+        unsigned index = AIOStatsBucketIndex( v );
+        ASSERT_GE( index, last ) << "Buckets grow with the value";
+        ASSERT_LE( v, AIOStatsBucketUpperBound( index ) );
+        if ( index > 0 ) {
+            ASSERT_GT( v, AIOStatsBucketUpperBound( index - 1 ) );
+        }
+        ASSERT_LE( AIOStatsBucketUpperBound( index ) - v, v / AIO_STATS_SUB_BUCKETS ) << "Within 1/16 of the value";
+        last = index;
+    }
+    EXPECT_EQ( (unsigned)AIO_STATS_NUM_BUCKETS - 1, AIOStatsBucketIndex( ULLONG_MAX ) );
+}
+
+TEST(AIOStats,SnapshotSummarizesTransfers )
+{
+    AIOStats *stats = NewAIOStats();
+    AIOStatsSnapshot snap;
+    unsigned long long now = AIOStatsNow();
+
+    for ( int i = 0; i < 1000; i ++ )
+        AIOStatsRecordTransfer( stats, AIO_STATS_BULK_IN, now - ( i < 990 ? 1000 : 1000000 ), 512, LIBUSB_SUCCESS );
+    AIOStatsRecordTransfer( stats, AIO_STATS_CONTROL, now, 0, LIBUSB_ERROR_TIMEOUT );
+    AIOStatsRecordTransfer( stats, AIO_STATS_CONTROL, now, 0, LIBUSB_ERROR_PIPE );
+    AIOStatsRecordFifo( stats, 100, 4096 );
+    AIOStatsRecordFifo( stats, 50, 4096 );
+    AIOStatsRecordOverruns( stats, 3 );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOStatsGetSnapshot( stats, &snap ) );
+    EXPECT_EQ( 1000, snap.transfers[AIO_STATS_BULK_IN].count );
+    EXPECT_EQ( 512000, snap.transfers[AIO_STATS_BULK_IN].bytes );
+    EXPECT_GE( snap.transfers[AIO_STATS_BULK_IN].p50_ns, 1000 );
+    EXPECT_LT( snap.transfers[AIO_STATS_BULK_IN].p50_ns, 1000000 );
+    EXPECT_GE( snap.transfers[AIO_STATS_BULK_IN].p999_ns, 1000000 );
+    EXPECT_LE( snap.transfers[AIO_STATS_BULK_IN].min_ns, snap.transfers[AIO_STATS_BULK_IN].p50_ns );
+    EXPECT_GE( snap.transfers[AIO_STATS_BULK_IN].max_ns, snap.transfers[AIO_STATS_BULK_IN].p999_ns );
+    EXPECT_GT( snap.transfers[AIO_STATS_BULK_IN].bytes_per_second, 0 );
+
+    EXPECT_EQ( 2, snap.transfers[AIO_STATS_CONTROL].errors );
+    EXPECT_EQ( 1, snap.transfers[AIO_STATS_CONTROL].timeouts );
+    EXPECT_EQ( 0, snap.transfers[AIO_STATS_BULK_OUT].count );
+    EXPECT_EQ( 0, snap.transfers[AIO_STATS_BULK_OUT].min_ns );
+    EXPECT_EQ( 100, snap.fifo_high_water );
+    EXPECT_EQ( 4096, snap.fifo_capacity );
+    EXPECT_EQ( 3, snap.overruns );
+
+    AIOStatsReset( stats );
+    AIOStatsGetSnapshot( stats, &snap );
+    EXPECT_EQ( 0, snap.transfers[AIO_STATS_BULK_IN].count );
+    EXPECT_EQ( 0, snap.overruns );
+
+    AIOStatsRecordTransfer( NULL, AIO_STATS_BULK_IN, now, 1, LIBUSB_SUCCESS );
+    DeleteAIOStats( stats );
+}
+
+int main(int argc, char *argv[] )
+{
+  testing::InitGoogleTest(&argc, argv);
+  testing::TestEventListeners & listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+  delete listeners.Release(listeners.default_result_printer());
+#endif
+
+  listeners.Append( new tap::TapListener() );
+  return RUN_ALL_TESTS();
+}
+
+#endif
@@ -0,0 +1,98 @@
+/**
+ * @file   AIOStats.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Always on per device transfer counters, latency histograms and
+ *         FIFO health, cheap enough to leave in the acquisition paths
+ *
+ */
+
+#ifndef _AIO_STATS_H
+#define _AIO_STATS_H
+
+#include "AIOTypes.h"
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+/**
+ * Latencies go into log-linear buckets: AIO_STATS_SUB_BUCKETS linear steps
+ * per power of two, so every bucket is within 1/16 of the value it holds.
+ * Values above 2^AIO_STATS_MAX_BITS ns ( ~18 min. ) land in the last bucket.
+ */
+#define AIO_STATS_SUB_BITS       4
+#define AIO_STATS_SUB_BUCKETS    ( 1 << AIO_STATS_SUB_BITS )
+#define AIO_STATS_MAX_BITS       40
+#define AIO_STATS_NUM_BUCKETS    ( ( AIO_STATS_MAX_BITS - AIO_STATS_SUB_BITS + 1 ) * AIO_STATS_SUB_BUCKETS )
+
+typedef enum {
+    AIO_STATS_BULK_IN  = 0,
+    AIO_STATS_BULK_OUT = 1,
+    AIO_STATS_CONTROL  = 2,
+    AIO_STATS_NUM_KINDS
+} AIOStatsKind;
+
+typedef struct aio_stats_histogram {
+    unsigned long long count;
+    unsigned long long errors;
+    unsigned long long timeouts;
+    unsigned long long bytes;
+    unsigned long long total_ns;
+    unsigned long long min_ns;
+    unsigned long long max_ns;
+    unsigned long long buckets[AIO_STATS_NUM_BUCKETS];
+} AIOStatsHistogram;
+
+typedef struct aio_stats {
+    AIOStatsHistogram transfers[AIO_STATS_NUM_KINDS];
+    unsigned long long fifo_high_water; /**< Most bytes seen queued in a device FIFO */
+    unsigned long long fifo_capacity;   /**< Size of that FIFO */
+    unsigned long long overruns;        /**< Data dropped because a FIFO or staging ring was full */
+    unsigned long long since_ns;        /**< AIOStatsNow() at creation or last reset */
+} AIOStats;
+
+typedef struct aio_stats_transfer_snapshot {
+    unsigned long long count;
+    unsigned long long errors;          /**< Includes timeouts */
+    unsigned long long timeouts;
+    unsigned long long bytes;
+    unsigned long long min_ns;
+    unsigned long long max_ns;
+    unsigned long long mean_ns;
+    unsigned long long p50_ns;
+    unsigned long long p99_ns;
+    unsigned long long p999_ns;
+    double bytes_per_second;            /**< Over the time since the last reset */
+} AIOStatsTransferSnapshot;
+
+typedef struct aio_stats_snapshot {
+    AIOStatsTransferSnapshot transfers[AIO_STATS_NUM_KINDS];
+    unsigned long long fifo_high_water;
+    unsigned long long fifo_capacity;
+    unsigned long long overruns;
+    double elapsed;                     /**< Seconds since the last reset */
+} AIOStatsSnapshot;
+
+PUBLIC_EXTERN AIOStats *NewAIOStats( void );
+PUBLIC_EXTERN void DeleteAIOStats( AIOStats *stats );
+PUBLIC_EXTERN void AIOStatsReset( AIOStats *stats );
+PUBLIC_EXTERN unsigned long long AIOStatsNow( void );
+PUBLIC_EXTERN void AIOStatsRecordTransfer( AIOStats *stats, AIOStatsKind kind, unsigned long long start_ns, int bytes, int libusbResult );
+PUBLIC_EXTERN void AIOStatsRecordFifo( AIOStats *stats, unsigned long long used, unsigned long long capacity );
+PUBLIC_EXTERN void AIOStatsRecordOverruns( AIOStats *stats, unsigned long long count );
+PUBLIC_EXTERN AIORET_TYPE AIOStatsGetSnapshot( AIOStats *stats, AIOStatsSnapshot *snapshot );
+PUBLIC_EXTERN unsigned AIOStatsBucketIndex( unsigned long long ns );
+PUBLIC_EXTERN unsigned long long AIOStatsBucketUpperBound( unsigned index );
+
+PUBLIC_EXTERN AIORESULT AIOUSB_GetStatistics( unsigned long DeviceIndex, AIOStatsSnapshot *snapshot );
+PUBLIC_EXTERN AIORESULT AIOUSB_GetLatencyHistogram( unsigned long DeviceIndex, AIOStatsKind kind, unsigned long long *counts, unsigned num_buckets );
+PUBLIC_EXTERN AIORESULT AIOUSB_ResetStatistics( unsigned long DeviceIndex );
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,279 @@
+/**
+ * @file   AIOTransferQueue.c
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  Bulk transfers kept queued against one endpoint, shared by the
+ *         streaming paths
+ *
+ */
+
+#include "AIOTransferQueue.h"
+#include "AIOStats.h"
+#include "AIOUSB_Log.h"
+#include <string.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+namespace AIOUSB {
+#endif
+
+#define AIOTRANSFERQUEUE_LOAD(p)        __atomic_load_n( (p), __ATOMIC_ACQUIRE )
+#define AIOTRANSFERQUEUE_ADD(p,v)       __atomic_add_fetch( (p), (v), __ATOMIC_ACQ_REL )
+
+#define AIOTRANSFERQUEUE_CANCEL_US      10000   /* how long each wait for cancellations pumps events */
+
+/**
+ * @brief The lock serialises completions against the owner's own submits
+ * and parks and covers parked and stopping. pending is atomic so waits can
+ * poll it without the lock.
+ */
+struct aio_transfer_queue {
+    pthread_mutex_t lock;
+    struct libusb_transfer **xfers;
+    unsigned char *data;
+    unsigned num_transfers;
+    unsigned transfer_size;
+    AIOStatsKind kind;
+    AIOStats *stats;                    /**< The device's, may be NULL */
+    int pending;                        /**< Submitted and not yet completed */
+    struct libusb_transfer **parked;    /**< Transfers the owner is holding back */
+    unsigned num_parked;
+    unsigned long long *submitted;      /**< AIOStatsNow() when each transfer was last submitted */
+    AIOUSB_BOOL stopping;               /**< Once set, completions leave the owner alone */
+    AIOTransferComplete complete;
+    void *object;
+};
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief The libusb error a finished transfer stands for, LIBUSB_SUCCESS
+ *        once it completed
+ */
+int AIOTransferQueueGetError( struct libusb_transfer *xfer )
+{
+    switch ( xfer->status ) {
+    case LIBUSB_TRANSFER_COMPLETED:
+        return LIBUSB_SUCCESS;
+    case LIBUSB_TRANSFER_TIMED_OUT:
+        return LIBUSB_ERROR_TIMEOUT;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+        return LIBUSB_ERROR_NO_DEVICE;
+    case LIBUSB_TRANSFER_CANCELLED:
+        return LIBUSB_ERROR_INTERRUPTED;
+    default:
+        return LIBUSB_ERROR_IO;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+static void LIBUSB_CALL aiotransferqueue_complete( struct libusb_transfer *xfer )
+{
+    AIOTransferQueue *queue = (AIOTransferQueue *)xfer->user_data;
+
+    pthread_mutex_lock( &queue->lock );
+    if ( queue->stopping ) {
+        /* the queue may be deleted as soon as pending reaches 0 */
+        pthread_mutex_unlock( &queue->lock );
+        AIOTRANSFERQUEUE_ADD( &queue->pending, -1 );
+        return;
+    }
+
+    if ( xfer->status != LIBUSB_TRANSFER_CANCELLED )
+        AIOStatsRecordTransfer( queue->stats,
+                                queue->kind,
+                                queue->submitted[( xfer->buffer - queue->data ) / queue->transfer_size],
+                                xfer->actual_length,
+                                AIOTransferQueueGetError( xfer )
+                                );
+    queue->complete( queue, xfer, queue->object );
+    AIOTRANSFERQUEUE_ADD( &queue->pending, -1 );
+    pthread_mutex_unlock( &queue->lock );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Allocates num_transfers bulk transfers of up to transfer_size
+ *        bytes on endpoint, all of them parked
+ * @param usb the device, whose libusb handle the transfers go through and
+ *        whose statistics they are recorded in
+ * @param complete called as each transfer finishes, with object
+ * @return the queue, or NULL if it could not be allocated
+ */
+AIOTransferQueue *NewAIOTransferQueue( USBDevice *usb,
+                                       unsigned char endpoint,
+                                       unsigned num_transfers,
+                                       unsigned transfer_size,
+                                       AIOTransferComplete complete,
+                                       void *object
+                                       )
+{
+    AIOTransferQueue *queue;
+    unsigned i;
+
+    if ( !usb || !usb->deviceHandle || !num_transfers || !transfer_size || !complete )
+        return NULL;
+    queue = (AIOTransferQueue *)calloc( 1, sizeof(AIOTransferQueue) );
+    if ( !queue )
+        return NULL;
+
+    queue->lock          = (pthread_mutex_t)PTHREAD_MUTEX_INITIALIZER;
+    queue->num_transfers = num_transfers;
+    queue->transfer_size = transfer_size;
+    queue->kind          = ( endpoint & LIBUSB_ENDPOINT_IN ? AIO_STATS_BULK_IN : AIO_STATS_BULK_OUT );
+    queue->stats         = usb->stats;
+    queue->complete      = complete;
+    queue->object        = object;
+    queue->xfers         = (struct libusb_transfer **)calloc( num_transfers, sizeof(struct libusb_transfer *) );
+    queue->parked        = (struct libusb_transfer **)calloc( num_transfers, sizeof(struct libusb_transfer *) );
+    queue->submitted     = (unsigned long long *)calloc( num_transfers, sizeof(unsigned long long) );
+    queue->data          = (unsigned char *)malloc( (size_t)num_transfers * transfer_size );
+    if ( !queue->xfers || !queue->parked || !queue->submitted || !queue->data )
+        goto out_NewAIOTransferQueue;
+
+    for ( i = 0; i < num_transfers; i ++ ) {
+        if ( !( queue->xfers[i] = libusb_alloc_transfer(0) ) )
+            goto out_NewAIOTransferQueue;
+        libusb_fill_bulk_transfer( queue->xfers[i],
+                                   usb->deviceHandle,
+                                   endpoint,
+                                   &queue->data[i*transfer_size],
+                                   transfer_size,
+                                   aiotransferqueue_complete,
+                                   queue,
+                                   0
+                                   );
+    }
+    /* unparked in order, transfer 0 first */
+    for ( i = num_transfers; i > 0; i -- )
+        queue->parked[queue->num_parked++] = queue->xfers[i-1];
+    return queue;
+
+ out_NewAIOTransferQueue:
+    DeleteAIOTransferQueue( queue );
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Cancels whatever is still in flight, waits for it and frees the
+ *        queue
+ */
+void DeleteAIOTransferQueue( AIOTransferQueue *queue )
+{
+    unsigned i;
+    if ( !queue )
+        return;
+    AIOTransferQueueCancel( queue );
+
+    for ( i = 0; queue->xfers && i < queue->num_transfers; i ++ )
+        libusb_free_transfer( queue->xfers[i] );
+    free( queue->xfers );
+    free( queue->parked );
+    free( queue->submitted );
+    free( queue->data );
+    pthread_mutex_destroy( &queue->lock );
+    free( queue );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Submits xfer for length bytes, counting it in pending first since
+ *        its completion can run on another thread before
+ *        libusb_submit_transfer returns. Called with the queue locked.
+ * @return the libusb result
+ */
+int AIOTransferQueueSubmit( AIOTransferQueue *queue, struct libusb_transfer *xfer, unsigned length )
+{
+    int usbresult;
+    xfer->length = (int)MIN( length, queue->transfer_size );
+    queue->submitted[( xfer->buffer - queue->data ) / queue->transfer_size] = AIOStatsNow();
+    AIOTRANSFERQUEUE_ADD( &queue->pending, 1 );
+    usbresult = libusb_submit_transfer( xfer );
+    if ( usbresult != LIBUSB_SUCCESS )
+        AIOTRANSFERQUEUE_ADD( &queue->pending, -1 );
+    return usbresult;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Holds xfer back until AIOTransferQueueUnpark. Called with the
+ *        queue locked.
+ */
+void AIOTransferQueuePark( AIOTransferQueue *queue, struct libusb_transfer *xfer )
+{
+    queue->parked[queue->num_parked++] = xfer;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief The transfer parked last, for the caller to submit or park again.
+ *        Called with the queue locked.
+ * @return NULL if none is parked
+ */
+struct libusb_transfer *AIOTransferQueueUnpark( AIOTransferQueue *queue )
+{
+    return ( queue->num_parked ? queue->parked[--queue->num_parked] : NULL );
+}
+
+/*----------------------------------------------------------------------------*/
+int AIOTransferQueuePending( AIOTransferQueue *queue )
+{
+    return AIOTRANSFERQUEUE_LOAD( &queue->pending );
+}
+
+/*----------------------------------------------------------------------------*/
+unsigned AIOTransferQueueGetNumTransfers( AIOTransferQueue *queue )
+{
+    return queue->num_transfers;
+}
+
+/*----------------------------------------------------------------------------*/
+unsigned AIOTransferQueueGetTransferSize( AIOTransferQueue *queue )
+{
+    return queue->transfer_size;
+}
+
+/*----------------------------------------------------------------------------*/
+void AIOTransferQueueLock( AIOTransferQueue *queue )
+{
+    pthread_mutex_lock( &queue->lock );
+}
+
+/*----------------------------------------------------------------------------*/
+void AIOTransferQueueUnlock( AIOTransferQueue *queue )
+{
+    pthread_mutex_unlock( &queue->lock );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Cancels every transfer and pumps libusb until all of them have
+ *        come back. libusb hands back every cancelled transfer, as
+ *        cancelled, completed or with the device gone, so this waits for
+ *        as long as that takes rather than freeing memory the kernel may
+ *        still write into. Completions from here on skip the owner.
+ */
+void AIOTransferQueueCancel( AIOTransferQueue *queue )
+{
+    unsigned i, waits;
+
+    pthread_mutex_lock( &queue->lock );
+    queue->stopping = AIOUSB_TRUE;
+    pthread_mutex_unlock( &queue->lock );
+
+    for ( i = 0; queue->xfers && i < queue->num_transfers; i ++ ) {
+        if ( queue->xfers[i] )
+            libusb_cancel_transfer( queue->xfers[i] );
+    }
+    for ( waits = 0; AIOTRANSFERQUEUE_LOAD( &queue->pending ) > 0; waits ++ ) {
+        struct timeval tv = { 0, AIOTRANSFERQUEUE_CANCEL_US };
+        if ( waits == 100 )
+            AIOUSB_ERROR("Still waiting for %d cancelled bulk transfers\n", AIOTRANSFERQUEUE_LOAD( &queue->pending ) );
+        libusb_handle_events_timeout_completed( NULL, &tv, NULL );
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
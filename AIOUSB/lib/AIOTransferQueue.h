@@ -0,0 +1,69 @@
+/**
+ * @file   AIOTransferQueue.h
+ * @author $Format: %an <%ae>$
+ * @date   $Format: %ad$
+ * @version $Format: %h$
+ * @brief  A set of libusb bulk transfers on one endpoint that are kept
+ *         submitted from their own completions
+ *
+ * Every streaming path ( continuous buffers, DIO streams, acquisition
+ * groups ) keeps a few transfers queued against an endpoint so the device
+ * never waits on the caller. The queue owns the transfers and their
+ * memory, counts the ones in flight, times them for the device statistics
+ * and holds back ( parks ) the ones its owner does not want submitted.
+ *
+ * Every queue pumps libusb's default context, so a completion can run on
+ * whichever thread is pumping, including another board's. libusb runs one
+ * completion at a time. The owner's callback runs with the queue's lock
+ * held, which it shares with anything else that submits or parks. Once
+ * AIOTransferQueueCancel has started, completions no longer reach the
+ * owner, and the queue stays allocated until libusb has handed back every
+ * transfer.
+ */
+
+#ifndef _AIO_TRANSFER_QUEUE_H
+#define _AIO_TRANSFER_QUEUE_H
+
+#include "AIOTypes.h"
+#include "USBDevice.h"
+#include <libusb.h>
+
+#ifdef __aiousb_cplusplus
+namespace AIOUSB
+{
+#endif
+
+typedef struct aio_transfer_queue AIOTransferQueue;
+
+/**
+ * @brief Called for every transfer that completes, fails or is cancelled
+ *        before the queue stops, with the queue locked. xfer is still
+ *        counted in AIOTransferQueuePending and is the callback's to
+ *        resubmit or park; one that is neither stays idle.
+ */
+typedef void (*AIOTransferComplete)( AIOTransferQueue *queue, struct libusb_transfer *xfer, void *object );
+
+PUBLIC_EXTERN AIOTransferQueue *NewAIOTransferQueue( USBDevice *usb,
+                                                     unsigned char endpoint,
+                                                     unsigned num_transfers,
+                                                     unsigned transfer_size,
+                                                     AIOTransferComplete complete,
+                                                     void *object
+                                                     );
+PUBLIC_EXTERN void DeleteAIOTransferQueue( AIOTransferQueue *queue );
+PUBLIC_EXTERN int AIOTransferQueueSubmit( AIOTransferQueue *queue, struct libusb_transfer *xfer, unsigned length );
+PUBLIC_EXTERN void AIOTransferQueuePark( AIOTransferQueue *queue, struct libusb_transfer *xfer );
+PUBLIC_EXTERN struct libusb_transfer *AIOTransferQueueUnpark( AIOTransferQueue *queue );
+PUBLIC_EXTERN int AIOTransferQueuePending( AIOTransferQueue *queue );
+PUBLIC_EXTERN unsigned AIOTransferQueueGetNumTransfers( AIOTransferQueue *queue );
+PUBLIC_EXTERN unsigned AIOTransferQueueGetTransferSize( AIOTransferQueue *queue );
+PUBLIC_EXTERN void AIOTransferQueueLock( AIOTransferQueue *queue );
+PUBLIC_EXTERN void AIOTransferQueueUnlock( AIOTransferQueue *queue );
+PUBLIC_EXTERN void AIOTransferQueueCancel( AIOTransferQueue *queue );
+PUBLIC_EXTERN int AIOTransferQueueGetError( struct libusb_transfer *xfer );
+
+#ifdef __aiousb_cplusplus
+}
+#endif
+
+#endif
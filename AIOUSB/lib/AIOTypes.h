@@ -83,6 +83,19 @@ CREATE_ENUM_W_START( AIOContinuousBufMode, 0 ,
                      AIOCONTINUOUS_BUF_OVERRIDE
                      );
 
+CREATE_ENUM_W_START( AIOContinuousBufOverrunPolicy, 0 ,
+                     AIOCONTINUOUS_BUF_DROP_NEWEST,      /* keep what is in the buffer, lose the new scans */
+                     AIOCONTINUOUS_BUF_OVERWRITE_OLDEST, /* make room by losing the oldest unread scans */
+                     AIOCONTINUOUS_BUF_BLOCK             /* stop reading the device until there is room */
+                     );
+
+CREATE_ENUM_W_START( AIOTransferPreference, 0 ,
+                     AIO_TRANSFERS_FIXED,                /* the configured block size, whatever the clock */
+                     AIO_TRANSFERS_LOW_LATENCY,          /* small transfers, scans soon after they are taken */
+                     AIO_TRANSFERS_BALANCED,
+                     AIO_TRANSFERS_HIGH_THROUGHPUT       /* large transfers, as few per second as possible */
+                     );
+
 #ifndef MIN
 #define MIN(a,b) (((a)<(b))?(a):(b))
 #endif
@@ -13,6 +13,7 @@ AIOUSBDevice *NewAIOUSBDevice( unsigned long DeviceIndex )
     AIOUSBDevice *dev = (AIOUSBDevice *)calloc(sizeof(AIOUSBDevice),1);
     dev->deviceIndex = DeviceIndex;
     dev->isInit      = AIOUSB_TRUE;
+    AIOUSBDeviceInitLock( dev );
     return dev;
 }
 
@@ -25,6 +26,7 @@ AIOUSBDevice *NewAIOUSBDeviceFromJSON( char *str )
 
     if (!json ) 
         return NULL;
+    AIOUSBDeviceInitLock( dev );
     cJSON *aiousbdevice = cJSON_GetObjectItem(json,"aiousbdevice");
 
     if (!aiousbdevice )
@@ -71,6 +73,7 @@ char *AIOUSBDeviceToJSON( AIOUSBDevice *device )
 /*----------------------------------------------------------------------------*/
 void DeleteAIOUSBDevice( AIOUSBDevice *dev) 
 {
+    pthread_mutex_destroy( &dev->lock );
     free(dev);
 }
 
@@ -110,6 +113,22 @@ AIORET_TYPE AIOUSBDeviceGetTimeout( AIOUSBDevice *device )
     return device->commTimeout;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Borrows a scratch buffer of at least size bytes from the device's
+ * pool. Give it back with AIOUSBDeviceReleaseBuffer.
+ */
+void *AIOUSBDeviceGetBuffer( AIOUSBDevice *device, size_t size )
+{
+    return AIOBufferPoolGet( ( device ? device->bufferPool : NULL ), size );
+}
+
+/*----------------------------------------------------------------------------*/
+void AIOUSBDeviceReleaseBuffer( AIOUSBDevice *device, void *buf )
+{
+    AIOBufferPoolPut( ( device ? device->bufferPool : NULL ), buf );
+}
+
 /*----------------------------------------------------------------------------*/
 AIORET_TYPE AIOUSBDeviceCopyADCConfigBlock( AIOUSBDevice *dev, ADCConfigBlock *newone )
 {
@@ -284,6 +303,56 @@ AIORET_TYPE AIOUSBDeviceSetDiscardFirstSample( AIOUSBDevice *device , AIOUSB_BOO
 }
 
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sets up the per device lock as a recursive mutex, so a locked
+ * call may use other locked calls on the same device, and the DIO flush
+ * condition that waits on it against the monotonic clock
+ */
+AIORET_TYPE AIOUSBDeviceInitLock( AIOUSBDevice *device )
+{
+    pthread_mutexattr_t attr;
+    pthread_condattr_t condattr;
+    AIORET_TYPE retval = AIOUSB_SUCCESS;
+
+    if ( !device )
+        return -AIOUSB_ERROR_INVALID_DEVICE;
+    if ( pthread_mutexattr_init( &attr ) != 0 )
+        return -AIOUSB_ERROR_INVALID_MUTEX;
+    if ( pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE ) != 0 ||
+         pthread_mutex_init( &device->lock, &attr ) != 0 )
+        retval = -AIOUSB_ERROR_INVALID_MUTEX;
+    pthread_mutexattr_destroy( &attr );
+
+    pthread_condattr_init( &condattr );
+    pthread_condattr_setclock( &condattr, CLOCK_MONOTONIC );
+    if ( pthread_cond_init( &device->DIOFlushCond, &condattr ) != 0 )
+        retval = -AIOUSB_ERROR_INVALID_MUTEX;
+    pthread_condattr_destroy( &condattr );
+
+    return retval;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Serializes transactions with one board. Different boards never
+ * share a lock, so threads driving separate boards don't wait on each other.
+ */
+AIORET_TYPE AIOUSBDeviceLock( AIOUSBDevice *device )
+{
+    if ( !device )
+        return -AIOUSB_ERROR_INVALID_DEVICE;
+    return ( pthread_mutex_lock( &device->lock ) == 0 ? AIOUSB_SUCCESS : -AIOUSB_ERROR_INVALID_MUTEX );
+}
+
+/*----------------------------------------------------------------------------*/
+AIORET_TYPE AIOUSBDeviceUnlock( AIOUSBDevice *device )
+{
+    if ( !device )
+        return -AIOUSB_ERROR_INVALID_DEVICE;
+    return ( pthread_mutex_unlock( &device->lock ) == 0 ? AIOUSB_SUCCESS : -AIOUSB_ERROR_INVALID_MUTEX );
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -4,9 +4,11 @@
 #include "AIOTypes.h"
 #include "ADCConfigBlock.h"
 #include "USBDevice.h"
+#include "AIOBufferPool.h"
 #include "cJSON.h"
 #include <string.h>
 #include <semaphore.h>
+#include <pthread.h>
 #include <libusb.h>
 
 #ifdef __aiousb_cplusplus
@@ -26,6 +28,8 @@ typedef struct aio_usb_driver {
     AIOUSB_BOOL discardFirstSample; /**< AIOUSB_TRUE == discard first A/D sample in all A/D read methods */
     unsigned commTimeout;           /**< timeout for device communication (ms.) */
     double miscClockHz;             /**< miscellaneous clock frequency setting */
+    AIOTransferPreference BulkTransferPreference; /**< how ADC_BulkAcquire sizes its reads, see AIOUSB_SetBulkTransferPreference */
+    unsigned BulkTransferLatency;   /**< ms for one ADC_BulkAcquire read to fill, 0 == the preference's */
 
     // device-specific properties
     unsigned ProductID;
@@ -73,9 +77,19 @@ typedef struct aio_usb_driver {
     AIOUSB_BOOL bDIORead;
     AIOUSB_BOOL bDeviceWasHere;
     unsigned char *LastDIOData;
+    unsigned char *PendingDIOData;  /**< Outputs staged by DIO_BeginWrite, NULL when no batch is open */
+    unsigned DIOBatchDepth;         /**< DIO_BeginWrite calls not yet committed */
+    AIOUSB_BOOL bDIOBatchDirty;     /**< PendingDIOData holds writes not yet sent */
+    unsigned long DIOFlushMs;       /**< Staged writes older than this go out without waiting for the commit, 0 == at commit only */
+    unsigned long long DIOBatchStart; /**< AIOStatsNow() of the oldest unsent staged write */
+    pthread_t DIOBatchOwner;        /**< Thread that opened the batch; other threads' DIO writes are refused while it is open */
+    pthread_t DIOFlushThread;       /**< Sends an overdue batch nobody else writes to, see DIO_SetWriteDeadline */
+    AIOUSB_BOOL bDIOFlushThread;    /**< DIOFlushThread is running and still to be joined */
+    AIORESULT DIOFlushResult;       /**< First error DIOFlushThread hit, reported by the commit */
     char *cachedName;
     unsigned long cachedSerialNumber;
     ADCConfigBlock cachedConfigBlock; /**< .size == 0 == uninitialized */
+    ADCConfigBlock writtenConfigBlock; /**< What WriteConfigBlock last sent the device, .size == 0 == unknown */
 
     /**
      * state of worker thread; these fields are deliberately unspecific so that
@@ -94,6 +108,13 @@ typedef struct aio_usb_driver {
     int ADBuf_size;
     AIOUSB_BOOL testing;
     AIOUSB_BOOL valid;
+    AIOBufferPool *bufferPool;      /**< transfer and conversion buffers, so the hot paths don't hit the heap */
+    AIOStats *stats;                /**< transfer latencies and FIFO health, see AIOUSB_GetStatistics */
+    unsigned short *hostCalTables[AD_NUM_GAIN_CODES]; /**< per range tables the counts converter applies, see AIOUSB_ADC_SetHostCalTable */
+    uint64_t sramCalHash;           /**< AIOCalCacheHash of the table last uploaded by AIOUSB_ADC_SetCalTable */
+    AIOUSB_BOOL sramCalValid;       /**< sramCalHash describes what is in the device's SRAM */
+    pthread_mutex_t lock;           /**< recursive; held across a transaction with this board, see AIOUSBDeviceLock */
+    pthread_cond_t DIOFlushCond;    /**< Waited on with lock; wakes DIOFlushThread when the batch changes */
 } AIOUSBDevice;
 
 typedef AIOUSBDevice DeviceDescriptor;
@@ -122,6 +143,11 @@ AIORET_TYPE AIOUSBDeviceGetDiscardFirstSample( AIOUSBDevice *device );
 AIORET_TYPE AIOUSBDeviceSetDiscardFirstSample( AIOUSBDevice *device , AIOUSB_BOOL discard );
 AIORET_TYPE AIOUSBDeviceSetTimeout( AIOUSBDevice *device, unsigned timeout );
 AIORET_TYPE AIOUSBDeviceGetTimeout( AIOUSBDevice *device );
+void *AIOUSBDeviceGetBuffer( AIOUSBDevice *device, size_t size );
+void AIOUSBDeviceReleaseBuffer( AIOUSBDevice *device, void *buf );
+AIORET_TYPE AIOUSBDeviceInitLock( AIOUSBDevice *device );
+AIORET_TYPE AIOUSBDeviceLock( AIOUSBDevice *device );
+AIORET_TYPE AIOUSBDeviceUnlock( AIOUSBDevice *device );
 
 
 #ifdef __aiousb_cplusplus
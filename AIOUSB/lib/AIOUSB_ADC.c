@@ -12,6 +12,9 @@
 #include "AIOTypes.h"
 #include "AIODeviceTable.h"
 #include "AIOUSB_Core.h"
+#include "AIOUSB_Properties.h"
+#include "AIOCalCache.h"
+#include "AIOBulkSizer.h"
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
@@ -117,10 +120,11 @@ AIORET_TYPE ADC_WriteADConfigBlock( unsigned long DeviceIndex , ADConfigBlock *c
     AIORESULT result = AIOUSB_SUCCESS;
     AIORET_TYPE retval;
 
-    AIODeviceTableGetDeviceAtIndex( DeviceIndex , &result );
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex , &result );
     if ( result  != AIOUSB_SUCCESS )
         goto out_ADC_WriteADConfigBlock;
 
+    deviceDesc->writtenConfigBlock.size = 0;
     result = GenericVendorWrite( DeviceIndex , 
                                  AUR_ADC_SET_CONFIG,
                                  0,
@@ -220,6 +224,10 @@ unsigned long ReadConfigBlock(unsigned long DeviceIndex,
 
 /*----------------------------------------------------------------------------*/
 /**
+ * @brief Sends the cached config block to the device, unless it is the
+ *       block WriteConfigBlock last sent, so callers can write before every
+ *       acquisition without paying a control transfer for an unchanged one.
+ *       Anything else that writes the registers clears writtenConfigBlock.
  * @param DeviceIndex
  */
 unsigned long WriteConfigBlock(unsigned long DeviceIndex)
@@ -245,6 +253,11 @@ unsigned long WriteConfigBlock(unsigned long DeviceIndex)
         if ( result  != AIOUSB_SUCCESS )
             goto out_WriteConfigBlock;
 
+        if ( deviceDesc->writtenConfigBlock.size == configBlock->size &&
+             memcmp( deviceDesc->writtenConfigBlock.registers, configBlock->registers, configBlock->size ) == 0 )
+            goto out_WriteConfigBlock;
+
+        deviceDesc->writtenConfigBlock.size = 0;
         bytesTransferred = usb->usb_control_transfer(usb,
                                                      USB_WRITE_TO_DEVICE, 
                                                      AUR_ADC_SET_CONFIG,
@@ -256,6 +269,8 @@ unsigned long WriteConfigBlock(unsigned long DeviceIndex)
                                                      );
         if ( bytesTransferred != ( int )configBlock->size )
             result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
+        else
+            deviceDesc->writtenConfigBlock = *configBlock;
     }
 
 out_WriteConfigBlock:
@@ -337,6 +352,111 @@ RETURN_AIOUSB_GetBulkAcquire:
                                 /* number of samples device can buffer */
 #define DEVICE_SAMPLE_BUFFER_SIZE 1024
 
+/*--------------------------------------------------------------------------*/
+/**
+ * @brief Acquires one block of numChannels x samplesPerChannel samples with
+ * the config block that is already on the device and averages each channel
+ * into counts[]. Costs two control transfers and one bulk read.
+ */
+static AIORESULT _adc_acquire_immediate( AIOUSBDevice *deviceDesc,
+                                         USBDevice *usb,
+                                         int numChannels,
+                                         int samplesPerChannel,
+                                         AIOUSB_BOOL discardFirstSample,
+                                         unsigned short counts[]
+                                         )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    int samplesToAverage = 0, sampleIndex = 0, libusbresult;
+    unsigned numSamples, bytesTransferred;
+    unsigned short *sampleBuffer;
+    unsigned char bcdata[] = {0x05,0x00,0x00,0x00 };
+
+    numSamples = numChannels * samplesPerChannel;
+    /* unsigned short numSamplesHigh = ( unsigned short )(numSamples >> 16); */
+    /* unsigned short numSamplesLow = ( unsigned short )numSamples; */
+    /* int numBytes = numSamples * sizeof(unsigned short); */
+    sampleBuffer = ( unsigned short* )AIOUSBDeviceGetBuffer( deviceDesc, numSamples * sizeof(unsigned short) );
+    if (!sampleBuffer ) {
+        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    /* BC */
+    bytesTransferred = usb->usb_control_transfer(usb,
+                                                 USB_WRITE_TO_DEVICE, 
+                                                 AUR_START_ACQUIRING_BLOCK,
+                                                 (numSamples >> 16),           /* High Samples */
+                                                 ( unsigned short )numSamples, /* Low samples */
+                                                 bcdata,
+                                                 sizeof(bcdata),
+                                                 deviceDesc->commTimeout
+                                                 );
+    if ( bytesTransferred != sizeof(bcdata) ) { 
+        result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);       
+        goto out_adc_acquire_immediate;
+    }
+
+    /* BF */
+    bytesTransferred = usb->usb_control_transfer(usb,
+                                                 USB_WRITE_TO_DEVICE,
+                                                 AUR_ADC_IMMEDIATE,
+                                                 0, 
+                                                 0, 
+                                                 ( unsigned char* )sampleBuffer, 
+                                                 0,
+                                                 deviceDesc->commTimeout
+                                                 );
+    if (bytesTransferred == 0) {
+        libusbresult = usb->usb_bulk_transfer(usb,
+                                              LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT,
+                                              ( unsigned char* )sampleBuffer, 
+                                              numSamples * sizeof(unsigned short), 
+                                              (int*)&bytesTransferred,
+                                              deviceDesc->commTimeout
+                                              );
+
+        if (libusbresult != LIBUSB_SUCCESS) {
+            result = LIBUSB_RESULT_TO_AIOUSB_RESULT(libusbresult);
+        } else if (bytesTransferred != numSamples * sizeof(unsigned short) ) {
+            result = AIOUSB_ERROR_INVALID_DATA;
+        } else {
+            /**
+             * Compute the average of all the samples taken for each channel, discarding
+             * the first sample if that option is enabled; each byte in sampleBuffer[] is
+             * 1 of 2 bytes for each sample, the first byte being the LSB and the second
+             * byte the MSB, in other words, little-endian format; so for convenience we
+             * simply declare sampleBuffer[] to be of type 'unsigned short' and the data
+             * is already in the correct format; the device returns data only for the
+             * channels requested, from startChannel to endChannel; AIOUSB_GetScan()
+             * returns the averaged data readings in counts[], putting the reading for
+             * startChannel in counts[0], and the reading for endChannel in counts[numChannels-1]
+             */
+            samplesToAverage = discardFirstSample ? samplesPerChannel - 1 : samplesPerChannel;
+            sampleIndex = 0;
+
+            for(int channel = 0; channel < numChannels; channel++) {
+                unsigned long sampleSum = 0;
+                if(discardFirstSample)
+                    sampleIndex++;                 /* skip over first sample */
+                int sample;
+                for(sample = 0; sample < samplesToAverage; sample++)
+                    sampleSum += sampleBuffer[ sampleIndex++ ];
+                counts[ channel ] = ( unsigned short )
+                    ((sampleSum + samplesToAverage / 2) / samplesToAverage);
+            }
+        }
+    }
+    /* else */
+    /*            result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred); */
+
+        
+    out_adc_acquire_immediate:
+        AIOUSBDeviceReleaseBuffer( deviceDesc, sampleBuffer );
+
+    return result;
+}
+    
+
 /*--------------------------------------------------------------------------*/
 /**
  * @brief Performs a scan and averages the voltage values.
@@ -357,12 +477,9 @@ PRIVATE unsigned long AIOUSB_GetScan(
 {
     ADConfigBlock origConfigBlock;
     AIOUSB_BOOL configChanged, discardFirstSample; 
-    int samplesToAverage = 0, sampleIndex = 0;
-    int numChannels, samplesPerChannel, libusbresult;
-    unsigned numSamples, overSample, triggerMode,  bytesTransferred;     
-    unsigned short *sampleBuffer;
+    int numChannels, samplesPerChannel;
+    unsigned overSample, triggerMode;
     AIORESULT result = AIOUSB_SUCCESS;
-    unsigned char bcdata[] = {0x05,0x00,0x00,0x00 };
 
     if(counts == NULL)
         return AIOUSB_ERROR_INVALID_PARAMETER;
@@ -486,92 +603,10 @@ PRIVATE unsigned long AIOUSB_GetScan(
      * Should resemble (04|05) F0 0E
      *
      */
-    if (configChanged) {
-        result = WriteConfigBlock(DeviceIndex);
-    }
+    result = WriteConfigBlock(DeviceIndex);  /* the device may hold another call's block */
 
-    numSamples = numChannels * samplesPerChannel;
-    /* unsigned short numSamplesHigh = ( unsigned short )(numSamples >> 16); */
-    /* unsigned short numSamplesLow = ( unsigned short )numSamples; */
-    /* int numBytes = numSamples * sizeof(unsigned short); */
-    sampleBuffer = ( unsigned short* )malloc( numSamples * sizeof(unsigned short) );
-    if (!sampleBuffer ) {
-        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
-        goto out_AIOUSB_GetScan;
-    }
+    result = _adc_acquire_immediate( deviceDesc, usb, numChannels, samplesPerChannel, discardFirstSample, counts );
 
-    /* BC */
-    bytesTransferred = usb->usb_control_transfer(usb,
-                                                 USB_WRITE_TO_DEVICE, 
-                                                 AUR_START_ACQUIRING_BLOCK,
-                                                 (numSamples >> 16),           /* High Samples */
-                                                 ( unsigned short )numSamples, /* Low samples */
-                                                 bcdata,
-                                                 sizeof(bcdata),
-                                                 deviceDesc->commTimeout
-                                                 );
-    if ( bytesTransferred != sizeof(bcdata) ) { 
-        result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);       
-        goto out_freebuf_AIOUSB_GetScan;
-    }
-
-    /* BF */
-    bytesTransferred = usb->usb_control_transfer(usb,
-                                                 USB_WRITE_TO_DEVICE,
-                                                 AUR_ADC_IMMEDIATE,
-                                                 0, 
-                                                 0, 
-                                                 ( unsigned char* )sampleBuffer, 
-                                                 0,
-                                                 deviceDesc->commTimeout
-                                                 );
-    if (bytesTransferred == 0) {
-        libusbresult = usb->usb_bulk_transfer(usb,
-                                              LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT,
-                                              ( unsigned char* )sampleBuffer, 
-                                              numSamples * sizeof(unsigned short), 
-                                              (int*)&bytesTransferred,
-                                              deviceDesc->commTimeout
-                                              );
-
-        if (libusbresult != LIBUSB_SUCCESS) {
-            result = LIBUSB_RESULT_TO_AIOUSB_RESULT(libusbresult);
-        } else if (bytesTransferred != numSamples * sizeof(unsigned short) ) {
-            result = AIOUSB_ERROR_INVALID_DATA;
-        } else {
-            /**
-             * Compute the average of all the samples taken for each channel, discarding
-             * the first sample if that option is enabled; each byte in sampleBuffer[] is
-             * 1 of 2 bytes for each sample, the first byte being the LSB and the second
-             * byte the MSB, in other words, little-endian format; so for convenience we
-             * simply declare sampleBuffer[] to be of type 'unsigned short' and the data
-             * is already in the correct format; the device returns data only for the
-             * channels requested, from startChannel to endChannel; AIOUSB_GetScan()
-             * returns the averaged data readings in counts[], putting the reading for
-             * startChannel in counts[0], and the reading for endChannel in counts[numChannels-1]
-             */
-            samplesToAverage = discardFirstSample ? samplesPerChannel - 1 : samplesPerChannel;
-            sampleIndex = 0;
-
-            for(int channel = 0; channel < numChannels; channel++) {
-                unsigned long sampleSum = 0;
-                if(discardFirstSample)
-                    sampleIndex++;                 /* skip over first sample */
-                int sample;
-                for(sample = 0; sample < samplesToAverage; sample++)
-                    sampleSum += sampleBuffer[ sampleIndex++ ];
-                counts[ channel ] = ( unsigned short )
-                    ((sampleSum + samplesToAverage / 2) / samplesToAverage);
-            }
-        }
-    }
-    /* else */
-    /*            result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred); */
-
-        
-    out_freebuf_AIOUSB_GetScan:
-        free(sampleBuffer);
-    
     if(configChanged) {
 
         deviceDesc->cachedConfigBlock = origConfigBlock;
@@ -803,8 +838,10 @@ unsigned long ADC_GetChannelV(
      * data for the specified channel
      */
 
+    AIOUSBDeviceLock( deviceDesc );
     result = ReadConfigBlock(DeviceIndex, AIOUSB_FALSE);
     if ( result != AIOUSB_SUCCESS ) {
+        AIOUSBDeviceUnlock( deviceDesc );
         return result;
     }
 
@@ -825,10 +862,126 @@ unsigned long ADC_GetChannelV(
 
     deviceDesc->cachedConfigBlock = origConfigBlock;
     WriteConfigBlock(DeviceIndex);
+    AIOUSBDeviceUnlock( deviceDesc );
 
     return result;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Reads a list of channels, each at its own range, in one immediate
+ *       scan. The channels are validated and scanned from the lowest to the
+ *       highest requested one. pBuf[i] receives the volts for requests[i].
+ *
+ *       Unlike ADC_GetChannelV the scan range, gain codes and scan trigger
+ *       are left in the cached config block and on the device afterwards,
+ *       and the block is only written when it differs from the one the
+ *       device last received. Polling the same set of channels repeatedly,
+ *       discardFirstSample or not, therefore costs only the two control
+ *       transfers and one bulk read of the acquisition itself.
+ * @param DeviceIndex
+ * @param requests channel / range pairs; channels sharing a gain group must
+ *        ask for the same range
+ * @param numRequests
+ * @param pBuf numRequests volts
+ * @return AIOUSB_SUCCESS or an AIOUSB_ERROR_* code
+ */
+unsigned long ADC_GetChannelsV(
+                               unsigned long DeviceIndex,
+                               const ADCChannelRequest *requests,
+                               unsigned numRequests,
+                               double *pBuf
+                               )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    ADConfigBlock configBlock, origConfigBlock, scanConfigBlock;
+    unsigned startChannel, endChannel, i, j;
+    int numChannels, samplesPerChannel;
+    unsigned short *counts;
+
+    if ( !requests || !numRequests || !pBuf )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+    if ( deviceDesc->bADCStream == AIOUSB_FALSE )
+        return AIOUSB_ERROR_NOT_SUPPORTED;
+    USBDevice *usb = AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+
+    startChannel = endChannel = requests[0].channel;
+    for ( i = 0; i < numRequests; i ++ ) {
+        if ( requests[i].channel >= deviceDesc->ADCMUXChannels || !VALID_ENUM( ADGainCode, requests[i].gainCode ) )
+            return AIOUSB_ERROR_INVALID_PARAMETER;
+        for ( j = 0; j < i; j ++ ) {
+            if ( requests[j].channel / deviceDesc->ADCChannelsPerGroup == requests[i].channel / deviceDesc->ADCChannelsPerGroup &&
+                 ( requests[j].gainCode != requests[i].gainCode || requests[j].differentialMode != requests[i].differentialMode ) )
+                return AIOUSB_ERROR_INVALID_PARAMETER;
+        }
+        startChannel = MIN( startChannel, requests[i].channel );
+        endChannel   = MAX( endChannel, requests[i].channel );
+    }
+
+    AIOUSBDeviceLock( deviceDesc );
+    result = ReadConfigBlock( DeviceIndex, AIOUSB_FALSE ); /* only goes to the device when nothing is cached */
+    if ( result != AIOUSB_SUCCESS )
+        goto out_ADC_GetChannelsV;
+
+    /**
+     * Build the block the scan needs on top of the cached one, using the
+     * same trigger and oversample rules as AIOUSB_GetScan()
+     */
+    origConfigBlock = configBlock = deviceDesc->cachedConfigBlock;
+    AIOUSB_SetCalMode( &configBlock, AD_CAL_MODE_NORMAL );
+    AIOUSB_SetTriggerMode( &configBlock, ( AIOUSB_GetTriggerMode( &configBlock ) | AD_TRIGGER_SCAN ) & ~( AD_TRIGGER_TIMER | AD_TRIGGER_EXTERNAL ) );
+    AIOUSB_SetScanRange( &configBlock, startChannel, endChannel );
+    for ( i = 0; i < numRequests; i ++ ) {
+        AIOUSB_SetGainCode( &configBlock, requests[i].channel, requests[i].gainCode );
+        AIOUSB_SetDifferentialMode( &configBlock, requests[i].channel, requests[i].differentialMode );
+    }
+
+    /**
+     * The user's oversample stays in the cached block, as in
+     * AIOUSB_GetScan(): the extra sample discardFirstSample needs, or a
+     * smaller oversample the device buffer forces, only goes to the
+     * device, which keeps it until something else is written
+     */
+    numChannels = endChannel - startChannel + 1;
+    samplesPerChannel = 1 + AIOUSB_GetOversample( &configBlock ) + ( deviceDesc->discardFirstSample ? 1 : 0 );
+    samplesPerChannel = MIN( samplesPerChannel, 256 );
+    if ( numChannels * samplesPerChannel > DEVICE_SAMPLE_BUFFER_SIZE )
+        samplesPerChannel = DEVICE_SAMPLE_BUFFER_SIZE / numChannels;
+    scanConfigBlock = configBlock;
+    AIOUSB_SetOversample( &scanConfigBlock, samplesPerChannel - 1 );
+
+    deviceDesc->cachedConfigBlock = scanConfigBlock;
+    result = WriteConfigBlock( DeviceIndex );       /* skipped when the device already has it */
+    deviceDesc->cachedConfigBlock = ( result == AIOUSB_SUCCESS ? configBlock : origConfigBlock );
+    if ( result != AIOUSB_SUCCESS )
+        goto out_ADC_GetChannelsV;
+
+    counts = ( unsigned short* )AIOUSBDeviceGetBuffer( deviceDesc, numChannels * sizeof(unsigned short) );
+    if ( !counts ) {
+        result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        goto out_ADC_GetChannelsV;
+    }
+
+    result = _adc_acquire_immediate( deviceDesc, usb, numChannels, samplesPerChannel, deviceDesc->discardFirstSample, counts );
+    if ( result == AIOUSB_SUCCESS ) {
+        for ( i = 0; i < numRequests; i ++ ) {
+            const struct ADRange *const range = &adRanges[ AIOUSB_GetGainCode( &configBlock, requests[i].channel ) ];
+            pBuf[i] = ( (( double )counts[ requests[i].channel - startChannel ] / ( double )AI_16_MAX_COUNTS) * range->range ) + range->minVolts;
+        }
+    }
+
+    AIOUSBDeviceReleaseBuffer( deviceDesc, counts );
+ out_ADC_GetChannelsV:
+    AIOUSBDeviceUnlock( deviceDesc );
+    return result;
+}
+
 /*----------------------------------------------------------------------------*/
 /**
  * @brief Preferred way to get immediate scan readings. Will Scan all channels ( ie vectored ) 
@@ -861,13 +1014,17 @@ unsigned long ADC_GetScanV(
     /**
      * get raw A/D counts
      */
-    unsigned short *counts = ( unsigned short* )malloc(deviceDesc->ADCMUXChannels * sizeof(unsigned short));
+    unsigned short *counts = ( unsigned short* )AIOUSBDeviceGetBuffer( deviceDesc, deviceDesc->ADCMUXChannels * sizeof(unsigned short) );
     if ( !counts )
         return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
 
+    AIOUSBDeviceLock( deviceDesc ); /* the scan range is read back below */
     result = ADC_GetScan(DeviceIndex, counts);
-    if ( result != AIOUSB_SUCCESS )
+    if ( result != AIOUSB_SUCCESS ) {
+        AIOUSBDeviceUnlock( deviceDesc );
+        AIOUSBDeviceReleaseBuffer( deviceDesc, counts );
         return result;
+    }
     
     /**
      * Convert from A/D counts to volts; only
@@ -896,8 +1053,9 @@ unsigned long ADC_GetScanV(
      */
     result = AIOUSB_ArrayCountsToVolts(DeviceIndex, startChannel, endChannel - startChannel + 1,
                                        counts + startChannel, pBuf + startChannel);
+    AIOUSBDeviceUnlock( deviceDesc );
 
-    free(counts);
+    AIOUSBDeviceReleaseBuffer( deviceDesc, counts );
     return result;
 }
 
@@ -941,9 +1099,11 @@ unsigned long ADC_GetScan(
      * going to be filled in with real readings
      */
     memset(pBuf, 0, deviceDesc->ADCMUXChannels * sizeof(unsigned short));
+    AIOUSBDeviceLock( deviceDesc );
     startChannel = AIOUSB_GetStartChannel(&deviceDesc->cachedConfigBlock);
 
-    return AIOUSB_GetScan(DeviceIndex, pBuf + startChannel);
+    result = AIOUSB_GetScan(DeviceIndex, pBuf + startChannel);
+    AIOUSBDeviceUnlock( deviceDesc );
  err_ADC_GetScan:
 
     return result;
@@ -991,6 +1151,7 @@ unsigned long ADC_GetConfig(
     }
 
 
+    AIOUSBDeviceLock( deviceDesc );
     result = ReadConfigBlock(DeviceIndex, AIOUSB_TRUE);
     if(result == AIOUSB_SUCCESS) {
           assert(deviceDesc->cachedConfigBlock.size > 0 &&
@@ -1000,6 +1161,7 @@ unsigned long ADC_GetConfig(
           *ConfigBufSize = deviceDesc->cachedConfigBlock.size;
 
       }
+    AIOUSBDeviceUnlock( deviceDesc );
 
 out_ADC_GetConfig:
     return result;
@@ -1105,7 +1267,10 @@ unsigned long ADC_SetConfig(
 
 
 
+     AIOUSBDeviceLock( deviceDesc );
+     deviceDesc->writtenConfigBlock.size = 0;
      usb->usb_put_config( usb, &configBlock );
+     AIOUSBDeviceUnlock( deviceDesc );
 
 out_ADC_SetConfig:
      return result;
@@ -1182,6 +1347,7 @@ unsigned long ADC_CopyConfig(
           goto out_ADC_CopyConfig;  
      }
 
+     AIOUSBDeviceLock( deviceDesc );
      deviceDesc->cachedConfigBlock = *config;
 
 
@@ -1189,6 +1355,7 @@ unsigned long ADC_CopyConfig(
 
      if(result == AIOUSB_SUCCESS)
           deviceDesc->cachedConfigBlock.size = config->size;
+     AIOUSBDeviceUnlock( deviceDesc );
 
 out_ADC_CopyConfig:
 
@@ -1230,6 +1397,7 @@ unsigned long ADC_RangeAll(
               return AIOUSB_ERROR_INVALID_PARAMETER;
     }
 
+    AIOUSBDeviceLock( deviceDesc );
     result = ReadConfigBlock(DeviceIndex, AIOUSB_FALSE);
     if(result == AIOUSB_SUCCESS) {
         
@@ -1241,6 +1409,7 @@ unsigned long ADC_RangeAll(
 
         result = WriteConfigBlock(DeviceIndex);
     }
+    AIOUSBDeviceUnlock( deviceDesc );
 
     return result;
 }
@@ -1280,6 +1449,7 @@ unsigned long ADC_Range1(unsigned long DeviceIndex,
         goto out_adc_range1;
 
 
+    AIOUSBDeviceLock( deviceDesc );
     result = ReadConfigBlock(DeviceIndex, AIOUSB_FALSE);
     if(result == AIOUSB_SUCCESS) {
 
@@ -1289,6 +1459,7 @@ unsigned long ADC_Range1(unsigned long DeviceIndex,
 
           result = WriteConfigBlock(DeviceIndex);
       }
+    AIOUSBDeviceUnlock( deviceDesc );
 
 out_adc_range1:
 
@@ -1325,6 +1496,7 @@ unsigned long ADC_ADMode(
     if(deviceDesc->bADCStream == AIOUSB_FALSE)
         return AIOUSB_ERROR_NOT_SUPPORTED;
 
+    AIOUSBDeviceLock( deviceDesc );
     result = ReadConfigBlock(DeviceIndex, AIOUSB_FALSE);
     if(result == AIOUSB_SUCCESS) {
         
@@ -1333,6 +1505,7 @@ unsigned long ADC_ADMode(
 
         result = WriteConfigBlock(DeviceIndex);
     }
+    AIOUSBDeviceUnlock( deviceDesc );
 
     return result;
 }
@@ -1360,12 +1533,13 @@ AIORESULT ADC_SetOversample(
         goto out_ADC_SetOversample;
     }
 
+    AIOUSBDeviceLock( deviceDesc );
     result = ReadConfigBlock(DeviceIndex, AIOUSB_FALSE);
-    if( result != AIOUSB_SUCCESS) 
-        goto out_ADC_SetOversample;
-
-    AIOUSB_SetOversample(&deviceDesc->cachedConfigBlock, Oversample);
-    result = WriteConfigBlock(DeviceIndex);
+    if( result == AIOUSB_SUCCESS) {
+        AIOUSB_SetOversample(&deviceDesc->cachedConfigBlock, Oversample);
+        result = WriteConfigBlock(DeviceIndex);
+    }
+    AIOUSBDeviceUnlock( deviceDesc );
 
 out_ADC_SetOversample:
 
@@ -1402,7 +1576,9 @@ AIORESULT ADC_SetAllGainCodeAndDiffMode( unsigned long DeviceIndex, unsigned gai
         result = AIOUSB_ERROR_NOT_SUPPORTED;
         goto out_ADC_SetAllGainCodeAndDiffMode;
     }
+    AIOUSBDeviceLock( deviceDesc );
     AIOUSB_SetAllGainCodeAndDiffMode( &deviceDesc->cachedConfigBlock, gain, differentialMode );
+    AIOUSBDeviceUnlock( deviceDesc );
 out_ADC_SetAllGainCodeAndDiffMode:
 
     return result;
@@ -1434,10 +1610,12 @@ unsigned long ADC_SetScanLimits(
     }
 
 
+    AIOUSBDeviceLock( deviceDesc );
     if( (result = ReadConfigBlock(DeviceIndex, AIOUSB_FALSE)) == AIOUSB_SUCCESS ) {
           AIOUSB_SetScanRange(&deviceDesc->cachedConfigBlock, StartChannel, EndChannel);
           result = WriteConfigBlock(DeviceIndex);
     }
+    AIOUSBDeviceUnlock( deviceDesc );
 
  out_ADC_SetScanLimits:
     return result;
@@ -1657,14 +1835,6 @@ static void *startAcquire(void *params)
     return &result;
 }
 
-#define STREAMING_PNA_DEFINITIONS                                       \
-    struct timespec foo , bar;                                          \
-    unsigned deltas[16*8192];                                           \
-    unsigned transactions[16*8192];                                     \
-    int tindex = 0;                                                     \
-    int num_reads = 0;
-
-
 /*----------------------------------------------------------------------------*/
 /**
  * @brief we assume the parameters passed to BulkAcquireWorker() have
@@ -1689,12 +1859,11 @@ static void *BulkAcquireWorker(void *params)
 
     libusb_device_handle * deviceHandle = AIOUSB_GetDeviceHandle(acquireParams->DeviceIndex);
     pthread_t startAcquireThread;
-    unsigned long streamingBlockSize , bytesRemaining;
+    unsigned long bytesRemaining;
     int threadResult;
-
-#ifdef PNA_TESTING
-    STREAMING_PNA_DEFINITIONS;
-#endif
+    AIOBulkSizer sizer;
+    ADCConfigBlock *config = &deviceDesc->cachedConfigBlock;
+    unsigned numChannels = ( config->size ? AIOUSB_GetEndChannel( config ) - AIOUSB_GetStartChannel( config ) + 1 : 0 );
 
     int bytesTransferred;
     unsigned char *data;
@@ -1710,7 +1879,12 @@ static void *BulkAcquireWorker(void *params)
         deviceDesc->workerResult = AIOUSB_ERROR_INVALID_THREAD;
         goto out_BulkAcquireWorker;
     } 
-    streamingBlockSize = deviceDesc->StreamingBlockSize; 
+    AIOBulkSizerInit( &sizer,
+                      deviceDesc->BulkTransferPreference,
+                      deviceDesc->BulkTransferLatency,
+                      AIOBulkSizerRate( deviceDesc->miscClockHz, numChannels, config->size ? AIOUSB_GetOversample( config ) : 0 ),
+                      deviceDesc->StreamingBlockSize
+                      );
 
     bytesRemaining = acquireParams->BufSize;
     deviceDesc->workerStatus = bytesRemaining;       // deviceDesc->workerStatus == bytes remaining to receive
@@ -1719,16 +1893,10 @@ static void *BulkAcquireWorker(void *params)
 
     data = ( unsigned char* )acquireParams->pBuf;
 
-#ifdef PNA_TESTING
-    clock_gettime( CLOCK_MONOTONIC_RAW, &bar );
-#endif
-
     while(bytesRemaining > 0) {
+        unsigned long streamingBlockSize = (unsigned long)AIOBulkSizerGetSize( &sizer );
         unsigned long bytesToTransfer = (bytesRemaining < streamingBlockSize) ? bytesRemaining : streamingBlockSize;
-#ifdef PNA_TESTING
-        clock_gettime( CLOCK_MONOTONIC_RAW, &foo );
-        deltas[num_reads++] =  ( foo.tv_sec - bar.tv_sec )*1e9 + (foo.tv_nsec - bar.tv_nsec );
-#endif
+        unsigned long long start = AIOStatsNow();
         libusbResult = libusb_bulk_transfer(deviceHandle, 
                                             LIBUSB_ENDPOINT_IN | USB_BULK_READ_ENDPOINT, 
                                             data, 
@@ -1736,38 +1904,18 @@ static void *BulkAcquireWorker(void *params)
                                             &bytesTransferred, 
                                             4000
                                             );
-#ifdef PNA_TESTING
-        clock_gettime( CLOCK_MONOTONIC_RAW, &bar );
-        transactions[tindex++] = bytesTransferred;
-        deltas[num_reads++] = ( bar.tv_sec - foo.tv_sec )*1e9 + (bar.tv_nsec - foo.tv_nsec);
-#endif
+        AIOStatsRecordTransfer( deviceDesc->stats, AIO_STATS_BULK_IN, start, bytesTransferred, libusbResult );
         if (libusbResult != LIBUSB_SUCCESS) {
             result = LIBUSB_RESULT_TO_AIOUSB_RESULT(libusbResult);
             /* printf("ERROR was %dl\n", (int)result ); */
             break;
         } else {
+            AIOBulkSizerObserve( &sizer, bytesTransferred, AIOStatsNow() );
             data += bytesTransferred;
             bytesRemaining -= bytesToTransfer; /* Actually read in bytes */
             deviceDesc->workerStatus = bytesRemaining;
         }
     }
-#ifdef PNA_TESTING
-    FILE *fp = fopen("delays.dat","w");
-    FILE *fp2 = fopen("data.dat","w");
-    if ( !fp || !fp2 ) {
-        printf("Can't open file delays.dat for writing");
-    } else {
-        for(int i= 0; i < num_reads ; i ++ ) {
-            fprintf(fp,"%u\n", deltas[i] );
-
-        }
-        for ( int i = 0 ; i < tindex ; i ++ ) {
-            fprintf(fp2,"%u\n", transactions[i] );
-        }
-        fclose(fp2);
-        fclose(fp);
-    }
-#endif
     
  out_BulkAcquireWorker:
     deviceDesc->workerStatus = 0;
@@ -2381,8 +2529,103 @@ char * ADConfigBlockToYAML(ADConfigBlock *config)
 
     return strdup(tbuf);
 }
+/*----------------------------------------------------------------------------*/
+static AIORESULT _adc_fastit_channels( AIOUSBDevice *deviceDesc, int *StartChannel, int *EndChannel )
+{
+    if (!deviceDesc->bADCStream || deviceDesc->ConfigBytes < 20 || !deviceDesc->FastITConfig )
+        return AIOUSB_ERROR_BAD_TOKEN_TYPE;
+
+    *StartChannel  = AIOUSB_GetRegister(deviceDesc->FastITConfig, 0x12) & 0x0F;
+    *EndChannel    = AIOUSB_GetRegister(deviceDesc->FastITConfig, 0x12) >> 4;
+
+    if( deviceDesc->ConfigBytes >= 21 ) {
+        *StartChannel = *StartChannel  | ((AIOUSB_GetRegister(deviceDesc->FastITConfig, 20 ) & 0xF ) << 4);
+        *EndChannel   = *EndChannel    | ( AIOUSB_GetRegister( deviceDesc->FastITConfig, 20 ) & 0xF0 );
+    }
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Number of bytes the device sends for one FastIT scan, once
+ *        ADC_InitFastITScanV has set up the FastIT config block
+ * @param DeviceIndex
+ * @return bytes per scan, or negative error code
+ */
+AIORET_TYPE ADC_FastITScanBytes( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    int StartChannel, EndChannel;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return -(AIORET_TYPE)result;
+
+    if ( (result = _adc_fastit_channels( deviceDesc, &StartChannel, &EndChannel )) != AIOUSB_SUCCESS )
+        return -(AIORET_TYPE)result;
+
+    /* 1 sample + 3 oversamples */
+    return (EndChannel - StartChannel + 1) * sizeof(unsigned short) * (AIOUSB_GetRegister(deviceDesc->FastITConfig, 0x13) + 1);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Averages one FastIT scan of raw counts, discarding the first
+ *        sample of each channel, and converts it to volts using the
+ *        ranges in the FastIT config block
+ * @param DeviceIndex
+ * @param counts ADC_FastITScanBytes() bytes as read from the device
+ * @param pData one voltage per channel
+ * @return
+ */
+AIORESULT ADC_FastITCountsToVolts( unsigned long DeviceIndex, const unsigned short *counts, double *pData )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    int StartChannel, EndChannel;
+    int i, ch;
+    double *pBuf;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+
+    if ( !counts || !pData )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+
+    if ( (result = _adc_fastit_channels( deviceDesc, &StartChannel, &EndChannel )) != AIOUSB_SUCCESS )
+        return result;
+
+    pBuf = pData;
+
+    for(i = 0, ch = StartChannel; ch <= EndChannel; i++, ch++) {
+          int RangeCode = AIOUSB_GetRegister(deviceDesc->FastITConfig, ch >> deviceDesc->RangeShift);
+          int Tot = 0, Wt = 0;
+          float V;
+          int j;
+          int numsamples = AIOUSB_GetRegister(deviceDesc->FastITConfig, 0x13) + 1;
+
+          for(j = 1; j < numsamples; j++) {
+                Tot += counts[i * (numsamples) + j];
+                Wt++;
+          }
+          V = Tot / Wt / (float)65536;
+          if((RangeCode & 1) != 0)
+              V = V * 2 - 1;
+          if((RangeCode & 2) == 0)
+              V = V * 2;
+          if((RangeCode & 4) == 0)
+              V = V * 5;
+
+          *pBuf = (double)V;
+          pBuf++;
+      }
+
+    return result;
+}
+
 /*----------------------------------------------------------------------------*/
 /**
+ * @brief Configures the counters and clocks for a single FastIT scan and
+ *        waits for it. Callers that scan repeatedly should keep an
+ *        AIOFastITSession open instead.
  * @param DeviceIndex
  * @param pBuf
  * @return
@@ -2390,6 +2633,7 @@ char * ADConfigBlockToYAML(ADConfigBlock *config)
 unsigned long ADC_GetFastITScanV(unsigned long DeviceIndex, double *pData)
 {
     AIORESULT result = 0;
+    AIORET_TYPE retval;
 
     int StartChannel;
     int EndChannel;
@@ -2399,39 +2643,26 @@ unsigned long ADC_GetFastITScanV(unsigned long DeviceIndex, double *pData)
 
     int bufsize;
     double clockHz = 0;
-    double *pBuf;
     int numsleep = 100;
     double CLOCK_SPEED = 100000;
-    int i, ch;
 
     AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
     if ( result != AIOUSB_SUCCESS )
         goto out_ADC_GetFastITScanV;
 
-    if (!deviceDesc->bADCStream) {
-          result = AIOUSB_ERROR_BAD_TOKEN_TYPE;
-          goto out_ADC_GetFastITScanV;
-      }
-
-    if (deviceDesc->ConfigBytes < 20) {
-          result = AIOUSB_ERROR_BAD_TOKEN_TYPE;
-          goto out_ADC_GetFastITScanV;
-      }
-
-    StartChannel  = AIOUSB_GetRegister(deviceDesc->FastITConfig, 0x12) & 0x0F;
-    EndChannel    = AIOUSB_GetRegister(deviceDesc->FastITConfig, 0x12) >> 4;
-
-    if( deviceDesc->ConfigBytes >= 21 ) {
-        StartChannel = StartChannel  | ((AIOUSB_GetRegister(deviceDesc->FastITConfig, 20 ) & 0xF ) << 4);
-        EndChannel   = EndChannel    | ( AIOUSB_GetRegister( deviceDesc->FastITConfig, 20 ) & 0xF0 );
-    }
-
+    if ( (result = _adc_fastit_channels( deviceDesc, &StartChannel, &EndChannel )) != AIOUSB_SUCCESS )
+        goto out_ADC_GetFastITScanV;
 
     Channels      = EndChannel - StartChannel + 1;
 
     CTR_8254Mode(DeviceIndex, 0, 2, 0);
     CTR_8254Mode(DeviceIndex, 0, 2, 1);
-    bufsize = Channels * sizeof(unsigned short) * (AIOUSB_GetRegister(deviceDesc->FastITConfig, 0x13) + 1); /* 1 sample + 3 oversamples */;
+    retval = ADC_FastITScanBytes( DeviceIndex );
+    if ( retval < 0 ) {
+        result = (AIORESULT)-retval;
+        goto out_ADC_GetFastITScanV;
+    }
+    bufsize = (int)retval;
 
     clockHz = 0;
 
@@ -2473,32 +2704,7 @@ unsigned long ADC_GetFastITScanV(unsigned long DeviceIndex, double *pData)
     if(result != AIOUSB_SUCCESS)
         goto CLEANUP_ADC_GetFastITScanV;
 
-    pBuf = pData;
-
-    for(i = 0, ch = StartChannel; ch <= EndChannel; i++, ch++) {
-          int RangeCode = AIOUSB_GetRegister(deviceDesc->FastITConfig, ch >> deviceDesc->RangeShift);
-          int Tot = 0, Wt = 0;
-          float V;
-          int j;
-          int numsamples = AIOUSB_GetRegister(deviceDesc->FastITConfig, 0x13) + 1;
-
-          for(j = 1; j < numsamples; j++) {
-                Tot += thisDataBuf[i * (numsamples) + j];
-                Wt++;
-          }
-          V = Tot / Wt / (float)65536;
-          if((RangeCode & 1) != 0)
-              V = V * 2 - 1;
-          if((RangeCode & 2) == 0)
-              V = V * 2;
-          if((RangeCode & 4) == 0)
-              V = V * 5;
-
-          *pBuf = (double)V;
-          pBuf++;
-
-          fflush(stdout);
-      }
+    result = ADC_FastITCountsToVolts( DeviceIndex, thisDataBuf, pData );
 
 CLEANUP_ADC_GetFastITScanV:
     free(thisDataBuf);
@@ -2898,6 +3104,81 @@ out_AIOUSB_ADC_InternalCal:
     return retval;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * AIOUSB_ADC_InternalCal measures the board's own references, not the range
+ * in use, and its table corrects the converter whatever the gain, so there
+ * is one cache entry per board, kept under the range it measures in
+ */
+#define INTERNAL_CAL_RANGE AD_GAIN_CODE_10V
+
+/**
+ * @brief Calibrates from the on-disk cache ( see AIOCalCache.h ), keyed by
+ * the device's serial number and product ID. Only when there is no usable
+ * entry does this run AIOUSB_ADC_InternalCal, saving its table for next
+ * time.
+ * @param DeviceIndex
+ * @param gainCode range the host side table is applied to
+ * @param hostSide AIOUSB_TRUE applies the table with
+ *        AIOUSB_ADC_SetHostCalTable instead of uploading it to SRAM,
+ *        and puts the 1:1 table in SRAM so counts aren't corrected twice
+ * @param mapped AIOUSB_TRUE reads the entry through a memory mapping
+ * @return
+ */
+AIORESULT AIOUSB_ADC_LoadCachedCal(
+                                   unsigned long DeviceIndex,
+                                   ADGainCode gainCode,
+                                   AIOUSB_BOOL hostSide,
+                                   AIOUSB_BOOL mapped
+                                   )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    const unsigned short *cached = NULL;
+    unsigned short *calTable = NULL;
+    uint64_t serial;
+    AIORET_TYPE found;
+
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+    if ( (unsigned)gainCode >= AD_NUM_GAIN_CODES )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( ( result = GetDeviceSerialNumber( DeviceIndex, &serial ) ) != AIOUSB_SUCCESS )
+        return result;
+    if ( !( calTable = ( unsigned short* )malloc(CAL_TABLE_WORDS * sizeof(unsigned short)) ) )
+        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    if ( mapped ) {
+        found = AIOCalCacheMap( serial, deviceDesc->ProductID, INTERNAL_CAL_RANGE, &cached, NULL );
+    } else {
+        found = AIOCalCacheLoad( serial, deviceDesc->ProductID, INTERNAL_CAL_RANGE, calTable, NULL );
+        cached = calTable;
+    }
+
+    if ( found != AIOUSB_SUCCESS ) {
+        cached = calTable;
+        result = AIOUSB_ADC_InternalCal( DeviceIndex, AIOUSB_TRUE, calTable, NULL );
+        if ( result == AIOUSB_SUCCESS )    /* a table that can't be cached is still good to use */
+            AIOCalCacheStore( serial, deviceDesc->ProductID, INTERNAL_CAL_RANGE, calTable );
+    }
+
+    if ( result == AIOUSB_SUCCESS && hostSide ) {
+        result = AIOUSB_ADC_SetHostCalTable( DeviceIndex, gainCode, cached );
+        /* put SRAM back to 1:1, free when it already holds it */
+        for ( int index = 0; index < CAL_TABLE_WORDS; index++ )
+            calTable[ index ] = index;
+        if ( result == AIOUSB_SUCCESS )
+            result = AIOUSB_ADC_SetCalTable( DeviceIndex, calTable );
+    } else if ( result == AIOUSB_SUCCESS && found == AIOUSB_SUCCESS ) {
+        result = AIOUSB_ADC_SetCalTable( DeviceIndex, cached );
+    }
+
+    if ( mapped && found == AIOUSB_SUCCESS )
+        AIOCalCacheUnmap( cached );
+    free( calTable );
+    return result;
+}
+
 /*----------------------------------------------------------------------------*/
 void AIOUSB_SetRegister(ADConfigBlock *cb, unsigned int Register, unsigned char value)
 {
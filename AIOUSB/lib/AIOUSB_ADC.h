@@ -23,6 +23,17 @@ PUBLIC_EXTERN AIORESULT ADC_GetChannelV( unsigned long DeviceIndex,
                                          unsigned long ChannelIndex,
                                          double *pBuf );
 
+typedef struct {
+    unsigned channel;                   /**< A/D ( MUX ) channel to read */
+    unsigned gainCode;                  /**< ADGainCode range for the channel */
+    AIOUSB_BOOL differentialMode;
+} ADCChannelRequest;
+
+PUBLIC_EXTERN AIORESULT ADC_GetChannelsV( unsigned long DeviceIndex,
+                                          const ADCChannelRequest *requests,
+                                          unsigned numRequests,
+                                          double *pBuf );
+
 
 #endif
     
@@ -114,6 +125,14 @@ PUBLIC_EXTERN AIORESULT ADC_GetFastITScanV(
     double *pData
     );
 
+PUBLIC_EXTERN AIORET_TYPE ADC_FastITScanBytes( unsigned long DeviceIndex );
+
+PUBLIC_EXTERN AIORESULT ADC_FastITCountsToVolts(
+    unsigned long DeviceIndex,
+    const unsigned short *counts,
+    double *pData
+    );
+
 PUBLIC_EXTERN AIORESULT ADC_GetITScanV(
     unsigned long DeviceIndex,
     double *pBuf
@@ -153,6 +172,9 @@ PUBLIC_EXTERN AIORET_TYPE AIOUSB_SetScanRange( ADConfigBlock *config, unsigned s
 PUBLIC_EXTERN unsigned long AIOUSB_SetStreamingBlockSize(
                                                          unsigned long DeviceIndex,
                                                          unsigned long BlockSize );
+PUBLIC_EXTERN unsigned long AIOUSB_SetBulkTransferPreference( unsigned long DeviceIndex,
+                                                              AIOTransferPreference preference,
+                                                              unsigned latency_ms );
 
 
 
@@ -170,6 +192,12 @@ PUBLIC_EXTERN unsigned long AIOUSB_ADC_InternalCal(
                                                    unsigned short returnCalTable[],
                                                    const char *saveFileName );
 
+PUBLIC_EXTERN AIORESULT AIOUSB_ADC_LoadCachedCal(
+                                                 unsigned long DeviceIndex,
+                                                 ADGainCode gainCode,
+                                                 AIOUSB_BOOL hostSide,
+                                                 AIOUSB_BOOL mapped );
+
 PUBLIC_EXTERN AIORET_TYPE  BulkPoll(
                                     unsigned long DeviceIndex,
                                     AIOBuf *
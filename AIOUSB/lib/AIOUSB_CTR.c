@@ -18,10 +18,8 @@ namespace AIOUSB {
 #define RETURN_IF_INVALID_INPUT(d, r, f ) do { \
         if( !d )                                                        \
             return (AIORET_TYPE)-AIOUSB_ERROR_INVALID_INDEX;            \
-        if( ( r = f ) != AIOUSB_SUCCESS ) {                             \
-            AIOUSB_UnLock();                                            \
+        if( ( r = f ) != AIOUSB_SUCCESS )                               \
             return r;                                                   \
-        }                                                               \
     } while (0)
 
 #define JUMP_IF_INVALID_INPUT(d,r,f, g ) do { \
@@ -53,15 +51,11 @@ AIORET_TYPE _check_block_index(AIOUSBDevice *deviceDesc, unsigned long BlockInde
         /* contiguous counter addressing*/
         BlockIndex = CounterIndex / COUNTERS_PER_BLOCK;
         CounterIndex = CounterIndex % COUNTERS_PER_BLOCK;
-        if (BlockIndex >= deviceDesc->Counters) {
-            AIOUSB_UnLock();
+        if (BlockIndex >= deviceDesc->Counters)
             return (AIORET_TYPE)-AIOUSB_ERROR_INVALID_PARAMETER;
-        }
     } else {
-        if ( BlockIndex >= deviceDesc->Counters || CounterIndex >= COUNTERS_PER_BLOCK ) {
-            AIOUSB_UnLock();
+        if ( BlockIndex >= deviceDesc->Counters || CounterIndex >= COUNTERS_PER_BLOCK )
             return (AIORET_TYPE)-AIOUSB_ERROR_INVALID_PARAMETER;
-        }
     }
     return (AIORET_TYPE)AIOUSB_SUCCESS;
 }
@@ -177,7 +171,7 @@ AIORET_TYPE CTR_8254Mode(
         goto out_CTR_8254Mode;
     }
 
-    AIOUSB_UnLock();
+    AIOUSBDeviceLock( deviceDesc );
     controlValue = (( unsigned short )CounterIndex << (6 + 8))  | (0x3u << (4 + 8))  | 
                    (( unsigned short )Mode << (1 + 8))          | ( unsigned short )BlockIndex;
     bytesTransferred = usb->usb_control_transfer(usb,
@@ -189,11 +183,11 @@ AIORET_TYPE CTR_8254Mode(
                                                  0,
                                                  deviceDesc->commTimeout
                                                  );
+    AIOUSBDeviceUnlock( deviceDesc );
     if (bytesTransferred != 0)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254Mode:
-    AIOUSB_UnLock();
     return result;
 }
 
@@ -232,7 +226,7 @@ AIORET_TYPE CTR_8254Load(
         goto out_CTR_8254Load;
     }
 
-    AIOUSB_UnLock();
+    AIOUSBDeviceLock( deviceDesc );
     controlValue = (( unsigned short )CounterIndex << (6 + 8)) | ( unsigned short )BlockIndex;
                 /* | ( 0x3u << ( 4 + 8 ) )*/
                 /* | ( ( unsigned short ) Mode << ( 1 + 8 ) )*/
@@ -245,11 +239,11 @@ AIORET_TYPE CTR_8254Load(
                                                  0, 
                                                  deviceDesc->commTimeout
                                                  );
+    AIOUSBDeviceUnlock( deviceDesc );
     if (bytesTransferred != 0)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254Load:
-    AIOUSB_UnLock();
     return result;
 }
 /*----------------------------------------------------------------------------*/
@@ -279,7 +273,7 @@ AIORET_TYPE CTR_8254ModeLoad(
         goto out_CTR_8254ModeLoad;
     }
 
-    AIOUSB_UnLock();
+    AIOUSBDeviceLock( deviceDesc );
     controlValue    = (( unsigned short )CounterIndex << (6 + 8))    | (0x3u << (4 + 8))  | 
                       (( unsigned short )Mode << (1 + 8))  | ( unsigned short )BlockIndex;
     bytesTransferred = usb->usb_control_transfer( usb,
@@ -291,11 +285,11 @@ AIORET_TYPE CTR_8254ModeLoad(
                                                   0, 
                                                   deviceDesc->commTimeout
                                                   );
+    AIOUSBDeviceUnlock( deviceDesc );
     if (bytesTransferred != 0)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
     
  out_CTR_8254ModeLoad:
-    AIOUSB_UnLock();
     return result;
 }
 /*----------------------------------------------------------------------------*/
@@ -318,7 +312,7 @@ AIORET_TYPE CTR_8254ReadModeLoad(
 
     JUMP_IF_NO_VALID_USB( deviceDesc , retval, _check_valid_input_for_modeload( deviceDesc, BlockIndex, CounterIndex, Mode, LoadValue, pReadValue), usb, out_CTR_8254ReadModeLoad );
 
-    AIOUSB_UnLock();
+    AIOUSBDeviceLock( deviceDesc );
 
     controlValue = (( unsigned short )CounterIndex << (6 + 8)) |  (0x3u << (4 + 8)) | 
                    (( unsigned short )Mode << (1 + 8))         |  ( unsigned short )BlockIndex;
@@ -332,6 +326,7 @@ AIORET_TYPE CTR_8254ReadModeLoad(
                                                   sizeof(readValue), 
                                                   deviceDesc->commTimeout
                                                   );
+    AIOUSBDeviceUnlock( deviceDesc );
     if ( bytesTransferred == sizeof(readValue) ) {
         /* TODO: verify endian mode; original code had it reversed*/
         *pReadValue = readValue;
@@ -339,7 +334,6 @@ AIORET_TYPE CTR_8254ReadModeLoad(
         result = -LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254ReadModeLoad:
-    AIOUSB_UnLock();
     return retval;
 }
 
@@ -361,7 +355,7 @@ AIORET_TYPE CTR_8254Read(
 
     JUMP_IF_NO_VALID_USB( deviceDesc, retval, _check_valid_counter_device( deviceDesc, BlockIndex, CounterIndex ), usb, out_CTR_8254Read );
 
-    AIOUSB_UnLock();
+    AIOUSBDeviceLock( deviceDesc );
 
     controlValue = (( unsigned short )CounterIndex << 8) | ( unsigned short )BlockIndex;
     bytesTransferred = usb->usb_control_transfer(usb,
@@ -373,6 +367,7 @@ AIORET_TYPE CTR_8254Read(
                                                  sizeof(readValue),
                                                  deviceDesc->commTimeout
                                                  );
+    AIOUSBDeviceUnlock( deviceDesc );
     if (bytesTransferred == sizeof(readValue)) {
         /* TODO: verify endian mode; original code had it reversed*/
         *pReadValue = readValue;
@@ -380,7 +375,6 @@ AIORET_TYPE CTR_8254Read(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254Read:
-    AIOUSB_UnLock();
     return result;
 }
 
@@ -399,7 +393,7 @@ AIORET_TYPE CTR_8254ReadAll(
     JUMP_IF_NO_VALID_USB( deviceDesc, retval, _check_valid_counter_device_for_read( deviceDesc, pData ) , usb, out_CTR_8254ReadAll);
 
     READ_BYTES = deviceDesc->Counters * COUNTERS_PER_BLOCK * sizeof(unsigned short);
-    AIOUSB_UnLock();
+    AIOUSBDeviceLock( deviceDesc );
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_READ_FROM_DEVICE, 
                                                  AUR_CTR_READALL,
@@ -409,11 +403,11 @@ AIORET_TYPE CTR_8254ReadAll(
                                                  READ_BYTES, 
                                                  deviceDesc->commTimeout
                                                  );
+    AIOUSBDeviceUnlock( deviceDesc );
     if (bytesTransferred != READ_BYTES)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
     
  out_CTR_8254ReadAll:
-    AIOUSB_UnLock();
     return result;
 }
 /*----------------------------------------------------------------------------*/
@@ -436,7 +430,7 @@ AIORET_TYPE CTR_8254ReadStatus(
 
     JUMP_IF_NO_VALID_USB( deviceDesc, retval, _check_block_index( deviceDesc, BlockIndex, CounterIndex ), usb, out_CTR_8254ReadStatus );  
 
-    AIOUSB_UnLock();
+    AIOUSBDeviceLock( deviceDesc );
 
     controlValue = (( unsigned short )CounterIndex << 8) | ( unsigned short )BlockIndex;
 
@@ -449,6 +443,7 @@ AIORET_TYPE CTR_8254ReadStatus(
                                                  READ_BYTES, 
                                                  deviceDesc->commTimeout
                                                  );
+    AIOUSBDeviceUnlock( deviceDesc );
     if (bytesTransferred == READ_BYTES) {
         *pReadValue = *( unsigned short* )readData;
         *pStatus = readData[ 2 ];
@@ -456,10 +451,72 @@ AIORET_TYPE CTR_8254ReadStatus(
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254ReadStatus:
-    AIOUSB_UnLock();
     return result;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Splits rootClock / *pHz into the two 8254 divisors that come
+ *        closest to *pHz, as CTR_StartOutputFreq programs them
+ * @param rootClock
+ * @param pHz requested frequency, set to the one the divisors give
+ * @param highDivisor load value for counter 1
+ * @param lowDivisor load value for counter 2
+ */
+void CTR_CalculateOutputFreqDivisors( long rootClock, double *pHz, unsigned short *highDivisor, unsigned short *lowDivisor )
+{
+    long frequency = ( long )*pHz;
+    long MIN_DIVISOR = 2;
+    long MAX_DIVISOR = 65535;
+    long bestHighDivisor = MIN_DIVISOR,
+        bestLowDivisor = MIN_DIVISOR,
+        minFreqError = 0;
+    AIOUSB_BOOL minFreqErrorValid = AIOUSB_FALSE;
+    long divisor = ( long )round(( double )rootClock / ( double )frequency);
+#if defined(DEBUG_START_CLOCK)
+    printf(
+        "Calculating divisors (total divisor = %ld)\n"
+        "  %8s  %8s  %8s\n",
+        divisor, "High", "Low", "Error"
+        );
+#endif
+    if (divisor > MIN_DIVISOR * MIN_DIVISOR) {
+        long lowDivisor;
+        for(lowDivisor = ( long )sqrt(divisor); lowDivisor >= MIN_DIVISOR; lowDivisor--) {
+            long highDivisor = divisor / lowDivisor;
+            long freqError = labs(frequency - rootClock / (highDivisor * lowDivisor));
+#if defined(DEBUG_START_CLOCK)
+            printf("  %8ld  %8ld  %8ld\n", highDivisor, lowDivisor, freqError);
+#endif
+            if (highDivisor > MAX_DIVISOR) {
+                /* this divisor would exceed the maximum; use best divisor calculated thus far*/
+                break;
+            } else if (freqError == 0) {
+                /* these divisors have no error; no need to continue searching for divisors*/
+                minFreqErrorValid = AIOUSB_TRUE;
+                minFreqError = freqError;
+                bestHighDivisor = highDivisor;
+                bestLowDivisor = lowDivisor;
+                break;
+            } else if (
+                !minFreqErrorValid ||
+                freqError < minFreqError
+                ) {
+                minFreqErrorValid = AIOUSB_TRUE;
+                minFreqError = freqError;
+                bestHighDivisor = highDivisor;
+                bestLowDivisor = lowDivisor;
+            }
+        }
+    }
+#if defined(DEBUG_START_CLOCK)
+    printf("  %8ld  %8ld  %8ld (final)\n", bestHighDivisor, bestLowDivisor, minFreqError);
+#endif
+    *highDivisor = ( unsigned short )bestHighDivisor;
+    *lowDivisor  = ( unsigned short )bestLowDivisor;
+    *pHz = rootClock / (bestHighDivisor * bestLowDivisor);              /* actual clock speed*/
+}
+
 /*----------------------------------------------------------------------------*/
 AIORET_TYPE CTR_StartOutputFreq(
                                   unsigned long DeviceIndex,
@@ -470,75 +527,31 @@ AIORET_TYPE CTR_StartOutputFreq(
     AIOUSBDevice * deviceDesc =AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
     RETURN_IF_INVALID_INPUT( deviceDesc, result, _check_valid_counter_output_frequency( deviceDesc, BlockIndex, pHz ) );
 
+    /* both counters of the pair are reprogrammed as one transaction */
+    AIOUSBDeviceLock( deviceDesc );
+
     if (*pHz <= 0) {
                                 /* turn off counters */
-          AIOUSB_UnLock();
           result = CTR_8254Mode(DeviceIndex, BlockIndex, 1, 2);
           if (result != AIOUSB_SUCCESS)
-              return result;
+              goto out_CTR_StartOutputFreq;
           result = CTR_8254Mode(DeviceIndex, BlockIndex, 2, 3);
           if (result != AIOUSB_SUCCESS)
-              return result;
+              goto out_CTR_StartOutputFreq;
           *pHz = 0;                                                                   /* actual clock speed*/
       } else {
-           long rootClock = deviceDesc->RootClock;
-          AIOUSB_UnLock();
-           long frequency = ( long )*pHz;
-           long MIN_DIVISOR = 2;
-           long MAX_DIVISOR = 65535;
-          long bestHighDivisor = MIN_DIVISOR,
-               bestLowDivisor = MIN_DIVISOR,
-               minFreqError = 0;
-          AIOUSB_BOOL minFreqErrorValid = AIOUSB_FALSE;
-           long divisor = ( long )round(( double )rootClock / ( double )frequency);
-#if defined(DEBUG_START_CLOCK)
-          printf(
-              "Calculating divisors (total divisor = %ld)\n"
-              "  %8s  %8s  %8s\n",
-              divisor, "High", "Low", "Error"
-              );
-#endif
-          if (divisor > MIN_DIVISOR * MIN_DIVISOR) {
-                long lowDivisor;
-                for(lowDivisor = ( long )sqrt(divisor); lowDivisor >= MIN_DIVISOR; lowDivisor--) {
-                      long highDivisor = divisor / lowDivisor;
-                       long freqError = labs(frequency - rootClock / (highDivisor * lowDivisor));
-#if defined(DEBUG_START_CLOCK)
-                      printf("  %8ld  %8ld  %8ld\n", highDivisor, lowDivisor, freqError);
-#endif
-                      if (highDivisor > MAX_DIVISOR) {
-                          /* this divisor would exceed the maximum; use best divisor calculated thus far*/
-                            break;
-                        } else if (freqError == 0) {
-                          /* these divisors have no error; no need to continue searching for divisors*/
-                            minFreqErrorValid = AIOUSB_TRUE;
-                            minFreqError = freqError;
-                            bestHighDivisor = highDivisor;
-                            bestLowDivisor = lowDivisor;
-                            break;
-                        } else if (
-                          !minFreqErrorValid ||
-                          freqError < minFreqError
-                          ) {
-                            minFreqErrorValid = AIOUSB_TRUE;
-                            minFreqError = freqError;
-                            bestHighDivisor = highDivisor;
-                            bestLowDivisor = lowDivisor;
-                        }
-                  }
-            }
-#if defined(DEBUG_START_CLOCK)
-          printf("  %8ld  %8ld  %8ld (final)\n", bestHighDivisor, bestLowDivisor, minFreqError);
-#endif
-          result = CTR_8254ModeLoad(DeviceIndex, BlockIndex, 1, 2, ( unsigned short )bestHighDivisor);
+          unsigned short highDivisor, lowDivisor;
+          CTR_CalculateOutputFreqDivisors( deviceDesc->RootClock, pHz, &highDivisor, &lowDivisor );
+          result = CTR_8254ModeLoad(DeviceIndex, BlockIndex, 1, 2, highDivisor);
           if (result != AIOUSB_SUCCESS)
-              return result;
-          result = CTR_8254ModeLoad(DeviceIndex, BlockIndex, 2, 3, ( unsigned short )bestLowDivisor);
+              goto out_CTR_StartOutputFreq;
+          result = CTR_8254ModeLoad(DeviceIndex, BlockIndex, 2, 3, lowDivisor);
           if (result != AIOUSB_SUCCESS)
-              return result;
-          *pHz = rootClock / (bestHighDivisor * bestLowDivisor);              /* actual clock speed*/
+              goto out_CTR_StartOutputFreq;
       }
 
+ out_CTR_StartOutputFreq:
+    AIOUSBDeviceUnlock( deviceDesc );
     return result;
 }
 /*----------------------------------------------------------------------------*/
@@ -555,7 +568,7 @@ AIORET_TYPE CTR_8254SelectGate(
     JUMP_IF_NO_VALID_USB( deviceDesc, result, _check_valid_counter_device_for_gate(deviceDesc, GateIndex ), usb, out_CTR_8254SelectGate );
 
     
-    AIOUSB_UnLock();
+    AIOUSBDeviceLock( deviceDesc );
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_WRITE_TO_DEVICE, 
                                                  AUR_CTR_SELGATE,
@@ -565,11 +578,11 @@ AIORET_TYPE CTR_8254SelectGate(
                                                  0, 
                                                  deviceDesc->commTimeout
                                                  );
+    AIOUSBDeviceUnlock( deviceDesc );
     if (bytesTransferred != 0)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CTR_8254SelectGate:
-    AIOUSB_UnLock();
     return result;
 }
 
@@ -580,7 +593,6 @@ AIORET_TYPE CTR_8254ReadLatched(
                                 ) 
 {
     AIORESULT result = AIOUSB_SUCCESS;
-    AIORET_TYPE retval = AIOUSB_SUCCESS;
     AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
     USBDevice *usb;
     int READ_BYTES;
@@ -590,7 +602,7 @@ AIORET_TYPE CTR_8254ReadLatched(
     
     READ_BYTES = deviceDesc->Counters * COUNTERS_PER_BLOCK * sizeof(unsigned short) + 1 ;/* for "old data" flag */
     
-    AIOUSB_UnLock();
+    AIOUSBDeviceLock( deviceDesc );
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_READ_FROM_DEVICE, 
                                                  AUR_CTR_READLATCHED,
@@ -600,12 +612,12 @@ AIORET_TYPE CTR_8254ReadLatched(
                                                  READ_BYTES, 
                                                  deviceDesc->commTimeout
                                                  );
+    AIOUSBDeviceUnlock( deviceDesc );
     if (bytesTransferred != READ_BYTES)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
     
  out_CTR_8254ReadLatched:
-    AIOUSB_UnLock();
-    return retval;
+    return result;
 }
 
 
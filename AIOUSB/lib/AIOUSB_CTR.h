@@ -59,6 +59,10 @@ PUBLIC_EXTERN AIORET_TYPE CTR_8254ReadStatus( unsigned long DeviceIndex,
 PUBLIC_EXTERN AIORET_TYPE CTR_StartOutputFreq( unsigned long DeviceIndex,
                                                unsigned long BlockIndex,
                                                double *pHz );
+PUBLIC_EXTERN void CTR_CalculateOutputFreqDivisors( long rootClock,
+                                                    double *pHz,
+                                                    unsigned short *highDivisor,
+                                                    unsigned short *lowDivisor );
 #endif
 
 PUBLIC_EXTERN AIORET_TYPE CTR_8254SelectGate( unsigned long DeviceIndex,
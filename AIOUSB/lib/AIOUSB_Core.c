@@ -9,6 +9,7 @@
 #include "ADCConfigBlock.h"
 #include "AIOUSB_Core.h"
 #include "AIODeviceTable.h"
+#include "AIOCalCache.h"
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
@@ -193,6 +194,11 @@ static const char VERSION_DATE[] = "$Format: %ad$";
  *   foreground thread monitors the progress. In such a case, the background thread might update
  *   a status variable which the foreground thread monitors. This form of resource sharing is
  *   supported by our mutual exclusion scheme.
+ *
+ * - deviceTable[] lookups take a shared table lock ( AIODeviceTableLockRead ), which is only
+ *   taken exclusively while devices are added or the table is reset. Each board also has its
+ *   own recursive lock ( AIOUSBDeviceLock ), held for the length of one transaction with it.
+ *   AIOUSB_Lock() / AIOUSB_UnLock() remain for existing callers; the library no longer uses them.
  */
 
 AIOUSB_BOOL AIOUSB_Lock() {
@@ -219,6 +225,7 @@ unsigned long AIOUSB_Validate_Lock(unsigned long *DeviceIndex)
     unsigned long result = (unsigned long)AIOUSB_SUCCESS;
     assert(DeviceIndex != 0);
 
+    AIODeviceTableLockRead();
     if(*DeviceIndex == diFirst) {
         /*
          * find first device on bus
@@ -267,6 +274,7 @@ unsigned long AIOUSB_Validate_Lock(unsigned long *DeviceIndex)
         else
             result = AIOUSB_ERROR_INVALID_INDEX;
     }
+    AIODeviceTableUnlock();
 
     return result;
 }
@@ -275,6 +283,7 @@ unsigned long AIOUSB_Validate(unsigned long *DeviceIndex)
 {
     unsigned long result = AIOUSB_ERROR_INVALID_INDEX;
 
+    AIODeviceTableLockRead();
     if(*DeviceIndex == diFirst) {
       /*
        * find first device on bus
@@ -324,6 +333,7 @@ unsigned long AIOUSB_Validate(unsigned long *DeviceIndex)
       else
         result = AIOUSB_ERROR_INVALID_INDEX;
     }
+    AIODeviceTableUnlock();
     
     return result;
 }
@@ -517,6 +527,7 @@ unsigned long AIOUSB_SetStreamingBlockSize(
           if ((BlockSize & 0x1FF) != 0)
                BlockSize = (BlockSize & 0xFFFFFE00ul) + 0x200;
           deviceDesc->StreamingBlockSize = BlockSize;
+          deviceDesc->BulkTransferPreference = AIO_TRANSFERS_FIXED;
      } else if(deviceDesc->bDIOStream) {
           if((BlockSize & 0xFF) != 0)
                BlockSize = (BlockSize & 0xFFFFFF00ul) + 0x100;
@@ -527,6 +538,34 @@ unsigned long AIOUSB_SetStreamingBlockSize(
      return result;
 }
 
+/**
+ * @brief How ADC_BulkAcquire sizes its reads: AIO_TRANSFERS_FIXED reads
+ * StreamingBlockSize at a time, the others size reads from the clock,
+ * channels and oversamples and follow the rate they complete at.
+ * AIOUSB_SetStreamingBlockSize pins the preference to AIO_TRANSFERS_FIXED.
+ * @param latency_ms how long one read should take to fill, 0 for the
+ *        preference's own budget
+ */
+unsigned long AIOUSB_SetBulkTransferPreference( unsigned long DeviceIndex,
+                                                AIOTransferPreference preference,
+                                                unsigned latency_ms
+                                                )
+{
+     unsigned long result = AIOUSB_Validate(&DeviceIndex);
+     if(result != AIOUSB_SUCCESS)
+          return result;
+     if ( !VALID_ENUM( AIOTransferPreference, preference ) )
+          return AIOUSB_ERROR_INVALID_PARAMETER;
+
+     DeviceDescriptor * deviceDesc = &deviceTable[ DeviceIndex ];
+     if ( !deviceDesc->bADCStream )
+          return AIOUSB_ERROR_NOT_SUPPORTED;
+
+     deviceDesc->BulkTransferPreference = preference;
+     deviceDesc->BulkTransferLatency = latency_ms;
+     return result;
+}
+
 unsigned long AIOUSB_ClearFIFO(
                                unsigned long DeviceIndex,
                                FIFO_Method Method
@@ -839,6 +878,12 @@ unsigned long AIOUSB_ADC_SetCalTable(
     if ( result != AIOUSB_SUCCESS )
         return result;    
 
+    /* SRAM already holds this table, nothing to send */
+    uint64_t hash = AIOCalCacheHash( calTable );
+    if ( deviceDesc->sramCalValid && deviceDesc->sramCalHash == hash )
+        return AIOUSB_SUCCESS;
+    deviceDesc->sramCalValid = AIOUSB_FALSE;
+
     unsigned short wValue, wIndex, wLength;
     unsigned char bRequest;
     unsigned char data[1024];
@@ -898,6 +943,77 @@ unsigned long AIOUSB_ADC_SetCalTable(
         wordsRemaining -= num_to_write;
         sramAddress += num_to_write;
     }
+    if ( result == AIOUSB_SUCCESS ) {
+        deviceDesc->sramCalHash  = hash;
+        deviceDesc->sramCalValid = AIOUSB_TRUE;
+    }
+
+    return result;
+}
+
+/*------------------------------------------------------------------------*/
+/**
+ * @brief Keeps a calibration table on the host instead of uploading it to
+ * SRAM. Continuous acquisitions started afterwards look every count of a
+ * channel in gainCode's range up in the table before averaging and
+ * converting it to volts.
+ * @param DeviceIndex
+ * @param gainCode range the table applies to
+ * @param calTable CAL_TABLE_WORDS words, or NULL to stop correcting this range
+ * @return
+ */
+AIORESULT AIOUSB_ADC_SetHostCalTable(
+                                     unsigned long DeviceIndex,
+                                     ADGainCode gainCode,
+                                     const unsigned short calTable[]
+                                     )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    unsigned short *table = NULL;
+    AIOUSBDevice *deviceDesc = AIODeviceTableGetDeviceAtIndex( DeviceIndex, &result );
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+    if ( (unsigned)gainCode >= AD_NUM_GAIN_CODES )
+        return AIOUSB_ERROR_INVALID_PARAMETER;
+
+    if ( calTable ) {
+        table = (unsigned short *)malloc( CAL_TABLE_WORDS * sizeof(unsigned short) );
+        if ( !table )
+            return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        memcpy( table, calTable, CAL_TABLE_WORDS * sizeof(unsigned short) );
+    }
+
+    AIOUSBDeviceLock( deviceDesc );
+    free( deviceDesc->hostCalTables[gainCode] );
+    deviceDesc->hostCalTables[gainCode] = table;
+    AIOUSBDeviceUnlock( deviceDesc );
+
+    return result;
+}
+
+/*------------------------------------------------------------------------*/
+/**
+ * @brief AIOUSB_ADC_SetHostCalTable for a straight line correction,
+ * corrected = gain * counts + offset, rounded and clamped to 16 bits
+ */
+AIORESULT AIOUSB_ADC_SetHostCalLinear(
+                                      unsigned long DeviceIndex,
+                                      ADGainCode gainCode,
+                                      double gain,
+                                      double offset
+                                      )
+{
+    AIORESULT result;
+    unsigned short *const calTable = ( unsigned short* )malloc(CAL_TABLE_WORDS * sizeof(unsigned short));
+    if ( !calTable )
+        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    for ( int count = 0; count < CAL_TABLE_WORDS; count ++ ) {
+        double value = gain * count + offset + 0.5;
+        calTable[count] = ( value <= 0 ? 0 : value >= 65535 ? 65535 : ( unsigned short )value );
+    }
+    result = AIOUSB_ADC_SetHostCalTable( DeviceIndex, gainCode, calTable );
+    free( calTable );
 
     return result;
 }
@@ -114,6 +114,13 @@ PUBLIC_EXTERN unsigned long AIOUSB_ADC_LoadCalTable(unsigned long DeviceIndex,
 
 PUBLIC_EXTERN unsigned long AIOUSB_ADC_SetCalTable(unsigned long DeviceIndex,
                                                    const unsigned short calTable[] );
+PUBLIC_EXTERN AIORESULT AIOUSB_ADC_SetHostCalTable(unsigned long DeviceIndex,
+                                                   ADGainCode gainCode,
+                                                   const unsigned short calTable[] );
+PUBLIC_EXTERN AIORESULT AIOUSB_ADC_SetHostCalLinear(unsigned long DeviceIndex,
+                                                    ADGainCode gainCode,
+                                                    double gain,
+                                                    double offset );
 PUBLIC_EXTERN unsigned long AIOUSB_ClearFIFO(unsigned long DeviceIndex,
                                              FIFO_Method Method
                                              );
@@ -70,7 +70,7 @@ unsigned long CustomEEPROMWrite(
 
     EXIT_FN_IF_NO_VALID_USB( deviceDesc , retval, _check_eeprom_data((AIORET_TYPE)result,DeviceIndex,StartAddress,DataSize,Data ), usb, out_CustomEEPROMWrite );
 
-    AIOUSB_UnLock();
+    AIOUSBDeviceLock( deviceDesc );
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_WRITE_TO_DEVICE, 
                                                  AUR_EEPROM_WRITE,
@@ -80,11 +80,11 @@ unsigned long CustomEEPROMWrite(
                                                  DataSize, 
                                                  deviceDesc->commTimeout
                                                  );
+    AIOUSBDeviceUnlock( deviceDesc );
     if(bytesTransferred != ( int )DataSize)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CustomEEPROMWrite:
-    AIOUSB_UnLock();
     return result;
 }
 
@@ -113,7 +113,7 @@ unsigned long CustomEEPROMRead(
 
     EXIT_FN_IF_NO_VALID_USB( deviceDesc , retval, _check_eeprom_data((AIORET_TYPE)result,DeviceIndex,StartAddress,*DataSize,Data ) , usb, out_CustomEEPROMRead );
 
-    AIOUSB_UnLock();
+    AIOUSBDeviceLock( deviceDesc );
     bytesTransferred  = usb->usb_control_transfer(usb,
                                                   USB_READ_FROM_DEVICE, 
                                                   AUR_EEPROM_READ,
@@ -123,11 +123,11 @@ unsigned long CustomEEPROMRead(
                                                   *DataSize, 
                                                   deviceDesc->commTimeout
                                                   );
+    AIOUSBDeviceUnlock( deviceDesc );
     if(bytesTransferred != ( int )*DataSize)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_CustomEEPROMRead:
-    AIOUSB_UnLock();
     return result;
 }
 
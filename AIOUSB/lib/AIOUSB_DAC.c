@@ -170,7 +170,7 @@ unsigned long DACMultiDirect( unsigned long DeviceIndex,
     int CONFIG_BLOCK_BYTES = 1 /* mask */ + DACS_PER_BLOCK * sizeof(unsigned short) /* 16-bit counts */;
     int numConfigBlocks = (highestChannel / DACS_PER_BLOCK) + 1;
     int configBytes = CONFIG_BLOCK_BYTES * numConfigBlocks;
-    unsigned char *configBuffer = ( unsigned char* )malloc(configBytes);
+    unsigned char *configBuffer = ( unsigned char* )AIOUSBDeviceGetBuffer( deviceDesc, configBytes );
 
     /* assert(configBuffer != 0); */
     if (!configBuffer ) {
@@ -204,7 +204,7 @@ unsigned long DACMultiDirect( unsigned long DeviceIndex,
         if (bytesTransferred != configBytes)
             result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
         
-        free(configBuffer);
+        AIOUSBDeviceReleaseBuffer( deviceDesc, configBuffer );
     }
 
     return result;
@@ -10,6 +10,8 @@
 #include "AIODeviceTable.h"
 #include "AIOUSB_Core.h"
 #include "USBDevice.h"
+#include "AIOStats.h"
+#include "AIOUSB_Log.h"
 
 #ifdef __cplusplus
 namespace AIOUSB {
@@ -92,6 +94,150 @@ USBDevice *_check_dio_get_device_handle( unsigned long DeviceIndex,
     return AIODeviceTableGetUSBDeviceAtIndex( DeviceIndex , result );
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sends the staged outputs as one write, if any are unsent. Called
+ * with the device lock held and a batch open
+ */
+static AIORESULT _dio_flush_batch( AIOUSBDevice *device, USBDevice *deviceHandle )
+{
+    if ( !device->bDIOBatchDirty )
+        return AIOUSB_SUCCESS;
+
+    memcpy( device->LastDIOData, device->PendingDIOData, device->DIOBytes );
+    int bytesTransferred = deviceHandle->usb_control_transfer(deviceHandle,
+                                                              USB_WRITE_TO_DEVICE,
+                                                              AUR_DIO_WRITE,
+                                                              0,
+                                                              0,
+                                                              device->PendingDIOData,
+                                                              device->DIOBytes,
+                                                              device->commTimeout
+                                                              );
+    device->bDIOBatchDirty = AIOUSB_FALSE;
+    if ( bytesTransferred != (signed)device->DIOBytes )
+        return LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Whether another thread's batch is open. Called with the device
+ * lock held
+ */
+static AIOUSB_BOOL _dio_foreign_batch( AIOUSBDevice *device )
+{
+    return ( device->PendingDIOData && !pthread_equal( device->DIOBatchOwner, pthread_self() ) ? AIOUSB_TRUE : AIOUSB_FALSE );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Sends the open batch once its oldest unsent write reaches the
+ * flush deadline, so an overdue batch goes out even when its owner stages
+ * nothing more. Runs until the batch it was started for closes.
+ */
+static void *_dio_flush_thread( void *object )
+{
+    AIOUSBDevice *device = (AIOUSBDevice *)object;
+
+    AIOUSBDeviceLock( device );
+    while ( device->bDIOFlushThread && pthread_equal( device->DIOFlushThread, pthread_self() ) ) {
+        unsigned long long due = device->DIOBatchStart + device->DIOFlushMs * 1000000ULL;
+        if ( !device->bDIOBatchDirty || !device->DIOFlushMs ) {
+            pthread_cond_wait( &device->DIOFlushCond, &device->lock );
+        } else if ( AIOStatsNow() >= due ) {
+            USBDevice *deviceHandle = AIOUSBDeviceGetUSBHandle( device );
+            AIORESULT result = AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
+            if ( deviceHandle )
+                result = _dio_flush_batch( device, deviceHandle );
+            device->bDIOBatchDirty = AIOUSB_FALSE;
+            if ( device->DIOFlushResult == AIOUSB_SUCCESS )
+                device->DIOFlushResult = result;
+        } else {
+            struct timespec deadline = { (time_t)( due / 1000000000ULL ), (long)( due % 1000000000ULL ) };
+            pthread_cond_timedwait( &device->DIOFlushCond, &device->lock, &deadline );
+        }
+    }
+    AIOUSBDeviceUnlock( device );
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Wakes the flush thread after the batch or the deadline changed,
+ * starting it the first time there is something to send. Called with the
+ * device lock held
+ */
+static void _dio_wake_flush( AIOUSBDevice *device )
+{
+    if ( device->PendingDIOData && device->bDIOBatchDirty && device->DIOFlushMs && !device->bDIOFlushThread ) {
+        if ( pthread_create( &device->DIOFlushThread, NULL, _dio_flush_thread, device ) == 0 )
+            device->bDIOFlushThread = AIOUSB_TRUE;
+        else
+            AIOUSB_ERROR("Unable to start the DIO flush thread, overdue writes wait for the next write\n");
+    }
+    pthread_cond_broadcast( &device->DIOFlushCond );
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Drops the open batch and lets its flush thread finish. Called with
+ * the device lock held; once the lock is let go the caller joins *flush
+ * @return AIOUSB_TRUE if there is a flush thread to join
+ */
+static AIOUSB_BOOL _dio_drop_batch( AIOUSBDevice *device, pthread_t *flush )
+{
+    AIOUSB_BOOL join = device->bDIOFlushThread;
+
+    free( device->PendingDIOData );
+    device->PendingDIOData  = NULL;
+    device->DIOBatchDepth   = 0;
+    device->bDIOBatchDirty  = AIOUSB_FALSE;
+    device->bDIOFlushThread = AIOUSB_FALSE;
+    *flush = device->DIOFlushThread;
+    pthread_cond_broadcast( &device->DIOFlushCond );
+
+    return join;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Notes a write staged in PendingDIOData, sending the batch if its
+ * oldest unsent write has waited past the flush deadline and otherwise
+ * leaving that to the flush thread. Called with the device lock held and
+ * a batch open
+ */
+static AIORESULT _dio_stage( AIOUSBDevice *device, USBDevice *deviceHandle )
+{
+    unsigned long long now = AIOStatsNow();
+    if ( !device->bDIOBatchDirty ) {
+        device->bDIOBatchDirty = AIOUSB_TRUE;
+        device->DIOBatchStart  = now;
+    }
+    if ( device->DIOFlushMs && now - device->DIOBatchStart >= device->DIOFlushMs * 1000000ULL )
+        return _dio_flush_batch( device, deviceHandle );
+    _dio_wake_flush( device );
+    return AIOUSB_SUCCESS;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Drops whatever batch is open on device, whichever thread opened
+ * it, for when the device goes away
+ */
+void DIO_CloseBatch( AIOUSBDevice *device )
+{
+    pthread_t flush;
+    AIOUSB_BOOL join;
+
+    AIOUSBDeviceLock( device );
+    join = _dio_drop_batch( device, &flush );
+    AIOUSBDeviceUnlock( device );
+    if ( join )
+        pthread_join( flush, NULL );
+}
+
 /*----------------------------------------------------------------------------*/
 AIORESULT DIO_Configure(
                         unsigned long DeviceIndex,
@@ -113,7 +259,6 @@ AIORESULT DIO_Configure(
     if ( device->LastDIOData == 0 )
         return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
 
-    memcpy(device->LastDIOData, DIOBufToBinary(buf), DIOBufByteSize( buf ) );
     bufferSize = device->DIOBytes + MASK_BYTES_SIZE(device);
     configBuffer = ( char* )malloc( bufferSize );
     if ( !configBuffer ) {
@@ -134,6 +279,8 @@ AIORESULT DIO_Configure(
         dest += 1;
     }
 
+    AIOUSBDeviceLock( device );
+    memcpy(device->LastDIOData, DIOBufToBinary(buf), DIOBufByteSize( buf ) );
     bytesTransferred = deviceHandle->usb_control_transfer(deviceHandle,
                                                           USB_WRITE_TO_DEVICE,
                                                           AUR_DIO_CONFIG,
@@ -143,6 +290,7 @@ AIORESULT DIO_Configure(
                                                           bufferSize,
                                                           device->commTimeout 
                                                           );
+    AIOUSBDeviceUnlock( device );
 
 
     if (bytesTransferred != bufferSize )
@@ -169,8 +317,6 @@ AIORESULT DIO_ConfigureRaw(
     if ( device->LastDIOData != 0 ) 
         return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
 
-    memcpy(device->LastDIOData, pData, device->DIOBytes);
-
     USBDevice *deviceHandle = _check_dio_get_device_handle( DeviceIndex, &device, &result );
 
     if ( !deviceHandle ) {
@@ -191,6 +337,8 @@ AIORESULT DIO_ConfigureRaw(
     dest += MASK_BYTES_SIZE( device );
     memset(dest, 0, MASK_BYTES_SIZE( device ) );
     
+    AIOUSBDeviceLock( device );
+    memcpy(device->LastDIOData, pData, device->DIOBytes);
     int bytesTransferred = deviceHandle->usb_control_transfer(deviceHandle,
                                                               USB_WRITE_TO_DEVICE,
                                                               AUR_DIO_CONFIG,
@@ -200,6 +348,7 @@ AIORESULT DIO_ConfigureRaw(
                                                               bufferSize,
                                                               device->commTimeout 
                                                               );
+    AIOUSBDeviceUnlock( device );
 
     if(bytesTransferred != bufferSize)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
@@ -226,8 +375,6 @@ AIORESULT DIO_ConfigureEx(
         return AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
     }
 
-    memcpy(device->LastDIOData, pData, device->DIOBytes);
-
     int bufferSize = device->DIOBytes + MASK_BYTES_SIZE( device) + TRISTATE_BYTES_SIZE(device);
     unsigned char *configBuffer = ( unsigned char* )malloc(bufferSize);
 
@@ -241,6 +388,8 @@ AIORESULT DIO_ConfigureEx(
     dest += MASK_BYTES_SIZE( device );
     memcpy(dest, pTristateMask, TRISTATE_BYTES_SIZE( device ) );
 
+    AIOUSBDeviceLock( device );
+    memcpy(device->LastDIOData, pData, device->DIOBytes);
     int bytesTransferred = deviceHandle->usb_control_transfer(deviceHandle,
                                                               USB_WRITE_TO_DEVICE,
                                                               AUR_DIO_CONFIG,
@@ -250,6 +399,7 @@ AIORESULT DIO_ConfigureEx(
                                                               bufferSize,
                                                               device->commTimeout
                                                               );
+    AIOUSBDeviceUnlock( device );
 
     if(bytesTransferred != bufferSize)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
@@ -281,6 +431,7 @@ AIORESULT DIO_ConfigurationQuery(
     if ( !configBuffer ) 
         return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
 
+    AIOUSBDeviceLock( device );
     int bytesTransferred = deviceHandle->usb_control_transfer(deviceHandle,
                                                               USB_READ_FROM_DEVICE,
                                                               AUR_DIO_CONFIG_QUERY,
@@ -290,6 +441,7 @@ AIORESULT DIO_ConfigurationQuery(
                                                               bufferSize,
                                                               device->commTimeout
                                                               );
+    AIOUSBDeviceUnlock( device );
 
 
     if ( bytesTransferred == bufferSize ) {
@@ -325,6 +477,17 @@ AIORESULT DIO_WriteAll(
 
     char foo[10] = {};
     memcpy(foo, pData, device->DIOBytes);
+    AIOUSBDeviceLock( device );
+    if ( _dio_foreign_batch( device ) ) {
+        AIOUSBDeviceUnlock( device );
+        return AIOUSB_ERROR_INVALID_THREAD;
+    }
+    if ( device->PendingDIOData ) {
+        memcpy( device->PendingDIOData, pData, device->DIOBytes );
+        result = _dio_stage( device, deviceHandle );
+        AIOUSBDeviceUnlock( device );
+        return result;
+    }
     memcpy(device->LastDIOData, pData, device->DIOBytes);
 
     int bytesTransferred = deviceHandle->usb_control_transfer(deviceHandle,
@@ -336,6 +499,7 @@ AIORESULT DIO_WriteAll(
                                                               device->DIOBytes,
                                                               device->commTimeout
                                                               );
+    AIOUSBDeviceUnlock( device );
 
 
     if(bytesTransferred != (signed)device->DIOBytes )
@@ -364,11 +528,24 @@ AIORESULT DIO_Write8(
     int dioBytes = device->DIOBytes;
 
 
-    unsigned char * dataBuffer = ( unsigned char* )malloc(dioBytes);
+    AIOUSBDeviceLock( device );
+    if ( _dio_foreign_batch( device ) ) {
+        AIOUSBDeviceUnlock( device );
+        return AIOUSB_ERROR_INVALID_THREAD;
+    }
+    if ( device->PendingDIOData ) {
+        device->PendingDIOData[ ByteIndex ] = Data;
+        result = _dio_stage( device, deviceHandle );
+        AIOUSBDeviceUnlock( device );
+        return result;
+    }
 
+    unsigned char * dataBuffer = ( unsigned char* )malloc(dioBytes);
 
-    if (!dataBuffer )
+    if (!dataBuffer ) {
+        AIOUSBDeviceUnlock( device );
         return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    }
 
     device->LastDIOData[ ByteIndex ] = Data;
     memcpy(dataBuffer, device->LastDIOData, dioBytes);
@@ -382,6 +559,7 @@ AIORESULT DIO_Write8(
                                                               dioBytes,
                                                               device->commTimeout
                                                               );
+    AIOUSBDeviceUnlock( device );
     if(bytesTransferred != dioBytes)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
     free(dataBuffer);
@@ -411,7 +589,9 @@ AIORESULT DIO_Write1(
         result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
     }
         
-    unsigned char value = device->LastDIOData[ byteIndex ];
+    /* Held across the read-modify-write so concurrent bit writes are not lost */
+    AIOUSBDeviceLock( device );
+    unsigned char value = ( device->PendingDIOData ? device->PendingDIOData : device->LastDIOData )[ byteIndex ];
     unsigned char bitMask = 1 << (BitIndex % BITS_PER_BYTE);
     if(bData == AIOUSB_FALSE)
         value &= ~bitMask;
@@ -419,10 +599,155 @@ AIORESULT DIO_Write1(
         value |= bitMask;
     
     result = DIO_Write8(DeviceIndex, byteIndex, value);
+    AIOUSBDeviceUnlock( device );
     
     return result;
 }
 
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Opens a write batch. Until the matching DIO_CommitWrite,
+ * DIO_WriteAll, DIO_Write8 and DIO_Write1 only stage their outputs, and
+ * the commit sends them all in one write. Batches nest; the outermost
+ * commit sends. The batch belongs to the calling thread: until it closes,
+ * batch calls and DIO writes from other threads fail with
+ * AIOUSB_ERROR_INVALID_THREAD rather than being sent under it or folded
+ * into it.
+ * @param DeviceIndex
+ * @return AIOUSB_SUCCESS if successful
+ */
+AIORESULT DIO_BeginWrite( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dio( DeviceIndex, &result );
+
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+    if ( !device->LastDIOData )
+        return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+
+    AIOUSBDeviceLock( device );
+    if ( _dio_foreign_batch( device ) ) {
+        AIOUSBDeviceUnlock( device );
+        return AIOUSB_ERROR_INVALID_THREAD;
+    }
+    if ( !device->PendingDIOData ) {
+        device->PendingDIOData = ( unsigned char* )malloc( device->DIOBytes );
+        if ( !device->PendingDIOData ) {
+            AIOUSBDeviceUnlock( device );
+            return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+        }
+        memcpy( device->PendingDIOData, device->LastDIOData, device->DIOBytes );
+        device->bDIOBatchDirty = AIOUSB_FALSE;
+        device->DIOBatchOwner  = pthread_self();
+        device->DIOFlushResult = AIOUSB_SUCCESS;
+    }
+    device->DIOBatchDepth ++;
+    AIOUSBDeviceUnlock( device );
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Closes the innermost write batch. Closing the outermost one sends
+ * everything staged since the last write as a single DIO_WriteAll
+ * @param DeviceIndex
+ * @return AIOUSB_SUCCESS if successful, otherwise the first error sending
+ * the batch, including sends the flush deadline made
+ */
+AIORESULT DIO_CommitWrite( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = NULL;
+    USBDevice *deviceHandle = _check_dio_get_device_handle( DeviceIndex, &device, &result );
+    pthread_t flush;
+    AIOUSB_BOOL join = AIOUSB_FALSE;
+
+    if ( !device )
+        return result;
+
+    AIOUSBDeviceLock( device );
+    if ( !device->PendingDIOData ) {
+        AIOUSBDeviceUnlock( device );
+        return AIOUSB_ERROR_INVALID_DEVICE_SETTING;
+    }
+    if ( _dio_foreign_batch( device ) ) {
+        AIOUSBDeviceUnlock( device );
+        return AIOUSB_ERROR_INVALID_THREAD;
+    }
+    if ( -- device->DIOBatchDepth == 0 ) {
+        if ( deviceHandle )
+            result = _dio_flush_batch( device, deviceHandle );
+        else if ( device->bDIOBatchDirty )
+            result = AIOUSB_ERROR_DEVICE_NOT_CONNECTED;
+        if ( result == AIOUSB_SUCCESS )
+            result = device->DIOFlushResult;
+        join = _dio_drop_batch( device, &flush );
+    }
+    AIOUSBDeviceUnlock( device );
+    if ( join )
+        pthread_join( flush, NULL );
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Closes every open write batch, dropping the writes not yet sent
+ * @param DeviceIndex
+ * @return AIOUSB_SUCCESS if successful
+ */
+AIORESULT DIO_AbortWrite( unsigned long DeviceIndex )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dio( DeviceIndex, &result );
+    pthread_t flush;
+    AIOUSB_BOOL join = AIOUSB_FALSE;
+
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+
+    AIOUSBDeviceLock( device );
+    if ( !device->PendingDIOData ) {
+        result = AIOUSB_ERROR_INVALID_DEVICE_SETTING;
+    } else if ( _dio_foreign_batch( device ) ) {
+        result = AIOUSB_ERROR_INVALID_THREAD;
+    } else {
+        join = _dio_drop_batch( device, &flush );
+    }
+    AIOUSBDeviceUnlock( device );
+    if ( join )
+        pthread_join( flush, NULL );
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Bounds how long a staged write waits inside an open batch: once
+ * the oldest unsent write is Milliseconds old, the batch is sent without
+ * closing it, from a flush thread if nothing else is staged by then
+ * @param DeviceIndex
+ * @param Milliseconds 0 sends only at commit
+ * @return AIOUSB_SUCCESS if successful
+ */
+AIORESULT DIO_SetWriteDeadline( unsigned long DeviceIndex, unsigned long Milliseconds )
+{
+    AIORESULT result = AIOUSB_SUCCESS;
+    AIOUSBDevice *device = _check_dio( DeviceIndex, &result );
+
+    if ( result != AIOUSB_SUCCESS )
+        return result;
+
+    AIOUSBDeviceLock( device );
+    device->DIOFlushMs = Milliseconds;
+    _dio_wake_flush( device );
+    AIOUSBDeviceUnlock( device );
+
+    return result;
+}
+
 /*----------------------------------------------------------------------------*/
 AIORESULT DIO_ReadAll(
                       unsigned long DeviceIndex,
@@ -435,40 +760,36 @@ AIORESULT DIO_ReadAll(
     AIORESULT result = AIOUSB_SUCCESS;
     AIOUSBDevice *device = NULL;
     int bytesTransferred;
-    char *tmpbuf;
+    unsigned char *tmpbuf;
 
     USBDevice *deviceHandle = _check_dio_get_device_handle( DeviceIndex, &device,  &result );
     if ( !deviceHandle )
         return AIOUSB_ERROR_DEVICE_NOT_FOUND;
-  
-    tmpbuf = (char*)malloc( sizeof(char)*device->DIOBytes );
 
+    /* Read into scratch so a failed or short read leaves buf as it was */
+    tmpbuf = (unsigned char *)AIOUSBDeviceGetBuffer( device, device->DIOBytes );
     if ( !tmpbuf )
         return AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
-    
+
+    AIOUSBDeviceLock( device );
     bytesTransferred = deviceHandle->usb_control_transfer(deviceHandle,
                                                           USB_READ_FROM_DEVICE, 
                                                           AUR_DIO_READ,
                                                           0, 
                                                           0, 
-                                                          (unsigned char *)tmpbuf,
+                                                          tmpbuf,
                                                           device->DIOBytes,
                                                           device->commTimeout
                                                           );
+    AIOUSBDeviceUnlock( device );
 
-    if( bytesTransferred < 0 || bytesTransferred != (int)device->DIOBytes ) {
+    if( bytesTransferred < 0 || bytesTransferred != (int)device->DIOBytes )
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
-        goto cleanup_DIO_ReadAll;
-    }
-
-    if ( DIOBufResize( buf, device->DIOBytes ) == NULL ) {
+    else if ( DIOBufResize( buf, device->DIOBytes*BITS_PER_BYTE ) == NULL )
         result = AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
-        goto cleanup_DIO_ReadAll;
-    }
-    
-    DIOBufReplaceString( buf, tmpbuf, device->DIOBytes ); /* Copy to the DIOBuf */
-    cleanup_DIO_ReadAll:
-    free(tmpbuf);
+    else
+        memcpy( DIOBufBytes( buf ), tmpbuf, device->DIOBytes ); /* The board sends the bits packed the way the DIOBuf keeps them */
+    AIOUSBDeviceReleaseBuffer( device, tmpbuf );
 
     return result;
 }
@@ -488,6 +809,7 @@ AIORESULT DIO_ReadAllToCharStr(
     }
     int bytes_to_transfer = MIN( size, device->DIOBytes );
 
+    AIOUSBDeviceLock( device );
     int bytesTransferred = deviceHandle->usb_control_transfer(deviceHandle,
                                                               USB_READ_FROM_DEVICE, 
                                                               AUR_DIO_READ,
@@ -497,6 +819,7 @@ AIORESULT DIO_ReadAllToCharStr(
                                                               bytes_to_transfer,
                                                               device->commTimeout
                                                               );
+    AIOUSBDeviceUnlock( device );
     if( bytesTransferred < 0 || bytesTransferred != (int)device->DIOBytes )
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
     
@@ -663,6 +986,7 @@ AIORESULT DIO_StreamSetClocks(
 
     *( unsigned short* )&configBlock[ 1 ] = OctaveDacFromFreq(WriteClockHz);
     *( unsigned short* )&configBlock[ 3 ] = OctaveDacFromFreq(ReadClockHz);
+    AIOUSBDeviceLock( device );
     bytesTransferred = usb->usb_control_transfer(usb,
                                                  USB_WRITE_TO_DEVICE, 
                                                  AUR_DIO_SETCLOCKS,
@@ -672,11 +996,11 @@ AIORESULT DIO_StreamSetClocks(
                                                  CONFIG_BLOCK_SIZE, 
                                                  device->commTimeout
                                                  );
+    AIOUSBDeviceUnlock( device );
     if(bytesTransferred != CONFIG_BLOCK_SIZE)
         result = LIBUSB_RESULT_TO_AIOUSB_RESULT(bytesTransferred);
 
  out_DIO_StreamSetClocks:
-    AIOUSB_UnLock();
     return result;
 }
 
@@ -65,6 +65,11 @@ PUBLIC_EXTERN unsigned long DIO_Write1(
                                        unsigned char bData
                                        );
 
+PUBLIC_EXTERN unsigned long DIO_BeginWrite( unsigned long DeviceIndex );
+PUBLIC_EXTERN unsigned long DIO_CommitWrite( unsigned long DeviceIndex );
+PUBLIC_EXTERN unsigned long DIO_AbortWrite( unsigned long DeviceIndex );
+PUBLIC_EXTERN unsigned long DIO_SetWriteDeadline( unsigned long DeviceIndex, unsigned long Milliseconds );
+void DIO_CloseBatch( AIOUSBDevice *device );
 
 PUBLIC_EXTERN unsigned long DIO_ReadAll(
                                         unsigned long DeviceIndex,
@@ -19,34 +19,74 @@ int _determine_strbuf_size( unsigned size )
     return size + strlen("0x") + 1;
 }
 
+/*----------------------------------------------------------------------------*/
+static unsigned _num_bytes( unsigned size )
+{
+    return ( size + BITS_PER_BYTE - 1 ) / BITS_PER_BYTE;
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Words for size bits plus the zero byte that terminates
+ *        DIOBufToBinary
+ */
+static unsigned _num_words( unsigned size )
+{
+    return ( _num_bytes( size ) + 1 + sizeof(uint64_t) - 1 ) / sizeof(uint64_t);
+}
+
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Zeros the bits from position size on, so word operations never
+ *        see stale bits past the end
+ */
+static void _clear_tail( DIOBuf *buf )
+{
+    unsigned char *bytes = (unsigned char *)buf->_words;
+    unsigned full = buf->_size / BITS_PER_BYTE;
+    unsigned total = buf->_num_words * sizeof(uint64_t);
+
+    if ( buf->_size % BITS_PER_BYTE ) {
+        bytes[full] &= (unsigned char)( 0xff << ( BITS_PER_BYTE - buf->_size % BITS_PER_BYTE ) );
+        full ++;
+    }
+    memset( &bytes[full], 0, total - full );
+}
+
+/*----------------------------------------------------------------------------*/
+static int _get_pos( DIOBuf *buf, unsigned pos )
+{
+    unsigned char *bytes = (unsigned char *)buf->_words;
+    return ( bytes[pos / BITS_PER_BYTE] >> ( 7 - pos % BITS_PER_BYTE ) ) & 1;
+}
+
 /*----------------------------------------------------------------------------*/
 DIOBuf *NewDIOBuf( unsigned size ) {
     DIOBuf *tmp = (DIOBuf *)malloc( sizeof(DIOBuf) );
     if( ! tmp ) 
         return tmp;
-    tmp->_buffer = (DIOBufferType *)calloc(size, sizeof(DIOBufferType));
-    if ( !tmp->_buffer ) {
+    tmp->_num_words = _num_words( size );
+    tmp->_words = (uint64_t *)calloc( tmp->_num_words, sizeof(uint64_t) );
+    if ( !tmp->_words ) {
         free( tmp );
         return NULL;
     }
     tmp->_strbuf_size = _determine_strbuf_size( size );
     tmp->_strbuf = (char *)malloc(sizeof(char) * tmp->_strbuf_size );
     if ( !tmp->_strbuf ) {
-        free(tmp->_buffer);
+        free(tmp->_words);
         free(tmp);
         return NULL;
     }
+    tmp->_strbuf[0] = '\0';
     tmp->_size = size;
     return tmp;
 }
 /*----------------------------------------------------------------------------*/
 void _copy_to_buf( DIOBuf *tmp, const char *ary, int size_array ) {
-    int tot_bit_size = tmp->_size;
-    int i; 
-    for ( i = 0 ; i < tot_bit_size ; i ++ ) { 
-        int curindex = i / 8;
-        tmp->_buffer[ i ] = (( ary[curindex] >> (( 8-1 ) - (i%8)) ) & 1 ? 1 : 0 );
-    }
+    unsigned nbytes = MIN( _num_bytes( tmp->_size ), (unsigned)size_array );
+    memcpy( tmp->_words, ary, nbytes );
+    _clear_tail( tmp );
 }
 /*----------------------------------------------------------------------------*/
 DIOBuf *NewDIOBufFromChar( const char *ary, int size_array ) {
@@ -98,29 +138,45 @@ DIOBuf *DIOBufReplaceBinString( DIOBuf *buf, char *bitstr )
 void DeleteDIOBuf( DIOBuf *buf ) 
 {
     buf->_size = 0;
-    free( buf->_buffer );
+    free( buf->_words );
     free( buf->_strbuf );
     free( buf );
 }
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief Keeps the first newsize bits and zeros any new ones. Resizing to
+ *        the current size allocates nothing, so a buffer reused for
+ *        DIO_ReadAll stays off the heap.
+ */
 DIOBuf *DIOBufResize( DIOBuf *buf , unsigned newsize ) 
 {
-    buf->_buffer = (unsigned char *)realloc( buf->_buffer, newsize*sizeof(unsigned char));
-    if ( !buf->_buffer ) {
-        buf->_size = 0;
-        buf->_strbuf_size = _determine_strbuf_size( newsize );
-        buf->_strbuf = (char *)realloc( buf->_strbuf, buf->_strbuf_size * sizeof(char) );
-        buf->_strbuf[0] = '\0';
-        return NULL;
+    unsigned newwords;
+    if ( newsize == buf->_size && buf->_words )
+        return buf;
+    newwords = _num_words( newsize );
+    if ( newwords != buf->_num_words ) {
+        uint64_t *words = (uint64_t *)realloc( buf->_words, newwords*sizeof(uint64_t) );
+        if ( !words ) {
+            buf->_size = 0;
+            buf->_strbuf[0] = '\0';
+            return NULL;
+        }
+        if ( newwords > buf->_num_words )
+            memset( &words[buf->_num_words], 0, ( newwords - buf->_num_words )*sizeof(uint64_t) );
+        buf->_words = words;
+        buf->_num_words = newwords;
+    }
+    if ( newsize < buf->_size ) {
+        buf->_size = newsize;
+        _clear_tail( buf );
     }
-    if( newsize > buf->_size )
-        memset( &buf->_buffer[buf->_size], 0, ( newsize - buf->_size ));
 
     buf->_strbuf_size = _determine_strbuf_size( newsize );
     buf->_strbuf = (char *)realloc( buf->_strbuf, buf->_strbuf_size * sizeof(char));
 
     if ( !buf->_strbuf )
         return NULL;
+    buf->_strbuf[0] = '\0';
     buf->_size = newsize;
     return buf;
 }
@@ -133,53 +189,55 @@ unsigned DIOBufByteSize( DIOBuf *buf ) {
   return buf->_size / BITS_PER_BYTE;
 }
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief Formats the bits into the display string, which is only built
+ *        when asked for
+ */
 char *DIOBufToString( DIOBuf *buf ) {
   unsigned i;
-  memset(buf->_strbuf,0, buf->_strbuf_size );
   for( i = 0; i < buf->_size ; i ++ )
-      buf->_strbuf[i] = ( buf->_buffer[i] == 0 ? '0' : '1' );
+      buf->_strbuf[i] = ( _get_pos( buf, i ) == 0 ? '0' : '1' );
   buf->_strbuf[buf->_size] = '\0';
   return buf->_strbuf;
 }
 
 /*----------------------------------------------------------------------------*/
 char *DIOBufToHex( DIOBuf *buf ) {
-    /* @bug , needs to preallocate space */
-    char *tmp = (char *)malloc( DIOBufSize(buf) / BITS_PER_BYTE );
+    static const char digits[] = "0123456789abcdef";
+    unsigned char *bytes = (unsigned char *)buf->_words;
     int size = DIOBufSize(buf) / BITS_PER_BYTE;
-
-    memset( buf->_strbuf, 0, buf->_strbuf_size );
-    memcpy( tmp, DIOBufToBinary( buf ), size );
-    /* memset(buf->_strbuf, 0, (DIOBufSize(buf) / BITS_PER_BYTE) ); */
+    int j = strlen("0x");
 
     strcpy(&buf->_strbuf[0], "0x" );
-    int j = strlen(buf->_strbuf);
-    /* for ( int i = 0 ; i < (int)strlen(tmp) ; i ++ , j = strlen(buf->_strbuf)) { */
-    for ( int i = 0 ; i <  size ; i ++ , j = strlen(buf->_strbuf)) {
-        sprintf(&buf->_strbuf[j], "%.2x", (unsigned char)tmp[i] );
+    for ( int i = 0 ; i <  size ; i ++ ) {
+        buf->_strbuf[j++] = digits[bytes[i] >> 4];
+        buf->_strbuf[j++] = digits[bytes[i] & 0xf];
     }
     buf->_strbuf[j] = 0;
-    free(tmp);
     return buf->_strbuf;
 }
 /*----------------------------------------------------------------------------*/
+/**
+ * @brief The packed bytes in the order the board sends them, followed by
+ *        a zero byte. No copy is made.
+ */
 char *DIOBufToBinary( DIOBuf *buf ) {
-    int i, j;
-    memset(buf->_strbuf, 0, DIOBufSize(buf) / BITS_PER_BYTE);
-    for ( i = 0, j = 0 ; i < (int)DIOBufSize(buf) ; i ++ , j = ( (j+1) % 8 )) { 
-        buf->_strbuf[i / BITS_PER_BYTE] |= buf->_buffer[i] << ( 7 - (j % BITS_PER_BYTE) );
-    }
-    buf->_strbuf[ DIOBufSize(buf) / BITS_PER_BYTE ] = '\0';
-    return buf->_strbuf;
+    return (char *)buf->_words;
 }
 /*----------------------------------------------------------------------------*/
 int DIOBufSetIndex( DIOBuf *buf, unsigned index, unsigned value )
 {
+    unsigned char *bytes = (unsigned char *)buf->_words;
+    unsigned pos;
 
-    if ( index > buf->_size - 1 ) {
+    if ( index >= buf->_size ) {
         return -AIOUSB_ERROR_INVALID_INDEX;
     } 
-    buf->_buffer[buf->_size - 1 - index] = ( value == AIOUSB_TRUE ? 1 : AIOUSB_FALSE );
+    pos = buf->_size - 1 - index;
+    if ( value == AIOUSB_TRUE )
+        bytes[pos / BITS_PER_BYTE] |= 1 << ( 7 - pos % BITS_PER_BYTE );
+    else
+        bytes[pos / BITS_PER_BYTE] &= ~( 1 << ( 7 - pos % BITS_PER_BYTE ) );
     return 0;
 }
 /*----------------------------------------------------------------------------*/
@@ -187,7 +245,7 @@ int DIOBufGetIndex( DIOBuf *buf, unsigned index ) {
     if ( index >= buf->_size ) 
         return -1;
   
-    return buf->_buffer[buf->_size - 1 - index ];
+    return _get_pos( buf, buf->_size - 1 - index );
 }
 /*----------------------------------------------------------------------------*/
 AIORET_TYPE DIOBufGetByteAtIndex( DIOBuf *buf, unsigned index , char *value ) {
@@ -214,6 +272,116 @@ AIORET_TYPE DIOBufSetByteAtIndex( DIOBuf *buf, unsigned index, char  value ) {
 
     return retval;
 }
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief The packed bytes, which DIO_ReadAll fills straight from the
+ *        control transfer. Channel c is bit c % 8 of byte c / 8.
+ */
+unsigned char *DIOBufBytes( DIOBuf *buf ) {
+    return (unsigned char *)buf->_words;
+}
+/*----------------------------------------------------------------------------*/
+static AIORET_TYPE _check_same_size( DIOBuf *buf, DIOBuf *other )
+{
+    if ( !buf || !other || buf->_size != other->_size )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    return AIOUSB_SUCCESS;
+}
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief buf &= other, a word at a time. Both must be the same size.
+ */
+AIORET_TYPE DIOBufAnd( DIOBuf *buf, DIOBuf *other ) {
+    AIORET_TYPE retval = _check_same_size( buf, other );
+    if ( retval != AIOUSB_SUCCESS )
+        return retval;
+    for ( unsigned i = 0; i < buf->_num_words; i ++ )
+        buf->_words[i] &= other->_words[i];
+    return retval;
+}
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief buf |= other, a word at a time. Both must be the same size.
+ */
+AIORET_TYPE DIOBufOr( DIOBuf *buf, DIOBuf *other ) {
+    AIORET_TYPE retval = _check_same_size( buf, other );
+    if ( retval != AIOUSB_SUCCESS )
+        return retval;
+    for ( unsigned i = 0; i < buf->_num_words; i ++ )
+        buf->_words[i] |= other->_words[i];
+    return retval;
+}
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief buf ^= other, a word at a time, leaving the bits that differ.
+ *        Both must be the same size.
+ */
+AIORET_TYPE DIOBufXor( DIOBuf *buf, DIOBuf *other ) {
+    AIORET_TYPE retval = _check_same_size( buf, other );
+    if ( retval != AIOUSB_SUCCESS )
+        return retval;
+    for ( unsigned i = 0; i < buf->_num_words; i ++ )
+        buf->_words[i] ^= other->_words[i];
+    return retval;
+}
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Makes buf a copy of other, resizing it to match
+ */
+AIORET_TYPE DIOBufCopy( DIOBuf *buf, DIOBuf *other ) {
+    if ( !buf || !other )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    if ( !DIOBufResize( buf, other->_size ) )
+        return -AIOUSB_ERROR_NOT_ENOUGH_MEMORY;
+    memcpy( buf->_words, other->_words, buf->_num_words*sizeof(uint64_t) );
+    return AIOUSB_SUCCESS;
+}
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Number of bits set
+ */
+AIORET_TYPE DIOBufPopCount( DIOBuf *buf ) {
+    AIORET_TYPE count = 0;
+    if ( !buf )
+        return -AIOUSB_ERROR_INVALID_PARAMETER;
+    for ( unsigned i = 0; i < buf->_num_words; i ++ )
+        count += __builtin_popcountll( buf->_words[i] );
+    return count;
+}
+/*----------------------------------------------------------------------------*/
+/**
+ * @brief Lowest channel at or after from whose bit differs between buf and
+ *        other, numbered as DIO_Read1 numbers them ( bit c % 8 of byte
+ *        c / 8 ) rather than by DIOBufGetIndex. Equal words are skipped
+ *        whole; pass the last result + 1 as from to walk every change.
+ * @return the channel, or 8 times the packed byte count ( DIOBufSize for
+ *         the whole byte buffers DIO_ReadAll fills ) when nothing differs
+ */
+AIORET_TYPE DIOBufFindFirstChange( DIOBuf *buf, DIOBuf *other, unsigned from ) {
+    AIORET_TYPE retval = _check_same_size( buf, other );
+    unsigned char *a, *b;
+    unsigned nbytes, first;
+    if ( retval != AIOUSB_SUCCESS )
+        return retval;
+
+    a = (unsigned char *)buf->_words;
+    b = (unsigned char *)other->_words;
+    nbytes = _num_bytes( buf->_size );
+    first = from / BITS_PER_BYTE;
+
+    for ( unsigned w = first / sizeof(uint64_t); w < buf->_num_words; w ++ ) {
+        if ( buf->_words[w] == other->_words[w] )
+            continue;
+        for ( unsigned k = MAX( first, w*sizeof(uint64_t) ); k < ( w + 1 )*sizeof(uint64_t) && k < nbytes; k ++ ) {
+            unsigned char diff = a[k] ^ b[k];
+            if ( k == first )
+                diff &= (unsigned char)( 0xff << ( from % BITS_PER_BYTE ) );
+            if ( diff )
+                return k*BITS_PER_BYTE + __builtin_ctz( diff );
+        }
+    }
+    return nbytes*BITS_PER_BYTE;
+}
 
 #ifdef __cplusplus 
 }
@@ -355,6 +523,71 @@ TEST(DIOBuf, Toggle_interview ) {
     free(tmp);
 }
 
+TEST(DIOBuf, Packed_Bytes_Are_The_Wire_Order ) {
+    DIOBuf *buf = NewDIOBuf( 32 );
+    unsigned char wire[4] = { 0x01, 0x80, 0x00, 0xf0 };
+    memcpy( DIOBufBytes(buf), wire, sizeof(wire) );
+    EXPECT_EQ( 0, memcmp( DIOBufToBinary(buf), wire, sizeof(wire) ) );
+    EXPECT_EQ( 6, DIOBufPopCount( buf ) );
+    EXPECT_STREQ( "0x018000f0", DIOBufToHex(buf) );
+    char val;
+    DIOBufGetByteAtIndex( buf, 3, &val );
+    EXPECT_EQ( 0x01, (unsigned char)val );
+    DeleteDIOBuf( buf );
+}
+
+TEST(DIOBuf, Word_Operations ) {
+    DIOBuf *a = NewDIOBuf( 128 );
+    DIOBuf *b = NewDIOBuf( 128 );
+    DIOBuf *c = NewDIOBuf( 96 );
+    for ( int i = 0; i < 16; i ++ ) {
+        DIOBufBytes(a)[i] = 0xf0;
+        DIOBufBytes(b)[i] = 0x3c;
+    }
+    EXPECT_EQ( 64, DIOBufPopCount( a ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIOBufAnd( a, b ) );
+    EXPECT_EQ( 0x30, DIOBufBytes(a)[15] );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIOBufOr( a, b ) );
+    EXPECT_EQ( 0x3c, DIOBufBytes(a)[0] );
+    EXPECT_EQ( AIOUSB_SUCCESS, DIOBufXor( a, b ) );
+    EXPECT_EQ( 0, DIOBufPopCount( a ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, DIOBufXor( a, c ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, DIOBufFindFirstChange( a, c, 0 ) );
+    DeleteDIOBuf( a );
+    DeleteDIOBuf( b );
+    DeleteDIOBuf( c );
+}
+
+TEST(DIOBuf, Find_Every_Change ) {
+    DIOBuf *last = NewDIOBuf( 96 );
+    DIOBuf *now = NewDIOBuf( 96 );
+    int expected[] = { 0, 9, 63, 64, 95 };
+    AIORET_TYPE channel;
+    int found = 0;
+
+    EXPECT_EQ( 96, DIOBufFindFirstChange( last, now, 0 ) );
+    for ( unsigned i = 0; i < sizeof(expected)/sizeof(int); i ++ )
+        DIOBufBytes(now)[expected[i] / 8] |= 1 << ( expected[i] % 8 );
+    for ( channel = DIOBufFindFirstChange( last, now, 0 ); channel < 96; channel = DIOBufFindFirstChange( last, now, channel + 1 ) )
+        EXPECT_EQ( expected[found++], channel );
+    EXPECT_EQ( 5, found );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, DIOBufCopy( last, now ) );
+    EXPECT_EQ( 96, DIOBufFindFirstChange( last, now, 0 ) );
+    DeleteDIOBuf( last );
+    DeleteDIOBuf( now );
+}
+
+TEST(DIOBuf, Shrinking_Clears_The_Tail ) {
+    DIOBuf *buf = NewDIOBufFromBinStr("1111111111111111" );
+    DIOBufResize( buf, 10 );
+    EXPECT_STREQ( "1111111111", DIOBufToString(buf) );
+    EXPECT_EQ( 10, DIOBufPopCount( buf ) );
+    DIOBufResize( buf, 16 );
+    EXPECT_STREQ( "1111111111000000", DIOBufToString(buf) );
+    DeleteDIOBuf( buf );
+}
+
 
 int main( int argc , char *argv[] ) 
 {
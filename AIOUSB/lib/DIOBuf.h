@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <stdint.h>
 
 #ifdef __aiousb_cplusplus
 namespace AIOUSB {
@@ -21,10 +22,18 @@ namespace AIOUSB {
 
 /* typedef AIOChannelMask DIOBuf; */
 typedef unsigned char DIOBufferType ;
+
+/**
+ * @brief Bits are packed eight to a byte in the order the board sends
+ * them, so DIO channel c is bit c % 8 of byte c / 8, and the bytes are
+ * stored in 64 bit words. Bits past _size are kept zero and there is
+ * always at least one zero byte after the last data byte.
+ */
 typedef struct {
     unsigned _size;
-    unsigned char *_buffer;        /**> Actual elements  */
-    char *_strbuf;                 /**> Display string   */
+    uint64_t *_words;              /**> Packed elements  */
+    unsigned _num_words;           /**> Words allocated in _words */
+    char *_strbuf;                 /**> Display string, built on demand */
     int _strbuf_size;              /**> Size of display string */
 } DIOBuf;
 
@@ -44,6 +53,13 @@ PUBLIC_EXTERN int DIOBufSetIndex( DIOBuf *buf, unsigned index, unsigned value );
 PUBLIC_EXTERN int DIOBufGetIndex( DIOBuf *buf, unsigned index );
 PUBLIC_EXTERN AIORET_TYPE DIOBufGetByteAtIndex( DIOBuf *buf, unsigned index, char *value);
 PUBLIC_EXTERN AIORET_TYPE DIOBufSetByteAtIndex( DIOBuf *buf, unsigned index, char  value );
+PUBLIC_EXTERN unsigned char *DIOBufBytes( DIOBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE DIOBufAnd( DIOBuf *buf, DIOBuf *other );
+PUBLIC_EXTERN AIORET_TYPE DIOBufOr( DIOBuf *buf, DIOBuf *other );
+PUBLIC_EXTERN AIORET_TYPE DIOBufXor( DIOBuf *buf, DIOBuf *other );
+PUBLIC_EXTERN AIORET_TYPE DIOBufCopy( DIOBuf *buf, DIOBuf *other );
+PUBLIC_EXTERN AIORET_TYPE DIOBufPopCount( DIOBuf *buf );
+PUBLIC_EXTERN AIORET_TYPE DIOBufFindFirstChange( DIOBuf *buf, DIOBuf *other, unsigned from );
 
 
 #ifdef __aiousb_cplusplus
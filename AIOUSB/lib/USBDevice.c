@@ -264,17 +264,24 @@ int usb_control_transfer(struct aiousb_device *dev_handle,
                          uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex,
                          unsigned char *data, uint16_t wLength, unsigned int timeout)
 {
-    AIOUSB_UnLock();
-    return libusb_control_transfer( get_usb_device( dev_handle ),
-                                    request_type,
-                                    bRequest,
-                                    wValue,
-                                    wIndex,
-                                    data,
-                                    wLength, 
-                                    timeout
-                                    );
-
+    unsigned long long start = AIOStatsNow();
+    int libusbResult;
+    libusbResult = libusb_control_transfer( get_usb_device( dev_handle ),
+                                            request_type,
+                                            bRequest,
+                                            wValue,
+                                            wIndex,
+                                            data,
+                                            wLength, 
+                                            timeout
+                                            );
+    AIOStatsRecordTransfer( ( dev_handle ? dev_handle->stats : NULL ),
+                            AIO_STATS_CONTROL,
+                            start,
+                            ( libusbResult > 0 ? libusbResult : 0 ),
+                            ( libusbResult < 0 ? libusbResult : LIBUSB_SUCCESS )
+                            );
+    return libusbResult;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -296,6 +303,7 @@ int usb_bulk_transfer( USBDevice *dev_handle,
 {
     int libusbResult = LIBUSB_SUCCESS;
     int total = 0;
+    unsigned long long start = AIOStatsNow();
     while (length > 0) {
           int bytes;
           libusbResult = libusb_bulk_transfer(get_usb_device( dev_handle ), 
@@ -328,6 +336,12 @@ int usb_bulk_transfer( USBDevice *dev_handle,
               break;
     }
     *actual_length = total;
+    AIOStatsRecordTransfer( ( dev_handle ? dev_handle->stats : NULL ),
+                            ( endpoint & LIBUSB_ENDPOINT_IN ? AIO_STATS_BULK_IN : AIO_STATS_BULK_OUT ),
+                            start,
+                            total,
+                            libusbResult
+                            );
     return libusbResult;
 }
 
@@ -6,6 +6,7 @@
 #include <stdlib.h>
 #include "ADCConfigBlock.h"
 #include "AIOEither.h"
+#include "AIOStats.h"
 
 #ifdef __aiousb_cplusplus
 namespace AIOUSB {
@@ -29,6 +30,7 @@ typedef struct aiousb_device {
     libusb_device_handle *deviceHandle;
     struct libusb_device_descriptor deviceDesc;
     AIOUSB_BOOL debug;
+    AIOStats *stats;                    /**< Owned by the AIOUSBDevice this belongs to */
 } USBDevice;
 
 typedef struct aiousb_libusb_args {
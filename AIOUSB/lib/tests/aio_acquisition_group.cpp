@@ -0,0 +1,368 @@
+/*****************************************************************************
+ * Runs an AIOAcquisitionGroup across fake USB-AI16-16A boards scanning
+ * different numbers of channels. Each board's input endpoint only starts
+ * producing scans once its counter 2 has been loaded, and hands them back
+ * in transfers that split scans at odd places. Every count encodes its
+ * board, scan number and channel so the merged scans can be checked.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOAcquisitionGroup.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include <unistd.h>
+using namespace AIOUSB;
+
+#define NUM_BOARDS 3
+
+typedef struct {
+    int request;
+    unsigned short wValue;
+    unsigned short wIndex;
+    unsigned long order;                        /* position among the requests to every board */
+} control_event;
+
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+static USBDevice usbs[NUM_BOARDS];
+static unsigned channels[NUM_BOARDS] = { 3, 5, 1 };
+static std::vector<control_event> controls[NUM_BOARDS];
+static int released[NUM_BOARDS];
+static unsigned long words_out[NUM_BOARDS];
+static unsigned long calls[NUM_BOARDS];
+static unsigned long scan_limit;
+static unsigned long num_controls;
+static int acquiring[NUM_BOARDS];
+static int fail_board;                          /* this board refuses its counter 1 load, -1 for none */
+
+static unsigned short expected_count( int board, unsigned long long scan, unsigned channel )
+{
+    return (unsigned short)( board * 20000 + scan * 8 + channel );
+}
+
+static int fake_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    int board = usb - usbs;
+    pthread_mutex_lock( &fake_lock );
+    control_event event = { bRequest, wValue, wIndex, num_controls ++ };
+    controls[board].push_back( event );
+    if ( board == fail_board && bRequest == AUR_CTR_MODELOAD && ( wValue >> 14 ) == 1 ) {
+        pthread_mutex_unlock( &fake_lock );
+        return LIBUSB_ERROR_PIPE;
+    }
+    if ( bRequest == AUR_START_ACQUIRING_BLOCK )
+        acquiring[board] = ( data[0] == 0x07 );
+    if ( bRequest == AUR_CTR_MODELOAD && ( wValue >> 14 ) == 2 )
+        released[board] = 1;
+    else if ( bRequest == AUR_CTR_MODE && ( wValue >> 14 ) == 2 )
+        released[board] = 0;
+    pthread_mutex_unlock( &fake_lock );
+    return wLength;
+}
+
+static int fake_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    int board = usb - usbs;
+    *actual_length = 0;
+    EXPECT_EQ( 0x86, endpoint );
+
+    pthread_mutex_lock( &fake_lock );
+    unsigned long words = 0;
+    if ( released[board] ) {
+        /* odd sized transfers so scans straddle them */
+        words = std::min( (unsigned long)length / 2, 1 + ( calls[board] ++ * 5 + board ) % 23 );
+        words = std::min( words, scan_limit * channels[board] - words_out[board] );
+        for ( unsigned long i = 0; i < words; i ++ ) {
+            unsigned long word = words_out[board] + i;
+            ((unsigned short *)data)[i] = expected_count( board, word / channels[board], word % channels[board] );
+        }
+        words_out[board] += words;
+    }
+    pthread_mutex_unlock( &fake_lock );
+
+    if ( !words ) {
+        usleep( 200 );
+        return LIBUSB_ERROR_TIMEOUT;
+    }
+    *actual_length = words * 2;
+    return 0;
+}
+
+/**
+ * @brief Waits until every scan let out so far has been taken in by the
+ *        group, kept or dropped
+ */
+static void wait_for_scans( AIOAcquisitionGroup *group )
+{
+    for ( int tries = 0; tries < 5000; tries ++ ) {
+        unsigned i;
+        for ( i = 0; i < group->num_members; i ++ ) {
+            AIOAcquisitionMember *member = &group->members[i];
+            if ( member->written + member->dropped < scan_limit )
+                break;
+        }
+        if ( i == group->num_members )
+            return;
+        usleep( 1000 );
+    }
+    FAIL() << "fake boards stalled";
+}
+
+static void check_scans( AIOAcquisitionGroup *group, unsigned short *counts, unsigned long long *sequences, int scans )
+{
+    for ( int scan = 0; scan < scans; scan ++ ) {
+        unsigned short *row = counts + scan * group->num_channels;
+        for ( unsigned board = 0; board < group->num_members; board ++ ) {
+            unsigned long long sequence = sequences[scan * group->num_members + board];
+            ASSERT_EQ( sequences[scan * group->num_members], sequence ) << "scan " << scan << " board " << board;
+            for ( unsigned channel = 0; channel < channels[board]; channel ++ )
+                ASSERT_EQ( expected_count( board, sequence, channel ), *row ++ ) << "scan " << scan << " board " << board;
+        }
+    }
+}
+
+/**
+ * @brief The cached config blocks of the boards, to check they are put back
+ */
+static void save_configs( ADCConfigBlock *configs )
+{
+    for ( int i = 0; i < NUM_BOARDS; i ++ )
+        configs[i] = deviceTable[i].cachedConfigBlock;
+}
+
+static void expect_configs( const ADCConfigBlock *configs )
+{
+    for ( int i = 0; i < NUM_BOARDS; i ++ ) {
+        ASSERT_EQ( configs[i].size, deviceTable[i].cachedConfigBlock.size ) << "board " << i;
+        EXPECT_EQ( 0, memcmp( configs[i].registers, deviceTable[i].cachedConfigBlock.registers, configs[i].size ) ) << "board " << i << " kept the group's config";
+    }
+}
+
+class AcquisitionGroupSetup : public ::testing::Test
+{
+ protected:
+    virtual void SetUp() {
+        unsigned long products[NUM_BOARDS];
+        for ( int i = 0; i < NUM_BOARDS; i ++ )
+            products[i] = USB_AI16_16A;
+        AIODeviceTablePopulateTableTest( products, NUM_BOARDS );
+        memset( usbs, 0, sizeof(usbs) );
+        memset( released, 0, sizeof(released) );
+        memset( words_out, 0, sizeof(words_out) );
+        memset( calls, 0, sizeof(calls) );
+        memset( acquiring, 0, sizeof(acquiring) );
+        fail_board = -1;
+        for ( int i = 0; i < NUM_BOARDS; i ++ ) {
+            controls[i].clear();
+            usbs[i].usb_control_transfer = fake_control_transfer;
+            usbs[i].usb_bulk_transfer    = fake_bulk_transfer;
+            deviceTable[i].usb_device = &usbs[i];
+        }
+        scan_limit = 0;
+        num_controls = 0;
+    }
+    virtual void TearDown() {
+        for ( int i = 0; i < NUM_BOARDS; i ++ )
+            deviceTable[i].usb_device = NULL;
+        AIODeviceTableClearDevices();
+    }
+};
+
+TEST_F(AcquisitionGroupSetup,RejectsBadDevices )
+{
+    AIOAcquisitionGroup *group = NewAIOAcquisitionGroup( 0 );
+    double hz = 1000;
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, AIOAcquisitionGroupStart( group, &hz ) );
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, AIOAcquisitionGroupAddDevice( group, 0, 0, 16, AD_GAIN_CODE_0_10V ) );
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, AIOAcquisitionGroupAddDevice( group, 0, 4, 3, AD_GAIN_CODE_0_10V ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOAcquisitionGroupAddDevice( group, 0, 0, 3, AD_GAIN_CODE_0_10V ) );
+    EXPECT_EQ( AIOUSB_ERROR_DUP_NAME, AIOAcquisitionGroupAddDevice( group, 0, 4, 7, AD_GAIN_CODE_0_10V ) );
+    EXPECT_NE( AIOUSB_SUCCESS, AIOAcquisitionGroupAddDevice( group, NUM_BOARDS, 0, 3, AD_GAIN_CODE_0_10V ) );
+    EXPECT_EQ( 4, AIOAcquisitionGroupNumberChannels( group ) );
+    DeleteAIOAcquisitionGroup( group );
+}
+
+TEST_F(AcquisitionGroupSetup,ArmsEveryBoardBeforeReleasingAny )
+{
+    AIOAcquisitionGroup *group = NewAIOAcquisitionGroup( 0 );
+    unsigned total = 0;
+    for ( int i = 0; i < NUM_BOARDS; i ++ ) {
+        ASSERT_EQ( AIOUSB_SUCCESS, AIOAcquisitionGroupAddDevice( group, i, 2, 2 + channels[i] - 1, AD_GAIN_CODE_0_5V ) );
+        total += channels[i];
+    }
+    ASSERT_EQ( total, AIOAcquisitionGroupNumberChannels( group ) );
+
+    ADCConfigBlock configs[NUM_BOARDS];
+    save_configs( configs );
+    double hz = 10000;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOAcquisitionGroupStart( group, &hz ) );
+    EXPECT_GT( hz, 0 );
+    EXPECT_NEAR( 10000, hz, 100 );
+
+    pthread_mutex_lock( &fake_lock );
+    /* the first release may only come once the last board is ready to go */
+    unsigned long last_armed = 0, first_released = ~0ul;
+    for ( int i = 0; i < NUM_BOARDS; i ++ ) {
+        std::vector<control_event> &events = controls[i];
+        size_t acquiring = events.size(), counter1 = events.size(), counter2 = events.size();
+        for ( size_t j = 0; j < events.size(); j ++ ) {
+            if ( events[j].request == AUR_START_ACQUIRING_BLOCK && acquiring == events.size() )
+                acquiring = j;
+            else if ( events[j].request == AUR_CTR_MODELOAD && ( events[j].wValue >> 14 ) == 1 )
+                counter1 = j;
+            else if ( events[j].request == AUR_CTR_MODELOAD && ( events[j].wValue >> 14 ) == 2 )
+                counter2 = j;
+        }
+        ASSERT_LT( acquiring, counter1 ) << "board " << i;
+        ASSERT_LT( counter1, counter2 ) << "board " << i << " was never released";
+        EXPECT_EQ( group->members[i].lowDivisor, events[counter2].wIndex );
+        EXPECT_EQ( group->members[i].highDivisor, events[counter1].wIndex );
+        EXPECT_EQ( counter2 + 1, events.size() ) << "nothing is sent to a board after its release";
+        last_armed     = std::max( last_armed, events[counter1].order );
+        first_released = std::min( first_released, events[counter2].order );
+    }
+    EXPECT_LT( last_armed, first_released );
+    scan_limit = 3000;
+    pthread_mutex_unlock( &fake_lock );
+
+    std::vector<unsigned short> counts( scan_limit * total );
+    std::vector<unsigned long long> sequences( scan_limit * NUM_BOARDS );
+    unsigned long got = 0;
+    for ( int tries = 0; got < scan_limit && tries < 5000; tries ++ ) {
+        AIORET_TYPE scans = AIOAcquisitionGroupRead( group, &counts[got * total], scan_limit - got, &sequences[got * NUM_BOARDS] );
+        ASSERT_GE( scans, 0 );
+        got += scans;
+        if ( !scans )
+            usleep( 1000 );
+    }
+    ASSERT_EQ( scan_limit, got );
+    check_scans( group, &counts[0], &sequences[0], got );
+    for ( unsigned long scan = 0; scan < got; scan ++ )
+        ASSERT_EQ( scan, sequences[scan * NUM_BOARDS] );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOAcquisitionGroupStop( group ) );
+    for ( int i = 0; i < NUM_BOARDS; i ++ ) {
+        EXPECT_EQ( 0, AIOAcquisitionGroupGetDropped( group, i ) );
+        EXPECT_EQ( 0, AIOAcquisitionGroupGetDiscarded( group, i ) );
+        EXPECT_EQ( 0, released[i] ) << "board " << i << " clock left running";
+        EXPECT_EQ( AUR_ADC_SET_CONFIG, controls[i].back().request ) << "board " << i << " config put back last";
+    }
+    expect_configs( configs );
+    DeleteAIOAcquisitionGroup( group );
+}
+
+TEST_F(AcquisitionGroupSetup,RealignsAfterOverruns )
+{
+    AIOAcquisitionGroup *group = NewAIOAcquisitionGroup( 16 );
+    unsigned total = 0;
+    for ( int i = 0; i < NUM_BOARDS; i ++ ) {
+        ASSERT_EQ( AIOUSB_SUCCESS, AIOAcquisitionGroupAddDevice( group, i, 0, channels[i] - 1, AD_GAIN_CODE_0_10V ) );
+        total += channels[i];
+    }
+    double hz = 1000;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOAcquisitionGroupStart( group, &hz ) );
+
+    std::vector<unsigned short> counts( 1000 * total );
+    std::vector<unsigned long long> sequences( 1000 * NUM_BOARDS );
+    unsigned long long last = 0;
+    unsigned long rows = 0;
+
+    /* the rings keep a different number of scans for each scan size */
+    for ( int phase = 1; phase <= 4; phase ++ ) {
+        pthread_mutex_lock( &fake_lock );
+        scan_limit = phase * 200;
+        pthread_mutex_unlock( &fake_lock );
+        wait_for_scans( group );
+
+        AIORET_TYPE scans = AIOAcquisitionGroupRead( group, &counts[0], 1000, &sequences[0] );
+        ASSERT_GT( scans, 0 );
+        check_scans( group, &counts[0], &sequences[0], scans );
+        for ( int scan = 0; scan < scans; scan ++ ) {
+            unsigned long long sequence = sequences[scan * NUM_BOARDS];
+            if ( rows ++ )
+                ASSERT_GT( sequence, last );
+            last = sequence;
+        }
+        EXPECT_EQ( 0, AIOAcquisitionGroupRead( group, &counts[0], 1000, &sequences[0] ) );
+    }
+    EXPECT_LT( rows, 800 );
+
+    unsigned long long dropped = 0, discarded = 0;
+    for ( int i = 0; i < NUM_BOARDS; i ++ ) {
+        dropped   += AIOAcquisitionGroupGetDropped( group, i );
+        discarded += AIOAcquisitionGroupGetDiscarded( group, i );
+    }
+    std::cout << "# " << rows << " scans kept, " << dropped << " dropped, " << discarded << " discarded" << std::endl;
+    EXPECT_GT( dropped, 0 );
+    EXPECT_GT( discarded, 0 );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOAcquisitionGroupStop( group ) );
+    DeleteAIOAcquisitionGroup( group );
+}
+
+TEST_F(AcquisitionGroupSetup,FailsWhenGapsRunOut )
+{
+    AIOAcquisitionGroup *group = NewAIOAcquisitionGroup( 2 * AIOACQUISITIONGROUP_MAX_GAPS );
+    std::vector<unsigned short> counts( 1000 * channels[0] );
+    std::vector<unsigned long long> sequences( 1000 );
+    unsigned long long last = 0;
+    unsigned long rows = 0;
+    AIORET_TYPE scans;
+    double hz = 1000;
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOAcquisitionGroupAddDevice( group, 0, 0, channels[0] - 1, AD_GAIN_CODE_0_10V ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOAcquisitionGroupStart( group, &hz ) );
+
+    /* reading one scan at a time leaves a new gap behind each overrun */
+    for ( int step = 1; step <= 2 * AIOACQUISITIONGROUP_MAX_GAPS; step ++ ) {
+        pthread_mutex_lock( &fake_lock );
+        scan_limit = step * 100;
+        pthread_mutex_unlock( &fake_lock );
+        wait_for_scans( group );
+        if ( ( scans = AIOAcquisitionGroupRead( group, &counts[0], 1, &sequences[0] ) ) <= 0 )
+            break;
+        check_scans( group, &counts[0], &sequences[0], scans );
+        last = sequences[0];
+        rows ++;
+    }
+    while ( ( scans = AIOAcquisitionGroupRead( group, &counts[0], 1000, &sequences[0] ) ) > 0 ) {
+        check_scans( group, &counts[0], &sequences[0], scans );
+        ASSERT_GT( sequences[0], last );
+        last = sequences[scans - 1];
+        rows += scans;
+    }
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_DATA, scans ) << "Scans past the last gap that fits are not handed out";
+    EXPECT_GT( rows, (unsigned long)AIOACQUISITIONGROUP_MAX_GAPS );
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_DATA, AIOAcquisitionGroupStop( group ) );
+    DeleteAIOAcquisitionGroup( group );
+}
+
+TEST_F(AcquisitionGroupSetup,DisarmsBoardThatFailedToArm )
+{
+    AIOAcquisitionGroup *group = NewAIOAcquisitionGroup( 0 );
+    double hz = 1000;
+    for ( int i = 0; i < NUM_BOARDS; i ++ )
+        ASSERT_EQ( AIOUSB_SUCCESS, AIOAcquisitionGroupAddDevice( group, i, 0, channels[i] - 1, AD_GAIN_CODE_0_10V ) );
+
+    ADCConfigBlock configs[NUM_BOARDS];
+    save_configs( configs );
+    fail_board = 1;
+    EXPECT_NE( AIOUSB_SUCCESS, AIOAcquisitionGroupStart( group, &hz ) );
+    for ( int i = 0; i < NUM_BOARDS; i ++ ) {
+        EXPECT_EQ( 0, acquiring[i] ) << "board " << i << " left acquiring";
+        EXPECT_EQ( 0, released[i] );
+    }
+    EXPECT_TRUE( controls[2].empty() ) << "boards after the failed one are never touched";
+    expect_configs( configs );
+    EXPECT_EQ( AUR_ADC_SET_CONFIG, controls[1].back().request ) << "the failed board's config is put back too";
+    DeleteAIOAcquisitionGroup( group );
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
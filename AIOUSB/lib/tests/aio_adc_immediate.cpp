@@ -0,0 +1,162 @@
+/*****************************************************************************
+ * Counts the USB transactions made by the immediate A/D reads against a fake
+ * device that remembers the last config block written to it.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOUSB_ADC.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+using namespace AIOUSB;
+
+static unsigned char device_registers[AD_MAX_CONFIG_REGISTERS];
+static int num_set_config, num_get_config, num_control, num_bulk;
+static int bulk_oversample, bulk_length;         /* what the device was set to for the last read */
+
+static int fake_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    num_control ++;
+    if ( bRequest == AUR_ADC_SET_CONFIG ) {
+        num_set_config ++;
+        memcpy( device_registers, data, wLength );
+    } else if ( bRequest == AUR_ADC_GET_CONFIG ) {
+        num_get_config ++;
+        memcpy( data, device_registers, wLength );
+    }
+    return wLength;
+}
+
+static int fake_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    num_bulk ++;
+    bulk_oversample = device_registers[AD_CONFIG_OVERSAMPLE];
+    bulk_length     = length;
+    memset( data, 0xff, length );
+    *actual_length = length;
+    return 0;
+}
+
+static void reset_counters()
+{
+    num_set_config = num_get_config = num_control = num_bulk = 0;
+}
+
+class ImmediateReadSetup : public AIOFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        usb.usb_control_transfer = fake_control_transfer;
+        usb.usb_bulk_transfer    = fake_bulk_transfer;
+        AddFakeDevice( USB_AIO16_16A );
+        ASSERT_EQ( AIOUSB_SUCCESS, result );
+        memcpy( device_registers, device->cachedConfigBlock.registers, device->cachedConfigBlock.size );
+        reset_counters();
+    }
+};
+
+TEST_F(ImmediateReadSetup,WritesConfigOnlyWhenItChanges )
+{
+    ADCChannelRequest requests[] = { { 2, AD_GAIN_CODE_10V, AIOUSB_FALSE },
+                                     { 5, AD_GAIN_CODE_5V,  AIOUSB_FALSE },
+                                     { 3, AD_GAIN_CODE_0_10V, AIOUSB_FALSE } };
+    double volts[3];
+
+    EXPECT_EQ( AIOUSB_SUCCESS, ADC_GetChannelsV( 0, requests, 3, volts ) );
+    EXPECT_EQ( 1, num_set_config );
+    EXPECT_EQ( 0, num_get_config );
+    EXPECT_EQ( 2, AIOUSB_GetStartChannel( &device->cachedConfigBlock ) );
+    EXPECT_EQ( 5, AIOUSB_GetEndChannel( &device->cachedConfigBlock ) );
+    EXPECT_EQ( 0, memcmp( device_registers, device->cachedConfigBlock.registers, device->cachedConfigBlock.size ) );
+    EXPECT_DOUBLE_EQ( 10.0, volts[0] );
+    EXPECT_DOUBLE_EQ( 5.0, volts[1] );
+    EXPECT_DOUBLE_EQ( 10.0, volts[2] );
+
+    reset_counters();
+    for ( int i = 0; i < 10; i ++ )
+        EXPECT_EQ( AIOUSB_SUCCESS, ADC_GetChannelsV( 0, requests, 3, volts ) );
+    EXPECT_EQ( 0, num_set_config ) << "Unchanged requests reuse the cached block";
+    EXPECT_EQ( 0, num_get_config );
+    EXPECT_EQ( 20, num_control );
+    EXPECT_EQ( 10, num_bulk );
+
+    reset_counters();
+    requests[1].gainCode = AD_GAIN_CODE_1V;
+    EXPECT_EQ( AIOUSB_SUCCESS, ADC_GetChannelsV( 0, requests, 3, volts ) );
+    EXPECT_EQ( 1, num_set_config );
+    EXPECT_DOUBLE_EQ( 1.0, volts[1] );
+}
+
+TEST_F(ImmediateReadSetup,DiscardedSampleStaysOutOfTheCachedBlock )
+{
+    ADCChannelRequest requests[] = { { 0, AD_GAIN_CODE_10V, AIOUSB_FALSE },
+                                     { 1, AD_GAIN_CODE_10V, AIOUSB_FALSE } };
+    double volts[2];
+
+    AIOUSB_SetOversample( &device->cachedConfigBlock, 3 );
+    memcpy( device_registers, device->cachedConfigBlock.registers, device->cachedConfigBlock.size );
+    AIOUSB_SetDiscardFirstSample( 0, AIOUSB_TRUE );
+
+    for ( int i = 0; i < 10; i ++ ) {
+        reset_counters();
+        EXPECT_EQ( AIOUSB_SUCCESS, ADC_GetChannelsV( 0, requests, 2, volts ) );
+        EXPECT_EQ( 4, bulk_oversample ) << "call " << i << ": one extra sample to discard";
+        EXPECT_EQ( (int)( 2 * 5 * sizeof(unsigned short) ), bulk_length );
+        EXPECT_EQ( 3u, AIOUSB_GetOversample( &device->cachedConfigBlock ) ) << "call " << i;
+        EXPECT_EQ( 4, device_registers[AD_CONFIG_OVERSAMPLE] ) << "the device keeps the scan's block";
+        EXPECT_EQ( ( i == 0 ? 1 : 0 ), num_set_config ) << "call " << i << ": repeated calls never rewrite the block";
+    }
+
+    AIOUSB_SetDiscardFirstSample( 0, AIOUSB_FALSE );
+    EXPECT_EQ( AIOUSB_SUCCESS, ADC_GetChannelsV( 0, requests, 2, volts ) );
+    reset_counters();
+    EXPECT_EQ( AIOUSB_SUCCESS, ADC_GetChannelsV( 0, requests, 2, volts ) );
+    EXPECT_EQ( 3, bulk_oversample );
+    EXPECT_EQ( 0, num_set_config ) << "Without the discard the cached block is the scan's";
+}
+
+TEST_F(ImmediateReadSetup,FewerTransactionsThanPerChannelReads )
+{
+    ADCChannelRequest requests[] = { { 0, AD_GAIN_CODE_10V, AIOUSB_FALSE },
+                                     { 1, AD_GAIN_CODE_10V, AIOUSB_FALSE } };
+    double volts[2];
+    int per_channel, batched;
+
+    for ( int i = 0; i < 10; i ++ ) {
+        ADC_GetChannelV( 0, 0, &volts[0] );
+        ADC_GetChannelV( 0, 1, &volts[1] );
+    }
+    reset_counters();
+    ADC_GetChannelV( 0, 0, &volts[0] );
+    ADC_GetChannelV( 0, 1, &volts[1] );
+    per_channel = num_control + num_bulk;
+
+    ADC_GetChannelsV( 0, requests, 2, volts );
+    reset_counters();
+    ADC_GetChannelsV( 0, requests, 2, volts );
+    batched = num_control + num_bulk;
+
+    EXPECT_EQ( 3, batched );
+    EXPECT_LT( batched, per_channel );
+    std::cout << "# two channels: " << per_channel << " transactions per channel, " << batched << " batched" << std::endl;
+}
+
+TEST_F(ImmediateReadSetup,RejectsBadRequests )
+{
+    double volts[2];
+    ADCChannelRequest bad_channel[] = { { 99, AD_GAIN_CODE_10V, AIOUSB_FALSE } };
+    ADCChannelRequest bad_gain[]    = { { 1, 42, AIOUSB_FALSE } };
+    ADCChannelRequest conflict[]    = { { 1, AD_GAIN_CODE_10V, AIOUSB_FALSE }, { 1, AD_GAIN_CODE_5V, AIOUSB_FALSE } };
+
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, ADC_GetChannelsV( 0, bad_channel, 1, volts ) );
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, ADC_GetChannelsV( 0, bad_gain, 1, volts ) );
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, ADC_GetChannelsV( 0, conflict, 2, volts ) );
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, ADC_GetChannelsV( 0, conflict, 0, volts ) );
+    EXPECT_EQ( 0, num_control + num_bulk );
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
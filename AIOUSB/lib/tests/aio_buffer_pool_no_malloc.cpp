@@ -0,0 +1,210 @@
+/*****************************************************************************
+ * Checks that the immediate, conversion and streaming paths stop touching
+ * the heap once they are warmed up. malloc / calloc / realloc are wrapped
+ * so every heap allocation made while counting is seen, wherever it comes
+ * from, the streaming workers' threads included.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOUSB_ADC.h"
+#include "AIOUSB_DAC.h"
+#include "AIOUSB_DIO.h"
+#include "AIOCountsConverter.h"
+#include "AIOContinuousBuffer.h"
+#include "AIOStats.h"
+#include "AIOFifo.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+#include <unistd.h>
+using namespace AIOUSB;
+
+extern "C" void *__libc_malloc( size_t size );
+extern "C" void *__libc_calloc( size_t num, size_t size );
+extern "C" void *__libc_realloc( void *ptr, size_t size );
+
+static volatile int counting = 0;
+static volatile unsigned long num_allocations = 0;
+
+extern "C" void *malloc( size_t size )
+{
+    if ( counting ) num_allocations ++;
+    return __libc_malloc( size );
+}
+
+extern "C" void *calloc( size_t num, size_t size )
+{
+    if ( counting ) num_allocations ++;
+    return __libc_calloc( num, size );
+}
+
+extern "C" void *realloc( void *ptr, size_t size )
+{
+    if ( counting ) num_allocations ++;
+    return __libc_realloc( ptr, size );
+}
+
+static int fake_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( request_type == USB_READ_FROM_DEVICE )
+        memset( data, 0x5a, wLength );
+    return wLength;
+}
+
+static volatile int streaming = 0;
+
+static int fake_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    for ( int i = 0; i < length / 2; i ++ )
+        ((uint16_t *)data)[i] = (uint16_t)( 1000 + i );
+    *actual_length = length;
+    if ( streaming )
+        usleep( length );       /* a 1 MB/s board, so the sizer settles on a size of its own */
+    return 0;
+}
+
+class NoMallocSetup : public AIOFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        usb.usb_control_transfer = fake_control_transfer;
+        usb.usb_bulk_transfer    = fake_bulk_transfer;
+        usb.usb_put_config       = USBDevicePutADCConfigBlock;
+        AddFakeDevice( USB_AIO16_16A );
+        ASSERT_EQ( AIOUSB_SUCCESS, result );
+    }
+};
+
+TEST_F(NoMallocSetup,ImmediateCallsAfterWarmUp )
+{
+    double volts[16];
+    unsigned short dacdata[] = { 0, 1000, 1, 2000 };
+    DIOBuf *dio = NewDIOBuf( 0 );
+
+    ASSERT_TRUE( device->bufferPool );
+
+    for ( int pass = 0; pass < 2; pass ++ ) {
+        num_allocations = 0;
+        counting = pass;
+        for ( int i = 0; i < 100; i ++ ) {
+            EXPECT_EQ( AIOUSB_SUCCESS, ADC_GetScanV( 0, volts ) );
+            EXPECT_EQ( AIOUSB_SUCCESS, DIO_ReadAll( 0, dio ) );
+            EXPECT_EQ( AIOUSB_SUCCESS, DACMultiDirect( 0, dacdata, 2 ) );
+        }
+        counting = 0;
+    }
+    EXPECT_EQ( 0, num_allocations ) << "Heap allocations after warm-up";
+    EXPECT_EQ( 0, AIOBufferPoolGetHeapAllocations( device->bufferPool ) );
+
+    DeleteDIOBuf( dio );
+}
+
+TEST_F(NoMallocSetup,ConvertFifoAfterWarmUp )
+{
+    int num_channels = 16, num_oversamples = 15, num_scans = 64;
+    unsigned num_counts = num_channels*(num_oversamples+1)*num_scans;
+    AIOGainRange ranges[16];
+    for ( int i = 0; i < num_channels; i ++ ) {
+        ranges[i].min = -10.0;
+        ranges[i].max = 10.0;
+    }
+    uint16_t *counts = (uint16_t *)AIOUSBDeviceGetBuffer( device, num_counts*sizeof(uint16_t) );
+    double *volts = (double *)AIOUSBDeviceGetBuffer( device, num_channels*num_scans*sizeof(double) );
+    for ( unsigned i = 0; i < num_counts; i ++ ) counts[i] = (uint16_t)i;
+
+    AIOFifoCounts *infifo  = NewAIOFifoCounts( num_counts );
+    AIOFifoVolts  *outfifo = NewAIOFifoVolts( num_channels*num_scans );
+    AIOCountsConverter *cc = NewAIOCountsConverter( num_channels, ranges, num_oversamples, sizeof(uint16_t) );
+
+    for ( int pass = 0; pass < 2; pass ++ ) {
+        num_allocations = 0;
+        counting = pass;
+        for ( int i = 0; i < 50; i ++ ) {
+            infifo->PushN( infifo, counts, num_counts );
+            EXPECT_EQ( num_channels*num_scans, cc->ConvertFifo( cc, outfifo, infifo, num_counts ) );
+            outfifo->PopN( outfifo, volts, num_channels*num_scans );
+        }
+        counting = 0;
+    }
+    EXPECT_EQ( 0, num_allocations ) << "Heap allocations after warm-up";
+
+    DeleteAIOCountsConverter( cc );
+    DeleteAIOFifoCounts( infifo );
+    DeleteAIOFifoVolts( outfifo );
+    AIOUSBDeviceReleaseBuffer( device, counts );
+    AIOUSBDeviceReleaseBuffer( device, volts );
+}
+
+/**
+ * @brief Streams from the fake board for a while, then counts the heap
+ * allocations made by both the worker and the reader in the same stretch
+ * once everything is warmed up
+ */
+static void stream_after_warm_up( AIOContinuousBuf *buf, AIOTransferPreference preference )
+{
+    static double readbuf[4096];
+    AIORET_TYPE bytes, total = 0;
+
+    AIOContinuousBufInitConfiguration( buf );
+    AIOContinuousBufSetStartAndEndChannel( buf, 0, 3 );
+    AIOContinuousBufSetAllGainCodeAndDiffMode( buf, AD_GAIN_CODE_10V, AIOUSB_FALSE );
+    AIOContinuousBufSetOverSample( buf, 0 );
+    AIOContinuousBufSetClock( buf, 1000 );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetTransferPreference( buf, preference, 0 ) );
+
+    streaming = 1;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufCallbackStart( buf ) );
+    for ( int pass = 0; pass < 2; pass ++ ) {
+        unsigned long long stop = AIOStatsNow() + 200*1000000ULL;
+        num_allocations = 0;
+        counting = pass;
+        while ( AIOStatsNow() < stop ) {
+            if ( ( bytes = AIOContinuousBufRead( buf, (AIOBufferType *)readbuf, sizeof(readbuf), sizeof(readbuf) ) ) > 0 )
+                total += counting * bytes;
+            else
+                usleep( 500 );
+        }
+        counting = 0;
+    }
+    EXPECT_GT( total, 0 ) << "Data kept coming while counting";
+    EXPECT_EQ( RUNNING, buf->status ) << "Still acquiring when counting stopped";
+    AIOContinuousBufEnd( buf );
+    streaming = 0;
+}
+
+TEST_F(NoMallocSetup,CountsWorkerAfterWarmUp )
+{
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, 16*1024, 4 );
+    AIOContinuousBufSetEndless( buf, AIOUSB_TRUE );
+
+    stream_after_warm_up( buf, AIO_TRANSFERS_BALANCED );
+    EXPECT_EQ( 0, num_allocations ) << "Heap allocations after warm-up";
+    EXPECT_EQ( 0, AIOBufferPoolGetHeapAllocations( device->bufferPool ) );
+
+    DeleteAIOContinuousBuf( buf );
+}
+
+TEST_F(NoMallocSetup,VoltsWorkerAfterWarmUp )
+{
+    AIOContinuousBuf *buf = NewAIOContinuousBufForVolts( 0, 256*1024, 4, 0 );
+
+    stream_after_warm_up( buf, AIO_TRANSFERS_HIGH_THROUGHPUT );
+    EXPECT_EQ( 0, num_allocations ) << "Heap allocations after warm-up";
+    EXPECT_EQ( 0, AIOBufferPoolGetHeapAllocations( device->bufferPool ) ) << "The 256 KB read buffer comes from the pool";
+
+    AIOCountsConverter *cc = buf->converter;
+    AIOFifoCounts *counts  = buf->volts_counts;
+    ASSERT_TRUE( cc && counts );
+    stream_after_warm_up( buf, AIO_TRANSFERS_HIGH_THROUGHPUT );
+    EXPECT_EQ( cc, buf->converter ) << "Starting again keeps the converter";
+    EXPECT_EQ( counts, buf->volts_counts );
+    EXPECT_EQ( 0, num_allocations );
+
+    DeleteAIOContinuousBuf( buf );
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
@@ -0,0 +1,210 @@
+/*****************************************************************************
+ * Checks the bulk sizer picks transfer sizes and counts from the clock for
+ * each preference, follows the rate transfers complete at without chasing
+ * noise, and leaves fixed sizes alone, then streams from the simulated
+ * USB-AI16-16A at a slow clock in real time and unthrottled.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOContinuousBuffer.h"
+#include "AIOBulkSizer.h"
+#include "AIOSimDevice.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+#include <unistd.h>
+using namespace AIOUSB;
+
+#define NUM_CHANNELS 4
+
+static unsigned size_for( AIOTransferPreference preference, double hz, unsigned num_channels )
+{
+    AIOBulkSizer sizer;
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOBulkSizerInit( &sizer, preference, 0, AIOBulkSizerRate( hz, num_channels, 0 ), 0 ) );
+    return (unsigned)AIOBulkSizerGetSize( &sizer );
+}
+
+TEST(AIOBulkSizer,SizesFollowTheClock )
+{
+    EXPECT_EQ( 8000, AIOBulkSizerRate( 1000, 4, 0 ) );
+    EXPECT_EQ( 64000, AIOBulkSizerRate( 1000, 4, 7 ) );
+
+    EXPECT_EQ( 512u, size_for( AIO_TRANSFERS_LOW_LATENCY, 1000, 4 ) );
+    EXPECT_EQ( 512u, size_for( AIO_TRANSFERS_BALANCED, 1000, 4 ) );
+    EXPECT_EQ( 16384u, size_for( AIO_TRANSFERS_HIGH_THROUGHPUT, 1000, 4 ) );
+
+    EXPECT_EQ( 1536u, size_for( AIO_TRANSFERS_LOW_LATENCY, 100000, 4 ) );
+    EXPECT_EQ( 7680u, size_for( AIO_TRANSFERS_BALANCED, 100000, 4 ) );
+    EXPECT_EQ( 39936u, size_for( AIO_TRANSFERS_HIGH_THROUGHPUT, 100000, 4 ) );
+
+    EXPECT_EQ( 16384u, size_for( AIO_TRANSFERS_LOW_LATENCY, 500000, 16 ) );
+    EXPECT_EQ( 65536u, size_for( AIO_TRANSFERS_BALANCED, 500000, 16 ) );
+    EXPECT_EQ( 262144u, size_for( AIO_TRANSFERS_HIGH_THROUGHPUT, 500000, 16 ) );
+}
+
+TEST(AIOBulkSizer,LatencyAndMinimumOverrideThePreference )
+{
+    AIOBulkSizer sizer;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOBulkSizerInit( &sizer, AIO_TRANSFERS_BALANCED, 20, AIOBulkSizerRate( 100000, 4, 0 ), 0 ) );
+    EXPECT_EQ( 15872, AIOBulkSizerGetSize( &sizer ) );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOBulkSizerInit( &sizer, AIO_TRANSFERS_BALANCED, 0, AIOBulkSizerRate( 10, 4, 0 ), 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOBulkSizerSetMinSize( &sizer, 16 * 256 * 2 + 2 ) );
+    EXPECT_EQ( 8704, AIOBulkSizerGetSize( &sizer ) ) << "never less than a whole scan";
+
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOBulkSizerInit( &sizer, (AIOTransferPreference)7, 0, 1000, 0 ) );
+}
+
+TEST(AIOBulkSizer,FollowsTheObservedRate )
+{
+    AIOBulkSizer sizer;
+    unsigned long long now = 1000000000ULL;
+    int i;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOBulkSizerInit( &sizer, AIO_TRANSFERS_BALANCED, 0, AIOBulkSizerRate( 1000, 4, 0 ), 0 ) );
+    ASSERT_EQ( 512, AIOBulkSizerGetSize( &sizer ) );
+
+    /* the board turns out to be running at 8 MB/s */
+    for ( i = 0; i < 50; i ++, now += 1000000 )
+        AIOBulkSizerObserve( &sizer, AIOBulkSizerGetSize( &sizer ), now );
+    EXPECT_EQ( 65536, AIOBulkSizerGetSize( &sizer ) );
+    EXPECT_EQ( 65536, AIOBulkSizerGetMaxSize( &sizer ) );
+
+    /* and back down to 8 KB/s */
+    for ( i = 0; i < 100; i ++, now += 64000000 )
+        AIOBulkSizerObserve( &sizer, 512, now );
+    EXPECT_EQ( 512, AIOBulkSizerGetSize( &sizer ) );
+    EXPECT_LT( sizer.resized, 30u );
+
+    now += 1000000;
+    EXPECT_EQ( 512, AIOBulkSizerObserve( &sizer, 0, now ) ) << "empty completions are not timed";
+}
+
+TEST(AIOBulkSizer,IgnoresJitter )
+{
+    AIOBulkSizer sizer;
+    unsigned long long now = 1000000000ULL;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOBulkSizerInit( &sizer, AIO_TRANSFERS_BALANCED, 0, AIOBulkSizerRate( 100000, 4, 0 ), 0 ) );
+    ASSERT_EQ( 7680, AIOBulkSizerGetSize( &sizer ) );
+
+    /* 9.6 ms a transfer at 800 KB/s, give or take 15% */
+    for ( int i = 0; i < 200; i ++ ) {
+        now += ( i % 2 ? 8160000 : 11040000 );
+        AIOBulkSizerObserve( &sizer, 7680, now );
+    }
+    EXPECT_EQ( 7680, AIOBulkSizerGetSize( &sizer ) );
+    EXPECT_EQ( 0u, sizer.resized );
+}
+
+TEST(AIOBulkSizer,TransfersCoverTheQueue )
+{
+    AIOBulkSizer sizer;
+    AIOBulkSizerInit( &sizer, AIO_TRANSFERS_BALANCED, 0, AIOBulkSizerRate( 100000, 4, 0 ), 0 );
+    EXPECT_EQ( 6, AIOBulkSizerGetTransfers( &sizer, 32 ) ) << "50 ms of 9.6 ms transfers";
+    EXPECT_EQ( 4, AIOBulkSizerGetTransfers( &sizer, 4 ) );
+
+    AIOBulkSizerInit( &sizer, AIO_TRANSFERS_BALANCED, 0, AIOBulkSizerRate( 1000, 4, 0 ), 0 );
+    EXPECT_EQ( 2, AIOBulkSizerGetTransfers( &sizer, 32 ) ) << "one transfer is never enough";
+
+    AIOBulkSizerInit( &sizer, AIO_TRANSFERS_LOW_LATENCY, 0, AIOBulkSizerRate( 100000, 4, 0 ), 0 );
+    EXPECT_EQ( 11, AIOBulkSizerGetTransfers( &sizer, 32 ) );
+}
+
+TEST(AIOBulkSizer,FixedNeverMoves )
+{
+    AIOBulkSizer sizer;
+    unsigned long long now = 1000000000ULL;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOBulkSizerInit( &sizer, AIO_TRANSFERS_FIXED, 0, AIOBulkSizerRate( 1000, 4, 0 ), 31 * 1024 ) );
+    EXPECT_EQ( 31 * 1024, AIOBulkSizerGetSize( &sizer ) );
+    for ( int i = 0; i < 50; i ++, now += 1000000 )
+        AIOBulkSizerObserve( &sizer, 65536, now );
+    EXPECT_EQ( 31 * 1024, AIOBulkSizerGetSize( &sizer ) );
+    EXPECT_EQ( 16, AIOBulkSizerGetTransfers( &sizer, 16 ) );
+
+    AIOBulkSizerInit( &sizer, AIO_TRANSFERS_FIXED, 0, 0, 1000 );
+    EXPECT_EQ( 1024, AIOBulkSizerGetSize( &sizer ) ) << "whole packets";
+    AIOBulkSizerInit( &sizer, AIO_TRANSFERS_FIXED, 0, 0, 0 );
+    EXPECT_EQ( 65536, AIOBulkSizerGetSize( &sizer ) );
+}
+
+class SimBulkSizer : public ::testing::Test
+{
+ protected:
+    virtual void SetUp() {
+        int numAccesDevices = 0;
+        AIOUSB_InitTest();
+        sim = NewAIOSimDevice();
+        ASSERT_TRUE( sim );
+        ASSERT_EQ( 0, AIOSimDeviceAddToDeviceTable( sim, &numAccesDevices, USB_AI16_16A ) );
+        buf = NewAIOContinuousBufForCounts( 0, 4096, NUM_CHANNELS );
+        AIOContinuousBufInitConfiguration( buf );
+        AIOContinuousBufSetStartAndEndChannel( buf, 0, NUM_CHANNELS - 1 );
+        AIOContinuousBufSetAllGainCodeAndDiffMode( buf, AD_GAIN_CODE_10V, AIOUSB_FALSE );
+        AIOContinuousBufSetClock( buf, 1000 );
+        AIOContinuousBufSetEndless( buf, AIOUSB_TRUE );
+    }
+    virtual void TearDown() {
+        DeleteAIOContinuousBuf( buf );
+        DeleteAIOSimDevice( sim );
+        AIODeviceTableClearDevices();
+    }
+
+    /**
+     * @brief Streams for ms, reading everything, and returns the bulk
+     * reads the simulator answered
+     */
+    unsigned long long stream( unsigned ms ) {
+        unsigned short counts[4096 * NUM_CHANNELS];
+        unsigned long long transfers;
+        EXPECT_EQ( AIOUSB_SUCCESS, AIOContinuousBufCallbackStart( buf ) );
+        unsigned long long stop = AIOStatsNow() + ms * 1000000ULL;
+        while ( AIOStatsNow() < stop ) {
+            if ( AIOContinuousBufReadIntegerScanCounts( buf, counts, 4096 * NUM_CHANNELS, 4096 * NUM_CHANNELS ) <= 0 )
+                usleep( 1000 );
+        }
+        size = AIOContinuousBufGetTransferSize( buf );
+        AIOContinuousBufEnd( buf );
+        pthread_mutex_lock( &sim->lock );
+        transfers = sim->bulk_transfers;
+        pthread_mutex_unlock( &sim->lock );
+        return transfers;
+    }
+
+    AIOSimDevice *sim;
+    AIOContinuousBuf *buf;
+    AIORET_TYPE size;
+};
+
+TEST_F(SimBulkSizer,SlowClocksGetSmallTransfers )
+{
+    EXPECT_EQ( AIO_TRANSFERS_BALANCED, AIOContinuousBufGetTransferPreference( buf ) );
+    stream( 300 );
+    EXPECT_EQ( 512, size ) << "10 ms of 1 kHz scans is less than a packet";
+}
+
+TEST_F(SimBulkSizer,FastDeliveryGrowsTransfers )
+{
+    unsigned long long transfers;
+    AIOSimDeviceSetRealTime( sim, AIOUSB_FALSE );
+    transfers = stream( 300 );
+    std::cout << "# " << transfers << " transfers, last of " << size << " bytes unthrottled" << std::endl;
+    EXPECT_EQ( 65536, size ) << "the clock said 8 KB/s, the reads said otherwise";
+}
+
+TEST_F(SimBulkSizer,FixedSizesArePinned )
+{
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetStreamingTransfers( buf, 0, 4096 ) );
+    EXPECT_EQ( AIO_TRANSFERS_FIXED, AIOContinuousBufGetTransferPreference( buf ) );
+    AIOSimDeviceSetRealTime( sim, AIOUSB_FALSE );
+    stream( 100 );
+    EXPECT_EQ( 4096, size );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetTransferPreference( buf, AIO_TRANSFERS_LOW_LATENCY, 0 ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOContinuousBufSetTransferPreference( buf, (AIOTransferPreference)9, 0 ) );
+    stream( 100 );
+    EXPECT_EQ( 16384, size ) << "low latency caps transfers at 16 KB";
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
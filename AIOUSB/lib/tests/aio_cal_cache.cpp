@@ -0,0 +1,144 @@
+/*****************************************************************************
+ * Calibrates a fake USB-AI16-16A from the on-disk calibration cache and
+ * counts the bulk transfers to the SRAM endpoint, checking that a cached
+ * table is used without recalibrating and an unchanged table is never
+ * sent twice.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIOUSB_ADC.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOCalCache.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+using namespace AIOUSB;
+
+#define FAKE_SERIAL 0x0123456789abcdefULL
+
+static int sram_blocks, eeprom_reads, other_requests;
+
+static int fake_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest == AUR_EEPROM_READ ) {
+        uint64_t serial = FAKE_SERIAL;
+        memcpy( data, &serial, MIN( wLength, sizeof(serial) ) );
+        eeprom_reads ++;
+    } else if ( bRequest != AUR_LOAD_BULK_CALIBRATION_BLOCK && bRequest != 0xBB ) {
+        other_requests ++;
+    }
+    if ( request_type == USB_READ_FROM_DEVICE && bRequest != AUR_EEPROM_READ )
+        memset( data, 0, wLength );
+    return wLength;
+}
+
+static int fake_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    if ( endpoint == 0x2 )
+        sram_blocks ++;
+    *actual_length = length;
+    return 0;
+}
+
+class CalCacheDevice : public AIOFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        usb.usb_control_transfer = fake_control_transfer;
+        usb.usb_bulk_transfer    = fake_bulk_transfer;
+        usb.usb_put_config       = USBDevicePutADCConfigBlock;
+        AddFakeDevice( USB_AI16_16A );
+        sram_blocks = eeprom_reads = other_requests = 0;
+
+        strcpy( dir, "/tmp/aiocalcachedevXXXXXX" );
+        ASSERT_TRUE( mkdtemp( dir ) );
+        AIOCalCacheSetDirectory( dir );
+        table.resize( CAL_TABLE_WORDS );
+        for ( int i = 0; i < CAL_TABLE_WORDS; i ++ )
+            table[i] = (unsigned short)( i / 2 + 1000 );
+    }
+    virtual void TearDown() {
+        char cmd[64];
+        sprintf( cmd, "rm -rf %s", dir );
+        ASSERT_EQ( 0, system( cmd ) );
+        AIOCalCacheSetDirectory( NULL );
+        AIOFakeDeviceTest::TearDown();
+    }
+
+    char dir[64];
+    std::vector<unsigned short> table;
+};
+
+TEST_F(CalCacheDevice,UnchangedTableIsNotUploadedAgain )
+{
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_SetCalTable( 0, &table[0] ) );
+    EXPECT_EQ( CAL_TABLE_WORDS / 1024, sram_blocks );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_SetCalTable( 0, &table[0] ) );
+    EXPECT_EQ( CAL_TABLE_WORDS / 1024, sram_blocks ) << "SRAM already holds this table";
+
+    table[7] ++;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_SetCalTable( 0, &table[0] ) );
+    EXPECT_EQ( 2 * CAL_TABLE_WORDS / 1024, sram_blocks );
+}
+
+TEST_F(CalCacheDevice,ClosedOrReaddedBoardGetsTheTableAgain )
+{
+    int numAccesDevices = 0;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_SetCalTable( 0, &table[0] ) );
+    EXPECT_EQ( CAL_TABLE_WORDS / 1024, sram_blocks );
+
+    deviceTable[0].usb_device = NULL;
+    CloseAllDevices();
+    deviceTable[0].usb_device = &usb;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_SetCalTable( 0, &table[0] ) );
+    EXPECT_EQ( 2 * CAL_TABLE_WORDS / 1024, sram_blocks ) << "a closed board's SRAM is not trusted";
+
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numAccesDevices, USB_AI16_16A, &usb );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_SetCalTable( 0, &table[0] ) );
+    EXPECT_EQ( 3 * CAL_TABLE_WORDS / 1024, sram_blocks ) << "nor is a board set up again";
+}
+
+TEST_F(CalCacheDevice,CachedTableSkipsCalibration )
+{
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCalCacheStore( FAKE_SERIAL, USB_AI16_16A, AD_GAIN_CODE_10V, &table[0] ) );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_LoadCachedCal( 0, AD_GAIN_CODE_10V, AIOUSB_TRUE, AIOUSB_TRUE ) );
+    ASSERT_TRUE( dev->hostCalTables[AD_GAIN_CODE_10V] );
+    EXPECT_EQ( 0, memcmp( &table[0], dev->hostCalTables[AD_GAIN_CODE_10V], CAL_TABLE_WORDS * sizeof(unsigned short) ) );
+    EXPECT_EQ( CAL_TABLE_WORDS / 1024, sram_blocks ) << "SRAM gets the 1:1 table, not the host side one";
+    EXPECT_EQ( 0, other_requests ) << "nothing but the serial number is asked of the device";
+    EXPECT_EQ( 1, eeprom_reads );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_LoadCachedCal( 0, AD_GAIN_CODE_10V, AIOUSB_TRUE, AIOUSB_FALSE ) );
+    EXPECT_EQ( CAL_TABLE_WORDS / 1024, sram_blocks ) << "SRAM already holds the 1:1 table";
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_LoadCachedCal( 0, AD_GAIN_CODE_10V, AIOUSB_FALSE, AIOUSB_FALSE ) );
+    EXPECT_EQ( 2 * CAL_TABLE_WORDS / 1024, sram_blocks );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_LoadCachedCal( 0, AD_GAIN_CODE_10V, AIOUSB_FALSE, AIOUSB_TRUE ) );
+    EXPECT_EQ( 2 * CAL_TABLE_WORDS / 1024, sram_blocks ) << "SRAM already holds this table";
+    EXPECT_EQ( 0, other_requests );
+
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, AIOUSB_ADC_LoadCachedCal( 0, (ADGainCode)AD_NUM_GAIN_CODES, AIOUSB_TRUE, AIOUSB_TRUE ) );
+}
+
+TEST_F(CalCacheDevice,OneEntryServesEveryRange )
+{
+    AIORESULT result;
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOCalCacheStore( FAKE_SERIAL, USB_AI16_16A, AD_GAIN_CODE_10V, &table[0] ) );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_LoadCachedCal( 0, AD_GAIN_CODE_0_5V, AIOUSB_TRUE, AIOUSB_TRUE ) );
+    ASSERT_TRUE( dev->hostCalTables[AD_GAIN_CODE_0_5V] );
+    EXPECT_EQ( 0, memcmp( &table[0], dev->hostCalTables[AD_GAIN_CODE_0_5V], CAL_TABLE_WORDS * sizeof(unsigned short) ) );
+    EXPECT_TRUE( dev->hostCalTables[AD_GAIN_CODE_10V] == NULL );
+    EXPECT_EQ( 0, other_requests ) << "the converter's table is the same for every range, no calibration";
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
@@ -10,6 +10,9 @@
 #include "gtest/gtest.h"
 #include "tap.h"
 #include <iostream>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
 using namespace AIOUSB;
 
 
@@ -161,6 +164,76 @@ TEST(AIOContinuousBuf, CanAssignDeviceToConfig) {
 
 }
 
+static bool poll_readable( int fd, int timeout_ms )
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll( &pfd, 1, timeout_ms ) == 1 && ( pfd.revents & POLLIN );
+}
+
+TEST(AIOContinuousBuf,PollFdFollowsWatermark )
+{
+    int num_channels = 4;
+    unsigned short counts[4*20] = {0};
+    AIOContinuousBuf *buf = NewAIOContinuousBufTesting( 0, 100, num_channels, AIOUSB_TRUE );
+
+    AIORET_TYPE fd = AIOContinuousBufGetPollFd( buf );
+    ASSERT_GE( fd, 0 );
+    EXPECT_EQ( fd, AIOContinuousBufGetPollFd( buf ) );
+    EXPECT_EQ( 1, AIOContinuousBufGetNotifyWatermark( buf ) );
+    EXPECT_FALSE( poll_readable( fd, 0 ) );
+
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOContinuousBufSetNotifyWatermark( buf, 0 ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetNotifyWatermark( buf, 10 ) );
+    AIOContinuousBufPushN( buf, counts, 9*num_channels );
+    EXPECT_FALSE( poll_readable( fd, 0 ) ) << "9 scans are under the watermark";
+    AIOContinuousBufPushN( buf, counts, num_channels );
+    EXPECT_TRUE( poll_readable( fd, 0 ) );
+    EXPECT_TRUE( poll_readable( fd, 0 ) ) << "stays readable until scans are taken";
+
+    AIOContinuousBufPopN( buf, counts, 2*num_channels );
+    EXPECT_FALSE( poll_readable( fd, 0 ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetNotifyWatermark( buf, 5 ) );
+    EXPECT_TRUE( poll_readable( fd, 0 ) ) << "lowering the watermark re-evaluates";
+
+    DeleteAIOContinuousBuf( buf );
+}
+
+static void *slow_producer( void *object )
+{
+    AIOContinuousBuf *buf = (AIOContinuousBuf *)object;
+    unsigned short scan[2] = { 1, 2 };
+    while ( buf->status == RUNNING ) {
+        if ( AIOContinuousBufCountScansAvailable( buf ) < 50 )
+            AIOContinuousBufPushN( buf, scan, 2 );
+        usleep( 500 );
+    }
+    return NULL;
+}
+
+TEST(AIOContinuousBuf,PollFdWakesReaderAndSignalsEnd )
+{
+    unsigned short counts[2*100];
+    AIOContinuousBuf *buf = NewAIOContinuousBufTesting( 0, 100, 2, AIOUSB_TRUE );
+    AIORET_TYPE fd = AIOContinuousBufGetPollFd( buf );
+    ASSERT_GE( fd, 0 );
+    AIOContinuousBufSetNotifyWatermark( buf, 20 );
+
+    buf->status = RUNNING;
+    ASSERT_EQ( 0, pthread_create( &buf->worker, NULL, slow_producer, buf ) );
+    for ( int i = 0; i < 3; i ++ ) {
+        ASSERT_TRUE( poll_readable( fd, 2000 ) );
+        EXPECT_GE( AIOContinuousBufCountScansAvailable( buf ), 20 );
+        AIOContinuousBufReadCompleteScanCounts( buf, counts, sizeof(counts)/sizeof(counts[0]) );
+    }
+
+    AIOContinuousBufEnd( buf );
+    AIOContinuousBufReadCompleteScanCounts( buf, counts, sizeof(counts)/sizeof(counts[0]) );
+    EXPECT_EQ( 0, AIOContinuousBufCountScansAvailable( buf ) );
+    EXPECT_TRUE( poll_readable( fd, 0 ) ) << "readable once the acquisition is over";
+
+    DeleteAIOContinuousBuf( buf );
+}
+
 #include <unistd.h>
 #include <stdio.h>
 
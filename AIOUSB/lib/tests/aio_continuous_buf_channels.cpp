@@ -0,0 +1,84 @@
+/*****************************************************************************
+ * Pushes numbered scans through small AIOContinuousBufs and reads them back
+ * one array per channel, for channel counts taking each of the deinterleave
+ * kernels. Pushes and reads of uneven sizes keep reads crossing the end of
+ * the ring, some of them in the middle of a scan.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIOContinuousBuffer.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+#include <vector>
+using namespace AIOUSB;
+
+#define RING_SCANS 50
+
+static unsigned short count_for( unsigned scan, unsigned ch )
+{
+    return (unsigned short)( scan * 37 + ch * 1009 );
+}
+
+class ChannelCounts : public ::testing::TestWithParam<int> {};
+TEST_P(ChannelCounts,MatchInterleavedOrder )
+{
+    unsigned num_channels = GetParam();
+    AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, RING_SCANS, num_channels );
+    std::vector<unsigned short> scans( RING_SCANS * num_channels );
+    std::vector<std::vector<unsigned short> > store( num_channels, std::vector<unsigned short>( RING_SCANS ) );
+    std::vector<unsigned short *> channels( num_channels );
+    unsigned pushed = 0, read = 0;
+
+    for ( unsigned ch = 0; ch < num_channels; ch ++ )
+        channels[ch] = &store[ch][0];
+
+    for ( int round = 0; round < 60; round ++ ) {
+        unsigned num = MIN( 1 + ( round * 13 ) % 31, RING_SCANS - 1 - ( pushed - read ) );
+        for ( unsigned i = 0; i < num; i ++ )
+            for ( unsigned ch = 0; ch < num_channels; ch ++ )
+                scans[i*num_channels+ch] = count_for( pushed + i, ch );
+        ASSERT_GE( AIOContinuousBufPushN( buf, &scans[0], num * num_channels ), 0 );
+        pushed += num;
+
+        AIORET_TYPE got = AIOContinuousBufReadChannelCounts( buf, &channels[0], 1 + ( round * 7 ) % 29 );
+        ASSERT_GE( got, 0 );
+        for ( unsigned ch = 0; ch < num_channels; ch ++ )
+            for ( int i = 0; i < got; i ++ )
+                ASSERT_EQ( count_for( read + i, ch ), store[ch][i] ) << "scan " << read + i << " channel " << ch;
+        read += got;
+    }
+    EXPECT_GT( read, 5 * RING_SCANS ) << "reads should have wrapped the ring several times";
+    EXPECT_EQ( pushed - read, AIOContinuousBufCountScansAvailable( buf ) );
+
+    DeleteAIOContinuousBuf( buf );
+}
+
+INSTANTIATE_TEST_CASE_P( Kernels, ChannelCounts, ::testing::Values( 1, 3, 4, 8, 12, 16, 24 ) );
+
+TEST(ChannelVolts,EagerVoltsBuffer )
+{
+    unsigned num_channels = 5;
+    AIOContinuousBuf *buf = NewAIOContinuousBufForVolts( 0, RING_SCANS, num_channels, 0 );
+    AIOFifoVolts *fifo = (AIOFifoVolts *)buf->fifo;
+    double scans[10*5], store[5][10];
+    double *channels[5] = { store[0], store[1], store[2], store[3], store[4] };
+    unsigned short counts[5];
+
+    for ( int i = 0; i < 10 * 5; i ++ )
+        scans[i] = i * 0.5;
+    fifo->PushN( fifo, scans, 10 * 5 );
+
+    ASSERT_EQ( 10, AIOContinuousBufReadChannelVolts( buf, channels, 20 ) );
+    for ( int scan = 0; scan < 10; scan ++ )
+        for ( unsigned ch = 0; ch < num_channels; ch ++ )
+            EXPECT_EQ( scans[scan*num_channels+ch], store[ch][scan] );
+
+    unsigned short *count_channels[5] = { counts, counts, counts, counts, counts };
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER, AIOContinuousBufReadChannelCounts( buf, count_channels, 1 ) );
+    DeleteAIOContinuousBuf( buf );
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
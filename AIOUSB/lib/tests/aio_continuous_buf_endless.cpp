@@ -0,0 +1,208 @@
+/*****************************************************************************
+ * Streams a counting pattern from a fake USB-AI16-16A through an endless
+ * AIOContinuousBuf whose ring is much smaller than the stream, checking
+ * each overrun policy keeps whole scans in order and accounts for every
+ * scan it loses. Transfers end part way through scans.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOContinuousBuffer.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include <unistd.h>
+using namespace AIOUSB;
+
+#define NUM_CHANNELS 4
+#define RING_SCANS   64
+
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long produced, limit, calls;
+
+static int fake_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    pthread_mutex_lock( &fake_lock );
+    unsigned long words = std::min( (unsigned long)length / 2, 1 + ( calls ++ * 7 ) % 45 );
+    words = std::min( words, limit - produced );
+    for ( unsigned long i = 0; i < words; i ++ )
+        ((unsigned short *)data)[i] = (unsigned short)( produced + i );
+    produced += words;
+    pthread_mutex_unlock( &fake_lock );
+
+    *actual_length = words * 2;
+    if ( !words )
+        usleep( 200 );
+    return 0;
+}
+
+static void set_limit( unsigned long scans )
+{
+    pthread_mutex_lock( &fake_lock );
+    limit = scans * NUM_CHANNELS;
+    pthread_mutex_unlock( &fake_lock );
+}
+
+static unsigned long get_produced()
+{
+    pthread_mutex_lock( &fake_lock );
+    unsigned long tmp = produced;
+    pthread_mutex_unlock( &fake_lock );
+    return tmp;
+}
+
+/**
+ * @brief Checks that counts holds whole scans of the pattern in order
+ * @return the scan number of the last scan
+ */
+static long check_scans( unsigned short *counts, int num_scans, long previous )
+{
+    for ( int scan = 0; scan < num_scans; scan ++ ) {
+        unsigned short first = counts[scan*NUM_CHANNELS];
+        EXPECT_EQ( 0, first % NUM_CHANNELS ) << "scan " << scan << " is out of step with the channels";
+        for ( int ch = 1; ch < NUM_CHANNELS; ch ++ )
+            EXPECT_EQ( (unsigned short)( first + ch ), counts[scan*NUM_CHANNELS+ch] );
+        long number = first / NUM_CHANNELS;
+        EXPECT_GT( number, previous );
+        previous = number;
+    }
+    return previous;
+}
+
+class EndlessSetup : public AIOFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        usb.usb_bulk_transfer    = fake_bulk_transfer;
+        usb.usb_put_config       = USBDevicePutADCConfigBlock;
+        AddFakeDevice( USB_AI16_16A );
+        produced = limit = calls = 0;
+
+        buf = NewAIOContinuousBufForCounts( 0, RING_SCANS, NUM_CHANNELS );
+        AIOContinuousBufSetClock( buf, 1000 );
+        ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetEndless( buf, AIOUSB_TRUE ) );
+    }
+    virtual void TearDown() {
+        DeleteAIOContinuousBuf( buf );
+        AIOFakeDeviceTest::TearDown();
+    }
+
+    /**
+     * @brief Lets scans out of the fake device and waits until the worker
+     *        has taken all of them
+     */
+    void produce( unsigned long scans ) {
+        set_limit( scans );
+        for ( int tries = 0; tries < 5000 && get_produced() < limit; tries ++ )
+            usleep( 1000 );
+        ASSERT_EQ( limit, get_produced() );
+        usleep( 20000 );
+    }
+
+    AIOContinuousBuf *buf;
+};
+
+TEST_F(EndlessSetup,KeepsStreamingPastTheRing )
+{
+    unsigned short counts[RING_SCANS*NUM_CHANNELS];
+    unsigned long total = 50 * RING_SCANS, got = 0;
+    long last = -1;
+
+    AIOContinuousBufSetOverrunPolicy( buf, AIOCONTINUOUS_BUF_BLOCK );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufCallbackStart( buf ) );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_DEVICE_SETTING, AIOContinuousBufSetEndless( buf, AIOUSB_FALSE ) );
+    set_limit( total );
+
+    for ( int tries = 0; got < total && tries < 20000; tries ++ ) {
+        AIORET_TYPE scans = AIOContinuousBufReadIntegerScanCounts( buf, counts, RING_SCANS*NUM_CHANNELS, RING_SCANS*NUM_CHANNELS );
+        ASSERT_GE( scans, 0 );
+        last = check_scans( counts, scans, last );
+        got += scans;
+        if ( !scans )
+            usleep( 500 );
+    }
+    EXPECT_EQ( total, got );
+    EXPECT_EQ( (long)total - 1, last );
+    EXPECT_EQ( RUNNING, AIOContinuousBufGetStatus( buf ) ) << "an endless stream only stops when ended";
+    EXPECT_EQ( 0, AIOContinuousBufGetDroppedScans( buf ) );
+
+    AIOContinuousBufEnd( buf );
+}
+
+TEST_F(EndlessSetup,DropNewestKeepsTheOldestScans )
+{
+    unsigned short counts[RING_SCANS*NUM_CHANNELS];
+    unsigned long total = 10 * RING_SCANS;
+
+    EXPECT_EQ( AIOCONTINUOUS_BUF_DROP_NEWEST, AIOContinuousBufGetOverrunPolicy( buf ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufCallbackStart( buf ) );
+    produce( total );
+
+    AIORET_TYPE kept = AIOContinuousBufCountScansAvailable( buf );
+    EXPECT_EQ( RING_SCANS, kept );
+    EXPECT_EQ( total - kept, (unsigned long)AIOContinuousBufGetDroppedScans( buf ) );
+    EXPECT_GT( AIOContinuousBufGetOverruns( buf ), 0 );
+
+    ASSERT_EQ( kept, AIOContinuousBufReadIntegerScanCounts( buf, counts, RING_SCANS*NUM_CHANNELS, RING_SCANS*NUM_CHANNELS ) );
+    EXPECT_EQ( kept - 1, check_scans( counts, kept, -1 ) );
+
+    /* once there is room again the stream carries on, in step */
+    produce( total + 8 );
+    ASSERT_EQ( 8, AIOContinuousBufReadIntegerScanCounts( buf, counts, RING_SCANS*NUM_CHANNELS, RING_SCANS*NUM_CHANNELS ) );
+    EXPECT_EQ( (long)total + 7, check_scans( counts, 8, kept - 1 ) );
+
+    AIOContinuousBufEnd( buf );
+}
+
+TEST_F(EndlessSetup,OverwriteOldestKeepsTheLatestScans )
+{
+    unsigned short counts[RING_SCANS*NUM_CHANNELS];
+    unsigned long total = 10 * RING_SCANS + 3;
+
+    AIOContinuousBufSetOverrunPolicy( buf, AIOCONTINUOUS_BUF_OVERWRITE_OLDEST );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufCallbackStart( buf ) );
+    produce( total );
+
+    AIORET_TYPE kept = AIOContinuousBufCountScansAvailable( buf );
+    EXPECT_EQ( RING_SCANS, kept );
+    EXPECT_EQ( total - kept, (unsigned long)AIOContinuousBufGetDroppedScans( buf ) );
+
+    ASSERT_EQ( kept, AIOContinuousBufReadIntegerScanCounts( buf, counts, RING_SCANS*NUM_CHANNELS, RING_SCANS*NUM_CHANNELS ) );
+    EXPECT_EQ( (long)total - 1, check_scans( counts, kept, total - kept - 1 ) );
+
+    AIOContinuousBufEnd( buf );
+}
+
+TEST_F(EndlessSetup,OverwriteSparesAcquiredScans )
+{
+    AIOFifoRegion region;
+    unsigned long total = 4 * RING_SCANS;
+
+    AIOContinuousBufSetOverrunPolicy( buf, AIOCONTINUOUS_BUF_OVERWRITE_OLDEST );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufCallbackStart( buf ) );
+    produce( RING_SCANS );
+    ASSERT_EQ( 10, AIOContinuousBufAcquireScans( buf, &region, 10 ) );
+    produce( total );
+
+    EXPECT_EQ( 0, ((unsigned short *)region.data[0])[0] ) << "held scans were overwritten";
+    EXPECT_EQ( total - RING_SCANS, (unsigned long)AIOContinuousBufGetDroppedScans( buf ) );
+    EXPECT_EQ( 10, AIOContinuousBufCommitScans( buf, 10 ) );
+    EXPECT_EQ( RING_SCANS - 10, AIOContinuousBufCountScansAvailable( buf ) );
+
+    AIOContinuousBufEnd( buf );
+}
+
+TEST_F(EndlessSetup,RejectsBadPolicy )
+{
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIOContinuousBufSetOverrunPolicy( buf, (AIOContinuousBufOverrunPolicy)7 ) );
+    EXPECT_EQ( AIOCONTINUOUS_BUF_DROP_NEWEST, AIOContinuousBufGetOverrunPolicy( buf ) );
+    EXPECT_EQ( AIOUSB_TRUE, AIOContinuousBufGetEndless( buf ) );
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
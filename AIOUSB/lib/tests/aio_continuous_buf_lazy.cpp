@@ -0,0 +1,217 @@
+/*****************************************************************************
+ * Streams oversampled counts from a fake USB-AI16-16A into a lazy volts
+ * AIOContinuousBuf and checks the volts converted at read time, in double
+ * and single precision, against the same counts converted by hand. The
+ * ring is small enough that reads keep crossing its end.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOContinuousBuffer.h"
+#include "AIOCountsConverter.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+#include <algorithm>
+#include <pthread.h>
+#include <unistd.h>
+using namespace AIOUSB;
+
+#define NUM_CHANNELS    4
+#define NUM_OVERSAMPLES 2
+#define RING_SCANS      10
+#define SCAN_COUNTS     ( NUM_CHANNELS * ( NUM_OVERSAMPLES + 1 ) )
+
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long produced, limit, calls;
+
+static unsigned short pattern( unsigned long i )
+{
+    unsigned long scan = i / SCAN_COUNTS, ch = ( i % SCAN_COUNTS ) / ( NUM_OVERSAMPLES + 1 ), os = i % ( NUM_OVERSAMPLES + 1 );
+    return (unsigned short)( scan * 977 + ch * 16001 + os * 311 );
+}
+
+static int fake_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    pthread_mutex_lock( &fake_lock );
+    unsigned long words = std::min( (unsigned long)length / 2, 1 + ( calls ++ * 5 ) % 29 );
+    words = std::min( words, limit - produced );
+    for ( unsigned long i = 0; i < words; i ++ )
+        ((unsigned short *)data)[i] = pattern( produced + i );
+    produced += words;
+    pthread_mutex_unlock( &fake_lock );
+
+    *actual_length = words * 2;
+    if ( !words )
+        usleep( 200 );
+    return 0;
+}
+
+class LazyVoltsSetup : public AIOFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        usb.usb_bulk_transfer    = fake_bulk_transfer;
+        usb.usb_put_config       = USBDevicePutADCConfigBlock;
+        AddFakeDevice( USB_AI16_16A );
+        produced = limit = calls = 0;
+
+        buf = NewAIOContinuousBufForLazyVolts( 0, RING_SCANS, NUM_CHANNELS, NUM_OVERSAMPLES );
+        AIOContinuousBufSetClock( buf, 1000 );
+    }
+    virtual void TearDown() {
+        DeleteAIOContinuousBuf( buf );
+        AIOFakeDeviceTest::TearDown();
+    }
+
+    /**
+     * @brief Volts the hand conversion gives for channel ch of scan
+     */
+    double expected( AIOGainRange *ranges, unsigned long scan, unsigned ch ) {
+        unsigned sum = 0;
+        for ( unsigned os = 0; os <= NUM_OVERSAMPLES; os ++ )
+            sum += pattern( scan * SCAN_COUNTS + ch * ( NUM_OVERSAMPLES + 1 ) + os );
+        return ( ranges[ch].max - ranges[ch].min ) / 65536 * (unsigned short)( sum / ( NUM_OVERSAMPLES + 1 ) ) + ranges[ch].min;
+    }
+
+    AIOContinuousBuf *buf;
+};
+
+TEST_F(LazyVoltsSetup,RingHoldsCounts )
+{
+    EXPECT_EQ( AIOUSB_TRUE, buf->lazy_volts );
+    EXPECT_EQ( (unsigned)sizeof(unsigned short), buf->fifo->refsize );
+    EXPECT_LT( buf->fifo->size, NUM_CHANNELS * ( NUM_OVERSAMPLES + 1 ) * ( RING_SCANS + 1 ) * sizeof(unsigned short) );
+
+    double volts[NUM_CHANNELS];
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER, AIOContinuousBufReadScanVolts( buf, volts, 1 ) ) << "nothing to convert with before the start";
+
+    AIOContinuousBuf *counts = NewAIOContinuousBufForCounts( 0, RING_SCANS, NUM_CHANNELS );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_AIOCONTINUOUS_BUFFER, AIOContinuousBufReadScanVolts( counts, volts, 1 ) );
+    DeleteAIOContinuousBuf( counts );
+}
+
+TEST_F(LazyVoltsSetup,ConvertsOnReadAcrossTheRingEnd )
+{
+    unsigned long total = 30 * RING_SCANS, got = 0;
+    double volts[3*NUM_CHANNELS];
+    float fvolts[3*NUM_CHANNELS];
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetEndless( buf, AIOUSB_TRUE ) );
+    AIOContinuousBufSetOverrunPolicy( buf, AIOCONTINUOUS_BUF_BLOCK );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufCallbackStart( buf ) );
+    AIOGainRange *ranges = NewAIOGainRangeFromADCConfigBlock( AIOUSBDeviceGetADCConfigBlock( AIODeviceTableGetDeviceAtIndex( 0, &result ) ) );
+    ASSERT_TRUE( ranges );
+
+    pthread_mutex_lock( &fake_lock );
+    limit = total * SCAN_COUNTS;
+    pthread_mutex_unlock( &fake_lock );
+
+    for ( int tries = 0; got < total && tries < 20000; tries ++ ) {
+        AIORET_TYPE scans;
+        if ( tries % 2 ) {
+            scans = AIOContinuousBufReadScanVolts( buf, volts, 3 );
+            ASSERT_GE( scans, 0 );
+            for ( int i = 0; i < scans * NUM_CHANNELS; i ++ )
+                ASSERT_DOUBLE_EQ( expected( ranges, got + i / NUM_CHANNELS, i % NUM_CHANNELS ), volts[i] ) << "scan " << got + i / NUM_CHANNELS;
+        } else {
+            scans = AIOContinuousBufReadScanVoltsFloat( buf, fvolts, 3 );
+            ASSERT_GE( scans, 0 );
+            for ( int i = 0; i < scans * NUM_CHANNELS; i ++ )
+                ASSERT_FLOAT_EQ( (float)expected( ranges, got + i / NUM_CHANNELS, i % NUM_CHANNELS ), fvolts[i] ) << "scan " << got + i / NUM_CHANNELS;
+        }
+        got += scans;
+        if ( !scans )
+            usleep( 500 );
+    }
+    EXPECT_EQ( total, got );
+    EXPECT_EQ( 0, AIOContinuousBufGetDroppedScans( buf ) );
+
+    AIOContinuousBufEnd( buf );
+    DeleteAIOGainRange( ranges );
+}
+
+TEST_F(LazyVoltsSetup,ChannelReadsMatchScanReads )
+{
+    double volts[RING_SCANS*NUM_CHANNELS], store[NUM_CHANNELS][RING_SCANS];
+    double *channels[NUM_CHANNELS] = { store[0], store[1], store[2], store[3] };
+    unsigned long got = 0;
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetEndless( buf, AIOUSB_TRUE ) );
+    AIOContinuousBufSetOverrunPolicy( buf, AIOCONTINUOUS_BUF_BLOCK );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufCallbackStart( buf ) );
+    AIORESULT result;
+    AIOGainRange *ranges = NewAIOGainRangeFromADCConfigBlock( AIOUSBDeviceGetADCConfigBlock( AIODeviceTableGetDeviceAtIndex( 0, &result ) ) );
+    ASSERT_TRUE( ranges );
+
+    pthread_mutex_lock( &fake_lock );
+    limit = 10 * RING_SCANS * SCAN_COUNTS;
+    pthread_mutex_unlock( &fake_lock );
+
+    for ( int tries = 0; got < 10 * RING_SCANS && tries < 20000; tries ++ ) {
+        AIORET_TYPE scans = AIOContinuousBufReadChannelVolts( buf, channels, 1 + tries % 7 );
+        ASSERT_GE( scans, 0 );
+        for ( int i = 0; i < scans; i ++ )
+            for ( int ch = 0; ch < NUM_CHANNELS; ch ++ )
+                ASSERT_DOUBLE_EQ( expected( ranges, got + i, ch ), store[ch][i] ) << "scan " << got + i;
+        got += scans;
+        if ( !scans )
+            usleep( 500 );
+    }
+    EXPECT_EQ( 10 * RING_SCANS, got );
+    EXPECT_EQ( 0, AIOContinuousBufReadScanVolts( buf, volts, RING_SCANS ) );
+
+    AIOContinuousBufEnd( buf );
+    DeleteAIOGainRange( ranges );
+}
+
+TEST_F(LazyVoltsSetup,AppliesHostCalibration )
+{
+    double volts[RING_SCANS*NUM_CHANNELS];
+    unsigned long got = 0;
+    AIORESULT result;
+    AIOUSBDevice *dev = AIODeviceTableGetDeviceAtIndex( 0, &result );
+    ADGainCode code = (ADGainCode)ADCConfigBlockGetGainCode( AIOUSBDeviceGetADCConfigBlock( dev ), 0 );
+
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, AIOUSB_ADC_SetHostCalLinear( 0, (ADGainCode)AD_NUM_GAIN_CODES, 1.0, 0.0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_SetHostCalLinear( 0, code, 0.5, 1000.0 ) );
+    ASSERT_TRUE( dev->hostCalTables[code] );
+    EXPECT_EQ( 1000, dev->hostCalTables[code][0] );
+    EXPECT_EQ( 33768, dev->hostCalTables[code][65535] );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetEndless( buf, AIOUSB_TRUE ) );
+    AIOContinuousBufSetOverrunPolicy( buf, AIOCONTINUOUS_BUF_BLOCK );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufCallbackStart( buf ) );
+    /* the acquisition keeps the tables it started with */
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_ADC_SetHostCalTable( 0, code, NULL ) );
+    AIOGainRange *ranges = NewAIOGainRangeFromADCConfigBlock( AIOUSBDeviceGetADCConfigBlock( dev ) );
+    ASSERT_TRUE( ranges );
+
+    pthread_mutex_lock( &fake_lock );
+    limit = 3 * RING_SCANS * SCAN_COUNTS;
+    pthread_mutex_unlock( &fake_lock );
+
+    for ( int tries = 0; got < 3 * RING_SCANS && tries < 20000; tries ++ ) {
+        AIORET_TYPE scans = AIOContinuousBufReadScanVolts( buf, volts, RING_SCANS );
+        ASSERT_GE( scans, 0 );
+        for ( int i = 0; i < scans * NUM_CHANNELS; i ++ ) {
+            unsigned long scan = got + i / NUM_CHANNELS;
+            unsigned ch = i % NUM_CHANNELS, sum = 0;
+            for ( unsigned os = 0; os <= NUM_OVERSAMPLES; os ++ )
+                sum += (unsigned)( 0.5 * pattern( scan * SCAN_COUNTS + ch * ( NUM_OVERSAMPLES + 1 ) + os ) + 1000.5 );
+            ASSERT_DOUBLE_EQ( ( ranges[ch].max - ranges[ch].min ) / 65536 * (unsigned short)( sum / ( NUM_OVERSAMPLES + 1 ) ) + ranges[ch].min, volts[i] ) << "scan " << scan;
+        }
+        got += scans;
+        if ( !scans )
+            usleep( 500 );
+    }
+    EXPECT_EQ( 3 * RING_SCANS, got );
+
+    AIOContinuousBufEnd( buf );
+    DeleteAIOGainRange( ranges );
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
@@ -0,0 +1,268 @@
+/*****************************************************************************
+ * Drives the AIOContinuousBuf asynchronous transfer engine against a mock
+ * libusb: transfers are queued and resubmitted, completions handed over
+ * through staging arrive in order even when another board's worker runs
+ * the callbacks, the sizer parks transfers it doesn't want in flight, and
+ * stopping waits for transfers the device is slow to give back instead
+ * of leaving them for a late completion to trip over.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIOContinuousBuffer.h"
+#include "AIOBulkSizer.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+#include <deque>
+#include <set>
+#include <pthread.h>
+#include <unistd.h>
+using namespace AIOUSB;
+
+namespace AIOUSB {
+AIORET_TYPE aiocontbuf_get_data( AIOContinuousBuf *buf, USBDevice *usb, unsigned char endpoint, unsigned char *data, int datasize, int *bytes, unsigned timeout );
+}
+
+#define NUM_CHANNELS   4
+#define AHEAD_WORDS    ( 16*1024 )      /* completed but unread, well inside staging */
+
+/*--------------------------------  mock libusb  -------------------------------*/
+static pthread_mutex_t events_lock = PTHREAD_MUTEX_INITIALIZER;  /* libusb runs one completion at a time */
+static pthread_mutex_t queue_lock  = PTHREAD_MUTEX_INITIALIZER;
+static std::deque<struct libusb_transfer *> queued;
+static std::set<struct libusb_transfer *> cancelled;
+static unsigned long submits, produced, consumed, most_queued;
+static volatile bool stuck;                                      /* nothing completes, not even cancels */
+static bool broken;                                              /* the next completion fails */
+
+struct libusb_transfer *libusb_alloc_transfer( int iso_packets )
+{
+    return (struct libusb_transfer *)calloc( 1, sizeof(struct libusb_transfer) );
+}
+
+void libusb_free_transfer( struct libusb_transfer *xfer )
+{
+    free( xfer );
+}
+
+int libusb_submit_transfer( struct libusb_transfer *xfer )
+{
+    pthread_mutex_lock( &queue_lock );
+    queued.push_back( xfer );
+    submits ++;
+    most_queued = std::max( most_queued, (unsigned long)queued.size() );
+    pthread_mutex_unlock( &queue_lock );
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_cancel_transfer( struct libusb_transfer *xfer )
+{
+    int retval = LIBUSB_ERROR_NOT_FOUND;
+    pthread_mutex_lock( &queue_lock );
+    for ( size_t i = 0; i < queued.size(); i ++ ) {
+        if ( queued[i] == xfer ) {
+            cancelled.insert( xfer );
+            retval = LIBUSB_SUCCESS;
+        }
+    }
+    pthread_mutex_unlock( &queue_lock );
+    return retval;
+}
+
+/**
+ * @brief Completes the oldest queued transfer with the next stretch of a
+ * counting pattern, or cancels it, unless the reader is too far behind
+ */
+int libusb_handle_events_timeout_completed( libusb_context *ctx, struct timeval *tv, int *completed )
+{
+    struct libusb_transfer *xfer = NULL;
+
+    pthread_mutex_lock( &events_lock );
+    pthread_mutex_lock( &queue_lock );
+    if ( !stuck && !queued.empty() ) {
+        xfer = queued.front();
+        if ( cancelled.erase( xfer ) ) {
+            xfer->status = LIBUSB_TRANSFER_CANCELLED;
+            xfer->actual_length = 0;
+        } else if ( broken ) {
+            xfer->status = LIBUSB_TRANSFER_ERROR;
+            xfer->actual_length = 0;
+            broken = false;
+        } else if ( produced - __atomic_load_n( &consumed, __ATOMIC_ACQUIRE ) < AHEAD_WORDS ) {
+            xfer->status = LIBUSB_TRANSFER_COMPLETED;
+            xfer->actual_length = xfer->length;
+            for ( int i = 0; i < xfer->length / 2; i ++ )
+                ((unsigned short *)xfer->buffer)[i] = (unsigned short)( produced ++ );
+        } else {
+            xfer = NULL;
+        }
+        if ( xfer )
+            queued.pop_front();
+    }
+    pthread_mutex_unlock( &queue_lock );
+
+    if ( xfer )
+        xfer->callback( xfer );
+    pthread_mutex_unlock( &events_lock );
+
+    if ( !xfer )
+        usleep( 1000 );
+    return LIBUSB_SUCCESS;
+}
+
+static unsigned long queued_size()
+{
+    pthread_mutex_lock( &queue_lock );
+    unsigned long tmp = queued.size();
+    pthread_mutex_unlock( &queue_lock );
+    return tmp;
+}
+
+/*---------------------------------  fixture  ---------------------------------*/
+class AsyncTransfers : public ::testing::Test
+{
+ protected:
+    virtual void SetUp() {
+        queued.clear();
+        cancelled.clear();
+        submits = produced = consumed = most_queued = 0;
+        stuck = broken = false;
+        usb = (USBDevice *)calloc( 1, sizeof(USBDevice) );
+        usb->deviceHandle = (libusb_device_handle *)&handle;
+        buf = NewAIOContinuousBufForCounts( 0, 4096, NUM_CHANNELS );
+    }
+    virtual void TearDown() {
+        if ( buf )
+            DeleteAIOContinuousBuf( buf );
+        free( usb );
+    }
+
+    /**
+     * @brief Reads words through aiocontbuf_get_data as the worker does and
+     * checks they carry on the counting pattern
+     */
+    void read_words( unsigned long words ) {
+        static unsigned char data[256*1024];
+        unsigned long start = consumed;
+        int bytes;
+        while ( consumed < start + words ) {
+            aiocontbuf_get_data( buf, usb, 0x86, data, sizeof(data), &bytes, 10 );
+            for ( int i = 0; i < bytes / 2; i ++ )
+                ASSERT_EQ( (unsigned short)( consumed + i ), ((unsigned short *)data)[i] ) << "at word " << consumed + i;
+            __atomic_add_fetch( &consumed, bytes / 2, __ATOMIC_RELEASE );
+        }
+    }
+
+    int handle;
+    USBDevice *usb;
+    AIOContinuousBuf *buf;
+};
+
+TEST_F(AsyncTransfers,QueuesAndResubmits )
+{
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetStreamingTransfers( buf, 8, 4096 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufStartTransfers( buf, usb ) );
+    ASSERT_TRUE( buf->transfers != NULL );
+    EXPECT_EQ( 8u, queued_size() );
+
+    read_words( 1024*1024 );
+    EXPECT_GE( submits, 1024*1024*2 / 4096u ) << "every completion was resubmitted";
+    EXPECT_EQ( 8u, queued_size() );
+    EXPECT_EQ( 8u, most_queued );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOContinuousBufStopTransfers( buf ) );
+    EXPECT_TRUE( buf->transfers == NULL );
+    EXPECT_EQ( 0u, queued_size() ) << "cancellations were all collected";
+}
+
+/**
+ * @brief Every engine pumps the default context, so another board's worker
+ * can run this buffer's completions while this worker drains staging
+ */
+static volatile bool pumping;
+static void *pump_events( void *object )
+{
+    while ( pumping ) {
+        struct timeval tv = { 0, 1000 };
+        libusb_handle_events_timeout_completed( NULL, &tv, NULL );
+    }
+    return NULL;
+}
+
+TEST_F(AsyncTransfers,CompletionsOnAnotherThread )
+{
+    pthread_t other;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetStreamingTransfers( buf, 16, 2048 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufStartTransfers( buf, usb ) );
+
+    pumping = true;
+    pthread_create( &other, NULL, pump_events, NULL );
+    read_words( 4*1024*1024 );
+    pumping = false;
+    pthread_join( other, NULL );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOContinuousBufStopTransfers( buf ) );
+    EXPECT_EQ( 0u, queued_size() );
+}
+
+TEST_F(AsyncTransfers,SizerParksTransfers )
+{
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetStreamingTransfers( buf, 32, 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOBulkSizerInit( &buf->sizer, AIO_TRANSFERS_BALANCED, 0, AIOBulkSizerRate( 100000, NUM_CHANNELS, 0 ), 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufStartTransfers( buf, usb ) );
+    EXPECT_EQ( 6u, queued_size() ) << "50 ms of 9.6 ms transfers, the rest parked";
+
+    /* the mock completes far faster than 800 KB/s, so the sizer grows the transfers and wants more of them */
+    read_words( 2*1024*1024 );
+    EXPECT_EQ( 65536, AIOContinuousBufGetTransferSize( buf ) );
+    EXPECT_GT( most_queued, 6u );
+    EXPECT_LE( most_queued, 32u );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOContinuousBufStopTransfers( buf ) );
+    EXPECT_EQ( 0u, queued_size() );
+}
+
+/**
+ * @brief Lets the stuck transfers go once the stop has had to wait for them
+ */
+static void *unstick( void *object )
+{
+    usleep( 50000 );
+    stuck = false;
+    return NULL;
+}
+
+TEST_F(AsyncTransfers,StopWaitsForPendingTransfers )
+{
+    pthread_t device;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetStreamingTransfers( buf, 8, 4096 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufStartTransfers( buf, usb ) );
+    read_words( 64*1024 );
+
+    stuck = true;
+    pthread_create( &device, NULL, unstick, NULL );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOContinuousBufStopTransfers( buf ) );
+    EXPECT_FALSE( stuck ) << "returned before the device gave the transfers back";
+    pthread_join( device, NULL );
+
+    EXPECT_TRUE( buf->transfers == NULL );
+    EXPECT_EQ( 0u, queued_size() );
+    EXPECT_EQ( 0u, cancelled.size() );
+}
+
+TEST_F(AsyncTransfers,StopReportsTransferError )
+{
+    int bytes;
+    unsigned char data[4096];
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetStreamingTransfers( buf, 8, 4096 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufStartTransfers( buf, usb ) );
+
+    broken = true;
+    EXPECT_EQ( LIBUSB_ERROR_IO, aiocontbuf_get_data( buf, usb, 0x86, data, sizeof(data), &bytes, 10 ) );
+    EXPECT_EQ( -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT( LIBUSB_ERROR_IO ), AIOContinuousBufStopTransfers( buf ) );
+    EXPECT_EQ( 0u, queued_size() );
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
@@ -0,0 +1,111 @@
+#include "AIOCountsConverter.h"
+#include "AIOFifo.h"
+#include "aio_test_fixture.h"
+#include <time.h>
+#include <iostream>
+
+using namespace AIOUSB;
+
+/**
+ * Microbenchmark for the counts to volts stage of continuous acquisition at
+ * 16 channels x 255 oversamples. "per value" is the original conversion loop,
+ * which allocated a scratch buffer every call and pushed each volt on its own;
+ * "batch" is AIOCountsConverterConvertFifo with the scalar and SIMD kernels.
+ */
+
+#define NUM_CHANNELS    16
+#define NUM_OVERSAMPLES 255
+#define SCANS_PER_CALL  16
+#define NUM_CALLS       400
+
+static int per_value_convert_fifo( AIOCountsConverter *cc, AIOFifoVolts *tofifo, AIOFifoCounts *fromfifo, unsigned num_counts )
+{
+    unsigned short *tmpbuf = (unsigned short *)malloc( num_counts*sizeof(uint16_t) );
+    unsigned samplesize = cc->num_oversamples + 1;
+    int num_converted = 0;
+
+    fromfifo->PopN( fromfifo, tmpbuf, num_counts );
+    for ( unsigned pos = 0; pos + samplesize <= num_counts; pos += samplesize ) {
+        unsigned sum = 0;
+        for ( unsigned os = 0; os < samplesize; os ++ )
+            sum += tmpbuf[pos + os];
+        sum /= samplesize;
+        AIOGainRange range = cc->gain_ranges[cc->channel_count];
+        tofifo->Push( tofifo, ((double)(range.max - range.min)*sum ) / 65536 + range.min );
+        cc->channel_count = ( cc->channel_count + 1 ) % cc->num_channels;
+        num_converted ++;
+    }
+    free(tmpbuf);
+    return num_converted;
+}
+
+typedef int (*convert_fn)( AIOCountsConverter *cc, AIOFifoVolts *tofifo, AIOFifoCounts *fromfifo, unsigned num_counts );
+
+static int batch_convert_fifo( AIOCountsConverter *cc, AIOFifoVolts *tofifo, AIOFifoCounts *fromfifo, unsigned num_counts )
+{
+    return cc->ConvertFifo( cc, tofifo, fromfifo, num_counts );
+}
+
+static double run_benchmark( convert_fn fn, AIOUSB_BOOL vectorized, double *checksum )
+{
+    unsigned num_counts = NUM_CHANNELS * (NUM_OVERSAMPLES+1) * SCANS_PER_CALL;
+    unsigned num_volts  = NUM_CHANNELS * SCANS_PER_CALL;
+    uint16_t *counts    = (uint16_t *)malloc( num_counts*sizeof(uint16_t) );
+    double *volts       = (double *)malloc( num_volts*sizeof(double) );
+    AIOGainRange ranges[NUM_CHANNELS];
+    struct timespec start, end;
+    double elapsed = 0;
+
+    for ( int i = 0; i < NUM_CHANNELS; i ++ ) {
+        ranges[i].min = -10.0;
+        ranges[i].max = 10.0;
+    }
+    for ( unsigned i = 0; i < num_counts; i ++ )
+        counts[i] = (uint16_t)( i * 2654435761u >> 16 );
+
+    AIOFifoCounts *infifo  = NewAIOFifoCounts( num_counts );
+    AIOFifoVolts  *outfifo = NewAIOFifoVolts( num_volts );
+    AIOCountsConverter *cc = NewAIOCountsConverter( NUM_CHANNELS, ranges, NUM_OVERSAMPLES, sizeof(uint16_t) );
+    AIOCountsConverterSetVectorized( cc, vectorized );
+
+    *checksum = 0;
+    for ( int call = 0; call < NUM_CALLS; call ++ ) {
+        infifo->PushN( infifo, counts, num_counts );
+        clock_gettime( CLOCK_MONOTONIC, &start );
+        fn( cc, outfifo, infifo, num_counts );
+        clock_gettime( CLOCK_MONOTONIC, &end );
+        elapsed += ( end.tv_sec - start.tv_sec ) + ( end.tv_nsec - start.tv_nsec ) / 1e9;
+        outfifo->PopN( outfifo, volts, num_volts );
+        for ( unsigned i = 0; i < num_volts; i ++ )
+            *checksum += volts[i];
+    }
+
+    DeleteAIOCountsConverter( cc );
+    DeleteAIOFifoCounts( infifo );
+    DeleteAIOFifoVolts( outfifo );
+    free(counts);
+    free(volts);
+
+    return (double)num_counts * NUM_CALLS / elapsed;
+}
+
+TEST(AIOCountsConverterBenchmark,SixteenChannels255Oversamples )
+{
+    double per_value_sum, scalar_sum, simd_sum;
+
+    double per_value = run_benchmark( per_value_convert_fifo, AIOUSB_FALSE, &per_value_sum );
+    double scalar    = run_benchmark( batch_convert_fifo, AIOUSB_FALSE, &scalar_sum );
+    double simd      = run_benchmark( batch_convert_fifo, AIOUSB_TRUE, &simd_sum );
+
+    EXPECT_EQ( per_value_sum, scalar_sum ) << "Batch conversion must produce the same volts";
+    EXPECT_EQ( per_value_sum, simd_sum ) << "SIMD conversion must produce the same volts";
+
+    std::cout << "# per value:    " << per_value / 1e6 << " Msamples/s" << std::endl;
+    std::cout << "# batch scalar: " << scalar / 1e6 << " Msamples/s" << std::endl;
+    std::cout << "# batch simd:   " << simd / 1e6 << " Msamples/s" << std::endl;
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
@@ -0,0 +1,229 @@
+/*****************************************************************************
+ * Hammers several fake boards from one thread each to check that I/O with
+ * different boards runs in parallel, and one board from many threads to
+ * check that its transfers and the cached DIO state stay consistent.
+ * Every fake transfer sleeps to stand in for the USB round trip. Parallel
+ * I/O is checked by counting the boards with a transfer in flight rather
+ * than by timing, so a loaded machine can't fail it.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOUSB_DIO.h"
+#include "AIOUSB_CTR.h"
+#include "AIOUSB_ADC.h"
+#include "AIOStats.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+#include <pthread.h>
+#include <unistd.h>
+using namespace AIOUSB;
+
+#define NUM_BOARDS    8
+#define TRANSFER_US   200
+#define OPS_PER_BOARD 250
+#define RENDEZVOUS_US 1000000
+
+static USBDevice usbs[NUM_BOARDS];
+static unsigned char dio_state[NUM_BOARDS][4];
+static int in_flight[NUM_BOARDS];
+static int overlapped[NUM_BOARDS];
+static int boards_in_flight, most_boards_in_flight;
+static int rendezvous;                          /* boards whose first transfer waits for the others */
+static int arrived[NUM_BOARDS];
+
+/**
+ * @brief Holds the first transfer of each board until rendezvous boards
+ * have one in flight. If I/O with one board held up another they would
+ * never all get there, and the wait gives up.
+ */
+static void wait_for_other_boards( int board )
+{
+    if ( board >= rendezvous || __sync_lock_test_and_set( &arrived[board], 1 ) )
+        return;
+    for ( int waited = 0; waited < RENDEZVOUS_US && __sync_add_and_fetch( &boards_in_flight, 0 ) < rendezvous; waited += 100 )
+        usleep( 100 );
+}
+
+static int fake_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    int board = usb - usbs;
+    bool first = ( __sync_add_and_fetch( &in_flight[board], 1 ) == 1 );
+    if ( !first ) {
+        __sync_add_and_fetch( &overlapped[board], 1 );
+    } else {
+        int boards = __sync_add_and_fetch( &boards_in_flight, 1 ), most;
+        while ( ( most = most_boards_in_flight ) < boards && !__sync_bool_compare_and_swap( &most_boards_in_flight, most, boards ) )
+            ;
+    }
+    wait_for_other_boards( board );
+    usleep( TRANSFER_US );
+    if ( bRequest == AUR_DIO_WRITE )
+        memcpy( dio_state[board], data, MIN( wLength, sizeof(dio_state[board]) ) );
+    else if ( bRequest == AUR_DIO_READ )
+        memcpy( data, dio_state[board], MIN( wLength, sizeof(dio_state[board]) ) );
+    if ( first )
+        __sync_sub_and_fetch( &boards_in_flight, 1 );
+    __sync_sub_and_fetch( &in_flight[board], 1 );
+    return wLength;
+}
+
+typedef struct {
+    unsigned long DeviceIndex;
+    unsigned first_bit;
+    AIORESULT result;
+} worker_args;
+
+static void *read_worker( void *arg )
+{
+    worker_args *args = (worker_args *)arg;
+    DIOBuf *buf = NewDIOBuf( 32 );
+    unsigned short counter;
+    args->result = AIOUSB_SUCCESS;
+    for ( int i = 0; i < OPS_PER_BOARD && args->result == AIOUSB_SUCCESS; i ++ ) {
+        if ( i % 2 )
+            args->result = DIO_ReadAll( args->DeviceIndex, buf );
+        else
+            args->result = CTR_8254Read( args->DeviceIndex, 0, 0, &counter );
+    }
+    DeleteDIOBuf( buf );
+    return NULL;
+}
+
+static void *bit_worker( void *arg )
+{
+    worker_args *args = (worker_args *)arg;
+    args->result = AIOUSB_SUCCESS;
+    for ( int i = 0; i < 40 && args->result == AIOUSB_SUCCESS; i ++ ) {
+        for ( unsigned bit = args->first_bit; bit < args->first_bit + 4; bit ++ )
+            args->result = DIO_Write1( args->DeviceIndex, bit, ( i + bit ) % 2 );
+    }
+    /* leave the upper two of each thread's bits set */
+    for ( unsigned bit = args->first_bit; bit < args->first_bit + 4 && args->result == AIOUSB_SUCCESS; bit ++ )
+        args->result = DIO_Write1( args->DeviceIndex, bit, bit - args->first_bit >= 2 );
+    return NULL;
+}
+
+static void *config_worker( void *arg )
+{
+    worker_args *args = (worker_args *)arg;
+    unsigned char gains[16];
+    args->result = AIOUSB_SUCCESS;
+    for ( int i = 0; i < 40 && args->result == AIOUSB_SUCCESS; i ++ ) {
+        if ( args->first_bit % 2 ) {
+            memset( gains, ( i + args->first_bit ) % 2 ? AD_GAIN_CODE_5V : AD_GAIN_CODE_10V, sizeof(gains) );
+            args->result = ADC_RangeAll( args->DeviceIndex, gains, AIOUSB_TRUE );
+        } else {
+            args->result = ADC_ADMode( args->DeviceIndex, ( i % 2 ? AD_TRIGGER_SCAN : 0 ), AD_CAL_MODE_NORMAL );
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Runs one thread on each of the first numBoards boards
+ * @return the most boards that had a transfer in flight at once
+ */
+static int run_boards( int numBoards )
+{
+    pthread_t threads[NUM_BOARDS];
+    worker_args args[NUM_BOARDS];
+    unsigned long long start = AIOStatsNow();
+    most_boards_in_flight = 0;
+    rendezvous = numBoards;
+    memset( arrived, 0, sizeof(arrived) );
+    for ( int i = 0; i < numBoards; i ++ ) {
+        args[i].DeviceIndex = i;
+        pthread_create( &threads[i], NULL, read_worker, &args[i] );
+    }
+    for ( int i = 0; i < numBoards; i ++ ) {
+        pthread_join( threads[i], NULL );
+        EXPECT_EQ( AIOUSB_SUCCESS, args[i].result );
+    }
+    std::cout << "# " << numBoards << " boards: " << numBoards * OPS_PER_BOARD / ( ( AIOStatsNow() - start ) / 1e9 ) << " ops/s" << std::endl;
+    return most_boards_in_flight;
+}
+
+class DeviceLockingSetup : public ::testing::Test
+{
+ protected:
+    virtual void SetUp() {
+        unsigned long products[NUM_BOARDS];
+        for ( int i = 0; i < NUM_BOARDS; i ++ )
+            products[i] = USB_DIO_32;
+        AIODeviceTablePopulateTableTest( products, NUM_BOARDS );
+        memset( usbs, 0, sizeof(usbs) );
+        memset( dio_state, 0, sizeof(dio_state) );
+        memset( in_flight, 0, sizeof(in_flight) );
+        memset( overlapped, 0, sizeof(overlapped) );
+        boards_in_flight = most_boards_in_flight = rendezvous = 0;
+        for ( int i = 0; i < NUM_BOARDS; i ++ ) {
+            usbs[i].usb_control_transfer = fake_control_transfer;
+            deviceTable[i].usb_device = &usbs[i];
+        }
+    }
+    virtual void TearDown() {
+        for ( int i = 0; i < NUM_BOARDS; i ++ )
+            deviceTable[i].usb_device = NULL;
+        AIODeviceTableClearDevices();
+    }
+};
+
+TEST_F(DeviceLockingSetup,BoardsScaleIndependently )
+{
+    EXPECT_EQ( 1, run_boards( 1 ) );
+    for ( int numBoards = 2; numBoards <= NUM_BOARDS; numBoards *= 2 )
+        EXPECT_EQ( numBoards, run_boards( numBoards ) ) << "I/O with " << numBoards << " boards should not serialize";
+    for ( int i = 0; i < NUM_BOARDS; i ++ )
+        EXPECT_EQ( 0, overlapped[i] );
+}
+
+TEST_F(DeviceLockingSetup,ConcurrentBitWritesAreNotLost )
+{
+    pthread_t threads[8];
+    worker_args args[8];
+    for ( int i = 0; i < 8; i ++ ) {
+        args[i].DeviceIndex = 0;
+        args[i].first_bit = i * 4;
+        pthread_create( &threads[i], NULL, bit_worker, &args[i] );
+    }
+    for ( int i = 0; i < 8; i ++ ) {
+        pthread_join( threads[i], NULL );
+        EXPECT_EQ( AIOUSB_SUCCESS, args[i].result );
+    }
+    EXPECT_EQ( 0, overlapped[0] ) << "Transfers with one board must not overlap";
+    for ( int i = 0; i < 4; i ++ ) {
+        EXPECT_EQ( 0xcc, dio_state[0][i] ) << "byte " << i;
+        EXPECT_EQ( 0xcc, deviceTable[0].LastDIOData[i] ) << "byte " << i;
+    }
+}
+
+TEST_F(DeviceLockingSetup,ConcurrentConfigChangesDoNotInterleave )
+{
+    unsigned long product = USB_AI16_16E;
+    pthread_t threads[8];
+    worker_args args[8];
+
+    for ( int i = 0; i < NUM_BOARDS; i ++ )
+        deviceTable[i].usb_device = NULL;
+    AIODeviceTableClearDevices();
+    AIODeviceTablePopulateTableTest( &product, 1 );
+    deviceTable[0].usb_device = &usbs[0];
+
+    for ( int i = 0; i < 8; i ++ ) {
+        args[i].DeviceIndex = 0;
+        args[i].first_bit = i;
+        pthread_create( &threads[i], NULL, config_worker, &args[i] );
+    }
+    for ( int i = 0; i < 8; i ++ ) {
+        pthread_join( threads[i], NULL );
+        EXPECT_EQ( AIOUSB_SUCCESS, args[i].result );
+    }
+    EXPECT_EQ( 0, overlapped[0] ) << "Config read-modify-writes on one board must not overlap";
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
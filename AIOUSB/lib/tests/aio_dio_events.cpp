@@ -0,0 +1,254 @@
+/*****************************************************************************
+ * Checks the change of state scanner against a sample by sample diff,
+ * its blocking, polling and overflow behaviour, that long quiet and busy
+ * stretches give exactly their changes (printing the scan rates), and
+ * that a DIO stream on a fake USB-DIO-16A reports every one sample pulse
+ * at the sample it happened.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOUSB_DIO.h"
+#include "AIODIOStream.h"
+#include "AIODIOEvents.h"
+#include "AIOStats.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+using namespace AIOUSB;
+
+#define PULSE_EVERY 997         /* input sample index where a one sample pulse on bit 3 starts */
+
+static unsigned short input_at( unsigned long i )
+{
+    return (unsigned short)( ( i / 5000 ) << 8 | ( i % PULSE_EVERY == 0 ? 0x08 : 0 ) );
+}
+
+static std::vector<AIODIOEvent> expected_events( const std::vector<unsigned short> &data, unsigned short watch )
+{
+    std::vector<AIODIOEvent> tmp;
+    for ( size_t i = 1; i < data.size(); i ++ ) {
+        unsigned short diff = ( data[i] ^ data[i-1] ) & watch;
+        if ( diff ) {
+            AIODIOEvent ev = { i, diff, data[i] };
+            tmp.push_back( ev );
+        }
+    }
+    return tmp;
+}
+
+TEST(DIOEvents,MatchesASampleBySampleDiff )
+{
+    std::vector<unsigned short> data( 100003 );
+    unsigned long long seed = 7;
+    for ( size_t i = 0; i < data.size(); i ++ ) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        data[i] = ( i > 0 && ( seed >> 60 ) ? data[i-1] : (unsigned short)( seed >> 32 ) );
+    }
+
+    for ( unsigned short watch = 0xffff; watch; watch = ( watch == 0xffff ? 0x0081 : 0 ) ) {
+        std::vector<AIODIOEvent> expected = expected_events( data, watch );
+        std::vector<AIODIOEvent> got( expected.size() + 1 );
+        AIODIOEvents *events = NewAIODIOEvents( expected.size() + 10, watch );
+        ASSERT_TRUE( events );
+        ASSERT_GT( expected.size(), 1000 );
+
+        /* odd block sizes so blocks start in every lane */
+        for ( size_t pos = 0, block = 1; pos < data.size(); pos += block, block = block * 3 % 1001 + 1 )
+            ASSERT_GE( AIODIOEventsScan( events, &data[pos], std::min( block, data.size() - pos ) ), 0 );
+        EXPECT_EQ( data.back(), AIODIOEventsGetLastValue( events ) );
+        EXPECT_EQ( 0, AIODIOEventsGetDropped( events ) );
+        ASSERT_EQ( (AIORET_TYPE)expected.size(), AIODIOEventsRead( events, &got[0], got.size(), 0 ) );
+        for ( size_t i = 0; i < expected.size(); i ++ ) {
+            ASSERT_EQ( expected[i].sample, got[i].sample ) << "event " << i;
+            ASSERT_EQ( expected[i].mask, got[i].mask ) << "event " << i;
+            ASSERT_EQ( expected[i].value, got[i].value ) << "event " << i;
+        }
+        DeleteAIODIOEvents( events );
+    }
+}
+
+TEST(DIOEvents,CountsDroppedEvents )
+{
+    unsigned short data[1000];
+    AIODIOEvent got[200];
+    for ( int i = 0; i < 1000; i ++ )
+        data[i] = (unsigned short)( i & 1 );
+
+    AIODIOEvents *events = NewAIODIOEvents( 100, 0xffff );
+    ASSERT_TRUE( events );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_DATA, AIODIOEventsGetLastValue( events ) );
+    EXPECT_EQ( 999, AIODIOEventsScan( events, data, 1000 ) );
+    AIORET_TYPE kept = AIODIOEventsAvailable( events );
+    EXPECT_GE( kept, 100 );
+    EXPECT_EQ( 999, kept + AIODIOEventsGetDropped( events ) ) << "every event is kept or counted";
+    EXPECT_EQ( kept, AIODIOEventsRead( events, got, 200, 0 ) );
+    EXPECT_EQ( 1, got[0].sample ) << "the oldest events are kept";
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOEventsReset( events ) );
+    EXPECT_EQ( 0, AIODIOEventsGetDropped( events ) );
+    EXPECT_EQ( 0, AIODIOEventsScan( events, data + 1, 1 ) ) << "the first sample after a reset sets the state";
+    DeleteAIODIOEvents( events );
+}
+
+static void *scan_later( void *object )
+{
+    static const unsigned short data[4] = { 0, 0, 4, 4 };
+    usleep( 20000 );
+    AIODIOEventsScan( (AIODIOEvents *)object, data, 4 );
+    usleep( 20000 );
+    AIODIOEventsEnd( (AIODIOEvents *)object );
+    return NULL;
+}
+
+TEST(DIOEvents,BlocksAndPolls )
+{
+    AIODIOEvent got[4];
+    pthread_t thread;
+    AIODIOEvents *events = NewAIODIOEvents( 0, 0xffff );
+    ASSERT_TRUE( events );
+
+    AIORET_TYPE fd = AIODIOEventsGetPollFd( events );
+    ASSERT_GE( fd, 0 );
+    struct pollfd pfd = { (int)fd, POLLIN, 0 };
+    EXPECT_EQ( 0, poll( &pfd, 1, 0 ) );
+    EXPECT_EQ( 0, AIODIOEventsRead( events, got, 4, 0 ) );
+    unsigned long long start = AIOStatsNow();
+    EXPECT_EQ( 0, AIODIOEventsRead( events, got, 4, 15 ) );
+    EXPECT_GE( AIOStatsNow() - start, 14000000ULL ) << "waited for the timeout";
+
+    ASSERT_EQ( 0, pthread_create( &thread, NULL, scan_later, events ) );
+    EXPECT_EQ( 1, AIODIOEventsRead( events, got, 4, -1 ) );
+    EXPECT_EQ( 2, got[0].sample );
+    EXPECT_EQ( 4, got[0].mask );
+    EXPECT_EQ( 0, poll( &pfd, 1, 0 ) ) << "reading drained the descriptor";
+    EXPECT_EQ( 0, AIODIOEventsRead( events, got, 4, -1 ) ) << "the end wakes a blocked reader";
+    EXPECT_EQ( 1, poll( &pfd, 1, 0 ) ) << "readable once the input has ended";
+    pthread_join( thread, NULL );
+    DeleteAIODIOEvents( events );
+}
+
+TEST(DIOEvents,LongQuietAndBusyStretches )
+{
+    std::vector<unsigned short> quiet( 1 << 20, 0x5a5a ), busy( 1 << 16 );
+    AIODIOEvent got[1024];
+    unsigned long long samples = 0;
+    AIORET_TYPE num, read = 0;
+    for ( size_t i = 0; i < busy.size(); i ++ )
+        busy[i] = (unsigned short)i;
+
+    AIODIOEvents *events = NewAIODIOEvents( busy.size(), 0xffff );
+    ASSERT_TRUE( events );
+    unsigned long long start = AIOStatsNow();
+    for ( int pass = 0; pass < 32; pass ++, samples += quiet.size() )
+        ASSERT_EQ( 0, AIODIOEventsScan( events, &quiet[0], quiet.size() ) );
+    double rate = samples / ( ( AIOStatsNow() - start ) / 1e9 );
+    std::cout << "# " << rate / 1e6 << " M samples/s without changes, the fastest clock is "
+              << AIODIOEVENTS_MAX_CLOCK_HZ / 1e6 << " M" << std::endl;
+    EXPECT_EQ( 0, AIODIOEventsAvailable( events ) ) << "32 M quiet samples queue nothing";
+    EXPECT_EQ( 0x5a5a, AIODIOEventsGetLastValue( events ) );
+
+    busy[0] = 0x5a5b;
+    start = AIOStatsNow();
+    EXPECT_EQ( (AIORET_TYPE)busy.size(), AIODIOEventsScan( events, &busy[0], busy.size() ) );
+    rate = busy.size() / ( ( AIOStatsNow() - start ) / 1e9 );
+    std::cout << "# " << rate / 1e6 << " M samples/s changing every sample" << std::endl;
+    EXPECT_EQ( 0, AIODIOEventsGetDropped( events ) );
+    while ( ( num = AIODIOEventsRead( events, got, 1024, 0 ) ) > 0 ) {
+        for ( AIORET_TYPE i = 0; i < num; i ++ ) {
+            unsigned long long at = samples + read + i;
+            ASSERT_EQ( at, got[i].sample );
+            ASSERT_EQ( busy[at - samples], got[i].value );
+        }
+        read += num;
+    }
+    EXPECT_EQ( (AIORET_TYPE)busy.size(), read ) << "one event for every changed sample";
+    DeleteAIODIOEvents( events );
+}
+
+/*----------------------------------------------------------------------------*/
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long in_produced, in_limit;
+
+static int fake_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    *actual_length = 0;
+    pthread_mutex_lock( &fake_lock );
+    unsigned long words = std::min( (unsigned long)length / 2, in_limit - in_produced );
+    for ( unsigned long i = 0; i < words; i ++ )
+        ((unsigned short *)data)[i] = input_at( in_produced + i );
+    in_produced += words;
+    pthread_mutex_unlock( &fake_lock );
+    if ( !words ) {
+        usleep( 200 );
+        return LIBUSB_ERROR_TIMEOUT;
+    }
+    *actual_length = words * 2;
+    return 0;
+}
+
+class DIOEventStream : public AIOFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        usb.usb_bulk_transfer    = fake_bulk_transfer;
+        AddFakeDevice( USB_DIO_16A );
+        in_produced = 0;
+        in_limit = 2000000;
+    }
+};
+
+TEST_F(DIOEventStream,ReportsEveryPulse )
+{
+    double readHz = 8000000;
+    std::vector<AIODIOEvent> got( 4096 );
+    unsigned long pulses = 0, ports = 0;
+    unsigned long expected_pulses = ( in_limit - 1 ) / PULSE_EVERY + ( in_limit - 2 ) / PULSE_EVERY + 1;
+    unsigned long expected_ports = ( in_limit - 1 ) / 5000;
+    AIODIOEvents *events = NewAIODIOEvents( 0, 0x0f08 );
+    AIODIOStream *stream = NewAIODIOStream( 0, AIODIOSTREAM_INPUT, 4096 );
+    ASSERT_TRUE( events );
+    ASSERT_TRUE( stream );
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, AIODIOStreamSetEvents( stream, NULL, AIOUSB_FALSE ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamSetEvents( stream, events, AIOUSB_FALSE ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamStart( stream, &readHz, NULL ) );
+    EXPECT_EQ( AIOUSB_ERROR_OPEN_FAILED, AIODIOStreamSetEvents( stream, events, AIOUSB_TRUE ) );
+
+    for ( ;; ) {
+        AIORET_TYPE num = AIODIOEventsRead( events, &got[0], got.size(), 1000 );
+        ASSERT_GE( num, 0 );
+        for ( AIORET_TYPE i = 0; i < num; i ++ ) {
+            unsigned long long s = got[i].sample;
+            ASSERT_EQ( input_at( s ), got[i].value ) << "sample " << s;
+            ASSERT_EQ( ( input_at( s ) ^ input_at( s - 1 ) ) & 0x0f08, got[i].mask ) << "sample " << s;
+            if ( got[i].mask & 0x08 ) {
+                ASSERT_EQ( 0, ( s - ( got[i].value & 0x08 ? 0 : 1 ) ) % PULSE_EVERY ) << "sample " << s;
+                pulses ++;
+            }
+            if ( got[i].mask & 0x0f00 )
+                ports ++;
+        }
+        if ( num == 0 || ( pulses == expected_pulses && ports == expected_ports ) )
+            break;
+    }
+    EXPECT_EQ( expected_pulses, pulses ) << "both edges of every pulse";
+    EXPECT_EQ( expected_ports, ports );
+    EXPECT_EQ( 0, AIODIOEventsGetDropped( events ) );
+    EXPECT_EQ( 0, AIODIOStreamReadAvailable( stream ) ) << "words were not kept";
+    EXPECT_EQ( 0, AIODIOStreamGetOverruns( stream ) );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOStreamStop( stream, AIOUSB_FALSE ) );
+    EXPECT_EQ( 0, AIODIOEventsRead( events, &got[0], got.size(), -1 ) ) << "stopping ends the events";
+    DeleteAIODIOStream( stream );
+    DeleteAIODIOEvents( events );
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
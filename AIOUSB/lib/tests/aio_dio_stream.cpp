@@ -0,0 +1,285 @@
+/*****************************************************************************
+ * Runs an AIODIOStream against a fake USB-DIO-16A whose input endpoint
+ * produces a counting pattern and whose output endpoint records what it is
+ * sent.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOUSB_DIO.h"
+#include "AIODIOStream.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include <unistd.h>
+using namespace AIOUSB;
+
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<unsigned short> sent;
+static std::vector<int> events;                 /* control request codes, -1 for a bulk write */
+static unsigned long in_produced, in_limit;
+static unsigned long in_consumed, in_window;   /* when in_window is set the fake stays at most that far ahead of the reader */
+static unsigned char clock_config[5];
+static int out_error;
+static int in_timeout;                          /* reads hand back their words with LIBUSB_ERROR_TIMEOUT */
+
+static int fake_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    pthread_mutex_lock( &fake_lock );
+    events.push_back( bRequest );
+    if ( bRequest == AUR_DIO_SETCLOCKS )
+        memcpy( clock_config, data, sizeof(clock_config) );
+    pthread_mutex_unlock( &fake_lock );
+    return wLength;
+}
+
+static int fake_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    *actual_length = 0;
+    if ( endpoint & LIBUSB_ENDPOINT_IN ) {
+        EXPECT_EQ( 0, length % AIODIOSTREAM_PACKET_BYTES );
+        pthread_mutex_lock( &fake_lock );
+        unsigned long words = std::min( (unsigned long)length / 2, in_limit - in_produced );
+        if ( in_window )
+            words = std::min( words, in_consumed + in_window - in_produced );
+        for ( unsigned long i = 0; i < words; i ++ )
+            ((unsigned short *)data)[i] = (unsigned short)( in_produced + i );
+        in_produced += words;
+        pthread_mutex_unlock( &fake_lock );
+        if ( !words ) {
+            usleep( 200 );
+            return LIBUSB_ERROR_TIMEOUT;
+        }
+        *actual_length = words * 2;
+        return ( in_timeout ? LIBUSB_ERROR_TIMEOUT : 0 );
+    }
+
+    pthread_mutex_lock( &fake_lock );
+    if ( out_error ) {
+        pthread_mutex_unlock( &fake_lock );
+        return LIBUSB_ERROR_PIPE;
+    }
+    sent.insert( sent.end(), (unsigned short *)data, (unsigned short *)( data + length ) );
+    events.push_back( -1 );
+    pthread_mutex_unlock( &fake_lock );
+    *actual_length = length;
+    return 0;
+}
+
+static unsigned long produced()
+{
+    pthread_mutex_lock( &fake_lock );
+    unsigned long tmp = in_produced;
+    pthread_mutex_unlock( &fake_lock );
+    return tmp;
+}
+
+class DIOStreamSetup : public AIOFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        usb.usb_control_transfer = fake_control_transfer;
+        usb.usb_bulk_transfer    = fake_bulk_transfer;
+        AddFakeDevice( USB_DIO_16A );
+        ASSERT_EQ( AIOUSB_SUCCESS, result );
+        sent.clear();
+        events.clear();
+        in_produced = in_limit = in_consumed = in_window = 0;
+        out_error = in_timeout = 0;
+        memset( clock_config, 0, sizeof(clock_config) );
+    }
+};
+
+TEST_F(DIOStreamSetup,CapturesWithoutGaps )
+{
+    double readHz = 1000000, writeHz = 0;
+    unsigned long total = 0, expected = 0;
+    unsigned short block[3000];
+    in_limit = 500000;
+    in_window = 32*1024;
+
+    AIODIOStream *stream = NewAIODIOStream( 0, AIODIOSTREAM_INPUT, 64*1024 );
+    ASSERT_TRUE( stream );
+    EXPECT_EQ( AUR_DIO_STREAM_OPEN_INPUT, events.back() );
+    EXPECT_TRUE( device->bDIOOpen );
+    EXPECT_EQ( NULL, NewAIODIOStream( 0, AIODIOSTREAM_OUTPUT, 0 ) ) << "One stream per device";
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamStart( stream, &readHz, &writeHz ) );
+    EXPECT_EQ( 0x01, clock_config[0] ) << "Only the read clock is enabled";
+
+    while ( total < in_limit ) {
+        AIORET_TYPE words = AIODIOStreamRead( stream, block, 3000 );
+        ASSERT_GE( words, 0 );
+        for ( int i = 0; i < words; i ++, expected ++ )
+            ASSERT_EQ( (unsigned short)expected, block[i] );
+        total += words;
+        pthread_mutex_lock( &fake_lock );
+        in_consumed = total;
+        pthread_mutex_unlock( &fake_lock );
+        if ( AIODIOStreamGetOverruns( stream ) )
+            break;
+    }
+    EXPECT_EQ( in_limit, total );
+    EXPECT_EQ( 0, AIODIOStreamGetOverruns( stream ) );
+
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOStreamStop( stream, AIOUSB_TRUE ) );
+    EXPECT_EQ( 0x03, clock_config[0] ) << "Clocks are stopped";
+    DeleteAIODIOStream( stream );
+    EXPECT_FALSE( device->bDIOOpen );
+}
+
+TEST_F(DIOStreamSetup,CountsOverruns )
+{
+    double readHz = 1000000;
+    unsigned short block[100];
+    in_limit = 50000;
+
+    AIODIOStream *stream = NewAIODIOStream( 0, AIODIOSTREAM_INPUT, 4000 );
+    ASSERT_TRUE( stream );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamStart( stream, &readHz, NULL ) );
+    while ( produced() < in_limit )
+        usleep( 100 );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOStreamStop( stream, AIOUSB_FALSE ) );
+
+    AIORET_TYPE kept = AIODIOStreamReadAvailable( stream );
+    EXPECT_GE( kept, 4000 );
+    EXPECT_EQ( in_limit, kept + AIODIOStreamGetOverruns( stream ) ) << "Every word is either kept or counted";
+    EXPECT_EQ( 100, AIODIOStreamRead( stream, block, 100 ) );
+    for ( int i = 0; i < 100; i ++ )
+        EXPECT_EQ( i, block[i] ) << "The oldest data is kept";
+
+    AIOStatsSnapshot stats;
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOUSB_GetStatistics( 0, &stats ) );
+    EXPECT_GT( stats.overruns, 0 );
+    EXPECT_GE( stats.fifo_high_water, 4000*sizeof(unsigned short) ) << "The ring filled up";
+    EXPECT_LE( stats.fifo_high_water, stats.fifo_capacity );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOUSB_ResetStatistics( 0 ) );
+    AIOUSB_GetStatistics( 0, &stats );
+    EXPECT_EQ( 0, stats.overruns );
+
+    DeleteAIODIOStream( stream );
+}
+
+TEST_F(DIOStreamSetup,GeneratesPrimedPattern )
+{
+    double readHz = 0, writeHz = 500000;
+    std::vector<unsigned short> pattern( 200000 );
+    for ( size_t i = 0; i < pattern.size(); i ++ )
+        pattern[i] = (unsigned short)( i * 7 );
+
+    AIODIOStream *stream = NewAIODIOStream( 0, AIODIOSTREAM_OUTPUT, 64*1024 );
+    ASSERT_TRUE( stream );
+    EXPECT_EQ( AUR_DIO_STREAM_OPEN_OUTPUT, events.back() );
+
+    size_t queued = AIODIOStreamWrite( stream, &pattern[0], 50000 );
+    EXPECT_EQ( 50000, queued );
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, AIODIOStreamStart( stream, &readHz, NULL ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamStart( stream, &readHz, &writeHz ) );
+    EXPECT_EQ( AIOUSB_ERROR_OPEN_FAILED, AIODIOStreamStart( stream, &readHz, &writeHz ) );
+
+    pthread_mutex_lock( &fake_lock );
+    std::vector<int>::iterator clocks = std::find( events.begin(), events.end(), (int)AUR_DIO_SETCLOCKS );
+    bool primed = ( std::find( events.begin(), clocks, -1 ) != clocks );
+    pthread_mutex_unlock( &fake_lock );
+    EXPECT_TRUE( primed ) << "Pattern is on the board before the clock starts";
+    EXPECT_EQ( 0x02, clock_config[0] ) << "Only the write clock is enabled";
+
+    while ( queued < pattern.size() ) {
+        AIORET_TYPE words = AIODIOStreamWrite( stream, &pattern[queued], pattern.size() - queued );
+        ASSERT_GE( words, 0 );
+        queued += words;
+    }
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOStreamStop( stream, AIOUSB_TRUE ) );
+    EXPECT_TRUE( sent == pattern );
+    EXPECT_EQ( -AIOUSB_ERROR_INVALID_PARAMETER, AIODIOStreamRead( stream, &pattern[0], 1 ) ) << "No input ring";
+
+    DeleteAIODIOStream( stream );
+}
+
+TEST_F(DIOStreamSetup,BothDirections )
+{
+    double readHz = 100000, writeHz = 100000;
+    unsigned short block[1000];
+    unsigned long echoed = 0;
+    in_limit = 100000;
+
+    AIODIOStream *stream = NewAIODIOStream( 0, AIODIOSTREAM_BOTH, 0 );
+    ASSERT_TRUE( stream );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamStart( stream, &readHz, &writeHz ) );
+    EXPECT_EQ( 0x00, clock_config[0] );
+
+    while ( echoed < in_limit ) {
+        AIORET_TYPE words = AIODIOStreamRead( stream, block, 1000 );
+        ASSERT_GE( words, 0 );
+        for ( AIORET_TYPE done = 0; done < words; ) {
+            AIORET_TYPE tmp = AIODIOStreamWrite( stream, block + done, words - done );
+            ASSERT_GE( tmp, 0 );
+            done += tmp;
+        }
+        echoed += words;
+    }
+    EXPECT_EQ( 0, AIODIOStreamGetOverruns( stream ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOStreamStop( stream, AIOUSB_TRUE ) );
+    ASSERT_EQ( in_limit, sent.size() ) << "Everything captured was echoed back out";
+    for ( unsigned long i = 0; i < in_limit; i ++ )
+        ASSERT_EQ( (unsigned short)i, sent[i] );
+
+    DeleteAIODIOStream( stream );
+}
+
+TEST_F(DIOStreamSetup,KeepsWordsFromTimedOutReads )
+{
+    double readHz = 1000, writeHz = 0;
+    unsigned long total = 0;
+    unsigned short block[1000];
+    in_limit = 20000;
+    in_timeout = 1;
+
+    AIODIOStream *stream = NewAIODIOStream( 0, AIODIOSTREAM_INPUT, 0 );
+    ASSERT_TRUE( stream );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamStart( stream, &readHz, &writeHz ) );
+    for ( int polls = 0; total < in_limit && polls < 10000; polls ++ ) {
+        AIORET_TYPE words = AIODIOStreamRead( stream, block, 1000 );
+        ASSERT_GE( words, 0 );
+        for ( AIORET_TYPE i = 0; i < words; i ++ )
+            ASSERT_EQ( (unsigned short)( total + i ), block[i] );
+        total += words;
+        if ( !words )
+            usleep( 500 );
+    }
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOStreamStop( stream, AIOUSB_FALSE ) );
+    EXPECT_EQ( in_limit, total ) << "Every word a timed out read returned was kept";
+
+    DeleteAIODIOStream( stream );
+}
+
+TEST_F(DIOStreamSetup,ReportsTransferErrors )
+{
+    double writeHz = 1000;
+    unsigned short pattern[100] = { 0 };
+
+    AIODIOStream *stream = NewAIODIOStream( 0, AIODIOSTREAM_OUTPUT, 0 );
+    ASSERT_TRUE( stream );
+    out_error = 1;
+    EXPECT_EQ( 100, AIODIOStreamWrite( stream, pattern, 100 ) );
+    EXPECT_EQ( LIBUSB_RESULT_TO_AIOUSB_RESULT( LIBUSB_ERROR_PIPE ), AIODIOStreamStart( stream, NULL, &writeHz ) );
+    EXPECT_EQ( -(AIORET_TYPE)LIBUSB_RESULT_TO_AIOUSB_RESULT( LIBUSB_ERROR_PIPE ), AIODIOStreamWrite( stream, pattern, 100 ) );
+    DeleteAIODIOStream( stream );
+}
+
+TEST(DIOStream,NotOnBoardsWithoutStreaming )
+{
+    int numAccesDevices = 0;
+    AIOUSB_InitTest();
+    AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numAccesDevices, USB_DIO_32, NULL );
+    EXPECT_EQ( NULL, NewAIODIOStream( 0, AIODIOSTREAM_INPUT, 0 ) );
+    AIODeviceTableClearDevices();
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
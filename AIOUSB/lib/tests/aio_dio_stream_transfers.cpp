@@ -0,0 +1,226 @@
+/*****************************************************************************
+ * Drives the AIODIOStream async transfers against a mock libusb: captured
+ * words arrive in order and generated words go out in order even when
+ * another board's thread runs the completions, and stopping waits for
+ * transfers the device is slow to give back.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIODIOStream.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+#include <deque>
+#include <set>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+using namespace AIOUSB;
+
+#define AHEAD_WORDS    ( 64*1024 )      /* captured but unread, well inside the input ring */
+
+/*--------------------------------  mock libusb  -------------------------------*/
+static pthread_mutex_t events_lock = PTHREAD_MUTEX_INITIALIZER;  /* libusb runs one completion at a time */
+static pthread_mutex_t queue_lock  = PTHREAD_MUTEX_INITIALIZER;
+static std::deque<struct libusb_transfer *> queued;
+static std::set<struct libusb_transfer *> cancelled;
+static std::vector<unsigned short> sent;
+static unsigned long produced, consumed;
+static volatile bool stuck;                                      /* nothing completes, not even cancels */
+
+struct libusb_transfer *libusb_alloc_transfer( int iso_packets )
+{
+    return (struct libusb_transfer *)calloc( 1, sizeof(struct libusb_transfer) );
+}
+
+void libusb_free_transfer( struct libusb_transfer *xfer )
+{
+    free( xfer );
+}
+
+int libusb_submit_transfer( struct libusb_transfer *xfer )
+{
+    pthread_mutex_lock( &queue_lock );
+    queued.push_back( xfer );
+    pthread_mutex_unlock( &queue_lock );
+    return LIBUSB_SUCCESS;
+}
+
+int libusb_cancel_transfer( struct libusb_transfer *xfer )
+{
+    int retval = LIBUSB_ERROR_NOT_FOUND;
+    pthread_mutex_lock( &queue_lock );
+    for ( size_t i = 0; i < queued.size(); i ++ ) {
+        if ( queued[i] == xfer ) {
+            cancelled.insert( xfer );
+            retval = LIBUSB_SUCCESS;
+        }
+    }
+    pthread_mutex_unlock( &queue_lock );
+    return retval;
+}
+
+/**
+ * @brief Completes the oldest queued transfer that can go: reads get the
+ * next stretch of a counting pattern unless the reader is too far behind,
+ * writes are recorded
+ */
+int libusb_handle_events_timeout_completed( libusb_context *ctx, struct timeval *tv, int *completed )
+{
+    struct libusb_transfer *xfer = NULL;
+
+    pthread_mutex_lock( &events_lock );
+    pthread_mutex_lock( &queue_lock );
+    for ( size_t i = 0; !stuck && !xfer && i < queued.size(); i ++ ) {
+        unsigned short *words = (unsigned short *)queued[i]->buffer;
+        if ( cancelled.erase( queued[i] ) ) {
+            xfer = queued[i];
+            xfer->status = LIBUSB_TRANSFER_CANCELLED;
+            xfer->actual_length = 0;
+        } else if ( !( queued[i]->endpoint & LIBUSB_ENDPOINT_IN ) ) {
+            xfer = queued[i];
+            xfer->status = LIBUSB_TRANSFER_COMPLETED;
+            xfer->actual_length = xfer->length;
+            sent.insert( sent.end(), words, words + xfer->length / 2 );
+        } else if ( produced - __atomic_load_n( &consumed, __ATOMIC_ACQUIRE ) < AHEAD_WORDS ) {
+            xfer = queued[i];
+            xfer->status = LIBUSB_TRANSFER_COMPLETED;
+            xfer->actual_length = xfer->length;
+            for ( int j = 0; j < xfer->length / 2; j ++ )
+                words[j] = (unsigned short)( produced ++ );
+        }
+        if ( xfer )
+            queued.erase( queued.begin() + i );
+    }
+    pthread_mutex_unlock( &queue_lock );
+
+    if ( xfer )
+        xfer->callback( xfer );
+    pthread_mutex_unlock( &events_lock );
+
+    if ( !xfer )
+        usleep( 1000 );
+    return LIBUSB_SUCCESS;
+}
+
+static unsigned long queued_size()
+{
+    pthread_mutex_lock( &queue_lock );
+    unsigned long tmp = queued.size();
+    pthread_mutex_unlock( &queue_lock );
+    return tmp;
+}
+
+/**
+ * @brief Every engine pumps the default context, so another board's thread
+ * can run this stream's completions
+ */
+static volatile bool pumping;
+static void *pump_events( void *object )
+{
+    while ( pumping ) {
+        struct timeval tv = { 0, 1000 };
+        libusb_handle_events_timeout_completed( NULL, &tv, NULL );
+    }
+    return NULL;
+}
+
+/*---------------------------------  fixture  ---------------------------------*/
+class DIOStreamTransfers : public AIOFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        queued.clear();
+        cancelled.clear();
+        sent.clear();
+        produced = consumed = 0;
+        stuck = false;
+        usb.deviceHandle = (libusb_device_handle *)&handle;
+        AddFakeDevice( USB_DIO_16A );
+    }
+    int handle;
+};
+
+TEST_F(DIOStreamTransfers,CompletionsOnAnotherThread )
+{
+    double readHz = 100000, writeHz = 100000;
+    unsigned short block[4096];
+    unsigned long echoed = 0, total = 1024*1024;
+    pthread_t other;
+
+    AIODIOStream *stream = NewAIODIOStream( 0, AIODIOSTREAM_BOTH, 0 );
+    ASSERT_TRUE( stream );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamStart( stream, &readHz, &writeHz ) );
+    ASSERT_TRUE( stream->in.transfers && stream->out.transfers );
+
+    pumping = true;
+    pthread_create( &other, NULL, pump_events, NULL );
+    while ( echoed < total ) {
+        AIORET_TYPE words = AIODIOStreamRead( stream, block, 4096 );
+        ASSERT_GE( words, 0 );
+        if ( echoed + words > total )
+            words = total - echoed;
+        for ( AIORET_TYPE i = 0; i < words; i ++ )
+            ASSERT_EQ( (unsigned short)( echoed + i ), block[i] ) << "at word " << echoed + i;
+        for ( AIORET_TYPE done = 0; done < words; ) {
+            AIORET_TYPE tmp = AIODIOStreamWrite( stream, block + done, words - done );
+            ASSERT_GE( tmp, 0 );
+            done += tmp;
+        }
+        echoed += words;
+        __atomic_add_fetch( &consumed, words, __ATOMIC_RELEASE );
+    }
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOStreamStop( stream, AIOUSB_TRUE ) );
+    pumping = false;
+    pthread_join( other, NULL );
+
+    EXPECT_TRUE( stream->in.transfers == NULL && stream->out.transfers == NULL );
+    EXPECT_EQ( 0u, queued_size() ) << "cancellations were all collected";
+    ASSERT_EQ( total, sent.size() ) << "everything captured was generated";
+    for ( unsigned long i = 0; i < total; i ++ )
+        ASSERT_EQ( (unsigned short)i, sent[i] );
+    DeleteAIODIOStream( stream );
+}
+
+/**
+ * @brief Lets the stuck transfers go once the stop has had to wait for them
+ */
+static void *unstick( void *object )
+{
+    usleep( 50000 );
+    stuck = false;
+    return NULL;
+}
+
+TEST_F(DIOStreamTransfers,StopWaitsForPendingTransfers )
+{
+    double readHz = 100000;
+    unsigned short block[4096];
+    pthread_t device;
+
+    AIODIOStream *stream = NewAIODIOStream( 0, AIODIOSTREAM_INPUT, 0 );
+    ASSERT_TRUE( stream );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIODIOStreamStart( stream, &readHz, NULL ) );
+    while ( consumed < 64*1024 ) {
+        AIORET_TYPE words = AIODIOStreamRead( stream, block, 4096 );
+        ASSERT_GE( words, 0 );
+        __atomic_add_fetch( &consumed, words, __ATOMIC_RELEASE );
+    }
+
+    stuck = true;
+    pthread_create( &device, NULL, unstick, NULL );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIODIOStreamStop( stream, AIOUSB_FALSE ) );
+    EXPECT_FALSE( stuck ) << "returned before the device gave the transfers back";
+    pthread_join( device, NULL );
+
+    EXPECT_TRUE( stream->in.transfers == NULL );
+    EXPECT_EQ( 0u, queued_size() );
+    EXPECT_EQ( 0u, cancelled.size() );
+    DeleteAIODIOStream( stream );
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
@@ -0,0 +1,223 @@
+/*****************************************************************************
+ * Stages bit and byte writes to a fake USB-IIRO-16 inside DIO write
+ * batches, counting the DIO_WRITE transfers to check a batch goes out as
+ * one write with every staged change, nested batches send once, an
+ * aborted batch sends nothing, the flush deadline bounds how long a
+ * staged write waits and other threads stay out of an open batch. Also
+ * checks a failed DIO_ReadAll leaves the caller's buffer alone.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOUSB_DIO.h"
+#include "DIOBuf.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+#include <unistd.h>
+#include <pthread.h>
+using namespace AIOUSB;
+
+static volatile int dio_writes;
+static unsigned char dio_state[4];
+static int read_result;                 /* what AUR_DIO_READ returns, 0 for the full read */
+
+static int fake_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( bRequest == AUR_DIO_WRITE ) {
+        memcpy( dio_state, data, MIN( wLength, sizeof(dio_state) ) );
+        dio_writes ++;
+    } else if ( bRequest == AUR_DIO_READ ) {
+        memcpy( data, dio_state, MIN( wLength, sizeof(dio_state) ) );
+        if ( read_result ) {
+            memset( data, 0xee, wLength );
+            return read_result;
+        }
+    } else if ( request_type == USB_READ_FROM_DEVICE ) {
+        memset( data, 0, wLength );
+    }
+    return wLength;
+}
+
+class DIOWriteBatch : public AIOFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        usb.usb_control_transfer = fake_control_transfer;
+        AddFakeDevice( USB_IIRO_16 );
+        dio_writes = 0;
+        read_result = 0;
+        memset( dio_state, 0, sizeof(dio_state) );
+    }
+
+};
+
+TEST_F(DIOWriteBatch,BatchSendsOneWrite )
+{
+    ASSERT_EQ( 4, deviceTable[0].DIOBytes );
+    for ( unsigned bit = 0; bit < 8; bit ++ )
+        ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, bit, bit % 2 ) );
+    EXPECT_EQ( 8, dio_writes ) << "one round trip per bit outside a batch";
+
+    dio_writes = 0;
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_BeginWrite( 0 ) );
+    for ( unsigned bit = 0; bit < 8; bit ++ )
+        ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, bit, !( bit % 2 ) ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write8( 0, 1, 0x5a ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, 15, AIOUSB_TRUE ) );
+    EXPECT_EQ( 0, dio_writes );
+    EXPECT_EQ( 0xaa, deviceTable[0].LastDIOData[0] ) << "the committed image is untouched until commit";
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_CommitWrite( 0 ) );
+    EXPECT_EQ( 1, dio_writes );
+    EXPECT_EQ( 0x55, dio_state[0] );
+    EXPECT_EQ( 0xda, dio_state[1] );
+    EXPECT_EQ( 0, memcmp( dio_state, deviceTable[0].LastDIOData, 4 ) );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_BeginWrite( 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_CommitWrite( 0 ) );
+    EXPECT_EQ( 1, dio_writes ) << "an empty batch sends nothing";
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_DEVICE_SETTING, DIO_CommitWrite( 0 ) );
+}
+
+TEST_F(DIOWriteBatch,NestedBatchesSendAtTheOutermostCommit )
+{
+    unsigned char all[4] = { 0x0f, 0xf0, 0x11, 0x22 };
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_BeginWrite( 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_WriteAll( 0, all ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_BeginWrite( 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, 0, AIOUSB_FALSE ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_CommitWrite( 0 ) );
+    EXPECT_EQ( 0, dio_writes );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_CommitWrite( 0 ) );
+    EXPECT_EQ( 1, dio_writes );
+    EXPECT_EQ( 0x0e, dio_state[0] );
+    EXPECT_EQ( 0xf0, dio_state[1] );
+    EXPECT_EQ( 0x22, dio_state[3] );
+}
+
+TEST_F(DIOWriteBatch,AbortDropsStagedWrites )
+{
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write8( 0, 0, 0x81 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_BeginWrite( 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_BeginWrite( 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write8( 0, 0, 0x7e ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_AbortWrite( 0 ) );
+    EXPECT_EQ( 1, dio_writes );
+    EXPECT_EQ( 0x81, deviceTable[0].LastDIOData[0] );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, 1, AIOUSB_TRUE ) );
+    EXPECT_EQ( 2, dio_writes ) << "writes go straight out again";
+    EXPECT_EQ( 0x83, dio_state[0] );
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_DEVICE_SETTING, DIO_AbortWrite( 0 ) );
+}
+
+/**
+ * @brief Waits up to a second for the fake device to have seen writes
+ */
+static int wait_for_writes( int writes )
+{
+    for ( int i = 0; dio_writes < writes && i < 1000; i ++ )
+        usleep( 1000 );
+    return dio_writes;
+}
+
+TEST_F(DIOWriteBatch,DeadlineSendsAnOldBatch )
+{
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_SetWriteDeadline( 0, 20 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_BeginWrite( 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, 3, AIOUSB_TRUE ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, 4, AIOUSB_TRUE ) );
+    EXPECT_EQ( 0, dio_writes );
+    EXPECT_EQ( 1, wait_for_writes( 1 ) ) << "the overdue batch went out with nothing else staged";
+    EXPECT_EQ( 0x18, dio_state[0] );
+    EXPECT_EQ( 0x18, deviceTable[0].LastDIOData[0] );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, 5, AIOUSB_TRUE ) );
+    EXPECT_EQ( 1, dio_writes ) << "the deadline restarts from the next staged write";
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_CommitWrite( 0 ) );
+    EXPECT_EQ( 2, dio_writes );
+    EXPECT_EQ( 0x38, dio_state[0] );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_BeginWrite( 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, 6, AIOUSB_TRUE ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_AbortWrite( 0 ) );
+    usleep( 40000 );
+    EXPECT_EQ( 2, dio_writes ) << "an aborted batch is not sent late";
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_SetWriteDeadline( 0, 0 ) );
+}
+
+/**
+ * @brief Tries every DIO write and batch call from another thread
+ */
+static unsigned long foreign_results[6];
+static void *foreign_writes( void *object )
+{
+    unsigned char all[4] = { 0xff, 0xff, 0xff, 0xff };
+    foreign_results[0] = DIO_Write1( 0, 7, AIOUSB_TRUE );
+    foreign_results[1] = DIO_Write8( 0, 1, 0xff );
+    foreign_results[2] = DIO_WriteAll( 0, all );
+    foreign_results[3] = DIO_BeginWrite( 0 );
+    foreign_results[4] = DIO_CommitWrite( 0 );
+    foreign_results[5] = DIO_AbortWrite( 0 );
+    return NULL;
+}
+
+TEST_F(DIOWriteBatch,OtherThreadsStayOutOfAnOpenBatch )
+{
+    pthread_t other;
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_BeginWrite( 0 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_Write1( 0, 0, AIOUSB_TRUE ) );
+    pthread_create( &other, NULL, foreign_writes, NULL );
+    pthread_join( other, NULL );
+    for ( int i = 0; i < 6; i ++ )
+        EXPECT_EQ( AIOUSB_ERROR_INVALID_THREAD, foreign_results[i] ) << "call " << i;
+    EXPECT_EQ( 0, dio_writes );
+
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_CommitWrite( 0 ) );
+    EXPECT_EQ( 1, dio_writes );
+    EXPECT_EQ( 0x01, dio_state[0] ) << "only the owner's write went out";
+    EXPECT_EQ( 0x00, dio_state[1] );
+
+    pthread_create( &other, NULL, foreign_writes, NULL );
+    pthread_join( other, NULL );
+    EXPECT_EQ( AIOUSB_SUCCESS, foreign_results[0] ) << "with the batch closed the thread writes again";
+    EXPECT_EQ( AIOUSB_SUCCESS, foreign_results[4] );
+    EXPECT_EQ( 4, dio_writes );
+    EXPECT_EQ( 0xff, dio_state[3] );
+}
+
+TEST_F(DIOWriteBatch,FailedReadLeavesTheBufferAlone )
+{
+    unsigned char all[4] = { 0x12, 0x34, 0x56, 0x78 };
+    DIOBuf *buf = NewDIOBuf( 8 );
+    ASSERT_TRUE( buf );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_WriteAll( 0, all ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, DIO_ReadAll( 0, buf ) );
+    ASSERT_EQ( 32u, DIOBufSize( buf ) );
+    EXPECT_EQ( 0, memcmp( all, DIOBufBytes( buf ), 4 ) );
+
+    memset( dio_state, 0xff, sizeof(dio_state) );
+    read_result = LIBUSB_ERROR_TIMEOUT;
+    EXPECT_EQ( LIBUSB_RESULT_TO_AIOUSB_RESULT( LIBUSB_ERROR_TIMEOUT ), DIO_ReadAll( 0, buf ) );
+    EXPECT_EQ( 0, memcmp( all, DIOBufBytes( buf ), 4 ) ) << "a failed read does not touch the buffer";
+    read_result = 2;
+    EXPECT_NE( AIOUSB_SUCCESS, DIO_ReadAll( 0, buf ) );
+    EXPECT_EQ( 0, memcmp( all, DIOBufBytes( buf ), 4 ) ) << "nor does a short one";
+
+    DIOBuf *empty = NewDIOBuf( 0 );
+    EXPECT_NE( AIOUSB_SUCCESS, DIO_ReadAll( 0, empty ) );
+    EXPECT_EQ( 0u, DIOBufSize( empty ) ) << "nor is the buffer resized";
+
+    read_result = 0;
+    EXPECT_EQ( AIOUSB_SUCCESS, DIO_ReadAll( 0, buf ) );
+    EXPECT_EQ( 0xff, DIOBufBytes( buf )[3] );
+    DeleteDIOBuf( empty );
+    DeleteDIOBuf( buf );
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
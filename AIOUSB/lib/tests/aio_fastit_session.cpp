@@ -0,0 +1,140 @@
+/*****************************************************************************
+ * Runs an AIOFastITSession against a fake device and checks that once the
+ * session is open each scan costs one start command and one bulk read.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOUSB_ADC.h"
+#include "AIOFastITSession.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+using namespace AIOUSB;
+
+static unsigned char device_registers[AD_MAX_CONFIG_REGISTERS];
+static int num_control, num_start, num_bulk;
+static int bulk_error;
+static unsigned short bulk_value;
+
+static int fake_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    num_control ++;
+    if ( bRequest == AUR_ADC_SET_CONFIG ) {
+        memcpy( device_registers, data, wLength );
+    } else if ( bRequest == AUR_ADC_GET_CONFIG ) {
+        memcpy( data, device_registers, wLength );
+    } else if ( bRequest == AUR_START_ACQUIRING_BLOCK ) {
+        num_start ++;
+    }
+    return wLength;
+}
+
+static int fake_bulk_transfer( USBDevice *usb, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout )
+{
+    num_bulk ++;
+    if ( bulk_error ) {
+        *actual_length = 0;
+        return LIBUSB_ERROR_TIMEOUT;
+    }
+    for ( int i = 0; i < length / 2; i ++ )
+        ((unsigned short *)data)[i] = bulk_value;
+    *actual_length = length;
+    return 0;
+}
+
+static void reset_counters()
+{
+    num_control = num_start = num_bulk = 0;
+}
+
+class FastITSessionSetup : public AIOFakeDeviceTest
+{
+ protected:
+    virtual void SetUp() {
+        usb.usb_control_transfer = fake_control_transfer;
+        usb.usb_bulk_transfer    = fake_bulk_transfer;
+        usb.usb_put_config       = USBDevicePutADCConfigBlock;
+        usb.usb_get_config       = USBDeviceFetchADCConfigBlock;
+        AddFakeDevice( USB_AIO16_16A );
+        ASSERT_EQ( AIOUSB_SUCCESS, result );
+        memset( device_registers, 0, sizeof(device_registers) );
+        device_registers[1] = AD_GAIN_CODE_10V;
+        bulk_error = 0;
+        bulk_value = 0x8000;
+        reset_counters();
+    }
+};
+
+TEST_F(FastITSessionSetup,OneStartAndOneBulkReadPerScan )
+{
+    double volts[16];
+    AIOFastITSession *session = NewAIOFastITSession( 0 );
+    ASSERT_TRUE( session );
+    EXPECT_EQ( 16, AIOFastITSessionGetNumChannels( session ) );
+    EXPECT_EQ( 16*4*sizeof(unsigned short), session->scan_bytes ) << "Oversample is raised to at least 3";
+
+    reset_counters();
+    for ( int i = 0; i < 200; i ++ )
+        ASSERT_EQ( AIOUSB_SUCCESS, AIOFastITSessionGetScanV( session, volts ) );
+
+    EXPECT_EQ( 200, num_start );
+    EXPECT_EQ( 200, num_control ) << "No counter or config traffic once the session is open";
+    EXPECT_EQ( 200, num_bulk );
+    EXPECT_EQ( 200, AIOFastITSessionGetScans( session ) );
+
+    EXPECT_DOUBLE_EQ( 5.0, volts[0] );
+    EXPECT_DOUBLE_EQ( 0.0, volts[1] );
+
+    DeleteAIOFastITSession( session );
+}
+
+TEST_F(FastITSessionSetup,RestoresConfigOnDelete )
+{
+    unsigned char before[AD_MAX_CONFIG_REGISTERS];
+    memcpy( before, device_registers, sizeof(before) );
+
+    AIOFastITSession *session = NewAIOFastITSession( 0 );
+    ASSERT_TRUE( session );
+    EXPECT_NE( 0, memcmp( before, device_registers, device->ConfigBytes ) );
+    DeleteAIOFastITSession( session );
+
+    EXPECT_EQ( 0, memcmp( before, device_registers, device->ConfigBytes ) );
+    EXPECT_EQ( NULL, device->FastITConfig );
+}
+
+TEST_F(FastITSessionSetup,StartAndWaitAreSeparate )
+{
+    double volts[16];
+    AIOFastITSession *session = NewAIOFastITSession( 0 );
+    ASSERT_TRUE( session );
+
+    EXPECT_EQ( AIOUSB_ERROR_INVALID_PARAMETER, AIOFastITSessionWaitScan( session, volts ) ) << "Nothing started";
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOFastITSessionStartScan( session ) );
+    EXPECT_EQ( AIOUSB_ERROR_OPEN_FAILED, AIOFastITSessionStartScan( session ) ) << "One scan outstanding at a time";
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOFastITSessionWaitScan( session, volts ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOFastITSessionStartScan( session ) );
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOFastITSessionWaitScan( session, volts ) );
+
+    DeleteAIOFastITSession( session );
+}
+
+TEST_F(FastITSessionSetup,ReportsTransferErrors )
+{
+    double volts[16];
+    AIOFastITSession *session = NewAIOFastITSession( 0 );
+    ASSERT_TRUE( session );
+
+    bulk_error = 1;
+    EXPECT_EQ( LIBUSB_RESULT_TO_AIOUSB_RESULT( LIBUSB_ERROR_TIMEOUT ), AIOFastITSessionGetScanV( session, volts ) );
+    bulk_error = 0;
+    EXPECT_EQ( AIOUSB_SUCCESS, AIOFastITSessionGetScanV( session, volts ) );
+    EXPECT_EQ( 1, AIOFastITSessionGetScans( session ) );
+
+    DeleteAIOFastITSession( session );
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
@@ -0,0 +1,106 @@
+#include "AIOFifo.h"
+#include "aio_test_fixture.h"
+#include <pthread.h>
+#include <time.h>
+#include <iostream>
+
+using namespace AIOUSB;
+
+/**
+ * Contention benchmark: one thread pushing blocks of counts while another
+ * pops them, as the continuous acquisition worker and the reading
+ * application do. The mutex run guards every PushN / PopN with a pthread
+ * mutex, which is what GRAB_RESOURCE / RELEASE_RESOURCE compile to when
+ * HAS_THREAD is set; the lock free run uses NewAIOFifoCountsLockFree.
+ */
+
+#define TOTAL_COUNTS  (4*1024*1024)
+#define BLOCK_COUNTS  256
+
+typedef struct {
+    AIOFifoCounts *fifo;
+    pthread_mutex_t *lock;
+    unsigned long failed_ops;
+} bench_args;
+
+static AIORET_TYPE bench_push( bench_args *args, uint16_t *block )
+{
+    AIORET_TYPE retval;
+    if ( args->lock ) pthread_mutex_lock( args->lock );
+    retval = args->fifo->PushN( args->fifo, block, BLOCK_COUNTS );
+    if ( args->lock ) pthread_mutex_unlock( args->lock );
+    return retval;
+}
+
+static AIORET_TYPE bench_pop( bench_args *args, uint16_t *block )
+{
+    AIORET_TYPE retval;
+    if ( args->lock ) pthread_mutex_lock( args->lock );
+    retval = args->fifo->PopN( args->fifo, block, BLOCK_COUNTS );
+    if ( args->lock ) pthread_mutex_unlock( args->lock );
+    return retval;
+}
+
+static void *bench_producer( void *obj )
+{
+    bench_args *args = (bench_args *)obj;
+    uint16_t block[BLOCK_COUNTS];
+    for ( unsigned i = 0; i < TOTAL_COUNTS; ) {
+        for ( int j = 0; j < BLOCK_COUNTS; j ++ ) block[j] = (uint16_t)(i + j);
+        if ( bench_push( args, block ) > 0 )
+            i += BLOCK_COUNTS;
+        else
+            args->failed_ops ++;
+    }
+    return NULL;
+}
+
+static double run_benchmark( AIOFifoCounts *fifo, pthread_mutex_t *lock, unsigned long *errors )
+{
+    pthread_t producer;
+    struct timespec start, end;
+    bench_args args = { fifo, lock, 0 };
+    uint16_t block[BLOCK_COUNTS];
+
+    *errors = 0;
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    pthread_create( &producer, NULL, bench_producer, &args );
+    for ( unsigned i = 0; i < TOTAL_COUNTS; ) {
+        if ( bench_pop( &args, block ) > 0 ) {
+            for ( int j = 0; j < BLOCK_COUNTS; j ++ )
+                if ( block[j] != (uint16_t)(i + j) )
+                    (*errors) ++;
+            i += BLOCK_COUNTS;
+        }
+    }
+    pthread_join( producer, NULL );
+    clock_gettime( CLOCK_MONOTONIC, &end );
+
+    double secs = ( end.tv_sec - start.tv_sec ) + ( end.tv_nsec - start.tv_nsec ) / 1e9;
+    return TOTAL_COUNTS / secs / 1e6;
+}
+
+TEST(AIOFifoContention,MutexVersusLockFree )
+{
+    unsigned long errors;
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    int size = 64*1024;
+
+    AIOFifoCounts *locked = NewAIOFifoCounts( size );
+    double mutex_rate = run_benchmark( locked, &lock, &errors );
+    EXPECT_EQ( 0, errors ) << "Mutex fifo corrupted data";
+    DeleteAIOFifoCounts( locked );
+
+    AIOFifoCounts *lockfree = NewAIOFifoCountsLockFree( size );
+    double lockfree_rate = run_benchmark( lockfree, NULL, &errors );
+    EXPECT_EQ( 0, errors ) << "Lock free fifo corrupted data";
+    DeleteAIOFifoCounts( lockfree );
+
+    std::cout << "# mutex:     " << mutex_rate << " Mcounts/s" << std::endl;
+    std::cout << "# lock free: " << lockfree_rate << " Mcounts/s" << std::endl;
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
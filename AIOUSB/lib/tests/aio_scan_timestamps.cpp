@@ -0,0 +1,216 @@
+/*****************************************************************************
+ * Checks the scan clock places scans from transfer stamps, dropped scans
+ * and latched counts, then streams from the simulated USB-AI16-16A on a
+ * clock the test steps and compares each scan's timestamp with when the
+ * simulator clocked it, with and without latching the counters.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOContinuousBuffer.h"
+#include "AIOScanClock.h"
+#include "AIOSimDevice.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+#include <vector>
+#include <unistd.h>
+using namespace AIOUSB;
+
+#define NUM_CHANNELS 4
+#define RING_SCANS   4096
+
+TEST(AIOScanClock,StampsBoundTheFirstScan )
+{
+    AIOScanClock *clock = NewAIOScanClock();
+    uint64_t ns[4];
+    ASSERT_TRUE( clock );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOScanClockReset( clock, 1000, 0, 0 ) );
+
+    EXPECT_EQ( 4, AIOScanClockTimes( clock, 0, 4, ns ) );
+    EXPECT_EQ( 0u, ns[3] ) << "no times before the first stamp";
+
+    AIOScanClockStamp( clock, 10, 1000000 + 9000 + 300 );
+    AIOScanClockKeep( clock, 10 );
+    AIOScanClockStamp( clock, 5, 1000000 + 14000 + 50 );
+    AIOScanClockKeep( clock, 5 );
+    AIOScanClockStamp( clock, 5, 1000000 + 19000 + 700 );
+    AIOScanClockKeep( clock, 5 );
+
+    ASSERT_EQ( 4, AIOScanClockTimes( clock, 0, 4, ns ) );
+    EXPECT_EQ( 1000050u, ns[0] ) << "the quickest transfer sets t0";
+    EXPECT_EQ( 1003050u, ns[3] );
+    EXPECT_EQ( 20, AIOScanClockGetKept( clock ) );
+    DeleteAIOScanClock( clock );
+}
+
+TEST(AIOScanClock,DroppedScansLeaveGaps )
+{
+    AIOScanClock *clock = NewAIOScanClock();
+    uint64_t ns[6];
+    AIOScanClockReset( clock, 100, 0, 0 );
+    AIOScanClockStamp( clock, 3, 200 );
+    AIOScanClockKeep( clock, 3 );
+    AIOScanClockDrop( clock, 4 );
+    AIOScanClockKeep( clock, 2 );
+    AIOScanClockDrop( clock, 1 );
+    AIOScanClockDrop( clock, 1 );
+    AIOScanClockKeep( clock, 5 );
+
+    ASSERT_EQ( 6, AIOScanClockTimes( clock, 1, 6, ns ) );
+    EXPECT_EQ( 100u, ns[0] );
+    EXPECT_EQ( 200u, ns[1] );
+    EXPECT_EQ( 700u, ns[2] ) << "four scans dropped after the third";
+    EXPECT_EQ( 800u, ns[3] );
+    EXPECT_EQ( 1100u, ns[4] ) << "adjacent drops add up";
+
+    ASSERT_EQ( 1, AIOScanClockTimes( clock, 6, 1, ns ) );
+    EXPECT_EQ( 1200u, ns[0] ) << "earlier gaps still count once passed";
+    DeleteAIOScanClock( clock );
+}
+
+TEST(AIOScanClock,LatchedCountsFixThePhase )
+{
+    AIOScanClock *clock = NewAIOScanClock();
+    uint64_t ns[2];
+    /* 100 ticks of 10 ns per scan, edges every 500 ns */
+    AIOScanClockReset( clock, 1000, 10, 100 );
+    AIOScanClockStamp( clock, 50, 1000000 + 49000 + 420 );
+    AIOScanClockKeep( clock, 50 );
+    EXPECT_EQ( 0, AIOScanClockGetLatches( clock ) );
+
+    /* 30 ticks into a half period: counted down by 60 */
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOScanClockLatch( clock, 40, 1000000 + 60000 + 290, 1000000 + 60000 + 310 ) );
+    EXPECT_EQ( 1, AIOScanClockGetLatches( clock ) );
+    ASSERT_EQ( 2, AIOScanClockTimes( clock, 0, 2, ns ) );
+    EXPECT_EQ( 1000000u, ns[0] ) << "the edge before the transfer bound";
+    EXPECT_EQ( 1001000u, ns[1] );
+
+    AIOScanClockLatch( clock, 101, 0, 0 );
+    EXPECT_EQ( 1, AIOScanClockGetLatches( clock ) ) << "counts above the load are ignored";
+    DeleteAIOScanClock( clock );
+}
+
+#define START_NS        1000000000000ULL        /* the simulator's time when the test takes its clock */
+#define SCANS_PER_STEP  5
+#define NUM_STEPS       40
+
+/**
+ * @brief The simulator's manual time, as the scan clock's source
+ */
+static unsigned long long sim_time( void *object )
+{
+    AIOSimDevice *sim = (AIOSimDevice *)object;
+    pthread_mutex_lock( &sim->lock );
+    unsigned long long ns = sim->manual_ns;
+    pthread_mutex_unlock( &sim->lock );
+    return ns;
+}
+
+class SimTimestamps : public ::testing::Test
+{
+ protected:
+    virtual void SetUp() {
+        int numAccesDevices = 0;
+        AIOUSB_InitTest();
+        sim = NewAIOSimDevice();
+        ASSERT_TRUE( sim );
+        ASSERT_EQ( 0, AIOSimDeviceAddToDeviceTable( sim, &numAccesDevices, USB_AI16_16A ) );
+        ASSERT_EQ( AIOUSB_SUCCESS, AIOSimDeviceSetTime( sim, START_NS ) );
+    }
+    virtual void TearDown() {
+        DeleteAIOSimDevice( sim );
+        AIODeviceTableClearDevices();
+    }
+
+    /**
+     * @brief Streams with the simulator and the scan clock both on the
+     * test's time, stepping it SCANS_PER_STEP scan periods at a time plus
+     * a quarter period, and keeps each scan's timestamp and when the
+     * simulator clocked it
+     */
+    void stream( unsigned hz, AIOUSB_BOOL latch, std::vector<uint64_t> &stamps, std::vector<double> &truth ) {
+        AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, RING_SCANS, NUM_CHANNELS );
+        std::vector<unsigned short> counts( RING_SCANS * NUM_CHANNELS );
+        std::vector<uint64_t> ns( RING_SCANS );
+        unsigned long long start_ns;
+        double scan_hz;
+
+        AIOContinuousBufInitConfiguration( buf );
+        AIOContinuousBufSetStartAndEndChannel( buf, 0, NUM_CHANNELS - 1 );
+        AIOContinuousBufSetAllGainCodeAndDiffMode( buf, AD_GAIN_CODE_10V, AIOUSB_FALSE );
+        AIOContinuousBufSetClock( buf, hz );
+        AIOContinuousBufSetEndless( buf, AIOUSB_TRUE );
+        AIOContinuousBufSetOverrunPolicy( buf, AIOCONTINUOUS_BUF_BLOCK );
+        ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufSetTimestamps( buf, AIOUSB_TRUE, latch ) );
+        EXPECT_EQ( AIOUSB_TRUE, AIOContinuousBufGetTimestamps( buf ) );
+        ASSERT_EQ( AIOUSB_SUCCESS, AIOScanClockSetSource( buf->scan_clock, sim_time, sim ) );
+        ASSERT_EQ( AIOUSB_SUCCESS, AIOContinuousBufCallbackStart( buf ) );
+        EXPECT_EQ( -AIOUSB_ERROR_INVALID_DEVICE_SETTING, AIOContinuousBufSetTimestamps( buf, AIOUSB_FALSE, AIOUSB_FALSE ) );
+
+        pthread_mutex_lock( &sim->lock );
+        start_ns = sim->clock_start_ns;
+        scan_hz  = sim->scan_hz;
+        pthread_mutex_unlock( &sim->lock );
+        ASSERT_EQ( START_NS, start_ns ) << "the clock has not moved since the test took it";
+        period_ns = 1e9 / scan_hz;
+
+        /* scan n comes due on clock edge n + 1 */
+        for ( unsigned step = 1; step <= NUM_STEPS; step ++ ) {
+            ASSERT_EQ( AIOUSB_SUCCESS, AIOSimDeviceSetTime( sim, start_ns + ( step * SCANS_PER_STEP + 0.25 ) * period_ns ) );
+            for ( int waits = 0; stamps.size() < step * SCANS_PER_STEP && waits < 2000; waits ++ ) {
+                AIORET_TYPE scans = AIOContinuousBufReadTimestampedScanCounts( buf, &counts[0], &ns[0], RING_SCANS );
+                ASSERT_GE( scans, 0 );
+                if ( !scans )
+                    usleep( 500 );
+                stamps.insert( stamps.end(), ns.begin(), ns.begin() + scans );
+            }
+            ASSERT_EQ( step * SCANS_PER_STEP, stamps.size() ) << "exactly the scans due by step " << step;
+        }
+        for ( size_t n = 0; n < stamps.size(); n ++ )
+            truth.push_back( start_ns + ( n + 1 ) * period_ns );
+        latches = AIOScanClockGetLatches( buf->scan_clock );
+        tick_ns = buf->divisora * 1e9 / ROOTCLOCK;
+
+        /* let the worker's last read find scans rather than wait out its timeout */
+        AIOSimDeviceSetTime( sim, start_ns + ( NUM_STEPS + 1 ) * SCANS_PER_STEP * period_ns );
+        AIOContinuousBufEnd( buf );
+        DeleteAIOContinuousBuf( buf );
+    }
+
+    AIOSimDevice *sim;
+    double period_ns;
+    double tick_ns;
+    AIORET_TYPE latches;
+};
+
+TEST_F(SimTimestamps,LatchedCountersPinEveryScan )
+{
+    std::vector<uint64_t> stamps;
+    std::vector<double> truth;
+    double worst = 0;
+
+    stream( 200, AIOUSB_TRUE, stamps, truth );
+    EXPECT_GE( latches, NUM_STEPS / 5 ) << "a latch every 100 ms, at most five 25 ms steps apart";
+    for ( size_t n = 0; n < stamps.size(); n ++ )
+        worst = MAX( worst, fabs( stamps[n] - truth[n] ) );
+    std::cout << "# " << stamps.size() << " scans, worst error " << worst << " ns with latched counters" << std::endl;
+    EXPECT_LE( worst, tick_ns + 1 ) << "within one counter tick of the simulated clock";
+}
+
+TEST_F(SimTimestamps,TransferStampsBoundEveryScan )
+{
+    std::vector<uint64_t> stamps;
+    std::vector<double> truth;
+
+    stream( 200, AIOUSB_FALSE, stamps, truth );
+    EXPECT_EQ( 0, latches );
+    for ( size_t n = 0; n < stamps.size(); n ++ ) {
+        ASSERT_GE( stamps[n] + 1.0, truth[n] ) << "scan " << n << " stamped before it happened";
+        ASSERT_LE( stamps[n], truth[n] + period_ns / 4 + 1 ) << "scan " << n << ": each read came a quarter period after its last scan";
+    }
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
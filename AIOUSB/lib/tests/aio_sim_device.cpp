@@ -0,0 +1,170 @@
+/*****************************************************************************
+ * Runs the ADC and continuous acquisition paths against the simulated
+ * USB-AI16-16A, checking immediate scans read back the generated volts,
+ * an unthrottled stream is exactly the generator's output and a real
+ * time stream keeps to the rate the counters were loaded with. The
+ * streaming tests run the simulator on a clock they set themselves.
+ ****************************************************************************/
+
+#include "AIOUSB_Core.h"
+#include "AIOUSB_ADC.h"
+#include "AIOUSB_CTR.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "AIOContinuousBuffer.h"
+#include "AIOSimDevice.h"
+#include "aio_test_fixture.h"
+#include <iostream>
+#include <vector>
+#include <unistd.h>
+using namespace AIOUSB;
+
+#define NUM_CHANNELS 4
+#define RING_SCANS   4096
+
+class SimDeviceSetup : public ::testing::Test
+{
+ protected:
+    virtual void SetUp() {
+        int numAccesDevices = 0;
+        AIOUSB_InitTest();
+        sim = NewAIOSimDevice();
+        ASSERT_TRUE( sim );
+        ASSERT_EQ( 0, AIOSimDeviceAddToDeviceTable( sim, &numAccesDevices, USB_AI16_16A ) );
+        AIOSimDeviceSetSeed( sim, 42 );
+        for ( unsigned ch = 0; ch < NUM_CHANNELS; ch ++ ) {
+            AIOSimSignal sig = { AIOSIM_SIGNAL_SINE, 2.0 + ch, 0.25 * ch, 10.0 * ( ch + 1 ), 0.5 * ch, 0.01 };
+            AIOSimDeviceSetSignal( sim, ch, &sig );
+        }
+    }
+    virtual void TearDown() {
+        DeleteAIOSimDevice( sim );
+        AIODeviceTableClearDevices();
+    }
+
+    AIOContinuousBuf *start_stream( unsigned hz ) {
+        AIOContinuousBuf *buf = NewAIOContinuousBufForCounts( 0, RING_SCANS, NUM_CHANNELS );
+        AIOContinuousBufInitConfiguration( buf );
+        AIOContinuousBufSetStartAndEndChannel( buf, 0, NUM_CHANNELS - 1 );
+        AIOContinuousBufSetAllGainCodeAndDiffMode( buf, AD_GAIN_CODE_10V, AIOUSB_FALSE );
+        AIOContinuousBufSetClock( buf, hz );
+        AIOContinuousBufSetEndless( buf, AIOUSB_TRUE );
+        AIOContinuousBufSetOverrunPolicy( buf, AIOCONTINUOUS_BUF_BLOCK );
+        EXPECT_EQ( AIOUSB_SUCCESS, AIOContinuousBufCallbackStart( buf ) );
+        return buf;
+    }
+
+    /**
+     * @brief Reads until got reaches num_scans, giving up if the stream
+     *        stalls for max_ms
+     * @return scans read in all
+     */
+    unsigned long read_scans( AIOContinuousBuf *buf, std::vector<unsigned short> &counts, unsigned long got, unsigned long num_scans, unsigned max_ms ) {
+        counts.resize( ( num_scans + RING_SCANS ) * NUM_CHANNELS );
+        unsigned long long stop = AIOStatsNow() + max_ms * 1000000ULL;
+        while ( got < num_scans && AIOStatsNow() < stop ) {
+            AIORET_TYPE scans = AIOContinuousBufReadIntegerScanCounts( buf, &counts[got*NUM_CHANNELS], RING_SCANS*NUM_CHANNELS, RING_SCANS*NUM_CHANNELS );
+            EXPECT_GE( scans, 0 );
+            if ( scans <= 0 )
+                usleep( 500 );
+            else
+                got += scans;
+        }
+        return got;
+    }
+
+    void end_stream( AIOContinuousBuf *buf ) {
+        AIOContinuousBufEnd( buf );
+        EXPECT_EQ( 0, AIOContinuousBufGetDroppedScans( buf ) );
+        DeleteAIOContinuousBuf( buf );
+    }
+
+    /**
+     * @brief Streams from an endless buffer until num_scans have been read
+     * @return scans read
+     */
+    unsigned long stream( unsigned hz, std::vector<unsigned short> &counts, unsigned long num_scans, unsigned max_ms ) {
+        AIOContinuousBuf *buf = start_stream( hz );
+        unsigned long got = read_scans( buf, counts, 0, num_scans, max_ms );
+        end_stream( buf );
+        return got;
+    }
+
+    AIOSimDevice *sim;
+};
+
+TEST_F(SimDeviceSetup,ImmediateScanReadsTheSignal )
+{
+    unsigned char gains[16];
+    double volts[16];
+    for ( unsigned ch = 0; ch < 16; ch ++ ) {
+        AIOSimSignal sig = { AIOSIM_SIGNAL_CONSTANT, 0, -7.5 + ch, 0, 0, 0 };
+        AIOSimDeviceSetSignal( sim, ch, &sig );
+        gains[ch] = AD_GAIN_CODE_10V;
+    }
+    ASSERT_EQ( AIOUSB_SUCCESS, ADC_SetScanLimits( 0, 0, 15 ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, ADC_RangeAll( 0, gains, AIOUSB_TRUE ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, ADC_GetScanV( 0, volts ) );
+    for ( unsigned ch = 0; ch < 16; ch ++ )
+        EXPECT_NEAR( -7.5 + ch, volts[ch], 20.0 / 65535 ) << "channel " << ch;
+
+    gains[13] = AD_GAIN_CODE_0_5V;
+    ASSERT_EQ( AIOUSB_SUCCESS, ADC_RangeAll( 0, gains, AIOUSB_TRUE ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, ADC_GetScanV( 0, volts ) );
+    EXPECT_NEAR( 5.0, volts[13], 1e-3 ) << "out of range inputs clip";
+    EXPECT_NEAR( -7.5 + 12, volts[12], 20.0 / 65535 );
+}
+
+TEST_F(SimDeviceSetup,CountersSetTheScanRate )
+{
+    double hz = 1234;
+    EXPECT_EQ( 0, AIOSimDeviceGetScanRate( sim ) );
+    ASSERT_EQ( AIOUSB_SUCCESS, CTR_StartOutputFreq( 0, 0, &hz ) );
+    EXPECT_NEAR( hz, AIOSimDeviceGetScanRate( sim ), 1 );
+}
+
+TEST_F(SimDeviceSetup,UnthrottledStreamIsTheGenerator )
+{
+    std::vector<unsigned short> counts;
+    unsigned long num_scans = 50000;
+
+    AIOSimDeviceSetRealTime( sim, AIOUSB_FALSE );
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOSimDeviceSetTime( sim, 0 ) );
+    ASSERT_GE( stream( 1000, counts, num_scans, 10000 ), num_scans ) << "the clock never moved, so nothing held the stream to 1 kHz";
+
+    for ( unsigned long scan = 0; scan < num_scans; scan ++ )
+        for ( unsigned ch = 0; ch < NUM_CHANNELS; ch ++ )
+            ASSERT_EQ( AIOSimDeviceCounts( sim, ch, scan, scan * NUM_CHANNELS + ch ), counts[scan*NUM_CHANNELS+ch] )
+                << "scan " << scan << " channel " << ch;
+
+    std::vector<unsigned short> again;
+    ASSERT_GE( stream( 1000, again, num_scans, 10000 ), num_scans );
+    EXPECT_TRUE( std::equal( counts.begin(), counts.begin() + num_scans * NUM_CHANNELS, again.begin() ) ) << "runs repeat";
+}
+
+TEST_F(SimDeviceSetup,RealTimeStreamKeepsToTheClock )
+{
+    std::vector<unsigned short> counts;
+    unsigned long got = 0;
+
+    ASSERT_EQ( AIOUSB_SUCCESS, AIOSimDeviceSetTime( sim, 0 ) );
+    AIOContinuousBuf *buf = start_stream( 2000 );
+    ASSERT_EQ( 2000, AIOSimDeviceGetScanRate( sim ) );
+    EXPECT_EQ( 0u, read_scans( buf, counts, got, 1, 50 ) ) << "no time has passed";
+
+    /* a quarter second of the simulator's clock at a time is 500 scans */
+    for ( unsigned long step = 1; step <= 4; step ++ ) {
+        ASSERT_EQ( AIOUSB_SUCCESS, AIOSimDeviceSetTime( sim, step * 250000000ULL ) );
+        got = read_scans( buf, counts, got, step * 500, 5000 );
+        ASSERT_EQ( step * 500, got ) << "step " << step;
+        EXPECT_EQ( got, read_scans( buf, counts, got, got + 1, 50 ) ) << "scans came faster than the clock";
+    }
+    /* the worker's read in flight finishes rather than timing out */
+    AIOSimDeviceSetTime( sim, 5 * 250000000ULL );
+    end_stream( buf );
+}
+
+int main(int argc, char *argv[] )
+{
+    return AIOTestMain( argc, argv );
+}
@@ -0,0 +1,72 @@
+/*****************************************************************************
+ * Shared by the tests in this directory, each of which builds into its own
+ * executable. AIOFakeDeviceTest puts one board at index 0 whose transfers
+ * go through the fixture's USBDevice, so a test only supplies the fakes it
+ * cares about, and AIOTestMain runs the tests with TAP output.
+ ****************************************************************************/
+
+#ifndef _AIO_TEST_FIXTURE_H
+#define _AIO_TEST_FIXTURE_H
+
+#include "AIOUSB_Core.h"
+#include "AIODeviceTable.h"
+#include "AIOUSBDevice.h"
+#include "gtest/gtest.h"
+#include "tap.h"
+#include <string.h>
+using namespace AIOUSB;
+
+/**
+ * @brief A control transfer the fake board always accepts, reading back zeros
+ */
+static inline int aiotest_control_transfer( USBDevice *usb, uint8_t request_type, uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned char *data, uint16_t wLength, unsigned int timeout )
+{
+    if ( request_type == USB_READ_FROM_DEVICE && data )
+        memset( data, 0, wLength );
+    return wLength;
+}
+
+class AIOFakeDeviceTest : public ::testing::Test
+{
+ protected:
+    AIOFakeDeviceTest() : device( NULL ), result( AIOUSB_SUCCESS ) {
+        memset( &usb, 0, sizeof(usb) );
+        usb.usb_control_transfer = aiotest_control_transfer;
+    }
+
+    /**
+     * @brief Adds a productID board at index 0 talking through usb, which
+     *        the caller has pointed at its fakes
+     */
+    void AddFakeDevice( unsigned long productID ) {
+        int numAccesDevices = 0;
+        AIOUSB_InitTest();
+        AIODeviceTableAddDeviceToDeviceTableWithUSBDevice( &numAccesDevices, productID, &usb );
+        device = AIODeviceTableGetDeviceAtIndex( 0, &result );
+    }
+
+    virtual void TearDown() {
+        deviceTable[0].usb_device = NULL;
+        AIODeviceTableClearDevices();
+    }
+
+    USBDevice usb;
+    AIOUSBDevice *device;
+    AIORESULT result;
+};
+
+/**
+ * @brief Runs every test, reporting in TAP
+ */
+static inline int AIOTestMain( int argc, char *argv[] )
+{
+    testing::InitGoogleTest( &argc, argv );
+    testing::TestEventListeners &listeners = testing::UnitTest::GetInstance()->listeners();
+#ifdef GTEST_TAP_PRINT_TO_STDOUT
+    delete listeners.Release( listeners.default_result_printer() );
+#endif
+    listeners.Append( new tap::TapListener() );
+    return RUN_ALL_TESTS();
+}
+
+#endif
@@ -349,14 +349,9 @@ unsigned long CTR_StartOutputFreq( unsigned long DeviceIndex,  unsigned long Blo
 #ifdef __cplusplus
    %extend DIOBuf {
      bool operator==( DIOBuf *b ) {
-       int i;
-       int equiv = 1;
        if ( b->_size != $self->_size )
          return 0;
-       for ( int i = 0; i < b->_size; i ++ )
-         equiv &= ( $self->_buffer[i] == b->_buffer[i] );
-       
-       return equiv == 1;
+       return memcmp( $self->_words, b->_words, $self->_num_words*sizeof(uint64_t) ) == 0;
      }
      
      bool operator!=( DIOBuf *b ) {
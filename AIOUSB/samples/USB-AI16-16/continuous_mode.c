@@ -2,6 +2,7 @@
 #include <aiousb.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <poll.h>
 #include <math.h>
 #include <ctype.h>
 #include <AIODataTypes.h>
@@ -175,8 +176,17 @@ main(int argc, char *argv[] )
 
     double *tobuf = (double*)malloc( tobufsize );
 
+    /**
+     * 5. Rather than spinning, sleep until scans arrive. The poll
+     *    descriptor is readable while scans are waiting or once
+     *    the acquisition is over.
+     */
+    struct pollfd pfd = { (int)AIOContinuousBufGetPollFd( buf ), POLLIN, 0 };
+
     while ( buf->status == RUNNING || read_count < options.num_scans ) {
 
+        poll( &pfd, 1, 100 );
+
         if ( (scans_remaining = AIOContinuousBufCountScansAvailable(buf) ) > 0 ) { 
 
             /* if ( scans_remaining == options.num_scans ) { */